@@ -1,109 +1,612 @@
 /*
- * Benchmark OpenCV vs FPGA equalizeHist on NV12 Y-channel
+ * Benchmark the histogram-equalization backends on the NV12 Y-channel
+ *
+ * Every backend runs --warmup untimed calls and then --iterations timed ones on the
+ * Y plane of the input image, resized to each --sizes entry. Reported per backend
+ * and size: mean/stddev/p99/min of the per-call time, Mpix/s over the timed loop,
+ * the H2D/kernel/D2H split from CL profiling for the FPGA backends, and PSNR/max
+ * diff against the CPU reference (cv::equalizeHist, or cv::CLAHE for the CLAHE
+ * backends).
+ *
+ * Backends (--backends=a,b,...; default all):
+ *   cpu             cv::equalizeHist
+ *   neon            neon_equalize_hist, --stripes row stripes
+ *   clahe-cpu       cv::CLAHE::apply
+ *   clahe-fpga      clahe_accel
+ *   fpga-sync       equalizeHist_accel, blocking write/run/read per frame
+ *   fpga-pipelined  equalizeHist_accel, two buffer sets on an out-of-order queue so
+ *                   frame N+1 uploads while frame N runs; per-call time is the frame's
+ *                   first write START to its read END
+ *
+ * --csv=FILE appends one row per backend and size (header on a new file; "-" for
+ * stdout) for regression tracking.
+ *
+ * --batch=DIR|LIST instead runs one --backend over a whole set of stills through
+ * image_batch.hpp and writes the results to --out-dir; the FPGA backends share the one
+ * context and take turns on its queue while decode/encode run on all --threads. Stills
+ * larger than the kernels' 3840x2160 go to the matching CPU backend instead.
+ *
+ * Run example:
+ *   ./1frameMeasure 2K.jpg --iterations=200 --sizes=1080p,4k --csv=bench.csv
+ *   ./1frameMeasure --batch=stills/ --backend=fpga-sync --out-dir=out --threads=4
  */
 
 #include "common/xf_headers.hpp"
 #include "xf_hist_equalize_tb_config.h"
 #include "xcl2.hpp"
+#include "clahe_fpga.hpp"
+#include "neon_equalize.hpp"
+#include "image_batch.hpp"
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
 
-int main(int argc, char** argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Invalid Number of Arguments!\nUsage:\n");
-        fprintf(stderr, "<Executable Name> <input image path> \n");
-        return -1;
-    }
+#define BENCH_ITERATIONS_DEFAULT 100
+#define BENCH_WARMUP_DEFAULT 10
+#define BENCH_CLIP_LIMIT_DEFAULT 2.0
+#define BENCH_TILES_DEFAULT 8       // clahe_accel supports up to 8x8
+#define BENCH_PIPELINE_SLOTS 2
+#define BENCH_FPGA_MAX_WIDTH 3840   // WIDTH_4k/HEIGHT_4k of the kernels in accel.cpp
+#define BENCH_FPGA_MAX_HEIGHT 2160
 
-    // -------------------- Load Image --------------------
-    cv::Mat bgr = cv::imread(argv[1]);
-    if (bgr.empty()) {
-        fprintf(stderr, "Cannot open image\n");
-        return -1;
-    }
+struct BenchSize {
+    const char *name;
+    int width, height;
+};
 
-    int height = bgr.rows;
-    int width  = bgr.cols;
+static const BenchSize bench_sizes[] = {
+    {"720p", 1280, 720},
+    {"1080p", 1920, 1080},
+    {"4k", 3840, 2160},
+};
 
-    std::cout << "Input image height : " << height << std::endl;
-    std::cout << "Input image width  : " << width  << std::endl;
+struct BenchStats {
+    double mean_ms{0}, stddev_ms{0}, p99_ms{0}, min_ms{0}, max_ms{0};
+};
 
-    // Convert BGR to YUV I420 (YUV420 planar)
-    cv::Mat yuv;
-    cv::cvtColor(bgr, yuv, cv::COLOR_BGR2YUV_I420);
+struct BenchResult {
+    std::string backend;
+    const BenchSize *size{nullptr};
+    int iterations{0};
+    BenchStats total;
+    double mpix_s{0};
+    bool has_stages{false};
+    BenchStats h2d, kernel, d2h;
+    double psnr_db{0};   // INFINITY when bit-exact
+    double max_diff{0};
+};
 
-    // Extract Y plane (first height*width bytes)
-    cv::Mat y_plane(height, width, CV_8UC1, yuv.data);
+struct BenchOptions {
+    int iterations{BENCH_ITERATIONS_DEFAULT};
+    int warmup{BENCH_WARMUP_DEFAULT};
+    int stripes{NEON_EQ_STRIPES_DEFAULT};
+    double clip_limit{BENCH_CLIP_LIMIT_DEFAULT};
+    int tiles{BENCH_TILES_DEFAULT};
+};
 
-    // Output buffers
-    cv::Mat y_ocv(height, width, CV_8UC1);
-    cv::Mat y_fpga(height, width, CV_8UC1);
-    cv::Mat diff(height, width, CV_8UC1);
+// Samples in ms; p99 by nearest rank
+static BenchStats bench_stats(std::vector<double> v) {
+    BenchStats s;
+    if (v.empty()) return s;
+    std::sort(v.begin(), v.end());
+    double sum = 0.0;
+    for (double x : v) sum += x;
+    s.mean_ms = sum / v.size();
+    double var = 0.0;
+    for (double x : v) var += (x - s.mean_ms) * (x - s.mean_ms);
+    s.stddev_ms = v.size() > 1 ? std::sqrt(var / (v.size() - 1)) : 0.0;
+    const size_t rank = (v.size() * 99 + 99) / 100;
+    s.p99_ms = v[std::min(rank, v.size()) - 1];
+    s.min_ms = v.front();
+    s.max_ms = v.back();
+    return s;
+}
 
-    // -------------------- OpenCV Software --------------------
-    auto t1 = std::chrono::high_resolution_clock::now();
-    cv::equalizeHist(y_plane, y_ocv);
-    auto t2 = std::chrono::high_resolution_clock::now();
-    double ocv_time = std::chrono::duration<double, std::milli>(t2 - t1).count();
-    std::cout << "OpenCV equalizeHist time: " << ocv_time << " ms" << std::endl;
+static double ms_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
 
-    // -------------------- FPGA OpenCL Setup --------------------
-    std::vector<cl::Device> devices = xcl::get_xil_devices();
-    cl::Device device = devices[0];
-    cl::Context context(device);
-    cl::CommandQueue q(context, device, CL_QUEUE_PROFILING_ENABLE);
+static double event_ms(const cl::Event &ev) {
+    cl_ulong start = 0, end = 0;
+    ev.getProfilingInfo(CL_PROFILING_COMMAND_START, &start);
+    ev.getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
+    return end > start ? (end - start) / 1e6 : 0.0;
+}
+
+static void bench_compare(const cv::Mat &ref, const cv::Mat &out, BenchResult *r) {
+    cv::Mat diff;
+    cv::absdiff(ref, out, diff);
+    double max_diff = 0.0;
+    cv::minMaxLoc(diff, nullptr, &max_diff);
+    diff.convertTo(diff, CV_64F);
+    const double mse = cv::mean(diff.mul(diff))[0];
+    r->max_diff = max_diff;
+    r->psnr_db = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : INFINITY;
+}
+
+// Warm-up, then `iterations` timed calls of fn(); fills r->total and r->mpix_s
+template <typename Fn>
+static void bench_cpu(const BenchOptions &o, const BenchSize &sz, Fn fn, BenchResult *r) {
+    for (int i = 0; i < o.warmup; ++i) fn();
+    std::vector<double> samples;
+    samples.reserve(o.iterations);
+    const auto loop0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < o.iterations; ++i) {
+        const auto t0 = std::chrono::steady_clock::now();
+        fn();
+        samples.push_back(ms_since(t0));
+    }
+    const double loop_ms = ms_since(loop0);
+    r->iterations = o.iterations;
+    r->total = bench_stats(samples);
+    r->mpix_s = loop_ms > 0.0 ? (double)sz.width * sz.height * o.iterations / (loop_ms * 1e3) : 0.0;
+}
 
-    std::string device_name = device.getInfo<CL_DEVICE_NAME>();
+/* ---------- FPGA ---------- */
+
+struct BenchFpga {
+    bool available{false};
+    cl::Context context;
+    cl::Device device;
+    cl::Program program;
+    cl::CommandQueue queue;       // in-order: sync and CLAHE backends
+    cl::CommandQueue ooo_queue;   // out-of-order: pipelined backend
+    cl::Kernel eq_kernel[BENCH_PIPELINE_SLOTS];
+    cl::Kernel clahe_kernel;
+};
+
+static bool bench_fpga_init(BenchFpga *f) {
+    std::vector<cl::Device> devices = xcl::get_xil_devices();
+    if (devices.empty()) {
+        fprintf(stderr, "No Xilinx FPGA devices found, skipping the FPGA backends\n");
+        return false;
+    }
+    f->device = devices[0];
+    f->context = cl::Context(f->device);
+    std::string device_name = f->device.getInfo<CL_DEVICE_NAME>();
     std::string binaryFile = xcl::find_binary_file(device_name, "krnl_hist_equalize");
     cl::Program::Binaries bins = xcl::import_binary_file(binaryFile);
     devices.resize(1);
-    cl::Program program(context, devices, bins);
-    cl::Kernel krnl(program, "equalizeHist_accel");
+    cl_int err = CL_SUCCESS;
+    f->program = cl::Program(f->context, devices, bins, nullptr, &err);
+    if (err == CL_SUCCESS) f->queue = cl::CommandQueue(f->context, f->device, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (err == CL_SUCCESS) {
+        f->ooo_queue = cl::CommandQueue(f->context, f->device,
+                                        CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err);
+    }
+    for (int s = 0; s < BENCH_PIPELINE_SLOTS && err == CL_SUCCESS; ++s) {
+        f->eq_kernel[s] = cl::Kernel(f->program, "equalizeHist_accel", &err);
+    }
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "FPGA setup failed (%d), skipping the FPGA backends\n", err);
+        return false;
+    }
+    // clahe_accel is linked into the same xclbin; older bitstreams may not have it
+    f->clahe_kernel = cl::Kernel(f->program, "clahe_accel", &err);
+    if (err != CL_SUCCESS) fprintf(stderr, "No clahe_accel in %s, skipping clahe-fpga\n", binaryFile.c_str());
+    f->available = true;
+    return true;
+}
+
+struct BenchFpgaSlot {
+    cl::Buffer in, ref, out;
+};
+
+static void bench_fpga_alloc(BenchFpga *f, BenchFpgaSlot *slot, size_t size) {
+    slot->in = cl::Buffer(f->context, CL_MEM_READ_ONLY, size);
+    slot->ref = cl::Buffer(f->context, CL_MEM_READ_ONLY, size);
+    slot->out = cl::Buffer(f->context, CL_MEM_WRITE_ONLY, size);
+}
+
+static void bench_fpga_sync(BenchFpga *f, const BenchOptions &o, const BenchSize &sz,
+                            const cv::Mat &y, cv::Mat &out, BenchResult *r) {
+    const size_t size = (size_t)sz.width * sz.height;
+    BenchFpgaSlot slot;
+    bench_fpga_alloc(f, &slot, size);
+    cl::Kernel &k = f->eq_kernel[0];
+    k.setArg(0, slot.in);
+    k.setArg(1, slot.ref);
+    k.setArg(2, slot.out);
+    k.setArg(3, sz.height);
+    k.setArg(4, sz.width);
+
+    std::vector<double> total, h2d, kern, d2h;
+    const auto run = [&](bool timed) {
+        cl::Event w1, w2, ke, rd;
+        const auto t0 = std::chrono::steady_clock::now();
+        f->queue.enqueueWriteBuffer(slot.in, CL_TRUE, 0, size, y.data, nullptr, &w1);
+        f->queue.enqueueWriteBuffer(slot.ref, CL_TRUE, 0, size, y.data, nullptr, &w2);
+        f->queue.enqueueTask(k, nullptr, &ke);
+        ke.wait();
+        f->queue.enqueueReadBuffer(slot.out, CL_TRUE, 0, size, out.data, nullptr, &rd);
+        if (!timed) return;
+        total.push_back(ms_since(t0));
+        h2d.push_back(event_ms(w1) + event_ms(w2));
+        kern.push_back(event_ms(ke));
+        d2h.push_back(event_ms(rd));
+    };
+    for (int i = 0; i < o.warmup; ++i) run(false);
+    const auto loop0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < o.iterations; ++i) run(true);
+    const double loop_ms = ms_since(loop0);
+
+    r->iterations = o.iterations;
+    r->total = bench_stats(total);
+    r->mpix_s = loop_ms > 0.0 ? (double)size * o.iterations / (loop_ms * 1e3) : 0.0;
+    r->has_stages = true;
+    r->h2d = bench_stats(h2d);
+    r->kernel = bench_stats(kern);
+    r->d2h = bench_stats(d2h);
+}
+
+static void bench_fpga_pipelined(BenchFpga *f, const BenchOptions &o, const BenchSize &sz,
+                                 const cv::Mat &y, cv::Mat &out, BenchResult *r) {
+    const size_t size = (size_t)sz.width * sz.height;
+    BenchFpgaSlot slots[BENCH_PIPELINE_SLOTS];
+    cv::Mat outs[BENCH_PIPELINE_SLOTS];
+    for (int s = 0; s < BENCH_PIPELINE_SLOTS; ++s) {
+        bench_fpga_alloc(f, &slots[s], size);
+        outs[s].create(sz.height, sz.width, CV_8UC1);
+        cl::Kernel &k = f->eq_kernel[s];
+        k.setArg(0, slots[s].in);
+        k.setArg(1, slots[s].ref);
+        k.setArg(2, slots[s].out);
+        k.setArg(3, sz.height);
+        k.setArg(4, sz.width);
+    }
+
+    const int frames = o.warmup + o.iterations;
+    std::vector<cl::Event> w1(frames), w2(frames), ke(frames), rd(frames);
+    const auto enqueue = [&](int i) {
+        const int s = i % BENCH_PIPELINE_SLOTS;
+        // A slot's buffers are reused once its previous frame has been read back
+        std::vector<cl::Event> free_slot;
+        if (i >= BENCH_PIPELINE_SLOTS) free_slot.push_back(rd[i - BENCH_PIPELINE_SLOTS]);
+        f->ooo_queue.enqueueWriteBuffer(slots[s].in, CL_FALSE, 0, size, y.data, &free_slot, &w1[i]);
+        f->ooo_queue.enqueueWriteBuffer(slots[s].ref, CL_FALSE, 0, size, y.data, &free_slot, &w2[i]);
+        std::vector<cl::Event> uploaded = {w1[i], w2[i]};
+        f->ooo_queue.enqueueTask(f->eq_kernel[s], &uploaded, &ke[i]);
+        std::vector<cl::Event> ran = {ke[i]};
+        f->ooo_queue.enqueueReadBuffer(slots[s].out, CL_FALSE, 0, size, outs[s].data, &ran, &rd[i]);
+    };
+
+    for (int i = 0; i < o.warmup; ++i) enqueue(i);
+    f->ooo_queue.finish();
+    const auto loop0 = std::chrono::steady_clock::now();
+    for (int i = o.warmup; i < frames; ++i) {
+        enqueue(i);
+        f->ooo_queue.flush();
+    }
+    f->ooo_queue.finish();
+    const double loop_ms = ms_since(loop0);
+
+    std::vector<double> total, h2d, kern, d2h;
+    for (int i = o.warmup; i < frames; ++i) {
+        cl_ulong start1 = 0, start2 = 0, end = 0;
+        w1[i].getProfilingInfo(CL_PROFILING_COMMAND_START, &start1);
+        w2[i].getProfilingInfo(CL_PROFILING_COMMAND_START, &start2);
+        rd[i].getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
+        const cl_ulong start = std::min(start1, start2);
+        total.push_back(end > start ? (end - start) / 1e6 : 0.0);
+        h2d.push_back(event_ms(w1[i]) + event_ms(w2[i]));
+        kern.push_back(event_ms(ke[i]));
+        d2h.push_back(event_ms(rd[i]));
+    }
+    outs[(frames - 1) % BENCH_PIPELINE_SLOTS].copyTo(out);
+
+    r->iterations = o.iterations;
+    r->total = bench_stats(total);
+    r->mpix_s = loop_ms > 0.0 ? (double)size * o.iterations / (loop_ms * 1e3) : 0.0;
+    r->has_stages = true;
+    r->h2d = bench_stats(h2d);
+    r->kernel = bench_stats(kern);
+    r->d2h = bench_stats(d2h);
+}
+
+static void bench_fpga_clahe(BenchFpga *f, const BenchOptions &o, const BenchSize &sz,
+                             const cv::Mat &y, cv::Mat &out, BenchResult *r) {
+    const size_t size = (size_t)sz.width * sz.height;
+    cl::Buffer in(f->context, CL_MEM_READ_ONLY, size);
+    cl::Buffer dst(f->context, CL_MEM_WRITE_ONLY, size);
+
+    cl::Kernel &k = f->clahe_kernel;
+    clahe_fpga_set_args(k, in, dst, sz.width, sz.height, o.clip_limit, o.tiles);
 
-    cl::Buffer imageToDevice1(context, CL_MEM_READ_ONLY, height * width);
-    cl::Buffer imageToDevice2(context, CL_MEM_READ_ONLY, height * width);
-    cl::Buffer imageFromDevice(context, CL_MEM_WRITE_ONLY, height * width);
+    std::vector<double> total, h2d, kern, d2h;
+    const auto run = [&](bool timed) {
+        cl::Event wr, ke, rd;
+        const auto t0 = std::chrono::steady_clock::now();
+        f->queue.enqueueWriteBuffer(in, CL_TRUE, 0, size, y.data, nullptr, &wr);
+        f->queue.enqueueTask(k, nullptr, &ke);
+        ke.wait();
+        f->queue.enqueueReadBuffer(dst, CL_TRUE, 0, size, out.data, nullptr, &rd);
+        if (!timed) return;
+        total.push_back(ms_since(t0));
+        h2d.push_back(event_ms(wr));
+        kern.push_back(event_ms(ke));
+        d2h.push_back(event_ms(rd));
+    };
+    for (int i = 0; i < o.warmup; ++i) run(false);
+    const auto loop0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < o.iterations; ++i) run(true);
+    const double loop_ms = ms_since(loop0);
 
-    // Set arguments
-    krnl.setArg(0, imageToDevice1);
-    krnl.setArg(1, imageToDevice2);
-    krnl.setArg(2, imageFromDevice);
-    krnl.setArg(3, height);
-    krnl.setArg(4, width);
+    r->iterations = o.iterations;
+    r->total = bench_stats(total);
+    r->mpix_s = loop_ms > 0.0 ? (double)size * o.iterations / (loop_ms * 1e3) : 0.0;
+    r->has_stages = true;
+    r->h2d = bench_stats(h2d);
+    r->kernel = bench_stats(kern);
+    r->d2h = bench_stats(d2h);
+}
+
+// Batch mode: one image through the in-order queue. The slot is reallocated only when
+// the image size changes; callers serialize (BatchOptions::serial_process).
+//
+// clahe_accel remaps with the tile LUTs its previous call built, so each still runs it
+// twice: once to build that still's LUTs, once to apply them.
+struct BenchFpgaBatch {
+    BenchFpgaSlot slot;
+    size_t size{0};
+    cv::Ptr<cv::CLAHE> cpu_clahe;   // stills the kernels can't take
+};
+
+static bool bench_fpga_apply(BenchFpga *f, BenchFpgaBatch *b, bool clahe, const BenchOptions &o,
+                             const cv::Mat &y, cv::Mat &out) {
+    const size_t size = y.total();
+    if (!y.isContinuous()) return false;
+    if (y.cols > BENCH_FPGA_MAX_WIDTH || y.rows > BENCH_FPGA_MAX_HEIGHT) {
+        fprintf(stderr, "%dx%d exceeds the kernels' %dx%d, using the CPU\n", y.cols, y.rows,
+                BENCH_FPGA_MAX_WIDTH, BENCH_FPGA_MAX_HEIGHT);
+        if (!clahe) {
+            cv::equalizeHist(y, out);
+            return true;
+        }
+        if (!b->cpu_clahe) b->cpu_clahe = cv::createCLAHE(o.clip_limit, cv::Size(o.tiles, o.tiles));
+        b->cpu_clahe->apply(y, out);
+        return true;
+    }
+    if (b->size != size) {
+        bench_fpga_alloc(f, &b->slot, size);
+        b->size = size;
+    }
+    out.create(y.rows, y.cols, CV_8UC1);
+
+    cl::Kernel &k = clahe ? f->clahe_kernel : f->eq_kernel[0];
+    cl_int err = CL_SUCCESS;
+    if (clahe) {
+        // Stills are unrelated, so none of them is primed by the one before
+        bool primed = false;
+        clahe_fpga_set_args(k, b->slot.in, b->slot.out, y.cols, y.rows, o.clip_limit, o.tiles);
+        err = clahe_fpga_run(f->queue, k, b->slot.in, b->slot.out, y.data, out.data, size, &primed);
+    } else {
+        k.setArg(0, b->slot.in);
+        k.setArg(1, b->slot.ref);
+        k.setArg(2, b->slot.out);
+        k.setArg(3, y.rows);
+        k.setArg(4, y.cols);
+        err = f->queue.enqueueWriteBuffer(b->slot.in, CL_FALSE, 0, size, y.data);
+        if (err == CL_SUCCESS) err = f->queue.enqueueWriteBuffer(b->slot.ref, CL_FALSE, 0, size, y.data);
+        if (err == CL_SUCCESS) err = f->queue.enqueueTask(k);
+        if (err == CL_SUCCESS) err = f->queue.enqueueReadBuffer(b->slot.out, CL_TRUE, 0, size, out.data);
+    }
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "FPGA %s failed: %d\n", clahe ? "clahe_accel" : "equalizeHist_accel", err);
+        return false;
+    }
+    return true;
+}
+
+/* ---------- Reporting ---------- */
 
-    // -------------------- FPGA Run --------------------
-    q.enqueueWriteBuffer(imageToDevice1, CL_TRUE, 0, height * width, y_plane.data);
-    q.enqueueWriteBuffer(imageToDevice2, CL_TRUE, 0, height * width, y_plane.data);
+static void print_result(const BenchResult &r) {
+    char psnr[32];
+    if (std::isinf(r.psnr_db)) snprintf(psnr, sizeof(psnr), "exact");
+    else snprintf(psnr, sizeof(psnr), "%.2f dB", r.psnr_db);
+    printf("%-15s %-6s mean %8.3f | sd %7.3f | p99 %8.3f | min %8.3f ms | %8.1f Mpix/s | PSNR %s, max diff %.0f\n",
+           r.backend.c_str(), r.size->name, r.total.mean_ms, r.total.stddev_ms, r.total.p99_ms, r.total.min_ms,
+           r.mpix_s, psnr, r.max_diff);
+    if (r.has_stages) {
+        printf("%-15s %-6s   H2D %.3f | kernel %.3f | D2H %.3f ms (mean)\n", "", "",
+               r.h2d.mean_ms, r.kernel.mean_ms, r.d2h.mean_ms);
+    }
+}
 
-    cl::Event event_sp;
-    q.enqueueTask(krnl, NULL, &event_sp);
-    clWaitForEvents(1, (const cl_event*)&event_sp);
+static void write_csv(const char *path, const std::vector<BenchResult> &results) {
+    const bool to_stdout = strcmp(path, "-") == 0;
+    FILE *f = to_stdout ? stdout : fopen(path, "a");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s for writing\n", path);
+        return;
+    }
+    if (!to_stdout) fseek(f, 0, SEEK_END);
+    if (to_stdout || ftell(f) == 0) {
+        fprintf(f, "backend,size,width,height,iterations,mean_ms,stddev_ms,p99_ms,min_ms,max_ms,mpix_s,"
+                   "h2d_mean_ms,kernel_mean_ms,d2h_mean_ms,psnr_db,max_diff\n");
+    }
+    for (const BenchResult &r : results) {
+        fprintf(f, "%s,%s,%d,%d,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.2f,", r.backend.c_str(), r.size->name,
+                r.size->width, r.size->height, r.iterations, r.total.mean_ms, r.total.stddev_ms,
+                r.total.p99_ms, r.total.min_ms, r.total.max_ms, r.mpix_s);
+        if (r.has_stages) fprintf(f, "%.4f,%.4f,%.4f,", r.h2d.mean_ms, r.kernel.mean_ms, r.d2h.mean_ms);
+        else fprintf(f, ",,,");
+        if (std::isinf(r.psnr_db)) fprintf(f, "inf,%.0f\n", r.max_diff);
+        else fprintf(f, "%.3f,%.0f\n", r.psnr_db, r.max_diff);
+    }
+    if (!to_stdout) fclose(f);
+}
 
-    cl_ulong start, end;
-    event_sp.getProfilingInfo(CL_PROFILING_COMMAND_START, &start);
-    event_sp.getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
-    double fpga_time = (end - start) / 1e6; // ms
-    std::cout << "FPGA equalizeHist time: " << fpga_time << " ms" << std::endl;
+static bool list_has(const std::vector<std::string> &list, const char *name) {
+    return std::find(list.begin(), list.end(), name) != list.end();
+}
 
-    q.enqueueReadBuffer(imageFromDevice, CL_TRUE, 0, height * width, y_fpga.data);
-    q.finish();
+static std::vector<std::string> split_list(const char *s) {
+    std::vector<std::string> out;
+    std::string cur;
+    for (const char *p = s; ; ++p) {
+        if (*p == ',' || *p == '\0') {
+            if (!cur.empty()) out.push_back(cur);
+            cur.clear();
+            if (*p == '\0') break;
+        } else {
+            cur += (char)tolower((unsigned char)*p);
+        }
+    }
+    return out;
+}
 
-    // -------------------- Compare Results --------------------
-    cv::absdiff(y_ocv, y_fpga, diff);
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage:\n%s <input image path> [--iterations=N] [--warmup=N] [--sizes=720p,1080p,4k]\n"
+                    "    [--backends=cpu,neon,clahe-cpu,clahe-fpga,fpga-sync,fpga-pipelined] [--stripes=N]\n"
+                    "    [--clip-limit=F] [--tiles=N] [--csv=FILE|-] [--save-images]\n", argv0);
+    batch_usage(argv0, " [--backend=cpu|neon|clahe-cpu|clahe-fpga|fpga-sync] [--stripes=N] [--clip-limit=F] [--tiles=N]");
+}
 
-    float err_per;
-    xf::cv::analyzeDiff(diff, 1, err_per);
+// --batch: one backend over every image; the timed loops and the reference comparison don't apply
+static int run_batch(BatchOptions batch, const std::string &backend, const BenchOptions &o) {
+    BenchFpga fpga;
+    BenchFpgaBatch fpga_batch;
+    const bool clahe = backend == "clahe-fpga" || backend == "clahe-cpu";
+    BatchProcessFn process;
 
-    if (err_per > 0.0f) {
-        std::cerr << "ERROR: Results mismatch, error = " << err_per << "%" << std::endl;
+    if (backend == "cpu") {
+        process = [](const cv::Mat &y, cv::Mat &out) { cv::equalizeHist(y, out); return true; };
+    } else if (backend == "neon") {
+        process = [&o](const cv::Mat &y, cv::Mat &out) {
+            out.create(y.rows, y.cols, CV_8UC1);
+            neon_equalize_hist(y, out, o.stripes);
+            return true;
+        };
+    } else if (backend == "clahe-cpu") {
+        process = [&o](const cv::Mat &y, cv::Mat &out) {
+            // cv::CLAHE keeps scratch buffers, so each worker thread gets its own
+            thread_local cv::Ptr<cv::CLAHE> c;
+            if (!c) c = cv::createCLAHE(o.clip_limit, cv::Size(o.tiles, o.tiles));
+            c->apply(y, out);
+            return true;
+        };
+    } else if (backend == "clahe-fpga" || backend == "fpga-sync") {
+        if (!bench_fpga_init(&fpga) || (clahe && !fpga.clahe_kernel())) return -1;
+        batch.serial_process = true;
+        process = [&](const cv::Mat &y, cv::Mat &out) { return bench_fpga_apply(&fpga, &fpga_batch, clahe, o, y, out); };
     } else {
-        std::cout << "Results match!" << std::endl;
+        fprintf(stderr, "Backend %s has no batch mode (cpu, neon, clahe-cpu, clahe-fpga, fpga-sync)\n", backend.c_str());
+        return -1;
     }
+    batch.suffix = "_" + backend;
+    std::cout << "Batch backend: " << backend << std::endl;
+    return batch_run(batch, process) ? 0 : -1;
+}
+
+int main(int argc, char** argv) {
+    const char *input = nullptr;
+    const char *csv = nullptr;
+    bool save_images = false;
+    BenchOptions o;
+    std::vector<std::string> sizes = {"720p", "1080p", "4k"};
+    std::vector<std::string> backends = {"cpu", "neon", "clahe-cpu", "clahe-fpga", "fpga-sync", "fpga-pipelined"};
+    BatchOptions batch;
+    std::string batch_backend = "cpu";
 
-    // -------------------- Save Debug Images --------------------
-    cv::imwrite("input_y.jpg", y_plane);
-    cv::imwrite("out_ocv_y.jpg", y_ocv);
-    cv::imwrite("out_fpga_y.jpg", y_fpga);
-    cv::imwrite("out_diff_y.jpg", diff);
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        if (strncmp(a, "--iterations=", 13) == 0) { int n = atoi(a + 13); if (n > 0) o.iterations = n; }
+        else if (strncmp(a, "--warmup=", 9) == 0) { int n = atoi(a + 9); if (n >= 0) o.warmup = n; }
+        else if (strncmp(a, "--sizes=", 8) == 0) sizes = split_list(a + 8);
+        else if (strncmp(a, "--backends=", 11) == 0) backends = split_list(a + 11);
+        else if (strncmp(a, "--stripes=", 10) == 0) { int n = atoi(a + 10); if (n > 0 && n <= 16) o.stripes = n; }
+        else if (strncmp(a, "--clip-limit=", 13) == 0) { double c = atof(a + 13); if (c > 0.0) o.clip_limit = c; }
+        else if (strncmp(a, "--tiles=", 8) == 0) { int n = atoi(a + 8); if (n > 0 && n <= BENCH_TILES_DEFAULT) o.tiles = n; }
+        else if (strncmp(a, "--csv=", 6) == 0) csv = a + 6;
+        else if (strcmp(a, "--save-images") == 0) save_images = true;
+        else if (strncmp(a, "--backend=", 10) == 0) { std::vector<std::string> l = split_list(a + 10); if (!l.empty()) batch_backend = l[0]; }
+        else if (batch_parse_arg(a, &batch)) {}
+        else if (a[0] != '-' && !input) input = a;
+        else {
+            fprintf(stderr, "Unknown argument: %s\n", a);
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (!batch.input.empty()) return run_batch(batch, batch_backend, o);
+    if (!input) {
+        fprintf(stderr, "Invalid Number of Arguments!\n");
+        usage(argv[0]);
+        return -1;
+    }
+
+    // -------------------- Load Image --------------------
+    cv::Mat bgr = cv::imread(input);
+    if (bgr.empty()) {
+        fprintf(stderr, "Cannot open image\n");
+        return -1;
+    }
+    std::cout << "Input image: " << bgr.cols << "x" << bgr.rows << " | warm-up " << o.warmup
+              << " | iterations " << o.iterations << std::endl;
+
+    BenchFpga fpga;
+    if (list_has(backends, "clahe-fpga") || list_has(backends, "fpga-sync") || list_has(backends, "fpga-pipelined")) {
+        bench_fpga_init(&fpga);
+    }
+    cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(o.clip_limit, cv::Size(o.tiles, o.tiles));
+
+    std::vector<BenchResult> results;
+    for (const BenchSize &sz : bench_sizes) {
+        if (!list_has(sizes, sz.name)) continue;
+
+        // Y plane of the resized frame (BGR -> I420, untimed)
+        cv::Mat resized, yuv;
+        cv::resize(bgr, resized, cv::Size(sz.width, sz.height), 0, 0, cv::INTER_AREA);
+        cv::cvtColor(resized, yuv, cv::COLOR_BGR2YUV_I420);
+        cv::Mat y_plane(sz.height, sz.width, CV_8UC1, yuv.data);
+
+        cv::Mat ref_eq, ref_clahe;
+        cv::equalizeHist(y_plane, ref_eq);
+        clahe->apply(y_plane, ref_clahe);
+
+        for (const std::string &b : backends) {
+            BenchResult r;
+            r.backend = b;
+            r.size = &sz;
+            cv::Mat out(sz.height, sz.width, CV_8UC1);
+            const cv::Mat *ref = &ref_eq;
+
+            if (b == "cpu") {
+                bench_cpu(o, sz, [&] { cv::equalizeHist(y_plane, out); }, &r);
+            } else if (b == "neon") {
+                bench_cpu(o, sz, [&] { neon_equalize_hist(y_plane, out, o.stripes); }, &r);
+            } else if (b == "clahe-cpu") {
+                bench_cpu(o, sz, [&] { clahe->apply(y_plane, out); }, &r);
+                ref = &ref_clahe;
+            } else if (b == "clahe-fpga") {
+                if (!fpga.available || !fpga.clahe_kernel()) continue;
+                bench_fpga_clahe(&fpga, o, sz, y_plane, out, &r);
+                ref = &ref_clahe;
+            } else if (b == "fpga-sync") {
+                if (!fpga.available) continue;
+                bench_fpga_sync(&fpga, o, sz, y_plane, out, &r);
+            } else if (b == "fpga-pipelined") {
+                if (!fpga.available) continue;
+                bench_fpga_pipelined(&fpga, o, sz, y_plane, out, &r);
+            } else {
+                fprintf(stderr, "Unknown backend %s\n", b.c_str());
+                continue;
+            }
+
+            bench_compare(*ref, out, &r);
+            print_result(r);
+            results.push_back(r);
+            if (save_images) cv::imwrite("out_" + b + "_" + sz.name + ".jpg", out);
+        }
+        if (save_images) cv::imwrite(std::string("input_y_") + sz.name + ".jpg", y_plane);
+    }
 
+    if (csv) write_csv(csv, results);
     return 0;
 }
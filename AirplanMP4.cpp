@@ -7,13 +7,17 @@
 #include <string.h>  // argv parsing
 #include <stdlib.h>  // atoi
 
+#include "output_pool.hpp"
+#include "latency_hist.hpp"
+#include "offline_mode.hpp"
+
 typedef struct {
     GstElement *appsrc;
     GstElement *appsink;
     gboolean video_info_valid;
     GstVideoInfo video_info;
     GTimer *processing_timer;
-    double total_processing_time;
+    LatencyStats processing_times;  // per-frame processing time: report window + whole run
     int frame_count;
     gchar *input_file;
     gboolean loop_playback;
@@ -22,6 +26,9 @@ typedef struct {
     GMainLoop *loop;
     GstElement *sink_pipeline;
     GstElement *src_pipeline;
+
+    OutputPool out_pool;  // preallocated NV12 buffers handed to appsrc
+    OfflineRun offline;   // --offline: unpaced transcode to MP4
 } CustomData;
 
 // Called when appsink has a new sample
@@ -52,6 +59,8 @@ static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
             g_print("Video info: %dx%d, format: %s\n",
                 data->video_info.width, data->video_info.height,
                 gst_video_format_to_string(data->video_info.finfo->format));
+            // Offline runs keep the decoded framerate, so appsrc takes the caps as decoded
+            if (data->offline.enabled) gst_app_src_set_caps(GST_APP_SRC(data->appsrc), caps);
         } else {
             g_printerr("Failed to extract video info\n");
             gst_sample_unref(sample);
@@ -91,13 +100,17 @@ static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
 
         g_timer_stop(data->processing_timer);
         double frame_processing_time = g_timer_elapsed(data->processing_timer, NULL) * 1000.0;
-        data->total_processing_time += frame_processing_time;
+        latency_stats_record_ms(&data->processing_times, frame_processing_time);
         data->frame_count++;
 
         if (data->frame_count % 100 == 0) {
-            double avg = data->total_processing_time / data->frame_count;
-            g_print("Stats - Frame %d: %.2f ms, avg: %.2f ms, FPS: %.1f\n",
-                data->frame_count, frame_processing_time, avg, (avg > 0.0 ? 1000.0 / avg : 0.0));
+            LatencySummary win;
+            latency_hist_drain(&data->processing_times.window, &win);
+            g_print("Stats - Frame %d: %.2f ms, last 100 avg/p50/p99/max: %.2f/%.2f/%.2f/%.2f ms, FPS: %.1f, "
+                "pool hits/misses: %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT "\n",
+                data->frame_count, frame_processing_time, win.avg_ms, win.p50_ms, win.p99_ms, win.max_ms,
+                (win.avg_ms > 0.0 ? 1000.0 / win.avg_ms : 0.0),
+                data->out_pool.hits.load(), data->out_pool.misses.load());
         }
 
         // Step 2: Reconstruct NV12
@@ -106,8 +119,8 @@ static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
         // Fill UV with neutral value 128
         memset(nv12_output.data + y_size, 128, uv_size);
 
-        // Step 3: Allocate new GstBuffer
-        GstBuffer *processed_buffer = gst_buffer_new_allocate(NULL, y_size + uv_size, NULL);
+        // Step 3: Take an output buffer from the pool
+        GstBuffer *processed_buffer = output_pool_acquire(&data->out_pool, &data->video_info, y_size + uv_size);
         if (!processed_buffer) {
             g_printerr("Failed to allocate processed buffer\n");
             gst_buffer_unmap(buffer, &map_info);
@@ -122,12 +135,12 @@ static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
 
             // copy timestamps from input buffer to keep timing coherent
             gst_buffer_copy_into(processed_buffer, buffer, GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+            if (data->offline.enabled) offline_note_frame(&data->offline, processed_buffer);
 
             GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(data->appsrc), processed_buffer);
             if (ret != GST_FLOW_OK) {
                 g_printerr("Failed to push buffer to appsrc: %d\n", ret);
-                // processed_buffer ownership passed to appsrc on success; if failure, unref
-                gst_buffer_unref(processed_buffer);
+                // appsrc takes ownership of processed_buffer even when the push fails
             }
         } else {
             g_printerr("Failed to map processed buffer\n");
@@ -153,7 +166,15 @@ static gboolean bus_message_cb(GstBus *bus, GstMessage *message, gpointer user_d
     switch (GST_MESSAGE_TYPE(message)) {
         case GST_MESSAGE_EOS:
             g_print("End of stream reached.\n");
-            if (data->loop_playback && data->sink_pipeline) {
+            if (data->offline.enabled) {
+                // Input EOS drains through appsrc; quit once mp4mux has finalized the file
+                if (GST_MESSAGE_SRC(message) == GST_OBJECT(data->sink_pipeline)) {
+                    gst_app_src_end_of_stream(GST_APP_SRC(data->appsrc));
+                } else {
+                    g_print("MP4 output file finalized.\n");
+                    if (data->loop) g_main_loop_quit(data->loop);
+                }
+            } else if (data->loop_playback && data->sink_pipeline) {
                 g_print("Restarting playback...\n");
                 // Seek back to start of file pipeline
                 if (!gst_element_seek_simple(
@@ -223,6 +244,10 @@ int main(int argc, char *argv[]) {
     int target_height = 720;
     int target_fps_num = 30;
     int target_fps_den = 1;
+    int pool_min = OUTPUT_POOL_MIN_DEFAULT; // --pool-min=N output buffers preallocated
+    int pool_max = OUTPUT_POOL_MAX_DEFAULT; // --pool-max=N before falling back to allocation
+    gchar *output_file = NULL;              // --output=FILE, --offline only
+    OfflineRun offline;
 
     for (int i = 1; i < argc; ++i) {
         if (g_str_has_prefix(argv[i], "--codec=")) {
@@ -264,6 +289,29 @@ int main(int argc, char *argv[]) {
                     target_fps_den = 1;
                 }
             }
+        } else if (g_str_has_prefix(argv[i], "--pool-min=")) {
+            const char *val = strchr(argv[i], '=');
+            if (val) {
+                int v = atoi(val + 1);
+                if (v > 0) pool_min = v;
+            }
+        } else if (g_str_has_prefix(argv[i], "--pool-max=")) {
+            const char *val = strchr(argv[i], '=');
+            if (val) {
+                int v = atoi(val + 1);
+                if (v > 0) pool_max = v;
+            }
+        } else if (g_strcmp0(argv[i], "--offline") == 0) {
+            offline.enabled = true;
+        } else if (g_str_has_prefix(argv[i], "--offline-queue=")) {
+            const char *val = strchr(argv[i], '=');
+            if (val) {
+                int v = atoi(val + 1);
+                if (v > 0) offline.queue = (guint)v;
+            }
+        } else if (g_str_has_prefix(argv[i], "--output=")) {
+            const char *val = strchr(argv[i], '=');
+            if (val) output_file = g_strdup(val + 1);
         }
     }
 
@@ -275,45 +323,76 @@ int main(int argc, char *argv[]) {
         g_printerr("  --resolution=WxH      Target resolution (default: 1280x720)\n");
         g_printerr("  --fps=N or N/D        Target framerate (default: 30/1)\n");
         g_printerr("  --loop                Loop playback\n");
+        g_printerr("  --pool-min=N          Preallocated output buffers (default: %d)\n", OUTPUT_POOL_MIN_DEFAULT);
+        g_printerr("  --pool-max=N          Output buffers before falling back to allocation (default: %d)\n", OUTPUT_POOL_MAX_DEFAULT);
+        g_printerr("  --offline             Transcode to MP4 as fast as possible, original timestamps, no UDP\n");
+        g_printerr("  --offline-queue=N     Frames queued between offline stages (default: %d)\n", OFFLINE_QUEUE_DEFAULT);
+        g_printerr("  --output=FILE         Offline MP4 output (default: <input>_processed.mp4)\n");
         return -1;
     }
 
     if (!g_file_test(input_file, G_FILE_TEST_EXISTS)) {
         g_printerr("Error: Input file '%s' does not exist\n", input_file);
         g_free(input_file);
+        g_free(output_file);
         return -1;
     }
 
+    if (offline.enabled) {
+        if (!output_file) output_file = offline_default_output(input_file);
+        if (loop_playback) g_print("--loop ignored with --offline\n");
+        loop_playback = FALSE;
+    }
+
     g_print("Input: %s\n", input_file);
     g_print("Target resolution: %dx%d @ %d/%d fps\n",
             target_width, target_height, target_fps_num, target_fps_den);
     g_print("Encoder: %s, target-bitrate: %d kbps\n",
             use_h265 ? "H.265" : "H.264", bitrate_kbps);
     g_print("Loop playback: %s\n", loop_playback ? "enabled" : "disabled");
+    if (offline.enabled) g_print("Offline: %s, %u frames per queue\n", output_file, offline.queue);
 
     CustomData data = {};
     data.video_info_valid = FALSE;
     data.processing_timer = g_timer_new();
-    data.total_processing_time = 0.0;
     data.frame_count = 0;
     data.input_file = input_file;
     data.loop_playback = loop_playback;
+    output_pool_init(&data.out_pool, (guint)pool_min, (guint)pool_max);
     data.loop = NULL;
     data.sink_pipeline = NULL;
     data.src_pipeline = NULL;
+    data.offline = offline;
 
     GError *error = NULL;
 
     // 1) File input pipeline → NV12@WxH@fps → appsink
     // If "omxh264dec" is unavailable, replace with "avdec_h264".
-    gchar *sink_pipeline_str = g_strdup_printf(
-        "filesrc location=%s ! "
-        "qtdemux ! queue ! h264parse ! omxh264dec ! "
-        "videoconvert ! videoscale ! videorate ! "
-        "video/x-raw,format=NV12,width=%d,height=%d,framerate=%d/%d ! "
-        "appsink name=my_sink emit-signals=true max-buffers=2 drop=false sync=true",
-        input_file, target_width, target_height, target_fps_num, target_fps_den
-    );
+    gchar *sink_pipeline_str = NULL;
+    if (offline.enabled) {
+        // Unpaced, no videorate: every decoded frame at its own timestamp
+        gchar *q_demux = offline_queue_desc("q_demux", offline.queue);
+        gchar *q_decoded = offline_queue_desc("q_decoded", offline.queue);
+        sink_pipeline_str = g_strdup_printf(
+            "filesrc location=%s ! "
+            "qtdemux ! %s ! h264parse ! omxh264dec ! %s ! "
+            "videoconvert ! videoscale ! "
+            "video/x-raw,format=NV12,width=%d,height=%d ! "
+            "appsink name=my_sink emit-signals=true max-buffers=%u drop=false sync=false",
+            input_file, q_demux, q_decoded, target_width, target_height, offline.queue
+        );
+        g_free(q_demux);
+        g_free(q_decoded);
+    } else {
+        sink_pipeline_str = g_strdup_printf(
+            "filesrc location=%s ! "
+            "qtdemux ! queue ! h264parse ! omxh264dec ! "
+            "videoconvert ! videoscale ! videorate ! "
+            "video/x-raw,format=NV12,width=%d,height=%d,framerate=%d/%d ! "
+            "appsink name=my_sink emit-signals=true max-buffers=2 drop=false sync=true",
+            input_file, target_width, target_height, target_fps_num, target_fps_den
+        );
+    }
 
     GstElement *sink_pipeline = gst_parse_launch(sink_pipeline_str, &error);
     g_free(sink_pipeline_str);
@@ -321,15 +400,30 @@ int main(int argc, char *argv[]) {
         g_printerr("Failed to create sink pipeline: %s\n", error ? error->message : "unknown");
         g_clear_error(&error);
         g_free(input_file);
+        g_free(output_file);
         return -1;
     }
 
     data.appsink = gst_bin_get_by_name(GST_BIN(sink_pipeline), "my_sink");
     data.sink_pipeline = sink_pipeline;
 
-    // 2) appsrc → encoder → pay → udpsink
+    // 2) appsrc → encoder → pay → udpsink, or appsrc → encoder → mp4mux → filesink offline
     gchar *src_pipeline_str = NULL;
-    if (use_h265) {
+    if (offline.enabled) {
+        // appsrc blocks at max-buffers instead of dropping; caps are set from the first sample
+        gchar *q_encoded = offline_queue_desc("q_encoded", offline.queue);
+        src_pipeline_str = g_strdup_printf(
+            "appsrc name=my_src is-live=false block=true max-buffers=%u format=GST_FORMAT_TIME do-timestamp=false ! "
+            "%s num-slices=8 periodicity-idr=240 cpb-size=500 gdr-mode=horizontal initial-delay=250 "
+            "control-rate=constant target-bitrate=%d gop-mode=low-delay-p ! %s ! "
+            "%s ! mp4mux faststart=true ! filesink location=%s sync=false",
+            offline.queue, use_h265 ? "omxh265enc" : "omxh264enc", bitrate_kbps, q_encoded,
+            use_h265 ? "h265parse ! video/x-h265,stream-format=hvc1,alignment=au"
+                     : "h264parse ! video/x-h264,stream-format=avc,alignment=au",
+            output_file
+        );
+        g_free(q_encoded);
+    } else if (use_h265) {
         src_pipeline_str = g_strdup_printf(
             "appsrc name=my_src is-live=true format=GST_FORMAT_TIME do-timestamp=true ! "
             "video/x-raw,format=NV12,width=%d,height=%d,framerate=%d/%d ! "
@@ -360,6 +454,7 @@ int main(int argc, char *argv[]) {
         g_clear_error(&error);
         gst_object_unref(sink_pipeline);
         g_free(input_file);
+        g_free(output_file);
         return -1;
     }
 
@@ -383,6 +478,7 @@ int main(int argc, char *argv[]) {
     g_print("Processing video file. Press Ctrl+C to exit.\n");
 
     // Start pipelines
+    if (data.offline.enabled) offline_start(&data.offline);
     GstStateChangeReturn src_ret  = gst_element_set_state(src_pipeline,  GST_STATE_PLAYING);
     GstStateChangeReturn sink_ret = gst_element_set_state(sink_pipeline, GST_STATE_PLAYING);
 
@@ -394,6 +490,7 @@ int main(int argc, char *argv[]) {
         gst_object_unref(src_pipeline);
         g_timer_destroy(data.processing_timer);
         g_free(input_file);
+        g_free(output_file);
         g_main_loop_unref(main_loop);
         return -1;
     }
@@ -407,12 +504,20 @@ int main(int argc, char *argv[]) {
         gst_object_unref(src_pipeline);
         g_timer_destroy(data.processing_timer);
         g_free(input_file);
+        g_free(output_file);
         g_main_loop_unref(main_loop);
         return -1;
     }
 
     g_main_loop_run(main_loop);
 
+    LatencySummary run;
+    if (latency_hist_snapshot(&data.processing_times.run, &run)) {
+        g_print("Processing time, %" G_GUINT64_FORMAT " frames: avg %.2f | min %.2f | p50 %.2f | p99 %.2f | max %.2f ms\n",
+                run.count, run.avg_ms, run.min_ms, run.p50_ms, run.p99_ms, run.max_ms);
+    }
+    if (data.offline.enabled) offline_print_summary(&data.offline);
+
     // Cleanup
     gst_object_unref(sink_bus);
     gst_object_unref(src_bus);
@@ -420,8 +525,10 @@ int main(int argc, char *argv[]) {
     gst_element_set_state(src_pipeline,  GST_STATE_NULL);
     gst_object_unref(sink_pipeline);
     gst_object_unref(src_pipeline);
+    output_pool_clear(&data.out_pool);
     g_timer_destroy(data.processing_timer);
     g_free(input_file);
+    g_free(output_file);
     g_main_loop_unref(main_loop);
 
     return 0;
@@ -5,11 +5,13 @@
 //
 // Build:
 // g++ -O3 -DNDEBUG -std=c++17 nv12_equalize_to_udp_and_mp4.cpp -o nv12_nv12_mp4 \
-//   $(pkg-config --cflags --libs gstreamer-1.0 gstreamer-app-1.0 gstreamer-video-1.0 opencv4) -lpthread
+//   $(pkg-config --cflags --libs gstreamer-1.0 gstreamer-app-1.0 gstreamer-video-1.0 opencv4) -lpthread \
+//   -lOpenCL -lxilinxopencl
 //
 // Example:
 // ./nv12_nv12_mp4 --input=sample.mp4 --output=out.mp4 --codec=h264 --bitrate=10000 \
 //   --resolution=1280x720 --fps=30 --loop
+// ./nv12_nv12_mp4 --input=archive.mp4 --output=out.mp4 --backend=fpga --offline
 
 #include <gst/gst.h>
 #include <gst/app/gstappsink.h>
@@ -20,6 +22,21 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+// OpenCL includes (--backend=fpga)
+#define CL_HPP_CL_1_2_DEFAULT_BUILD
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#define CL_HPP_ENABLE_PROGRAM_CONSTRUCTION_FROM_ARRAY_COMPATIBILITY 1
+#include <CL/cl2.hpp>
+#include "xcl2.hpp"
+
+#include "output_pool.hpp"
+#include "latency_hist.hpp"
+#include "offline_mode.hpp"
+#include "clahe_fpga.hpp"
 
 typedef struct {
     GstElement *appsrc;
@@ -27,7 +44,7 @@ typedef struct {
     gboolean video_info_valid;
     GstVideoInfo video_info;
     GTimer *processing_timer;
-    double total_processing_time;
+    LatencyStats processing_times;  // per-frame processing time: report window + whole run
     int frame_count;
     gchar *input_file;
     gchar *output_file;
@@ -43,6 +60,14 @@ typedef struct {
     int    tile_grid;            // e.g., 8 means (8x8)
     cv::Ptr<cv::CLAHE> clahe;    // created once and reused
 
+    // === --backend=fpga ===
+    gboolean use_fpga;
+    SharedOpenCLContext fpga_shared;
+    WorkerOpenCLContext fpga_worker;
+
+    OutputPool out_pool;         // preallocated NV12 buffers handed to appsrc
+    OfflineRun offline;          // --offline: unpaced transcode to MP4
+
     GstClockTime frame_duration;
     GstClockTime current_timestamp;
 
@@ -147,7 +172,11 @@ static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
         data->clahe->setClipLimit(data->clip_limit);
         data->clahe->setTilesGridSize(cv::Size(data->tile_grid, data->tile_grid));
     }
-    data->clahe->apply(y_in, y_out);
+    // FPGA errors fall back to the CPU for this frame
+    if (!data->use_fpga || !fpga_clahe_apply(&data->fpga_shared, &data->fpga_worker, y_in, y_out,
+                                             data->clip_limit, data->tile_grid)) {
+        data->clahe->apply(y_in, y_out);
+    }
 
         cv::Mat nv12_out(height * 3 / 2, width, CV_8UC1);
         memcpy(nv12_out.data, y_out.data, y_size);
@@ -155,16 +184,20 @@ static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
 
         g_timer_stop(data->processing_timer);
         const double ms = g_timer_elapsed(data->processing_timer, NULL) * 1000.0;
-        data->total_processing_time += ms;
+        latency_stats_record_ms(&data->processing_times, ms);
         data->frame_count++;
         if ((data->frame_count % 100) == 0) {
-            const double avg = data->total_processing_time / data->frame_count;
-            g_print("Stats - Frame %d: %.2f ms, avg: %.2f ms, FPS: %.1f\n",
-                    data->frame_count, ms, avg, avg > 0.0 ? 1000.0 / avg : 0.0);
+            LatencySummary win;
+            latency_hist_drain(&data->processing_times.window, &win);
+            g_print("Stats - Frame %d: %.2f ms, last 100 avg/p50/p99/max: %.2f/%.2f/%.2f/%.2f ms, FPS: %.1f, "
+                    "pool hits/misses: %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT "\n",
+                    data->frame_count, ms, win.avg_ms, win.p50_ms, win.p99_ms, win.max_ms,
+                    win.avg_ms > 0.0 ? 1000.0 / win.avg_ms : 0.0,
+                    data->out_pool.hits.load(), data->out_pool.misses.load());
         }
 
         // Create output buffer
-        GstBuffer *out = gst_buffer_new_allocate(NULL, y_size + uv_size, NULL);
+        GstBuffer *out = output_pool_acquire(&data->out_pool, &data->video_info, y_size + uv_size);
         if (!out) {
             g_printerr("Failed to allocate processed buffer\n");
             gst_buffer_unmap(buffer, &map_info);
@@ -177,15 +210,20 @@ static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
             memcpy(wmap.data, nv12_out.data, y_size + uv_size);
             gst_buffer_unmap(out, &wmap);
 
-            GST_BUFFER_PTS(out) = data->current_timestamp;
-            GST_BUFFER_DTS(out) = data->current_timestamp;
-            GST_BUFFER_DURATION(out) = data->frame_duration;
-            data->current_timestamp += data->frame_duration;
+            if (data->offline.enabled) {
+                // Offline keeps the decoded timeline
+                gst_buffer_copy_into(out, buffer, GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+                offline_note_frame(&data->offline, out);
+            } else {
+                GST_BUFFER_PTS(out) = data->current_timestamp;
+                GST_BUFFER_DTS(out) = data->current_timestamp;
+                GST_BUFFER_DURATION(out) = data->frame_duration;
+                data->current_timestamp += data->frame_duration;
+            }
 
             GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(data->appsrc), out);
             if (ret != GST_FLOW_OK) {
-                g_printerr("Failed to push buffer to appsrc: %d\n", ret);
-                gst_buffer_unref(out);
+                g_printerr("Failed to push buffer to appsrc: %d\n", ret);  // appsrc owns the buffer either way
             }
         } else {
             g_printerr("Failed to map processed buffer\n");
@@ -295,6 +333,10 @@ int main(int argc, char *argv[]) {
     gboolean udp_only = FALSE;
     double clip_limit = 2.0;  // default CLAHE clip limit
     int    tile_grid  = 8;    // default CLAHE tile grid size (tile x tile)
+    gboolean use_fpga = FALSE; // --backend=cpu|fpga
+    int pool_min = OUTPUT_POOL_MIN_DEFAULT;  // --pool-min=N output buffers preallocated
+    int pool_max = OUTPUT_POOL_MAX_DEFAULT;  // --pool-max=N before falling back to allocation
+    OfflineRun offline;
 
     for (int i = 1; i < argc; ++i) {
         if (g_str_has_prefix(argv[i], "--codec=")) {
@@ -350,6 +392,19 @@ int main(int argc, char *argv[]) {
         } else if (g_strcmp0(argv[i], "--tile") == 0 && i + 1 < argc) {
             int v = atoi(argv[i + 1]);
             if (v >= 1) tile_grid = v; i++;
+        } else if (g_str_has_prefix(argv[i], "--backend=")) {
+            const char *val = strchr(argv[i], '=');
+            if (val && g_ascii_strcasecmp(val + 1, "fpga") == 0) use_fpga = TRUE;
+        } else if (g_strcmp0(argv[i], "--backend") == 0 && i + 1 < argc) {
+            if (g_ascii_strcasecmp(argv[i + 1], "fpga") == 0) use_fpga = TRUE; i++;
+        } else if (g_str_has_prefix(argv[i], "--pool-min=")) {
+            const char *val = strchr(argv[i], '='); if (val) { int v = atoi(val + 1); if (v > 0) pool_min = v; }
+        } else if (g_str_has_prefix(argv[i], "--pool-max=")) {
+            const char *val = strchr(argv[i], '='); if (val) { int v = atoi(val + 1); if (v > 0) pool_max = v; }
+        } else if (g_strcmp0(argv[i], "--offline") == 0) {
+            offline.enabled = true;
+        } else if (g_str_has_prefix(argv[i], "--offline-queue=")) {
+            const char *val = strchr(argv[i], '='); if (val) { int v = atoi(val + 1); if (v > 0) offline.queue = (guint)v; }
         }
     }
         
@@ -367,6 +422,10 @@ int main(int argc, char *argv[]) {
         g_printerr("  --loop                Loop playback");
         g_printerr("  --clipLimit=F        CLAHE clip limit (default: 2.0)");
         g_printerr("  --tile=N             CLAHE tiles grid size NxN (default: 8)");
+        g_printerr("  --backend=cpu|fpga   Run CLAHE on the A53 cores or on clahe_accel (default: cpu)");
+        g_printerr("  --pool-min=N --pool-max=N  Preallocated output buffers (default: %d..%d)", OUTPUT_POOL_MIN_DEFAULT, OUTPUT_POOL_MAX_DEFAULT);
+        g_printerr("  --offline            Transcode to MP4 as fast as possible, original timestamps, no UDP");
+        g_printerr("  --offline-queue=N    Frames queued between offline stages (default: %d)", OFFLINE_QUEUE_DEFAULT);
         return -1;
     }
 
@@ -376,6 +435,13 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
+    if (offline.enabled) {
+        if (udp_only) g_print("--udp-only ignored with --offline\n");
+        if (loop_playback) g_print("--loop ignored with --offline\n");
+        udp_only = FALSE;
+        loop_playback = FALSE;
+    }
+
     if (!udp_only && !output_file) {
         gchar *base = g_path_get_basename(input_file);
         gchar *name_noext = NULL; gchar *dot = g_strrstr(base, ".");
@@ -389,11 +455,11 @@ int main(int argc, char *argv[]) {
     g_print("Target resolution: %dx%d @ %d/%d fps\n", target_width, target_height, target_fps_num, target_fps_den);
     g_print("Encoder: %s, target-bitrate: %d kbps\n", use_h265 ? "H.265" : "H.264", bitrate_kbps);
     g_print("Loop playback: %s\n", loop_playback ? "enabled" : "disabled");
+    if (offline.enabled) g_print("Offline: %u frames per queue\n", offline.queue);
 
     CustomData data = {};
     data.video_info_valid = FALSE;
     data.processing_timer = g_timer_new();
-    data.total_processing_time = 0.0;
     data.frame_count = 0;
     data.input_file = input_file;
     data.output_file = output_file;
@@ -403,12 +469,27 @@ int main(int argc, char *argv[]) {
     data.src_pipeline = NULL;
     data.save_to_file = !udp_only;
     data.current_timestamp = 0;
+    output_pool_init(&data.out_pool, (guint)pool_min, (guint)pool_max);
+    data.offline = offline;
 
     // Initialize CLAHE
     data.clip_limit = clip_limit;
     data.tile_grid  = tile_grid < 1 ? 1 : tile_grid;
     data.clahe      = cv::createCLAHE(data.clip_limit, cv::Size(data.tile_grid, data.tile_grid));
 
+    // FPGA backend: clahe_accel from the shared xclbin, CPU if it can't be used
+    data.use_fpga = use_fpga;
+    if (data.use_fpga && data.tile_grid > CLAHE_TILES_MAX) {
+        g_printerr("clahe_accel supports up to %dx%d tiles, using CPU CLAHE\n", CLAHE_TILES_MAX, CLAHE_TILES_MAX);
+        data.use_fpga = FALSE;
+    }
+    if (data.use_fpga && (!initialize_shared_opencl_context(&data.fpga_shared) ||
+                          !initialize_worker_opencl_context(&data.fpga_worker, &data.fpga_shared))) {
+        g_printerr("FPGA backend unavailable, using CPU CLAHE\n");
+        data.use_fpga = FALSE;
+    }
+    g_print("CLAHE backend: %s\n", data.use_fpga ? "FPGA (clahe_accel)" : "CPU (cv::CLAHE)");
+
     g_print("CLAHE: clipLimit=%.3f, tileGrid=%dx%d", data.clip_limit, data.tile_grid, data.tile_grid);
     data.frame_duration = 0;
     data.got_in_eos = FALSE; data.got_out_eos = FALSE;
@@ -416,11 +497,23 @@ int main(int argc, char *argv[]) {
     GError *error = NULL;
 
     // 1) Input pipeline: filesrc -> decodebin -> NV12 WxH fps -> appsink
-    gchar *sink_pipeline_str = g_strdup_printf(
-        "filesrc location=%s ! decodebin ! videoconvert ! videoscale ! videorate ! "
-        "video/x-raw,format=NV12,width=%d,height=%d,framerate=%d/%d ! "
-        "appsink name=my_sink emit-signals=true max-buffers=5 drop=true sync=false",
-        input_file, target_width, target_height, target_fps_num, target_fps_den);
+    gchar *sink_pipeline_str = NULL;
+    if (offline.enabled) {
+        // No videorate and no drops: appsink pushes back on the decoder through q_decoded
+        gchar *q_decoded = offline_queue_desc("q_decoded", offline.queue);
+        sink_pipeline_str = g_strdup_printf(
+            "filesrc location=%s ! decodebin ! %s ! videoconvert ! videoscale ! "
+            "video/x-raw,format=NV12,width=%d,height=%d ! "
+            "appsink name=my_sink emit-signals=true max-buffers=%u drop=false sync=false",
+            input_file, q_decoded, target_width, target_height, offline.queue);
+        g_free(q_decoded);
+    } else {
+        sink_pipeline_str = g_strdup_printf(
+            "filesrc location=%s ! decodebin ! videoconvert ! videoscale ! videorate ! "
+            "video/x-raw,format=NV12,width=%d,height=%d,framerate=%d/%d ! "
+            "appsink name=my_sink emit-signals=true max-buffers=5 drop=true sync=false",
+            input_file, target_width, target_height, target_fps_num, target_fps_den);
+    }
 
     GstElement *sink_pipeline = gst_parse_launch(sink_pipeline_str, &error);
     g_free(sink_pipeline_str);
@@ -436,7 +529,22 @@ int main(int argc, char *argv[]) {
 
     // 2) Output pipeline
     gchar *src_pipeline_str = NULL;
-    if (udp_only) {
+    if (offline.enabled) {
+        // appsrc's thread feeds the encoder, q_encoded decouples mp4mux; caps come from set_appsrc_caps()
+        gchar *q_encoded = offline_queue_desc("q_encoded", offline.queue);
+        src_pipeline_str = g_strdup_printf(
+            "appsrc name=my_src is-live=false block=true max-buffers=%u format=GST_FORMAT_TIME do-timestamp=false ! "
+            "video/x-raw,format=NV12,width=%d,height=%d ! "
+            "%s num-slices=8 periodicity-idr=240 cpb-size=500 gdr-mode=horizontal initial-delay=250 "
+            "control-rate=constant target-bitrate=%d gop-mode=low-delay-p ! %s ! "
+            "%s ! mp4mux faststart=true ! filesink location=%s sync=false",
+            offline.queue, target_width, target_height, use_h265 ? "omxh265enc" : "omxh264enc",
+            bitrate_kbps, q_encoded,
+            use_h265 ? "h265parse ! video/x-h265,stream-format=hvc1,alignment=au"
+                     : "h264parse ! video/x-h264,stream-format=avc,alignment=au",
+            output_file);
+        g_free(q_encoded);
+    } else if (udp_only) {
         if (use_h265) {
             src_pipeline_str = g_strdup_printf(
                 "appsrc name=my_src is-live=true block=true format=GST_FORMAT_TIME do-timestamp=false ! "
@@ -513,6 +621,7 @@ int main(int argc, char *argv[]) {
     g_print("Processing video file. Press Ctrl+C to exit.\n");
 
     // Start pipelines
+    if (data.offline.enabled) offline_start(&data.offline);
     if (gst_element_set_state(src_pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
         g_printerr("Failed to start src pipeline\n");
     if (gst_element_set_state(sink_pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
@@ -520,6 +629,13 @@ int main(int argc, char *argv[]) {
 
     g_main_loop_run(main_loop);
 
+    LatencySummary run;
+    if (latency_hist_snapshot(&data.processing_times.run, &run)) {
+        g_print("Processing time, %" G_GUINT64_FORMAT " frames: avg %.2f | min %.2f | p50 %.2f | p99 %.2f | max %.2f ms\n",
+                run.count, run.avg_ms, run.min_ms, run.p50_ms, run.p99_ms, run.max_ms);
+    }
+    if (data.offline.enabled) offline_print_summary(&data.offline);
+
     // Cleanup
     gst_object_unref(sink_bus);
     gst_object_unref(src_bus);
@@ -529,6 +645,9 @@ int main(int argc, char *argv[]) {
     if (data.appsrc) gst_object_unref(data.appsrc);
     gst_object_unref(sink_pipeline);
     gst_object_unref(src_pipeline);
+    output_pool_clear(&data.out_pool);
+    cleanup_worker_opencl_context(&data.fpga_worker);
+    cleanup_shared_opencl_context(&data.fpga_shared);
     g_timer_destroy(data.processing_timer);
     g_free(input_file);
     if (output_file) g_free(output_file);
@@ -5,6 +5,7 @@
 // g++ -O3 -DNDEBUG -std=c++17 relay_debug_nv12_worker_opencl_fpga.cpp -o relay_debug_worker_opencl_fpga \
 //   $(pkg-config --cflags --libs gstreamer-1.0 gstreamer-app-1.0 gstreamer-video-1.0 opencv4) \
 //   -lOpenCL -lpthread -lxilinxopencl
+// --metrics-port needs -DWITH_METRICS $(pkg-config --cflags --libs libsoup-2.4) as well
 
 #include <gst/gst.h>
 #include <gst/app/gstappsink.h>
@@ -17,6 +18,21 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <chrono>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "frame_reorder.hpp"
+#include "frame_ring.hpp"
+#include "output_pool.hpp"
+#include "temporal_lut.hpp"
+#include "latency_meta.hpp"
+#include "metrics_server.hpp"
+#include "bench_mode.hpp"
+#include "stream_sched.hpp"
+#include "neon_equalize.hpp"
+#include "deadline_governor.hpp"
+#include "scene_change.hpp"
 
 // OpenCL includes
 #define CL_HPP_CL_1_2_DEFAULT_BUILD
@@ -24,6 +40,7 @@
 #define CL_HPP_MINIMUM_OPENCL_VERSION 120
 #define CL_HPP_ENABLE_PROGRAM_CONSTRUCTION_FROM_ARRAY_COMPATIBILITY 1
 #include <CL/cl2.hpp>
+#include <CL/cl_ext_xilinx.h>
 
 // Xilinx OpenCL utilities (assuming xcl2.hpp is available)
 #include "xcl2.hpp"
@@ -35,6 +52,39 @@
 #define HEIGHT_2k 1080
 #define INPUT_PTR_WIDTH 256
 #define OUTPUT_PTR_WIDTH 256
+#define LUT_BINS 256
+#define KERNEL_WORD_BYTES (INPUT_PTR_WIDTH / 8)   // the kernels move whole 256-bit words
+#define MAX_PIPELINE_SLOTS 3
+#define MAX_COMPUTE_UNITS 8
+#define KERNEL_CLOCK_MHZ 300      // default data-mover clock of the xclbins
+#define KERNEL_CLOCK_HEADROOM 0.8 // share of the clock the stream can sustain (stalls, row gaps)
+#define MAX_STREAMS STREAM_SCHED_MAX // --input=... may be given this many times
+#define STREAM_PORT_BASE 5004        // stream N goes to port 5004 + 2N unless ,port= says otherwise
+#define FPGA_ERROR_LIMIT_DEFAULT 5   // OpenCL errors in one status interval that take the FPGA out of service
+#define FPGA_RETRY_S_DEFAULT 30      // seconds on the CPU before the FPGA gets another go
+
+// Per-stage latency from CL profiling events; the status tick drains the window every 2 s
+static void stage_record(LatencyStats* st, const cl::Event& ev) {
+    cl_ulong start = 0, end = 0;
+    if (!ev() || ev.getProfilingInfo(CL_PROFILING_COMMAND_START, &start) != CL_SUCCESS ||
+        ev.getProfilingInfo(CL_PROFILING_COMMAND_END, &end) != CL_SUCCESS || end < start) return;
+    latency_stats_record(st, end - start);
+}
+
+// A stage made of several commands (a frame's uploads or readbacks): their START..END durations summed.
+// Events that were never enqueued are skipped.
+static void stage_record_sum(LatencyStats* st, std::initializer_list<const cl::Event*> events) {
+    cl_ulong total = 0;
+    bool any = false;
+    for (const cl::Event* ev : events) {
+        cl_ulong start = 0, end = 0;
+        if (!(*ev)() || ev->getProfilingInfo(CL_PROFILING_COMMAND_START, &start) != CL_SUCCESS ||
+            ev->getProfilingInfo(CL_PROFILING_COMMAND_END, &end) != CL_SUCCESS || end < start) continue;
+        total += end - start;
+        any = true;
+    }
+    if (any) latency_stats_record(st, total);
+}
 
 struct Counters {
     // Camera queue (q_cam)
@@ -58,36 +108,164 @@ struct Counters {
     // OpenCL FPGA processing timing
     std::atomic<uint64_t> total_processing_time_us{0};
     std::atomic<uint64_t> opencl_errors{0};
+
+    // --zero-copy: inputs the kernel read in place vs. inputs that still needed an upload
+    std::atomic<uint64_t> zero_copy_inputs{0},   copied_inputs{0};
+
+    // Frames the CPU equalizer handled (FPGA still starting, or taken out of service)
+    std::atomic<uint64_t> cpu_frames{0};
+
+    // --static-detect: blocks measured / changed, and frames remapped with the LUT they had
+    std::atomic<uint64_t> scene_blocks_total{0}, scene_blocks_changed{0};
+    std::atomic<uint64_t> static_frames{0};
+
+    // CL profiling START..END per frame: upload (or migrate), kernel, readback (or migrate)
+    LatencyStats stage_h2d, stage_kernel, stage_d2h;
+
+    // Rates over the last status interval, set by the tick for --metrics-port
+    std::atomic<double> camera_fps{0}, input_fps{0}, output_fps{0}, encoder_fps{0}, output_kbps{0};
+    std::atomic<double> changed_blocks_pct{0};
+};
+
+// One hardware instance of the kernel in the xclbin (v++ --connectivity.nk=<kernel>:N)
+struct ComputeUnit {
+    std::string name;                       // <kernel>_1 .. <kernel>_N, or the bare kernel name
+    std::atomic<int> in_flight{0};          // frames enqueued on this CU and not yet completed
+    std::atomic<int> bound_workers{0};      // workers whose buffers live in this CU's banks
+    std::atomic<uint64_t> busy_ns{0};       // kernel execution time from profiling events
+    std::atomic<uint64_t> frames{0};
 };
 
 struct SharedOpenCLContext {
     cl::Context context;
     cl::Device device;
     cl::Program program;
+    bool single_read{true};   // equalizeHist_single_accel (one Y read) vs equalizeHist_accel (in + ref)
+    bool nv12{false};         // equalizeHist_nv12_accel: whole NV12 frame in/out, UV passed through
     bool initialized{false};
     GMutex mutex; // Protect shared resources
+    int nppc{1};              // pixels per clock of the loaded xclbin
+
+    ComputeUnit cus[MAX_COMPUTE_UNITS];
+    int  num_cus{0};
+    int  max_cus{MAX_COMPUTE_UNITS};   // --cus=N limits how many CUs are used
+    bool least_loaded{true};           // --cu-policy=least-loaded | bound
 };
 
-struct WorkerOpenCLContext {
-    cl::CommandQueue queue;
-    cl::Kernel kernel;
-    
+struct Stream;
+
+// One in-flight frame: device buffers plus the events that chain H2D -> kernel -> D2H
+struct PipelineSlot {
     // Pre-allocated buffers for efficiency
     cl::Buffer img_y_in_buffer;
-    cl::Buffer img_y_ref_buffer;
+    cl::Buffer img_y_ref_buffer;   // dual-read kernel only
     cl::Buffer img_y_out_buffer;
+    cl::Buffer lut_buffer;         // single-read kernel only: LUT in (256 B)
+    cl::Buffer hist_buffer;        // single-read kernel only: histogram out (256 x u32)
+
+    // Async mode only (write/ref/lut events also time the blocking path's uploads)
+    cl::Event write_event;
+    cl::Event ref_event;           // dual-read kernel: second Y plane upload
+    cl::Event lut_event;           // single-read kernel: LUT upload
+    cl::Event kernel_event;
+    cl::Event read_event;
+    cl::Event hist_event;
+    GstBuffer *inbuf{nullptr};     // camera buffer, held (mapped) until its upload completes
+    GstMapInfo in_map{};
+    GstBuffer *outbuf{nullptr};    // output buffer, mapped; D2H lands directly in it
+    GstMapInfo out_map{};
+    bool in_zero_copy{false};      // kernel reads the camera mapping itself, hold it until the kernel ends
+    bool out_zero_copy{false};     // outbuf comes from the cl::Buffer pool, kernel writes it directly
+    uint8_t  lut[LUT_BINS]{};      // host copies must outlive the non-blocking transfers
+    uint32_t hist[LUT_BINS]{};
+    std::chrono::high_resolution_clock::time_point submit_time{};
+    Stream      *stream{nullptr};                 // camera the frame came from
+    uint64_t     seq{0};                          // capture order, for the reorder stage
+    GstClockTime pts{GST_CLOCK_TIME_NONE};
+    GstClockTime duration{GST_CLOCK_TIME_NONE};
+    int  cu{-1};                   // compute unit this frame was dispatched to
+    bool busy{false};
+};
+
+struct HostInputBuffer {
+    const void *host_ptr{nullptr};
+    size_t      size{0};
+    cl::Buffer  buffer;
+};
+
+struct WorkerOpenCLContext {
+    cl::CommandQueue queue;
+    cl::Kernel kernel;                            // home CU kernel, used for bank assignment
+    cl::Kernel cu_kernels[MAX_COMPUTE_UNITS];     // one kernel object per CU for dispatch
+    int home_cu{0};
+
+    // Slot 0 is used by the blocking path; async mode rotates over num_slots
+    PipelineSlot slots[MAX_PIPELINE_SLOTS];
+
+    // --zero-copy: camera mappings wrapped as CL_MEM_USE_HOST_PTR buffers, keyed by address
+    // and size. v4l2src recycles a handful of buffers, so this stays small and avoids
+    // per-frame imports; it is dropped whenever a camera renegotiates (caps_epoch).
+    std::vector<HostInputBuffer> host_in_cache;
+    uint32_t host_in_epoch{0};
+    SceneFrame scene;            // --static-detect verdict for the frame being submitted
+    int num_slots{1};
+    int next_slot{0};
+    int in_flight{0};
     size_t buffer_size{0};
     bool initialized{false};
+    bool init_failed{false};     // this worker stays on the CPU equalizer
 };
 
-struct CustomData {
+// What the workers run the next frame on. The relay streams on the CPU equalizer from the
+// start while the xclbin loads in the background, switches to the FPGA once it is ready and
+// goes back to the CPU when OpenCL errors pile up.
+enum RelayBackend {
+    RELAY_BACKEND_CPU,     // neon_equalize_hist on the worker thread
+    RELAY_BACKEND_FPGA,
+};
+
+struct CustomData;
+
+// One camera (--input): its own pipelines, ring, ordering, LUT and counters. The FPGA
+// context, the compute units and the workers are shared by every stream.
+struct Stream {
+    int          index{0};
+    std::string  device{"/dev/video0"};
+    int          width{1920}, height{1080}, fps{60};
+    int          port{STREAM_PORT_BASE};
+    CustomData  *app{nullptr};
+
+    GstElement  *sink_pipe{nullptr};
+    GstElement  *src_pipe{nullptr};
     GstElement  *appsrc{nullptr};
     GstElement  *appsink{nullptr};
     gboolean     video_info_valid{FALSE};
     GstVideoInfo video_info{};
+    GstCaps     *caps{nullptr};     // last caps seen by new_sample_cb, to notice renegotiation
+
+    FrameRing    work_ring{};       // bounded hand-off of GstBuffer* from callback to workers
+    GstBufferPool *out_pool{nullptr};    // NV12 output frames backed by host-mapped cl::Buffers
+    OutputPool host_pool{};              // preallocated NV12 output frames when out_pool is not in use
+    FrameReorder reorder{};              // capture-order output stage in front of appsrc
+    LatencyTrace latency{};              // per-frame q_cam -> payloader latency (latency_meta.hpp)
+
+    // Single-read kernel: LUT built from this camera's most recent histogram, shared by workers
+    GMutex   lut_mutex;
+    uint8_t  lut[LUT_BINS]{};
+    bool     lut_valid{false};
+    TemporalLut tlut{};
+    SceneChange scene{};                 // --static-detect samples of this camera
+
+    Counters     ctr{};
+};
+
+struct CustomData {
+    // Cameras, and the scheduler that spreads their frames over the workers
+    Stream       streams[MAX_STREAMS];
+    int          num_streams{1};
+    StreamSched  sched{};
+    size_t       max_y_size{0};     // largest Y plane of any stream, worker slots are sized for it
 
-    // Worker decoupling
-    GAsyncQueue *work_q{nullptr};   // carries GstBuffer* from callback to worker
     GThread     *worker{nullptr};
     std::atomic<bool> stop{false};
 
@@ -96,35 +274,300 @@ struct CustomData {
     GThread     **workers{nullptr};
     SharedOpenCLContext shared_opencl{}; // Shared context and program
     WorkerOpenCLContext *worker_opencl_contexts{nullptr}; // Per-worker queues and buffers
-
-    Counters     ctr{};
+    int pipeline_depth{1};               // 1 = blocking submit, 2..3 = async ping-pong slots
+    bool zero_copy{false};               // kernel reads camera buffers / writes out_pool buffers directly
+    std::atomic<uint32_t> caps_epoch{0}; // bumped when any camera renegotiates; workers drop host_in_cache
+    int kernel_clock_mhz{KERNEL_CLOCK_MHZ}; // used to pick the NPPC xclbin for the caps
+    bool temporal{false};   // --lut-mode=temporal: EMA over frame histograms plus scene-cut reset
+
+    // Backend hot-swap. Only the status tick changes backend after start-up, apart from the
+    // init thread's one switch to the FPGA.
+    std::atomic<int>  backend{RELAY_BACKEND_CPU};
+    std::atomic<bool> fpga_ready{false};    // shared context (and zero-copy pools) usable
+    std::atomic<bool> fpga_failed{false};   // background init gave up
+    GThread *fpga_init_thread{nullptr};     // --fpga-init=background
+    double   pixel_rate{0.0};               // all streams, for the xclbin choice
+    int      width_align{1};                // gcd of the stream widths
+    int      eq_stripes{NEON_EQ_STRIPES_DEFAULT};  // --eq-stripes=N for the CPU equalizer
+    int      fpga_error_limit{FPGA_ERROR_LIMIT_DEFAULT}; // --fpga-error-limit=N (0 = never fall back)
+    int      fpga_retry_s{FPGA_RETRY_S_DEFAULT};         // --fpga-retry=S (0 = stay on the CPU)
+    gint64   fpga_retry_at_us{0};
+    uint64_t prev_opencl_errors{0};
+    std::atomic<uint64_t> backend_swaps{0};
+
+    // --governor: sheds enhancement work when frames overrun their budget (status tick)
+    DeadlineGovernor governor{};
+    uint64_t prev_gov_busy_us{0}, prev_gov_frames{0};
+
+    bool scene_detect{false};   // --static-detect: static frames reuse the LUT, skip histogram and device
+    bool static_roi{false};     // --static-roi: static blocks go to the encoder as low-quality ROI
+
+    MetricsServer metrics{};             // --metrics-port: Prometheus /metrics
     GMainLoop   *loop{nullptr};
 };
 
+/* ---------- Histogram / LUT helpers ---------- */
+
+static void compute_y_histogram(const uint8_t* y, size_t n, uint32_t hist[LUT_BINS]) {
+    memset(hist, 0, LUT_BINS * sizeof(uint32_t));
+    for (size_t i = 0; i < n; ++i) hist[y[i]]++;
+}
+
+// Same mapping as cv::equalizeHist, so the single-read path matches the CPU relays
+static void build_equalize_lut(const uint32_t hist[LUT_BINS], size_t total, uint8_t lut[LUT_BINS]) {
+    int i = 0;
+    while (i < LUT_BINS && hist[i] == 0) ++i;
+
+    if (i == LUT_BINS || hist[i] == total) {
+        memset(lut, i == LUT_BINS ? 0 : i, LUT_BINS);
+        return;
+    }
+
+    const float scale = 255.0f / (float)(total - hist[i]);
+    uint32_t sum = 0;
+    memset(lut, 0, i + 1);
+    for (++i; i < LUT_BINS; ++i) {
+        sum += hist[i];
+        lut[i] = cv::saturate_cast<uint8_t>(sum * scale);
+    }
+}
+
+// Copy the stream's current LUT; the first frame bootstraps it on the CPU
+static void acquire_shared_lut(Stream* s, const uint8_t* y, size_t y_size, uint8_t lut[LUT_BINS]) {
+    g_mutex_lock(&s->lut_mutex);
+    if (!s->lut_valid) {
+        uint32_t hist[LUT_BINS];
+        compute_y_histogram(y, y_size, hist);
+        if (s->app->temporal) {
+            temporal_lut_update(&s->tlut, hist);
+            temporal_lut_get(&s->tlut, s->lut);
+        } else {
+            build_equalize_lut(hist, y_size, s->lut);
+        }
+        s->lut_valid = true;
+    }
+    memcpy(lut, s->lut, LUT_BINS);
+    g_mutex_unlock(&s->lut_mutex);
+}
+
+// A finished frame's histogram becomes (or, in temporal mode, is folded into) the LUT
+// for the next submitted frame
+static void publish_shared_lut(Stream* s, const uint32_t hist[LUT_BINS], size_t y_size) {
+    uint8_t lut[LUT_BINS];
+    if (s->app->temporal) {
+        temporal_lut_update(&s->tlut, hist);
+        temporal_lut_get(&s->tlut, lut);
+    } else {
+        build_equalize_lut(hist, y_size, lut);
+    }
+    g_mutex_lock(&s->lut_mutex);
+    memcpy(s->lut, lut, LUT_BINS);
+    s->lut_valid = true;
+    g_mutex_unlock(&s->lut_mutex);
+}
+
+// The stream's LUT without bootstrapping one; false before any frame has published it
+static bool current_shared_lut(Stream* s, uint8_t lut[LUT_BINS]) {
+    g_mutex_lock(&s->lut_mutex);
+    const bool valid = s->lut_valid;
+    if (valid) memcpy(lut, s->lut, LUT_BINS);
+    g_mutex_unlock(&s->lut_mutex);
+    return valid;
+}
+
+// --static-roi: the frame's static blocks travel with the output buffer to omxh26xenc
+static void attach_scene_roi(CustomData* d, GstBuffer* outbuf, const SceneFrame* sf) {
+    if (d->static_roi && sf) scene_change_add_roi(outbuf, sf);
+}
+
 /* ---------- OpenCL FPGA Initialization ---------- */
 
-static bool initialize_shared_opencl_context(SharedOpenCLContext* shared_ctx) {
+static const char* kernel_base_name(const SharedOpenCLContext* shared_ctx) {
+    if (shared_ctx->nv12) return "equalizeHist_nv12_accel";
+    return shared_ctx->single_read ? "equalizeHist_single_accel" : "equalizeHist_accel";
+}
+
+// Bytes per frame DMA: the Y plane, or the whole NV12 frame for the fused kernel
+static size_t device_frame_size(const SharedOpenCLContext* shared_ctx, size_t y_size) {
+    return shared_ctx->nv12 ? y_size + y_size / 2 : y_size;
+}
+
+// The kernels read and write ceil(size / 32) words, and a frame buffer (the slot buffers,
+// the cl_buffer_pool frames, or the camera mapping itself with --zero-copy) is exactly one
+// DMA long, so a frame whose Y plane, or whole NV12 frame for the fused kernel, is not a
+// whole number of words would be overrun. Those go to the CPU.
+static bool kernel_frame_aligned(const SharedOpenCLContext* shared_ctx, size_t y_size) {
+    return device_frame_size(shared_ctx, y_size) % KERNEL_WORD_BYTES == 0;
+}
+
+// "<kernel>:{<cu>}" pins the kernel object to one CU; the bare name lets XRT choose
+static std::string cu_kernel_spec(const SharedOpenCLContext* shared_ctx, int cu) {
+    std::string base = kernel_base_name(shared_ctx);
+    if (shared_ctx->cus[cu].name == base) return base;
+    return base + ":{" + shared_ctx->cus[cu].name + "}";
+}
+
+static void discover_compute_units(SharedOpenCLContext* shared_ctx) {
+    std::string base = kernel_base_name(shared_ctx);
+    shared_ctx->num_cus = 0;
+    for (int i = 0; i < shared_ctx->max_cus; ++i) {
+        std::string name = base + "_" + std::to_string(i + 1);
+        cl_int err = CL_SUCCESS;
+        cl::Kernel probe(shared_ctx->program, (base + ":{" + name + "}").c_str(), &err);
+        if (err != CL_SUCCESS) break;
+        shared_ctx->cus[shared_ctx->num_cus++].name = name;
+    }
+    if (shared_ctx->num_cus == 0) {
+        shared_ctx->cus[0].name = base;
+        shared_ctx->num_cus = 1;
+    }
+    g_print("FPGA compute units: %d (%s dispatch)\n", shared_ctx->num_cus,
+            shared_ctx->least_loaded ? "least-loaded" : "bound");
+}
+
+// Pick the CU for the next frame. On the MPSoC every CU reaches the same PS DDR, so a
+// worker may borrow an idle CU even though its buffers were placed for its home CU.
+static int acquire_compute_unit(SharedOpenCLContext* shared_ctx, int home_cu) {
+    int best = home_cu;
+    if (shared_ctx->least_loaded) {
+        for (int c = 0; c < shared_ctx->num_cus; ++c) {
+            if (shared_ctx->cus[c].in_flight.load(std::memory_order_relaxed) <
+                shared_ctx->cus[best].in_flight.load(std::memory_order_relaxed)) best = c;
+        }
+    }
+    shared_ctx->cus[best].in_flight.fetch_add(1, std::memory_order_relaxed);
+    return best;
+}
+
+static void release_compute_unit(SharedOpenCLContext* shared_ctx, int cu, const cl::Event* kernel_event) {
+    if (cu < 0) return;
+    ComputeUnit* unit = &shared_ctx->cus[cu];
+    cl_ulong start = 0, end = 0;
+    if (kernel_event && (*kernel_event)() &&
+        kernel_event->getProfilingInfo(CL_PROFILING_COMMAND_START, &start) == CL_SUCCESS &&
+        kernel_event->getProfilingInfo(CL_PROFILING_COMMAND_END, &end) == CL_SUCCESS && end > start) {
+        unit->busy_ns.fetch_add(end - start, std::memory_order_relaxed);
+        unit->frames.fetch_add(1, std::memory_order_relaxed);
+    }
+    unit->in_flight.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// Allocate in the memory bank wired to arg_index of the given CU kernel
+static cl::Buffer make_bank_buffer(SharedOpenCLContext* shared_ctx, const cl::Kernel& kernel, int arg_index,
+                                   cl_mem_flags flags, size_t size) {
+    cl_mem_ext_ptr_t ext;
+    ext.flags = arg_index;
+    ext.obj = nullptr;
+    ext.param = kernel();
+    cl_int err = CL_SUCCESS;
+    cl::Buffer buf(shared_ctx->context, flags | CL_MEM_EXT_PTR_XILINX, size, &ext, &err);
+    if (err != CL_SUCCESS) buf = cl::Buffer(shared_ctx->context, flags, size);
+    return buf;
+}
+
+// accel.cpp is built once per pixels-per-clock; krnl_hist_equalize is the NPPC1 build
+static std::string xclbin_name_for_nppc(int nppc) {
+    return nppc == 1 ? std::string("krnl_hist_equalize") : "krnl_hist_equalize_nppc" + std::to_string(nppc);
+}
+
+// Smallest pixels-per-clock whose throughput covers pixel_rate at the kernel clock. width
+// must be a multiple of the NPPC; with several cameras pass the gcd of their widths.
+static int select_kernel_nppc(double pixel_rate, int width, int clock_mhz) {
+    static const int options[] = {1, 4, 8};
+    for (int nppc : options) {
+        if (width % nppc != 0) continue;
+        if (pixel_rate <= clock_mhz * 1e6 * nppc * KERNEL_CLOCK_HEADROOM) return nppc;
+    }
+    return width % 8 == 0 ? 8 : 1;
+}
+
+// xcl::find_binary_file exits when nothing matches, so every xclbin is probed here instead
+static bool find_xclbin_variant(const std::string& name, std::string* path) {
+    const char* bindir = g_getenv("XCL_BINDIR");
+    const char* dirs[] = {bindir, ".", "xclbin"};
+    for (const char* dir : dirs) {
+        if (!dir) continue;
+        gchar* candidate = g_strdup_printf("%s/%s.xclbin", dir, name.c_str());
+        bool found = g_file_test(candidate, G_FILE_TEST_EXISTS);
+        if (found) *path = candidate;
+        g_free(candidate);
+        if (found) return true;
+    }
+    return false;
+}
+
+// xcl::get_xil_devices exits without a Xilinx platform; the background bring-up must
+// return instead, so the relay keeps streaming on the CPU equalizer
+static bool probe_xil_devices(std::vector<cl::Device>* devices) {
+    std::vector<cl::Platform> platforms;
+    if (cl::Platform::get(&platforms) != CL_SUCCESS) return false;
+    for (cl::Platform& platform : platforms) {
+        std::string vendor;
+        if (platform.getInfo(CL_PLATFORM_VENDOR, &vendor) != CL_SUCCESS) continue;
+        if (vendor.find("Xilinx") == std::string::npos) continue;
+        if (platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, devices) == CL_SUCCESS && !devices->empty()) return true;
+    }
+    return false;
+}
+
+// pixel_rate is the sum over all streams: every camera's frames run on the same CUs
+static bool initialize_shared_opencl_context(SharedOpenCLContext* shared_ctx, double pixel_rate, int width,
+                                             int clock_mhz) {
     try {
         // Get Xilinx FPGA devices
-        std::vector<cl::Device> devices = xcl::get_xil_devices();
-        if (devices.empty()) {
+        std::vector<cl::Device> devices;
+        if (!probe_xil_devices(&devices)) {
             g_printerr("No Xilinx FPGA devices found\n");
             return false;
         }
         
         shared_ctx->device = devices[0];
-        shared_ctx->context = cl::Context(shared_ctx->device);
+        cl_int err = CL_SUCCESS;
+        shared_ctx->context = cl::Context(shared_ctx->device, nullptr, nullptr, nullptr, &err);
+        if (err != CL_SUCCESS) {
+            g_printerr("Failed to create OpenCL context: %d\n", err);
+            return false;
+        }
         
-        // Load the FPGA binary once for all workers
-        std::string device_name = shared_ctx->device.getInfo<CL_DEVICE_NAME>();
-        std::string binaryFile = xcl::find_binary_file(device_name, "krnl_hist_equalize");
+        // Load the FPGA binary once for all workers, sized for the configured caps. Falls back
+        // to the next wider variant that is installed, and finally to the NPPC1 build. Only
+        // the dual-read kernel is built per NPPC; the single-read and NV12 kernels already
+        // take 32 pixels per beat, so they always load the NPPC1 build.
+        const int wanted = shared_ctx->single_read ? 1 : select_kernel_nppc(pixel_rate, width, clock_mhz);
+        std::string binaryFile;
+        shared_ctx->nppc = 1;
+        static const int variants[] = {4, 8};
+        for (int nppc : variants) {
+            if (wanted == 1 || nppc < wanted || width % nppc != 0) continue;
+            if (find_xclbin_variant(xclbin_name_for_nppc(nppc), &binaryFile)) { shared_ctx->nppc = nppc; break; }
+        }
+        if (binaryFile.empty() && !find_xclbin_variant(xclbin_name_for_nppc(1), &binaryFile)) {
+            g_printerr("No %s.xclbin in $XCL_BINDIR, . or xclbin/\n", xclbin_name_for_nppc(1).c_str());
+            return false;
+        }
+        if (shared_ctx->nppc < wanted) {
+            g_printerr("No NPPC%d xclbin for %.0f Mpix/s, using NPPC%d (may not keep up)\n",
+                       wanted, pixel_rate / 1e6, shared_ctx->nppc);
+        }
+        if (shared_ctx->single_read) {
+            g_print("FPGA binary: %s (%d pixels per beat)\n", binaryFile.c_str(), INPUT_PTR_WIDTH / 8);
+        } else {
+            g_print("FPGA binary: %s (NPPC%d, %.0f Mpix/s capacity at %d MHz)\n", binaryFile.c_str(), shared_ctx->nppc,
+                    clock_mhz * shared_ctx->nppc * KERNEL_CLOCK_HEADROOM, clock_mhz);
+        }
         cl::Program::Binaries bins = xcl::import_binary_file(binaryFile);
         
         std::vector<cl::Device> prog_devices = {shared_ctx->device};
-        shared_ctx->program = cl::Program(shared_ctx->context, prog_devices, bins);
+        shared_ctx->program = cl::Program(shared_ctx->context, prog_devices, bins, nullptr, &err);
+        if (err != CL_SUCCESS) {
+            g_printerr("Failed to program FPGA: %d\n", err);
+            return false;
+        }
         
         // Initialize mutex for thread safety
         g_mutex_init(&shared_ctx->mutex);
+
+        discover_compute_units(shared_ctx);
         
         shared_ctx->initialized = true;
         g_print("Shared OpenCL FPGA context initialized successfully\n");
@@ -141,18 +584,36 @@ static bool initialize_shared_opencl_context(SharedOpenCLContext* shared_ctx) {
 
 static bool initialize_worker_opencl_context(WorkerOpenCLContext* ctx, SharedOpenCLContext* shared_ctx, int worker_id) {
     try {
-        // Create worker-specific command queue
-        ctx->queue = cl::CommandQueue(shared_ctx->context, shared_ctx->device, CL_QUEUE_PROFILING_ENABLE);
+        // Create worker-specific command queue. Async mode needs out-of-order execution so the
+        // next upload can run while the previous kernel and readback are still in flight.
+        cl_command_queue_properties props = CL_QUEUE_PROFILING_ENABLE;
+        if (ctx->num_slots > 1) props |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+        ctx->queue = cl::CommandQueue(shared_ctx->context, shared_ctx->device, props);
         
-        // Create worker-specific kernel instance
-        ctx->kernel = cl::Kernel(shared_ctx->program, "equalizeHist_accel");
+        // Bind to the CU with the fewest workers; its banks hold this worker's buffers
+        g_mutex_lock(&shared_ctx->mutex);
+        int home = 0;
+        for (int c = 1; c < shared_ctx->num_cus; ++c) {
+            if (shared_ctx->cus[c].bound_workers.load() < shared_ctx->cus[home].bound_workers.load()) home = c;
+        }
+        shared_ctx->cus[home].bound_workers.fetch_add(1);
+        g_mutex_unlock(&shared_ctx->mutex);
+
+        // Create worker-specific kernel instances, one per CU
+        for (int c = 0; c < shared_ctx->num_cus; ++c) {
+            ctx->cu_kernels[c] = cl::Kernel(shared_ctx->program, cu_kernel_spec(shared_ctx, c).c_str());
+        }
+        ctx->home_cu = home;
+        ctx->kernel = ctx->cu_kernels[home];
         
         ctx->initialized = true;
-        g_print("Worker %d: OpenCL context initialized successfully\n", worker_id);
+        g_print("Worker %d: OpenCL context initialized successfully (home CU %s)\n",
+                worker_id, shared_ctx->cus[home].name.c_str());
         return true;
         
     } catch (const GError& e) {
       g_printerr("OpenCL initialization error");
+      return false;
     }
     catch (const std::exception& e) {
         g_printerr("Worker %d: Exception during OpenCL initialization: %s\n", worker_id, e.what());
@@ -173,15 +634,28 @@ static void cleanup_worker_opencl_context(WorkerOpenCLContext* ctx) {
 }
 
 static bool allocate_worker_opencl_buffers(WorkerOpenCLContext* ctx, SharedOpenCLContext* shared_ctx, size_t y_size) {
-    if (ctx->buffer_size == y_size && ctx->img_y_in_buffer() != nullptr) {
-        return true; // Buffers already allocated for this size
+    if (ctx->buffer_size >= y_size && ctx->slots[0].img_y_in_buffer() != nullptr) {
+        return true; // Buffers already allocated, big enough for every stream
     }
     
     try {
-        // Allocate new buffers using shared context
-        ctx->img_y_in_buffer = cl::Buffer(shared_ctx->context, CL_MEM_READ_ONLY, y_size);
-        ctx->img_y_ref_buffer = cl::Buffer(shared_ctx->context, CL_MEM_READ_ONLY, y_size);
-        ctx->img_y_out_buffer = cl::Buffer(shared_ctx->context, CL_MEM_WRITE_ONLY, y_size);
+        // Allocate new buffers using shared context, one set per pipeline slot
+        for (int s = 0; s < ctx->num_slots; ++s) {
+            PipelineSlot* slot = &ctx->slots[s];
+            // Placed in the banks of the home CU (argument order of the selected kernel)
+            const cl::Kernel& k = ctx->kernel;
+            if (shared_ctx->single_read) {
+                const size_t frame_size = device_frame_size(shared_ctx, y_size);
+                slot->img_y_in_buffer  = make_bank_buffer(shared_ctx, k, 0, CL_MEM_READ_ONLY, frame_size);
+                slot->img_y_out_buffer = make_bank_buffer(shared_ctx, k, 1, CL_MEM_WRITE_ONLY, frame_size);
+                slot->lut_buffer  = make_bank_buffer(shared_ctx, k, 2, CL_MEM_READ_ONLY, LUT_BINS * sizeof(uint8_t));
+                slot->hist_buffer = make_bank_buffer(shared_ctx, k, 3, CL_MEM_WRITE_ONLY, LUT_BINS * sizeof(uint32_t));
+            } else {
+                slot->img_y_in_buffer  = make_bank_buffer(shared_ctx, k, 0, CL_MEM_READ_ONLY, y_size);
+                slot->img_y_ref_buffer = make_bank_buffer(shared_ctx, k, 1, CL_MEM_READ_ONLY, y_size);
+                slot->img_y_out_buffer = make_bank_buffer(shared_ctx, k, 2, CL_MEM_WRITE_ONLY, y_size);
+            }
+        }
         ctx->buffer_size = y_size;
         return true;
         
@@ -191,88 +665,635 @@ static bool allocate_worker_opencl_buffers(WorkerOpenCLContext* ctx, SharedOpenC
     }
 }
 
+/* ---------- Zero-copy output pool: NV12 frames backed by host-mapped cl::Buffers ---------- */
+
+// Attached to every pool GstBuffer; the mapping stays valid for the buffer's lifetime
+struct ClFrameMemory {
+    cl::Buffer buffer;
+    cl::CommandQueue queue;   // for the final unmap
+    void *host_ptr{nullptr};
+};
+
+static GQuark cl_frame_quark(void) {
+    static GQuark q = g_quark_from_static_string("cl-frame-memory");
+    return q;
+}
+
+static ClFrameMemory* cl_frame_from_buffer(GstBuffer* buffer) {
+    return (ClFrameMemory*)gst_mini_object_get_qdata(GST_MINI_OBJECT(buffer), cl_frame_quark());
+}
+
+static void cl_frame_memory_free(gpointer data) {
+    ClFrameMemory *frame = (ClFrameMemory*)data;
+    frame->queue.enqueueUnmapMemObject(frame->buffer, frame->host_ptr);
+    frame->queue.finish();
+    delete frame;
+}
+
+typedef struct {
+    GstBufferPool parent;
+    SharedOpenCLContext *shared;
+    cl::CommandQueue *map_queue;
+} ClBufferPool;
+
+typedef struct {
+    GstBufferPoolClass parent_class;
+} ClBufferPoolClass;
+
+G_DEFINE_TYPE(ClBufferPool, cl_buffer_pool, GST_TYPE_BUFFER_POOL)
+
+static GstFlowReturn cl_buffer_pool_alloc_buffer(GstBufferPool *pool, GstBuffer **buffer,
+                                                 GstBufferPoolAcquireParams *params) {
+    (void)params;
+    ClBufferPool *self = (ClBufferPool*)pool;
+
+    GstStructure *config = gst_buffer_pool_get_config(pool);
+    GstCaps *caps = NULL; guint size = 0, min = 0, max = 0;
+    gst_buffer_pool_config_get_params(config, &caps, &size, &min, &max);
+    gst_structure_free(config);
+
+    cl_int err = CL_SUCCESS;
+    ClFrameMemory *frame = new ClFrameMemory();
+    frame->queue = *self->map_queue;
+    frame->buffer = cl::Buffer(self->shared->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size, nullptr, &err);
+    if (err == CL_SUCCESS) {
+        frame->host_ptr = frame->queue.enqueueMapBuffer(frame->buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                                                        0, size, nullptr, nullptr, &err);
+    }
+    if (err != CL_SUCCESS || !frame->host_ptr) {
+        g_printerr("cl_buffer_pool: failed to allocate %u byte frame: %d\n", size, err);
+        delete frame;
+        return GST_FLOW_ERROR;
+    }
+
+    *buffer = gst_buffer_new_wrapped_full((GstMemoryFlags)0, frame->host_ptr, size, 0, size, NULL, NULL);
+    gst_mini_object_set_qdata(GST_MINI_OBJECT(*buffer), cl_frame_quark(), frame, cl_frame_memory_free);
+    return GST_FLOW_OK;
+}
+
+static void cl_buffer_pool_finalize(GObject *object) {
+    ClBufferPool *self = (ClBufferPool*)object;
+    delete self->map_queue;
+    self->map_queue = nullptr;
+    G_OBJECT_CLASS(cl_buffer_pool_parent_class)->finalize(object);
+}
+
+static void cl_buffer_pool_class_init(ClBufferPoolClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = cl_buffer_pool_finalize;
+    GST_BUFFER_POOL_CLASS(klass)->alloc_buffer = cl_buffer_pool_alloc_buffer;
+}
+
+static void cl_buffer_pool_init(ClBufferPool *self) {
+    self->shared = nullptr;
+    self->map_queue = nullptr;
+}
+
+static GstBufferPool* cl_buffer_pool_new(SharedOpenCLContext* shared, guint frame_size, guint min_buffers, guint max_buffers) {
+    ClBufferPool *pool = (ClBufferPool*)g_object_new(cl_buffer_pool_get_type(), NULL);
+    pool->shared = shared;
+    pool->map_queue = new cl::CommandQueue(shared->context, shared->device);
+
+    GstBufferPool *bpool = GST_BUFFER_POOL(pool);
+    GstStructure *config = gst_buffer_pool_get_config(bpool);
+    gst_buffer_pool_config_set_params(config, NULL, frame_size, min_buffers, max_buffers);
+    if (!gst_buffer_pool_set_config(bpool, config) || !gst_buffer_pool_set_active(bpool, TRUE)) {
+        g_printerr("cl_buffer_pool: failed to activate\n");
+        gst_object_unref(bpool);
+        return nullptr;
+    }
+    return bpool;
+}
+
+// Wrap a camera mapping as a device-visible buffer. XRT only imports page-aligned user memory;
+// anything else falls back to a regular upload.
+// Entries are keyed by address and size: a camera that reallocates its buffers may hand out
+// the same address for a different frame size, and streams of different sizes share a worker.
+static bool lookup_host_input_buffer(CustomData* d, WorkerOpenCLContext* ctx, const void* host_ptr,
+                                     size_t y_size, cl::Buffer* out) {
+    if (((uintptr_t)host_ptr & 4095) != 0) return false;
+
+    const uint32_t epoch = d->caps_epoch.load(std::memory_order_acquire);
+    if (epoch != ctx->host_in_epoch) {
+        ctx->host_in_cache.clear();   // in-flight commands keep their own reference
+        ctx->host_in_epoch = epoch;
+    }
+    for (auto &entry : ctx->host_in_cache) {
+        if (entry.host_ptr == host_ptr && entry.size == y_size) { *out = entry.buffer; return true; }
+    }
+
+    cl_int err = CL_SUCCESS;
+    cl::Buffer buf(d->shared_opencl.context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, y_size,
+                   const_cast<void*>(host_ptr), &err);
+    if (err != CL_SUCCESS) return false;
+
+    if (ctx->host_in_cache.size() >= 16) ctx->host_in_cache.erase(ctx->host_in_cache.begin());
+    ctx->host_in_cache.push_back(HostInputBuffer{host_ptr, y_size, buf});
+    *out = buf;
+    return true;
+}
+
 /* ---------- Pad probes ---------- */
 
 static GstPadProbeReturn probe_cam_out(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
-    auto *d = (CustomData*)user_data;
+    auto *s = (Stream*)user_data;
     if ((GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) && GST_PAD_PROBE_INFO_BUFFER(info)) {
         GstBuffer *b = GST_PAD_PROBE_INFO_BUFFER(info);
-        d->ctr.cam_out_frames.fetch_add(1, std::memory_order_relaxed);
-        d->ctr.cam_out_bytes .fetch_add(gst_buffer_get_size(b), std::memory_order_relaxed);
+        s->ctr.cam_out_frames.fetch_add(1, std::memory_order_relaxed);
+        s->ctr.cam_out_bytes .fetch_add(gst_buffer_get_size(b), std::memory_order_relaxed);
     }
     return GST_PAD_PROBE_OK;
 }
 
 static GstPadProbeReturn probe_qcam_out(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
-    auto *d = (CustomData*)user_data;
+    auto *s = (Stream*)user_data;
     if ((GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) && GST_PAD_PROBE_INFO_BUFFER(info)) {
         GstBuffer *b = GST_PAD_PROBE_INFO_BUFFER(info);
-        d->ctr.qcam_out_frames.fetch_add(1, std::memory_order_relaxed);
-        d->ctr.qcam_out_bytes .fetch_add(gst_buffer_get_size(b), std::memory_order_relaxed);
+        s->ctr.qcam_out_frames.fetch_add(1, std::memory_order_relaxed);
+        s->ctr.qcam_out_bytes .fetch_add(gst_buffer_get_size(b), std::memory_order_relaxed);
     }
     return GST_PAD_PROBE_OK;
 }
 
 static GstPadProbeReturn probe_apps_sink(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
-    auto *d = (CustomData*)user_data;
+    auto *s = (Stream*)user_data;
     if ((GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) && GST_PAD_PROBE_INFO_BUFFER(info)) {
         GstBuffer *b = GST_PAD_PROBE_INFO_BUFFER(info);
-        d->ctr.appsink_in_frames.fetch_add(1, std::memory_order_relaxed);
-        d->ctr.appsink_in_bytes .fetch_add(gst_buffer_get_size(b), std::memory_order_relaxed);
+        s->ctr.appsink_in_frames.fetch_add(1, std::memory_order_relaxed);
+        s->ctr.appsink_in_bytes .fetch_add(gst_buffer_get_size(b), std::memory_order_relaxed);
     }
     return GST_PAD_PROBE_OK;
 }
 
 static GstPadProbeReturn probe_after_appsrc_queue(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
-    auto *d = (CustomData*)user_data;
+    auto *s = (Stream*)user_data;
     if ((GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) && GST_PAD_PROBE_INFO_BUFFER(info)) {
         GstBuffer *b = GST_PAD_PROBE_INFO_BUFFER(info);
-        d->ctr.after_src_frames.fetch_add(1, std::memory_order_relaxed);
-        d->ctr.after_src_bytes .fetch_add(gst_buffer_get_size(b), std::memory_order_relaxed);
+        s->ctr.after_src_frames.fetch_add(1, std::memory_order_relaxed);
+        s->ctr.after_src_bytes .fetch_add(gst_buffer_get_size(b), std::memory_order_relaxed);
     }
     return GST_PAD_PROBE_OK;
 }
 
 static GstPadProbeReturn probe_encoder_sink(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
-    auto *d = (CustomData*)user_data;
+    auto *s = (Stream*)user_data;
     if ((GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) && GST_PAD_PROBE_INFO_BUFFER(info)) {
         GstBuffer *b = GST_PAD_PROBE_INFO_BUFFER(info);
-        d->ctr.encoder_in_frames.fetch_add(1, std::memory_order_relaxed);
-        d->ctr.encoder_in_bytes .fetch_add(gst_buffer_get_size(b), std::memory_order_relaxed);
+        s->ctr.encoder_in_frames.fetch_add(1, std::memory_order_relaxed);
+        s->ctr.encoder_in_bytes .fetch_add(gst_buffer_get_size(b), std::memory_order_relaxed);
     }
     return GST_PAD_PROBE_OK;
 }
 
 /* ---------- appsink callback: O(1) enqueue ---------- */
 
+// Frames the ring drops still own a sequence number; release it so output doesn't stall
+static void drop_queued_frame(gpointer user_data, GstBuffer *buf) {
+    auto *s = (Stream*)user_data;
+    frame_reorder_push(&s->reorder, frame_reorder_seq(buf), nullptr);
+    gst_buffer_unref(buf);
+}
+
 static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
-    auto *d = (CustomData *)user_data;
+    auto *s = (Stream *)user_data;
 
     GstSample *sample = gst_app_sink_pull_sample(appsink);
     if (!sample) return GST_FLOW_ERROR;
     GstBuffer *inbuf = gst_sample_get_buffer(sample);
     if (!inbuf) { gst_sample_unref(sample); return GST_FLOW_ERROR; }
 
+    // A renegotiation (caps change, camera restart) may reallocate the v4l2 buffers, so the
+    // workers' imported host buffers can no longer be trusted
+    if (GstCaps *caps = gst_sample_get_caps(sample)) {
+        if (caps != s->caps) {
+            if (s->caps && !gst_caps_is_equal(caps, s->caps)) {
+                s->app->caps_epoch.fetch_add(1, std::memory_order_acq_rel);
+            }
+            gst_caps_replace(&s->caps, caps);
+        }
+    }
+
     // Cache caps once (diagnostic only)
-    if (!d->video_info_valid) {
+    if (!s->video_info_valid) {
         if (GstCaps *caps = gst_sample_get_caps(sample)) {
-            if (gst_video_info_from_caps(&d->video_info, caps)) {
-                d->video_info_valid = TRUE;
-                g_print("Video info: %dx%d\n", d->video_info.width, d->video_info.height);
+            if (gst_video_info_from_caps(&s->video_info, caps)) {
+                s->video_info_valid = TRUE;
+                g_print("Stream %d video info: %dx%d\n", s->index, s->video_info.width, s->video_info.height);
+                // The xclbin was chosen from the requested caps before the pipeline started;
+                // only the dual-read kernel depends on the NPPC
+                const int fps = s->video_info.fps_d > 0 ? s->video_info.fps_n / s->video_info.fps_d : 0;
+                const double rate = (double)s->video_info.width * s->video_info.height * fps;
+                const int nppc = select_kernel_nppc(rate, s->video_info.width, s->app->kernel_clock_mhz);
+                if (!s->app->shared_opencl.single_read && s->app->fpga_ready.load(std::memory_order_acquire) &&
+                    nppc > s->app->shared_opencl.nppc) {
+                    g_printerr("Negotiated caps need an NPPC%d kernel, NPPC%d is loaded\n", nppc, s->app->shared_opencl.nppc);
+                }
             }
         }
     }
 
     // O(1): ref buffer, queue to worker, unref sample (returns one ref to pool)
     gst_buffer_ref(inbuf);
-    g_async_queue_push(d->work_q, inbuf);
-    d->ctr.enqueued_frames.fetch_add(1, std::memory_order_relaxed);
-    d->ctr.enqueued_bytes .fetch_add(gst_buffer_get_size(inbuf), std::memory_order_relaxed);
+    frame_reorder_tag(&s->reorder, inbuf);
+    latency_meta_stamp(inbuf, LATENCY_APPSINK);
+    frame_ring_push(&s->work_ring, inbuf);
+    stream_sched_notify(&s->app->sched);
+    s->ctr.enqueued_frames.fetch_add(1, std::memory_order_relaxed);
+    s->ctr.enqueued_bytes .fetch_add(gst_buffer_get_size(inbuf), std::memory_order_relaxed);
 
     gst_sample_unref(sample);
     return GST_FLOW_OK;
 }
 
+/* ---------- async submission (pipeline_depth > 1) ---------- */
+
+static bool cl_event_done(const cl::Event& ev) {
+    cl_int status = CL_QUEUED;
+    if (ev.getInfo(CL_EVENT_COMMAND_EXECUTION_STATUS, &status) != CL_SUCCESS) return true;
+    return status <= CL_COMPLETE; // negative values are errors, also terminal
+}
+
+// Hand the camera buffer back as soon as the device is done with it so v4l2src can reuse it
+static void release_slot_input(PipelineSlot* slot, bool wait) {
+    if (!slot->inbuf) return;
+    const cl::Event& guard = slot->in_zero_copy ? slot->kernel_event : slot->write_event;
+    if (wait) guard.wait();
+    else if (!cl_event_done(guard)) return;
+    gst_buffer_unmap(slot->inbuf, &slot->in_map);
+    gst_buffer_unref(slot->inbuf);
+    slot->inbuf = nullptr;
+}
+
+// Enqueue H2D -> kernel -> D2H without blocking; the chain is ordered by events only.
+// With --zero-copy the kernel reads the camera mapping and writes a pool buffer directly,
+// and the transfers degrade to cache-maintenance migrations.
+// Takes ownership of inbuf (mapped) in both the success and the failure case;
+// slot->stream says which camera's pool, LUT and counters it uses.
+static bool submit_frame_async(CustomData* d, WorkerOpenCLContext* ctx, PipelineSlot* slot,
+                               GstBuffer* inbuf, const GstMapInfo& in_map, int width, int height,
+                               const SceneFrame* sf) {
+    Stream* s = slot->stream;
+    const size_t y_size = (size_t)width * (size_t)height;
+    const size_t uv_size = y_size / 2;
+    const bool single_read = d->shared_opencl.single_read;
+    const bool nv12 = d->shared_opencl.nv12;
+    const size_t dev_size = device_frame_size(&d->shared_opencl, y_size);
+
+    GstBuffer *outbuf = nullptr;
+    ClFrameMemory *out_frame = nullptr;
+    if (s->out_pool) {
+        if (gst_buffer_pool_acquire_buffer(s->out_pool, &outbuf, NULL) == GST_FLOW_OK) {
+            out_frame = cl_frame_from_buffer(outbuf);
+        }
+    } else {
+        outbuf = output_pool_acquire(&s->host_pool, &s->video_info, y_size + uv_size);
+    }
+    if (!outbuf || (s->out_pool && !out_frame) || !gst_buffer_map(outbuf, &slot->out_map, GST_MAP_WRITE)) {
+        if (outbuf) gst_buffer_unref(outbuf);
+        GstMapInfo m = in_map;
+        gst_buffer_unmap(inbuf, &m);
+        gst_buffer_unref(inbuf);
+        s->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    // Fill UV with neutral value 128 (same output as the blocking path). Pool buffers are
+    // filled after the migration back to the host so the cache invalidate can't drop it.
+    // The NV12 kernel writes the camera's UV itself.
+    if (!out_frame && !nv12) memset(slot->out_map.data + y_size, 128, uv_size);
+
+    latency_meta_carry(inbuf, outbuf);   // trace stamps go with the output frame
+    attach_scene_roi(d, outbuf, sf);
+
+    slot->inbuf = inbuf;
+    slot->in_map = in_map;
+    slot->outbuf = outbuf;
+    slot->out_zero_copy = out_frame != nullptr;
+    slot->submit_time = std::chrono::high_resolution_clock::now();
+
+    // Input: wrap the camera mapping when XRT can import it, otherwise upload into the slot buffer
+    cl_int err = CL_SUCCESS;
+    cl::Buffer in_cl = slot->img_y_in_buffer;
+    bool in_zero_copy = d->zero_copy && lookup_host_input_buffer(d, ctx, slot->in_map.data, dev_size, &in_cl);
+    slot->in_zero_copy = in_zero_copy;
+    slot->ref_event = cl::Event();   // only enqueued for some kernels and inputs
+    slot->lut_event = cl::Event();
+    slot->hist_event = cl::Event();
+    std::vector<cl::Event> kernel_deps(1);
+    if (in_zero_copy) {
+        std::vector<cl::Memory> objs(1, in_cl);
+        err = ctx->queue.enqueueMigrateMemObjects(objs, 0, nullptr, &slot->write_event);
+        s->ctr.zero_copy_inputs.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        // The camera buffer is uploaded straight from its mapping (no clone)
+        err = ctx->queue.enqueueWriteBuffer(slot->img_y_in_buffer, CL_FALSE, 0, dev_size,
+                                            slot->in_map.data, nullptr, &slot->write_event);
+        s->ctr.copied_inputs.fetch_add(1, std::memory_order_relaxed);
+    }
+    kernel_deps[0] = slot->write_event;
+
+    cl::Buffer out_cl = out_frame ? out_frame->buffer : slot->img_y_out_buffer;
+    slot->cu = acquire_compute_unit(&d->shared_opencl, ctx->home_cu);
+    cl::Kernel& kernel = ctx->cu_kernels[slot->cu];
+    if (err == CL_SUCCESS && single_read) {
+        acquire_shared_lut(s, slot->in_map.data, y_size, slot->lut);
+        err = ctx->queue.enqueueWriteBuffer(slot->lut_buffer, CL_FALSE, 0, sizeof(slot->lut),
+                                            slot->lut, nullptr, &slot->lut_event);
+        kernel_deps.push_back(slot->lut_event);
+        kernel.setArg(0, in_cl);
+        kernel.setArg(1, out_cl);
+        kernel.setArg(2, slot->lut_buffer);
+        kernel.setArg(3, slot->hist_buffer);
+        kernel.setArg(4, height);
+        kernel.setArg(5, width);
+    } else if (err == CL_SUCCESS) {
+        // A wrapped camera buffer can feed both ports, no second upload needed
+        cl::Buffer ref_cl = in_zero_copy ? in_cl : slot->img_y_ref_buffer;
+        if (!in_zero_copy) {
+            err = ctx->queue.enqueueWriteBuffer(slot->img_y_ref_buffer, CL_FALSE, 0, y_size,
+                                                slot->in_map.data, nullptr, &slot->ref_event);
+            kernel_deps.push_back(slot->ref_event);
+        }
+        kernel.setArg(0, in_cl);
+        kernel.setArg(1, ref_cl);
+        kernel.setArg(2, out_cl);
+        kernel.setArg(3, height);
+        kernel.setArg(4, width);
+    }
+
+    if (err == CL_SUCCESS) err = ctx->queue.enqueueTask(kernel, &kernel_deps, &slot->kernel_event);
+
+    std::vector<cl::Event> read_deps(1, slot->kernel_event);
+    if (err == CL_SUCCESS && out_frame) {
+        std::vector<cl::Memory> objs(1, out_cl);
+        err = ctx->queue.enqueueMigrateMemObjects(objs, CL_MIGRATE_MEM_OBJECT_HOST, &read_deps, &slot->read_event);
+    } else if (err == CL_SUCCESS) {
+        err = ctx->queue.enqueueReadBuffer(slot->img_y_out_buffer, CL_FALSE, 0, dev_size,
+                                           slot->out_map.data, &read_deps, &slot->read_event);
+    }
+    if (err == CL_SUCCESS && single_read) {
+        err = ctx->queue.enqueueReadBuffer(slot->hist_buffer, CL_FALSE, 0, sizeof(slot->hist),
+                                           slot->hist, &read_deps, &slot->hist_event);
+    }
+    if (err == CL_SUCCESS) err = ctx->queue.flush();
+
+    if (err != CL_SUCCESS) {
+        // Whatever did get enqueued may still reference the host memory
+        ctx->queue.finish();
+        release_compute_unit(&d->shared_opencl, slot->cu, nullptr);
+        slot->cu = -1;
+        gst_buffer_unmap(slot->outbuf, &slot->out_map);
+        gst_buffer_unref(slot->outbuf);
+        slot->outbuf = nullptr;
+        gst_buffer_unmap(slot->inbuf, &slot->in_map);
+        gst_buffer_unref(slot->inbuf);
+        slot->inbuf = nullptr;
+        s->ctr.opencl_errors.fetch_add(1, std::memory_order_relaxed);
+        g_printerr("OpenCL async submit failed: %d\n", err);
+        return false;
+    }
+
+    slot->busy = true;
+    ctx->in_flight++;
+    return true;
+}
+
+// Wait for a slot's readback, then push its output buffer downstream
+static void complete_frame_async(CustomData* d, WorkerOpenCLContext* ctx, PipelineSlot* slot) {
+    Stream* s = slot->stream;
+    const size_t y_size = (size_t)s->video_info.width * (size_t)s->video_info.height;
+
+    cl_int err = slot->read_event.wait();
+    if (err == CL_SUCCESS && d->shared_opencl.single_read) err = slot->hist_event.wait();
+    if (err == CL_SUCCESS) {
+        stage_record_sum(&s->ctr.stage_h2d, {&slot->write_event, &slot->ref_event, &slot->lut_event});
+        stage_record(&s->ctr.stage_kernel, slot->kernel_event);
+        stage_record_sum(&s->ctr.stage_d2h, {&slot->read_event, &slot->hist_event});
+    }
+    release_slot_input(slot, true);
+    release_compute_unit(&d->shared_opencl, slot->cu, &slot->kernel_event);
+    slot->cu = -1;
+
+    GstBuffer *outbuf = slot->outbuf;
+    if (slot->out_zero_copy && !d->shared_opencl.nv12) memset(slot->out_map.data + y_size, 128, y_size / 2);
+    gst_buffer_unmap(outbuf, &slot->out_map);
+    slot->outbuf = nullptr;
+    slot->busy = false;
+    ctx->in_flight--;
+
+    if (err != CL_SUCCESS) {
+        gst_buffer_unref(outbuf);
+        frame_reorder_push(&s->reorder, slot->seq, nullptr);
+        s->ctr.opencl_errors.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    if (d->shared_opencl.single_read) publish_shared_lut(s, slot->hist, y_size);
+
+    // Submit-to-readback span, so it includes time spent behind other in-flight frames
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::high_resolution_clock::now() - slot->submit_time);
+    s->ctr.total_processing_time_us.fetch_add(duration.count(), std::memory_order_relaxed);
+
+    // Capture timestamps travel with the frame (rebased by the reorder stage)
+    frame_reorder_carry_timing(outbuf, slot->pts, slot->duration);
+
+    s->ctr.processed_frames.fetch_add(1, std::memory_order_relaxed);
+    s->ctr.processed_bytes .fetch_add(gst_buffer_get_size(outbuf), std::memory_order_relaxed);
+
+    latency_meta_stamp(outbuf, LATENCY_DONE);
+    guint failures = frame_reorder_push(&s->reorder, slot->seq, outbuf);
+    if (failures) s->ctr.push_failures.fetch_add(failures, std::memory_order_relaxed);
+}
+
+// Complete in-flight frames in submission order; only blocks on the oldest when asked to
+static void drain_frames_async(CustomData* d, WorkerOpenCLContext* ctx, bool block_oldest) {
+    for (int s = 0; s < ctx->num_slots; ++s) release_slot_input(&ctx->slots[s], false);
+
+    while (ctx->in_flight > 0) {
+        int oldest = (ctx->next_slot - ctx->in_flight + ctx->num_slots) % ctx->num_slots;
+        PipelineSlot* slot = &ctx->slots[oldest];
+        bool ready = cl_event_done(slot->read_event) &&
+                     (!d->shared_opencl.single_read || cl_event_done(slot->hist_event));
+        if (!ready && !block_oldest) break;
+        complete_frame_async(d, ctx, slot);
+        block_oldest = false;
+    }
+}
+
+/* ---------- backends: CPU equalizer, FPGA bring-up and hot-swap ---------- */
+
+// Load the xclbin and, for --zero-copy, the cl::Buffer output pools. Workers build their
+// queues and kernels themselves the first time they see the FPGA backend.
+static bool bring_up_fpga(CustomData* d) {
+    if (!initialize_shared_opencl_context(&d->shared_opencl, d->pixel_rate, d->width_align, d->kernel_clock_mhz)) {
+        return false;
+    }
+    // Zero-copy output pool: enough frames for every in-flight slot plus what the encoder holds
+    if (d->zero_copy) {
+        guint min_bufs = (guint)(d->num_workers * d->pipeline_depth + 2);
+        for (int i = 0; i < d->num_streams; i++) {
+            Stream *s = &d->streams[i];
+            guint frame_size = (guint)((size_t)s->width * (size_t)s->height * 3 / 2);
+            s->out_pool = cl_buffer_pool_new(&d->shared_opencl, frame_size, min_bufs, min_bufs + 6);
+            if (!s->out_pool) g_printerr("Stream %d: zero-copy output pool unavailable, using regular buffers\n", i);
+        }
+    }
+    d->fpga_ready.store(true, std::memory_order_release);
+    return true;
+}
+
+// --fpga-init=background: device probe, xclbin import and program creation happen here
+// while the pipelines already stream through the CPU equalizer
+static gpointer fpga_init_thread_fn(gpointer user_data) {
+    auto *d = (CustomData*)user_data;
+    const gint64 start = g_get_monotonic_time();
+    if (!bring_up_fpga(d)) {
+        d->fpga_failed.store(true, std::memory_order_release);
+        g_printerr("FPGA unavailable, staying on the CPU equalizer\n");
+        return nullptr;
+    }
+    g_print("FPGA ready after %.1f s, switching workers from the CPU equalizer\n",
+            (g_get_monotonic_time() - start) / 1e6);
+    int expected = RELAY_BACKEND_CPU;
+    if (d->backend.compare_exchange_strong(expected, RELAY_BACKEND_FPGA, std::memory_order_acq_rel)) {
+        d->backend_swaps.fetch_add(1, std::memory_order_relaxed);
+    }
+    return nullptr;
+}
+
+// Status tick: take the FPGA out of service when OpenCL errors climb, and give it another
+// go after --fpga-retry seconds on the CPU. The stream keeps running either way.
+static void backend_watchdog(CustomData* d) {
+    uint64_t errors = 0;
+    for (int i = 0; i < d->num_streams; ++i) errors += d->streams[i].ctr.opencl_errors.load();
+    const uint64_t fresh = errors - d->prev_opencl_errors;
+    d->prev_opencl_errors = errors;
+
+    const gint64 now = g_get_monotonic_time();
+    const int backend = d->backend.load(std::memory_order_acquire);
+    if (backend == RELAY_BACKEND_FPGA && d->fpga_error_limit > 0 && fresh >= (uint64_t)d->fpga_error_limit) {
+        d->backend.store(RELAY_BACKEND_CPU, std::memory_order_release);
+        d->backend_swaps.fetch_add(1, std::memory_order_relaxed);
+        d->fpga_retry_at_us = d->fpga_retry_s > 0 ? now + (gint64)d->fpga_retry_s * G_USEC_PER_SEC : 0;
+        g_printerr("%" G_GUINT64_FORMAT " OpenCL errors in the last interval, falling back to the CPU equalizer\n", fresh);
+    } else if (backend == RELAY_BACKEND_CPU && d->fpga_ready.load(std::memory_order_acquire) &&
+               d->fpga_retry_at_us != 0 && now >= d->fpga_retry_at_us) {
+        d->fpga_retry_at_us = 0;
+        d->backend.store(RELAY_BACKEND_FPGA, std::memory_order_release);
+        d->backend_swaps.fetch_add(1, std::memory_order_relaxed);
+        g_print("Retrying the FPGA backend\n");
+    }
+}
+
+static const char* backend_status(CustomData* d) {
+    if (d->backend.load(std::memory_order_acquire) == RELAY_BACKEND_FPGA) return "FPGA";
+    if (d->fpga_failed.load(std::memory_order_acquire)) return "CPU (FPGA unavailable)";
+    if (!d->fpga_ready.load(std::memory_order_acquire)) return "CPU (FPGA initializing)";
+    return d->fpga_retry_at_us != 0 ? "CPU (OpenCL errors, FPGA retry pending)" : "CPU (OpenCL errors)";
+}
+
+// The worker's queue and kernels, built on its first FPGA frame. A worker that can't get
+// them stays on the CPU; the errors it counts let the watchdog see a device gone bad.
+static bool ensure_worker_fpga(CustomData* d, Stream* s, WorkerOpenCLContext* ctx, int worker_id) {
+    if (ctx->initialized) return true;
+    if (ctx->init_failed) return false;
+    if (initialize_worker_opencl_context(ctx, &d->shared_opencl, worker_id)) return true;
+    g_printerr("Worker %d: Failed to initialize OpenCL context, using the CPU equalizer\n", worker_id);
+    ctx->init_failed = true;
+    s->ctr.opencl_errors.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+static_assert(SCENE_CHANGE_STEP == GOVERNOR_HIST_SUBSAMPLE, "the detector's histogram stands in for the governor's");
+
+// Y plane by the governor's level: the full two-pass equalizer, a subsampled histogram,
+// one pass with the previous LUT, or (skip: the governor's alternate frames and static
+// frames) a plain remap with it. Every level below full publishes the stream's LUT, so
+// the FPGA path and skipped frames can pick it up. sub_hist, when given, is this frame's
+// histogram on the subsampled grid, already gathered by the static-scene detector.
+static void equalize_y_cpu(CustomData* d, Stream* s, const uint8_t* src, uint8_t* dst, int width, int height,
+                           bool skip, const uint32_t* sub_hist) {
+    uint8_t  lut[LUT_BINS];
+    uint32_t hist[LUT_BINS];
+    const int level = governor_level(&d->governor);
+    const bool have_lut = (skip || level > GOVERNOR_FULL) && current_shared_lut(s, lut);
+    if (skip && have_lut) {
+        neon_eq_apply(src, (size_t)width, dst, (size_t)width, width, height, lut, d->eq_stripes);
+        return;
+    }
+    if (level == GOVERNOR_FULL && !sub_hist) {
+        neon_equalize_hist(src, (size_t)width, dst, (size_t)width, width, height, d->eq_stripes);
+        return;
+    }
+    if (level == GOVERNOR_FULL) {
+        // Exact output; the detector's histogram leaves a LUT behind for the static frames
+        neon_equalize_hist(src, (size_t)width, dst, (size_t)width, width, height, d->eq_stripes);
+        size_t total = 0;
+        for (int i = 0; i < LUT_BINS; ++i) total += sub_hist[i];
+        publish_shared_lut(s, sub_hist, total);
+        return;
+    }
+    const bool reuse = have_lut && level >= GOVERNOR_LUT_REUSE;
+    if (sub_hist) {
+        memcpy(hist, sub_hist, sizeof(hist));
+        if (reuse) neon_eq_apply(src, (size_t)width, dst, (size_t)width, width, height, lut, d->eq_stripes);
+    } else {
+        temporal_lut_apply_gather(src, (size_t)width, reuse ? dst : nullptr, (size_t)width, width, height, lut,
+                                  GOVERNOR_HIST_SUBSAMPLE, d->eq_stripes, hist);
+    }
+    size_t total = 0;
+    for (int i = 0; i < LUT_BINS; ++i) total += hist[i];
+    publish_shared_lut(s, hist, total);
+    if (reuse) return;
+    current_shared_lut(s, lut);
+    neon_eq_apply(src, (size_t)width, dst, (size_t)width, width, height, lut, d->eq_stripes);
+}
+
+// Y through the CPU equalizer straight into an output frame. Chroma comes out as the
+// configured kernel writes it (kept for --kernel=nv12, neutral otherwise), so a swap
+// between backends only shows as the LUT switching to the kernel's.
+// Takes ownership of inbuf (mapped).
+static void process_frame_cpu(CustomData* d, Stream* s, GstBuffer* inbuf, GstMapInfo& in_map, uint64_t seq,
+                              GstClockTime pts, GstClockTime duration, bool skip, const SceneFrame* sf) {
+    const int width = s->video_info.width;
+    const int height = s->video_info.height;
+    const size_t y_size = (size_t)width * (size_t)height;
+    const size_t uv_size = y_size / 2;
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    GstBuffer *outbuf = output_pool_acquire(&s->host_pool, &s->video_info, y_size + uv_size);
+    GstMapInfo out_map;
+    if (!outbuf || !gst_buffer_map(outbuf, &out_map, GST_MAP_WRITE)) {
+        if (outbuf) gst_buffer_unref(outbuf);
+        gst_buffer_unmap(inbuf, &in_map);
+        gst_buffer_unref(inbuf);
+        s->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+        frame_reorder_push(&s->reorder, seq, nullptr);
+        return;
+    }
+    equalize_y_cpu(d, s, in_map.data, out_map.data, width, height, skip, sf ? sf->hist : nullptr);
+    if (d->shared_opencl.nv12) memcpy(out_map.data + y_size, in_map.data + y_size, uv_size);
+    else memset(out_map.data + y_size, 128, uv_size);
+    gst_buffer_unmap(outbuf, &out_map);
+
+    latency_meta_carry(inbuf, outbuf);   // trace stamps go with the output frame
+    attach_scene_roi(d, outbuf, sf);
+    gst_buffer_unmap(inbuf, &in_map);
+    gst_buffer_unref(inbuf);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::high_resolution_clock::now() - start_time);
+    s->ctr.total_processing_time_us.fetch_add(elapsed.count(), std::memory_order_relaxed);
+    if (!skip) s->ctr.cpu_frames.fetch_add(1, std::memory_order_relaxed);
+
+    frame_reorder_carry_timing(outbuf, pts, duration);
+    s->ctr.processed_frames.fetch_add(1, std::memory_order_relaxed);
+    s->ctr.processed_bytes .fetch_add(gst_buffer_get_size(outbuf), std::memory_order_relaxed);
+
+    latency_meta_stamp(outbuf, LATENCY_DONE);
+    guint failures = frame_reorder_push(&s->reorder, seq, outbuf);
+    if (failures) s->ctr.push_failures.fetch_add(failures, std::memory_order_relaxed);
+}
+
 /* ---------- worker thread: OpenCL FPGA histogram equalization + push ---------- */
 
 static gpointer worker_thread_fn(gpointer user_data) {
@@ -285,46 +1306,120 @@ static gpointer worker_thread_fn(gpointer user_data) {
     CustomData* d = worker_data->main_data;
     int worker_id = worker_data->worker_id;
     
-    // Initialize worker OpenCL context for this worker
+    // The OpenCL queue and kernels are set up on the first FPGA frame (ensure_worker_fpga)
     WorkerOpenCLContext* ctx = &d->worker_opencl_contexts[worker_id];
-    if (!initialize_worker_opencl_context(ctx, &d->shared_opencl, worker_id)) {
-        g_printerr("Worker %d: Failed to initialize OpenCL context, exiting\n", worker_id);
-        return nullptr;
-    }
 
     g_print("Worker %d: Started successfully\n", worker_id);
 
     while (!d->stop.load(std::memory_order_acquire)) {
-        // Pop with timeout to allow graceful exit
-        gpointer item = g_async_queue_timeout_pop(d->work_q, 50 * G_TIME_SPAN_MILLISECOND);
-        if (!item) continue;
+        // Pop with timeout to allow graceful exit; poll faster while frames are in flight
+        gint64 timeout = ctx->in_flight > 0 ? 2 * G_TIME_SPAN_MILLISECOND : 50 * G_TIME_SPAN_MILLISECOND;
+        int stream = 0;
+        GstBuffer *inbuf = stream_sched_pop(&d->sched, timeout, &stream);
+        if (!inbuf) {
+            // No new frame: don't leave finished work sitting in the pipeline
+            if (ctx->in_flight > 0) drain_frames_async(d, ctx, true);
+            continue;
+        }
 
-        GstBuffer *inbuf = (GstBuffer*)item;
+        Stream *s = &d->streams[stream];
+        latency_meta_stamp(inbuf, LATENCY_WORKER);
+        const uint64_t seq = frame_reorder_seq(inbuf);
+        const GstClockTime in_pts = GST_BUFFER_PTS(inbuf);
+        const GstClockTime in_duration = GST_BUFFER_DURATION(inbuf);
 
         try {
             // Map input buffer for reading
             GstMapInfo map_info;
             if (!gst_buffer_map(inbuf, &map_info, GST_MAP_READ)) {
                 gst_buffer_unref(inbuf);
-                d->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+                s->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+                frame_reorder_push(&s->reorder, seq, nullptr);
                 continue;
             }
 
-            if (!d->video_info_valid) {
+            if (!s->video_info_valid) {
                 gst_buffer_unmap(inbuf, &map_info);
                 gst_buffer_unref(inbuf);
+                frame_reorder_push(&s->reorder, seq, nullptr);
                 continue;
             }
 
-            int width = d->video_info.width;
-            int height = d->video_info.height;
+            int width = s->video_info.width;
+            int height = s->video_info.height;
             size_t y_size = (size_t)width * (size_t)height;
             size_t uv_size = (size_t)width * (size_t)height / 2;
 
             if (map_info.size < y_size + uv_size) {
                 gst_buffer_unmap(inbuf, &map_info);
                 gst_buffer_unref(inbuf);
-                d->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+                s->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+                frame_reorder_push(&s->reorder, seq, nullptr);
+                continue;
+            }
+
+            // Static-scene detection on a downsampled grid, which also gathers the histogram
+            const SceneFrame* sf = nullptr;
+            if (d->scene_detect) {
+                scene_change_detect(&s->scene, map_info.data, (size_t)width, width, height, seq, &ctx->scene);
+                sf = &ctx->scene;
+                s->ctr.scene_blocks_total.fetch_add(sf->total, std::memory_order_relaxed);
+                s->ctr.scene_blocks_changed.fetch_add(sf->changed, std::memory_order_relaxed);
+            }
+
+            // Governor at skip-alternate, and static frames: remapped on the CPU with the LUT
+            // the last frame published, so they never reach the device. The dual-read kernel
+            // publishes none, so on it every frame still goes to the FPGA.
+            uint8_t shed_lut[LUT_BINS];
+            const bool shed = governor_frame(&d->governor, seq);
+            const bool skip = (shed || (sf && sf->is_static)) &&
+                              (d->shared_opencl.single_read ||
+                               d->backend.load(std::memory_order_acquire) != RELAY_BACKEND_FPGA) &&
+                              current_shared_lut(s, shed_lut);
+            // Counted only once a LUT is there to remap with; otherwise the frame is processed
+            if (skip && shed) governor_skipped(&d->governor);
+            else if (skip) s->ctr.static_frames.fetch_add(1, std::memory_order_relaxed);
+
+            // The NV12 kernel always takes this path: it DMAs straight from the camera mapping
+            // into the output buffer, with no Y clone or UV copy on the CPU
+            // CPU equalizer until the FPGA is up, and while it is out of service. Frames still
+            // in flight on the device finish first; the reorder stage keeps the order.
+            if (skip || d->backend.load(std::memory_order_acquire) != RELAY_BACKEND_FPGA ||
+                !kernel_frame_aligned(&d->shared_opencl, y_size) || !ensure_worker_fpga(d, s, ctx, worker_id)) {
+                if (!skip) while (ctx->in_flight > 0) drain_frames_async(d, ctx, true);
+                process_frame_cpu(d, s, inbuf, map_info, seq, in_pts, in_duration, skip, sf);
+                continue;
+            }
+
+            // Slot buffers are sized for the largest stream; a camera that negotiated more than
+            // it asked for grows them, after the frames still using the old ones are done
+            const size_t slot_size = MAX(y_size, d->max_y_size);
+            if (ctx->buffer_size != 0 && ctx->buffer_size < slot_size) {
+                while (ctx->in_flight > 0) drain_frames_async(d, ctx, true);
+            }
+
+            if (ctx->num_slots > 1 || d->zero_copy || d->shared_opencl.nv12) {
+                if (!allocate_worker_opencl_buffers(ctx, &d->shared_opencl, slot_size)) {
+                    gst_buffer_unmap(inbuf, &map_info);
+                    gst_buffer_unref(inbuf);
+                    s->ctr.opencl_errors.fetch_add(1, std::memory_order_relaxed);
+                    frame_reorder_push(&s->reorder, seq, nullptr);
+                    continue;
+                }
+                // Slots rotate, so a busy next slot holds the oldest in-flight frame
+                PipelineSlot* slot = &ctx->slots[ctx->next_slot];
+                if (slot->busy) complete_frame_async(d, ctx, slot);
+                slot->stream = s;
+                slot->seq = seq;
+                slot->pts = in_pts;
+                slot->duration = in_duration;
+                if (submit_frame_async(d, ctx, slot, inbuf, map_info, width, height, sf)) {
+                    ctx->next_slot = (ctx->next_slot + 1) % ctx->num_slots;
+                } else {
+                    frame_reorder_push(&s->reorder, seq, nullptr);
+                }
+                // Depth 1 (zero-copy or NV12 without pipelining) completes each frame before the next
+                drain_frames_async(d, ctx, ctx->num_slots == 1);
                 continue;
             }
 
@@ -336,48 +1431,102 @@ static gpointer worker_thread_fn(gpointer user_data) {
             cv::Mat y_plane_out(height, width, CV_8UC1);
 
             // Allocate OpenCL buffers if needed
-            if (!allocate_worker_opencl_buffers(ctx, &d->shared_opencl, y_size)) {
+            if (!allocate_worker_opencl_buffers(ctx, &d->shared_opencl, slot_size)) {
                 gst_buffer_unmap(inbuf, &map_info);
                 gst_buffer_unref(inbuf);
-                d->ctr.opencl_errors.fetch_add(1, std::memory_order_relaxed);
+                s->ctr.opencl_errors.fetch_add(1, std::memory_order_relaxed);
+                frame_reorder_push(&s->reorder, seq, nullptr);
                 continue;
             }
 
-            // OpenCL FPGA Histogram Equalization
-            try {
+            // OpenCL FPGA Histogram Equalization. cl2.hpp is built without exceptions, so a
+            // failing device shows up only in the return codes.
+            PipelineSlot* slot = &ctx->slots[0];
+            int cu = acquire_compute_unit(&d->shared_opencl, ctx->home_cu);
+            cl::Kernel& kernel = ctx->cu_kernels[cu];
+            cl::Event kernel_event;
+            cl_int err = CL_SUCCESS;
+            slot->ref_event = cl::Event();
+            slot->lut_event = cl::Event();
+            slot->hist_event = cl::Event();
+            if (d->shared_opencl.single_read) {
+                uint8_t  lut[LUT_BINS];
+                uint32_t hist[LUT_BINS];
+                acquire_shared_lut(s, y_plane_in.data, y_size, lut);
+
+                kernel.setArg(0, slot->img_y_in_buffer);
+                kernel.setArg(1, slot->img_y_out_buffer);
+                kernel.setArg(2, slot->lut_buffer);
+                kernel.setArg(3, slot->hist_buffer);
+                kernel.setArg(4, height);
+                kernel.setArg(5, width);
+
+                // One Y plane DMA in; the LUT is only 256 bytes
+                err = ctx->queue.enqueueWriteBuffer(slot->img_y_in_buffer, CL_TRUE, 0, y_size, y_plane_in.data,
+                                                    nullptr, &slot->write_event);
+                if (err == CL_SUCCESS) err = ctx->queue.enqueueWriteBuffer(slot->lut_buffer, CL_TRUE, 0, sizeof(lut), lut,
+                                                                           nullptr, &slot->lut_event);
+
+                if (err == CL_SUCCESS) err = ctx->queue.enqueueTask(kernel, nullptr, &kernel_event);
+                if (err == CL_SUCCESS) err = ctx->queue.finish();
+
+                if (err == CL_SUCCESS) err = ctx->queue.enqueueReadBuffer(slot->img_y_out_buffer, CL_TRUE, 0, y_size,
+                                                                          y_plane_out.data, nullptr, &slot->read_event);
+                if (err == CL_SUCCESS) err = ctx->queue.enqueueReadBuffer(slot->hist_buffer, CL_TRUE, 0, sizeof(hist), hist,
+                                                                          nullptr, &slot->hist_event);
+                if (err == CL_SUCCESS) err = ctx->queue.finish();
+
+                if (err == CL_SUCCESS) publish_shared_lut(s, hist, y_size);
+            } else {
                 // Set kernel arguments
-                ctx->kernel.setArg(0, ctx->img_y_in_buffer);
-                ctx->kernel.setArg(1, ctx->img_y_ref_buffer);  // Using same input as reference
-                ctx->kernel.setArg(2, ctx->img_y_out_buffer);
-                ctx->kernel.setArg(3, height);
-                ctx->kernel.setArg(4, width);
-
-                // Transfer data to FPGA
-                ctx->queue.enqueueWriteBuffer(ctx->img_y_in_buffer, CL_TRUE, 0, y_size, y_plane_in.data);
-                ctx->queue.enqueueWriteBuffer(ctx->img_y_ref_buffer, CL_TRUE, 0, y_size, y_plane_in.data);
-                
+                kernel.setArg(0, slot->img_y_in_buffer);
+                kernel.setArg(1, slot->img_y_ref_buffer);  // Using same input as reference
+                kernel.setArg(2, slot->img_y_out_buffer);
+                kernel.setArg(3, height);
+                kernel.setArg(4, width);
+
+                // Transfer data to FPGA (the H2D stage counts both planes)
+                err = ctx->queue.enqueueWriteBuffer(slot->img_y_in_buffer, CL_TRUE, 0, y_size, y_plane_in.data,
+                                                    nullptr, &slot->write_event);
+                if (err == CL_SUCCESS) err = ctx->queue.enqueueWriteBuffer(slot->img_y_ref_buffer, CL_TRUE, 0, y_size,
+                                                                           y_plane_in.data, nullptr, &slot->ref_event);
+
                 // Execute kernel on FPGA
-                ctx->queue.enqueueTask(ctx->kernel);
-                ctx->queue.finish();
-                
+                if (err == CL_SUCCESS) err = ctx->queue.enqueueTask(kernel, nullptr, &kernel_event);
+                if (err == CL_SUCCESS) err = ctx->queue.finish();
+
                 // Read result back from FPGA
-                ctx->queue.enqueueReadBuffer(ctx->img_y_out_buffer, CL_TRUE, 0, y_size, y_plane_out.data);
+                if (err == CL_SUCCESS) err = ctx->queue.enqueueReadBuffer(slot->img_y_out_buffer, CL_TRUE, 0, y_size,
+                                                                          y_plane_out.data, nullptr, &slot->read_event);
+                if (err == CL_SUCCESS) err = ctx->queue.finish();
+            }
+            if (err != CL_SUCCESS) {
+                // Counted for backend_watchdog; the frame is dropped like a failed async submit
                 ctx->queue.finish();
-
-            } catch (const GError& e) {
-                g_printerr("OpenCL initialization error");
+                release_compute_unit(&d->shared_opencl, cu, nullptr);
+                gst_buffer_unmap(inbuf, &map_info);
+                gst_buffer_unref(inbuf);
+                s->ctr.opencl_errors.fetch_add(1, std::memory_order_relaxed);
+                g_printerr("OpenCL frame failed: %d\n", err);
+                frame_reorder_push(&s->reorder, seq, nullptr);
                 continue;
             }
+            release_compute_unit(&d->shared_opencl, cu, &kernel_event);
+            stage_record_sum(&s->ctr.stage_h2d, {&slot->write_event, &slot->ref_event, &slot->lut_event});
+            stage_record(&s->ctr.stage_kernel, kernel_event);
+            stage_record_sum(&s->ctr.stage_d2h, {&slot->read_event, &slot->hist_event});
+
             auto end_time = std::chrono::high_resolution_clock::now();
             auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
-            d->ctr.total_processing_time_us.fetch_add(duration.count(), std::memory_order_relaxed);
+            s->ctr.total_processing_time_us.fetch_add(duration.count(), std::memory_order_relaxed);
 
             // Create output buffer
-            GstBuffer *outbuf = gst_buffer_new_allocate(NULL, y_size + uv_size, NULL);
+            GstBuffer *outbuf = output_pool_acquire(&s->host_pool, &s->video_info, y_size + uv_size);
             if (!outbuf) {
                 gst_buffer_unmap(inbuf, &map_info);
                 gst_buffer_unref(inbuf);
-                d->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+                s->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+                frame_reorder_push(&s->reorder, seq, nullptr);
                 continue;
             }
 
@@ -393,34 +1542,37 @@ static gpointer worker_thread_fn(gpointer user_data) {
                 gst_buffer_unref(outbuf);
                 gst_buffer_unmap(inbuf, &map_info);
                 gst_buffer_unref(inbuf);
-                d->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+                s->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+                frame_reorder_push(&s->reorder, seq, nullptr);
                 continue;
             }
 
+            latency_meta_carry(inbuf, outbuf);   // trace stamps go with the output frame
+            attach_scene_roi(d, outbuf, sf);
             gst_buffer_unmap(inbuf, &map_info);
             gst_buffer_unref(inbuf); // release camera buffer
 
-            // Fresh timestamps in appsrc pipeline
-            GST_BUFFER_PTS(outbuf)      = GST_CLOCK_TIME_NONE;
-            GST_BUFFER_DTS(outbuf)      = GST_CLOCK_TIME_NONE;
-            GST_BUFFER_DURATION(outbuf) = GST_CLOCK_TIME_NONE;
+            // Capture timestamps travel with the frame (rebased by the reorder stage)
+            frame_reorder_carry_timing(outbuf, in_pts, in_duration);
 
-            d->ctr.processed_frames.fetch_add(1, std::memory_order_relaxed);
-            d->ctr.processed_bytes .fetch_add(gst_buffer_get_size(outbuf), std::memory_order_relaxed);
+            s->ctr.processed_frames.fetch_add(1, std::memory_order_relaxed);
+            s->ctr.processed_bytes .fetch_add(gst_buffer_get_size(outbuf), std::memory_order_relaxed);
 
-            GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(d->appsrc), outbuf);
-            if (ret != GST_FLOW_OK) {
-                d->ctr.push_failures.fetch_add(1, std::memory_order_relaxed);
-                gst_buffer_unref(outbuf);
-            }
+            latency_meta_stamp(outbuf, LATENCY_DONE);
+            guint failures = frame_reorder_push(&s->reorder, seq, outbuf);
+            if (failures) s->ctr.push_failures.fetch_add(failures, std::memory_order_relaxed);
 
         } catch (const std::exception& e) {
             gst_buffer_unref(inbuf);
-            d->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+            frame_reorder_push(&s->reorder, seq, nullptr);
+            s->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
             g_printerr("Worker %d: Processing error: %s\n", worker_id, e.what());
         }
     }
     
+    // Flush whatever is still in flight before tearing down
+    while (ctx->in_flight > 0) drain_frames_async(d, ctx, true);
+
     // Cleanup worker OpenCL context
     cleanup_worker_opencl_context(ctx);
     g_print("Worker %d: Exiting\n", worker_id);
@@ -430,34 +1582,42 @@ static gpointer worker_thread_fn(gpointer user_data) {
 /* ---------- periodic status ---------- */
 
 // Static variables to track previous values for rate calculation
-static uint64_t prev_cam_out = 0;
-static uint64_t prev_apps_in = 0;
-static uint64_t prev_processed = 0;
-static uint64_t prev_encoder_in = 0;
-static uint64_t prev_encoder_bytes = 0;
-
-static gboolean status_tick(gpointer user_data) {
-    auto *d = (CustomData*)user_data;
-
-    const uint64_t cam_out = d->ctr.cam_out_frames.load();
-    const uint64_t apps_in = d->ctr.appsink_in_frames.load();
-    const uint64_t processed = d->ctr.processed_frames.load();
-    const uint64_t encoder_in = d->ctr.encoder_in_frames.load();
-    const uint64_t encoder_bytes = d->ctr.encoder_in_bytes.load();
-
-    const int qlen = g_async_queue_length(d->work_q);
-    const uint64_t proc_errors = d->ctr.processing_errors.load();
-    const uint64_t opencl_errors = d->ctr.opencl_errors.load();
-    const uint64_t total_proc_time = d->ctr.total_processing_time_us.load();
+static uint64_t prev_cu_busy_ns[MAX_COMPUTE_UNITS] = {0};
+static uint64_t prev_cu_frames[MAX_COMPUTE_UNITS] = {0};
+static uint64_t prev_cam_out[MAX_STREAMS] = {0};
+static uint64_t prev_apps_in[MAX_STREAMS] = {0};
+static uint64_t prev_processed[MAX_STREAMS] = {0};
+static uint64_t prev_encoder_in[MAX_STREAMS] = {0};
+static uint64_t prev_encoder_bytes[MAX_STREAMS] = {0};
+static uint64_t prev_scene_total[MAX_STREAMS] = {0};
+static uint64_t prev_scene_changed[MAX_STREAMS] = {0};
+
+static void status_print_stream(CustomData *d, Stream *s) {
+    const int i = s->index;
+    const uint64_t cam_out = s->ctr.cam_out_frames.load();
+    const uint64_t apps_in = s->ctr.appsink_in_frames.load();
+    const uint64_t processed = s->ctr.processed_frames.load();
+    const uint64_t encoder_in = s->ctr.encoder_in_frames.load();
+    const uint64_t encoder_bytes = s->ctr.encoder_in_bytes.load();
+
+    const int qlen = (int)frame_ring_depth(&s->work_ring);
+    const uint64_t proc_errors = s->ctr.processing_errors.load();
+    const uint64_t opencl_errors = s->ctr.opencl_errors.load();
+    const uint64_t total_proc_time = s->ctr.total_processing_time_us.load();
 
     // Calculate frame rates (frames per 2 seconds, so divide by 2 for fps)
-    double camera_fps = (cam_out - prev_cam_out) / 2.0;
-    double opencv_input_fps = (apps_in - prev_apps_in) / 2.0;
-    double opencv_output_fps = (processed - prev_processed) / 2.0;
-    double encoder_input_fps = (encoder_in - prev_encoder_in) / 2.0;
+    double camera_fps = (cam_out - prev_cam_out[i]) / 2.0;
+    double opencv_input_fps = (apps_in - prev_apps_in[i]) / 2.0;
+    double opencv_output_fps = (processed - prev_processed[i]) / 2.0;
+    double encoder_input_fps = (encoder_in - prev_encoder_in[i]) / 2.0;
     
     // Calculate output bitrate (bytes per 2 seconds, convert to kbps)
-    double output_bitrate_kbps = (encoder_bytes - prev_encoder_bytes) * 8.0 / (2.0 * 1000.0);
+    double output_bitrate_kbps = (encoder_bytes - prev_encoder_bytes[i]) * 8.0 / (2.0 * 1000.0);
+    s->ctr.camera_fps.store(camera_fps, std::memory_order_relaxed);
+    s->ctr.input_fps.store(opencv_input_fps, std::memory_order_relaxed);
+    s->ctr.output_fps.store(opencv_output_fps, std::memory_order_relaxed);
+    s->ctr.encoder_fps.store(encoder_input_fps, std::memory_order_relaxed);
+    s->ctr.output_kbps.store(output_bitrate_kbps, std::memory_order_relaxed);
 
     double avg_proc_time_ms = 0.0;
     if (processed > 0) {
@@ -478,8 +1638,11 @@ static gboolean status_tick(gpointer user_data) {
         processing_status = "IDLE";
     }
 
+    if (d->num_streams > 1) {
+        g_print("\n--- Stream %d: %s %dx%d@%d -> port %d ---\n", i, s->device.c_str(), s->width, s->height,
+                s->fps, s->port);
+    }
     g_print(
-        "\n=== FRAME RATE MONITORING (every 2s) ===\n"
         "Camera Capture Rate: %6.1f fps\n"
         "OpenCV Input Rate:   %6.1f fps\n"
         "OpenCV Output Rate:  %6.1f fps\n"
@@ -487,26 +1650,255 @@ static gboolean status_tick(gpointer user_data) {
         "Output Bitrate:      %6.1f kbps\n"
         "\n"
         "Queue Length: %d | Processing Errors: %" G_GUINT64_FORMAT " | Avg Process Time: %.2f ms\n"
-        "Processing Status: %s (workers=%d, avg_frame_time=%.1fms)\n",
+        "Processing Status: %s (workers=%d, pipeline_depth=%d, avg_frame_time=%.1fms)\n",
         camera_fps,
         opencv_input_fps, 
         opencv_output_fps,
         encoder_input_fps,
         output_bitrate_kbps,
         qlen, proc_errors + opencl_errors, avg_proc_time_ms,
-        processing_status, d->num_workers, avg_proc_time_ms
+        processing_status, d->num_workers, d->pipeline_depth, avg_proc_time_ms
     );
+    g_print("Reorder (window %u): held %u | reordered %" G_GUINT64_FORMAT " | late drops %" G_GUINT64_FORMAT
+            " | gaps %" G_GUINT64_FORMAT "\n",
+            s->reorder.window, frame_reorder_held(&s->reorder), s->reorder.reordered.load(),
+            s->reorder.late_drops.load(), s->reorder.gaps.load());
+    LatencySummary h2d, k, d2h;
+    const bool have_h2d = latency_hist_drain(&s->ctr.stage_h2d.window, &h2d);
+    const bool have_k = latency_hist_drain(&s->ctr.stage_kernel.window, &k);
+    const bool have_d2h = latency_hist_drain(&s->ctr.stage_d2h.window, &d2h);
+    if (have_h2d && have_k && have_d2h) {
+        g_print("FPGA stages (avg/p99 ms): H2D %.3f/%.3f | kernel %.3f/%.3f | D2H %.3f/%.3f -> %s-bound\n",
+                h2d.avg_ms, h2d.p99_ms, k.avg_ms, k.p99_ms, d2h.avg_ms, d2h.p99_ms,
+                h2d.avg_ms + d2h.avg_ms > k.avg_ms ? "DMA" : "compute");
+    }
+    if (d->zero_copy) {
+        g_print("Zero-copy inputs: %" G_GUINT64_FORMAT " | Copied inputs: %" G_GUINT64_FORMAT " | Output pool: %s\n",
+                s->ctr.zero_copy_inputs.load(), s->ctr.copied_inputs.load(), s->out_pool ? "cl::Buffer" : "off");
+    }
+    if (!s->out_pool) {
+        g_print("Output pool (%u..%u): hits %" G_GUINT64_FORMAT " | misses %" G_GUINT64_FORMAT "\n",
+                s->host_pool.min_buffers, s->host_pool.max_buffers,
+                s->host_pool.hits.load(), s->host_pool.misses.load());
+    }
+    g_print("Frame ring (%u, drop %s): high water %" G_GUINT64_FORMAT " | dropped oldest %" G_GUINT64_FORMAT
+            " | newest %" G_GUINT64_FORMAT " | stale %" G_GUINT64_FORMAT "\n",
+            (guint)s->work_ring.capacity, frame_drop_policy_name(s->work_ring.policy), s->work_ring.high_water.load(),
+            s->work_ring.dropped_oldest.load(), s->work_ring.dropped_newest.load(), s->work_ring.dropped_stale.load());
+    if (d->temporal) {
+        g_print("Temporal LUT: updates %" G_GUINT64_FORMAT " | scene cuts %" G_GUINT64_FORMAT "\n",
+                s->tlut.updates.load(), s->tlut.scene_cuts.load());
+    }
+    if (d->scene_detect) {
+        const uint64_t total = s->ctr.scene_blocks_total.load(), changed = s->ctr.scene_blocks_changed.load();
+        const uint64_t window_total = total - prev_scene_total[i];
+        const double pct = window_total ? 100.0 * (changed - prev_scene_changed[i]) / window_total : 0.0;
+        s->ctr.changed_blocks_pct.store(pct, std::memory_order_relaxed);
+        g_print("Static scene: changed blocks %5.1f%% | static frames %" G_GUINT64_FORMAT "%s\n",
+                pct, s->ctr.static_frames.load(), d->static_roi ? " | ROI hints on" : "");
+        prev_scene_total[i] = total;
+        prev_scene_changed[i] = changed;
+    }
+    latency_trace_print(&s->latency);
 
     // Update previous values for next iteration
-    prev_cam_out = cam_out;
-    prev_apps_in = apps_in;
-    prev_processed = processed;
-    prev_encoder_in = encoder_in;
-    prev_encoder_bytes = encoder_bytes;
+    prev_cam_out[i] = cam_out;
+    prev_apps_in[i] = apps_in;
+    prev_processed[i] = processed;
+    prev_encoder_in[i] = encoder_in;
+    prev_encoder_bytes[i] = encoder_bytes;
+}
+
+// Status tick: the window's average processing time against what one frame may take.
+// The workers share every stream, so the budget is the frames they can overlap (workers,
+// times the pipeline depth on the FPGA) over the combined frame rate.
+static void governor_tick(CustomData* d) {
+    uint64_t busy_us = 0, frames = 0;
+    int fps_total = 0;
+    for (int i = 0; i < d->num_streams; ++i) {
+        busy_us += d->streams[i].ctr.total_processing_time_us.load();
+        frames += d->streams[i].ctr.processed_frames.load();
+        fps_total += d->streams[i].fps;
+    }
+    const uint64_t window_us = busy_us - d->prev_gov_busy_us, window_frames = frames - d->prev_gov_frames;
+    d->prev_gov_busy_us = busy_us;
+    d->prev_gov_frames = frames;
+    if (window_frames == 0 || fps_total <= 0) return;
+
+    const bool fpga = d->backend.load(std::memory_order_acquire) == RELAY_BACKEND_FPGA;
+    const int overlap = d->num_workers * (fpga ? d->pipeline_depth : 1);
+    governor_update(&d->governor, window_us / 1000.0 / window_frames, 1000.0 * overlap / fps_total);
+}
 
+static gboolean status_tick(gpointer user_data) {
+    auto *d = (CustomData*)user_data;
+
+    backend_watchdog(d);
+    governor_tick(d);
+
+    g_print("\n=== FRAME RATE MONITORING (every 2s) ===\n");
+    for (int i = 0; i < d->num_streams; ++i) status_print_stream(d, &d->streams[i]);
+
+    // The CUs serve every stream
+    if (d->num_streams > 1) {
+        g_print("\n--- FPGA (%d streams, %s schedule) ---\n", d->num_streams,
+                stream_sched_policy_name(d->sched.policy));
+    }
+    uint64_t cpu_frames = 0;
+    for (int i = 0; i < d->num_streams; ++i) cpu_frames += d->streams[i].ctr.cpu_frames.load();
+    g_print("Backend: %s | swaps %" G_GUINT64_FORMAT " | CPU-equalized frames %" G_GUINT64_FORMAT "\n",
+            backend_status(d), d->backend_swaps.load(), cpu_frames);
+    governor_print(&d->governor);
+    const int num_cus = d->fpga_ready.load(std::memory_order_acquire) ? d->shared_opencl.num_cus : 0;
+    for (int c = 0; c < num_cus; ++c) {
+        const ComputeUnit* cu = &d->shared_opencl.cus[c];
+        const uint64_t busy_ns = cu->busy_ns.load();
+        const uint64_t frames = cu->frames.load();
+        g_print("CU %-32s util %5.1f%% | %5.1f fps | in-flight %d | workers %d\n",
+                cu->name.c_str(), (busy_ns - prev_cu_busy_ns[c]) / 2e9 * 100.0,
+                (frames - prev_cu_frames[c]) / 2.0, cu->in_flight.load(), cu->bound_workers.load());
+        prev_cu_busy_ns[c] = busy_ns;
+        prev_cu_frames[c] = frames;
+    }
     return TRUE;
 }
 
+/* ---------- --metrics-port: Prometheus export ---------- */
+
+// One series per stream, labelled stream="N" ahead of the stage labels. With a single
+// camera the label is left out, so the series read as they did before --input. A metric's
+// series must stay together in the exposition, so each call loops over the streams.
+// Returns NULL when there is nothing to label.
+static gchar *metrics_stream_labels(CustomData *d, int i, const char *labels) {
+    if (d->num_streams <= 1) return labels ? g_strdup(labels) : NULL;
+    return labels ? g_strdup_printf("stream=\"%d\",%s", i, labels) : g_strdup_printf("stream=\"%d\"", i);
+}
+
+static void metrics_stream_counter(GString *out, CustomData *d, const char *name, const char *help,
+                                   const char *labels, std::atomic<uint64_t> Counters::*field) {
+    for (int i = 0; i < d->num_streams; ++i) {
+        const uint64_t v = (d->streams[i].ctr.*field).load(std::memory_order_relaxed);
+        gchar *l = metrics_stream_labels(d, i, labels);
+        if (l) metrics_counter_labeled(out, name, i == 0 ? help : NULL, l, v);
+        else metrics_counter(out, name, help, v);
+        g_free(l);
+    }
+}
+
+static void metrics_stream_gauge(GString *out, CustomData *d, const char *name, const char *help,
+                                 const char *labels, std::atomic<double> Counters::*field) {
+    for (int i = 0; i < d->num_streams; ++i) {
+        const double v = (d->streams[i].ctr.*field).load(std::memory_order_relaxed);
+        gchar *l = metrics_stream_labels(d, i, labels);
+        if (l) metrics_gauge_labeled(out, name, i == 0 ? help : NULL, l, v);
+        else metrics_gauge(out, name, help, v);
+        g_free(l);
+    }
+}
+
+static void metrics_stream_stage(GString *out, CustomData *d, const char *help, const char *stage,
+                                 LatencyStats Counters::*field) {
+    gchar *stage_label = g_strdup_printf("stage=\"%s\"", stage);
+    for (int i = 0; i < d->num_streams; ++i) {
+        gchar *l = metrics_stream_labels(d, i, stage_label);
+        metrics_histogram(out, "relay_fpga_stage_seconds", i == 0 ? help : NULL, l, &(d->streams[i].ctr.*field).run);
+        g_free(l);
+    }
+    g_free(stage_label);
+}
+
+static void render_metrics(GString *out, gpointer user_data) {
+    auto *d = (CustomData*)user_data;
+    metrics_stream_counter(out, d, "relay_frames_total", "Frames seen at each stage", "stage=\"camera\"", &Counters::cam_out_frames);
+    metrics_stream_counter(out, d, "relay_frames_total", NULL, "stage=\"input\"", &Counters::appsink_in_frames);
+    metrics_stream_counter(out, d, "relay_frames_total", NULL, "stage=\"enqueued\"", &Counters::enqueued_frames);
+    metrics_stream_counter(out, d, "relay_frames_total", NULL, "stage=\"output\"", &Counters::processed_frames);
+    metrics_stream_counter(out, d, "relay_frames_total", NULL, "stage=\"encoder\"", &Counters::encoder_in_frames);
+    metrics_stream_counter(out, d, "relay_bytes_total", "Bytes seen at each stage", "stage=\"camera\"", &Counters::cam_out_bytes);
+    metrics_stream_counter(out, d, "relay_bytes_total", NULL, "stage=\"encoder\"", &Counters::encoder_in_bytes);
+    metrics_stream_gauge(out, d, "relay_fps", "Frame rate over the last status interval", "stage=\"camera\"", &Counters::camera_fps);
+    metrics_stream_gauge(out, d, "relay_fps", NULL, "stage=\"input\"", &Counters::input_fps);
+    metrics_stream_gauge(out, d, "relay_fps", NULL, "stage=\"output\"", &Counters::output_fps);
+    metrics_stream_gauge(out, d, "relay_fps", NULL, "stage=\"encoder\"", &Counters::encoder_fps);
+    metrics_stream_gauge(out, d, "relay_encoder_input_kbps", "Raw bitrate into the encoder over the last status interval",
+                         NULL, &Counters::output_kbps);
+    metrics_stream_counter(out, d, "relay_processing_errors_total", "Frames the workers failed to process", NULL, &Counters::processing_errors);
+    metrics_stream_counter(out, d, "relay_opencl_errors_total", "OpenCL calls that failed", NULL, &Counters::opencl_errors);
+    metrics_stream_counter(out, d, "relay_push_failures_total", "appsrc pushes that failed", NULL, &Counters::push_failures);
+    metrics_stream_counter(out, d, "relay_input_uploads_total", "Kernel inputs read in place (zero_copy) or uploaded (copied)",
+                           "mode=\"zero_copy\"", &Counters::zero_copy_inputs);
+    metrics_stream_counter(out, d, "relay_input_uploads_total", NULL, "mode=\"copied\"", &Counters::copied_inputs);
+    metrics_stream_counter(out, d, "relay_cpu_frames_total", "Frames the CPU equalizer handled instead of the FPGA", NULL,
+                           &Counters::cpu_frames);
+    metrics_gauge(out, "relay_backend_fpga", "1 while the workers use the FPGA, 0 on the CPU equalizer",
+                  d->backend.load(std::memory_order_relaxed) == RELAY_BACKEND_FPGA ? 1.0 : 0.0);
+    metrics_counter(out, "relay_backend_swaps_total", "Switches between the CPU and FPGA backends",
+                    d->backend_swaps.load(std::memory_order_relaxed));
+    if (d->scene_detect) {
+        metrics_stream_gauge(out, d, "relay_changed_blocks_percent", "Blocks the static-scene detector saw change, last status interval",
+                             NULL, &Counters::changed_blocks_pct);
+        metrics_stream_counter(out, d, "relay_static_frames_total", "Static frames remapped with the LUT they already had", NULL,
+                               &Counters::static_frames);
+    }
+    metrics_gauge(out, "relay_governor_level", "Load-shedding level: 0 full, 1 subsample, 2 lut-reuse, 3 skip-alternate",
+                  governor_level(&d->governor));
+    metrics_counter(out, "relay_governor_skipped_frames_total", "Frames remapped with the previous LUT without analysis",
+                    d->governor.skipped.load(std::memory_order_relaxed));
+
+    metrics_stream_stage(out, d, "CL profiling START..END per frame", "h2d", &Counters::stage_h2d);
+    metrics_stream_stage(out, d, NULL, "kernel", &Counters::stage_kernel);
+    metrics_stream_stage(out, d, NULL, "d2h", &Counters::stage_d2h);
+
+    // Each metric's series must stay together in the exposition, so one pass per metric
+    const int num_cus = d->fpga_ready.load(std::memory_order_acquire) ? d->shared_opencl.num_cus : 0;
+    metrics_header(out, "relay_cu_frames_total", "counter", "Frames run on each compute unit");
+    for (int i = 0; i < num_cus; ++i) {
+        const ComputeUnit *cu = &d->shared_opencl.cus[i];
+        g_string_append_printf(out, "relay_cu_frames_total{cu=\"%s\"} %" G_GUINT64_FORMAT "\n", cu->name.c_str(),
+                               cu->frames.load(std::memory_order_relaxed));
+    }
+    metrics_header(out, "relay_cu_busy_seconds_total", "counter", "Kernel execution time on each compute unit");
+    for (int i = 0; i < num_cus; ++i) {
+        const ComputeUnit *cu = &d->shared_opencl.cus[i];
+        g_string_append_printf(out, "relay_cu_busy_seconds_total{cu=\"%s\"} %.9f\n", cu->name.c_str(),
+                               cu->busy_ns.load(std::memory_order_relaxed) / 1e9);
+    }
+    metrics_header(out, "relay_cu_in_flight", "gauge", "Frames enqueued on each compute unit");
+    for (int i = 0; i < num_cus; ++i) {
+        const ComputeUnit *cu = &d->shared_opencl.cus[i];
+        g_string_append_printf(out, "relay_cu_in_flight{cu=\"%s\"} %d\n", cu->name.c_str(),
+                               cu->in_flight.load(std::memory_order_relaxed));
+    }
+
+    // The shared stage helpers export unlabelled series, so with several cameras the ring,
+    // reorder, pool and latency detail stays in the status output
+    if (d->num_streams > 1) return;
+    Stream *s = &d->streams[0];
+    metrics_frame_ring(out, &s->work_ring);
+    metrics_reorder(out, &s->reorder);
+    if (!s->out_pool) metrics_output_pool(out, &s->host_pool);
+    if (d->temporal) {
+        metrics_counter(out, "relay_temporal_lut_updates_total", "Histograms folded into the temporal LUT", s->tlut.updates.load(std::memory_order_relaxed));
+        metrics_counter(out, "relay_temporal_lut_scene_cuts_total", "Temporal LUT resets on a scene cut", s->tlut.scene_cuts.load(std::memory_order_relaxed));
+    }
+    metrics_latency_trace(out, &s->latency);
+}
+
+/* ---------- --bench: stage counters ---------- */
+
+// Summed over the streams: the bench measures what the shared workers and CUs sustain
+static void bench_read_counters(gpointer user_data, uint64_t counts[BENCH_STAGES]) {
+    auto *d = (CustomData*)user_data;
+    for (int st = 0; st < BENCH_STAGES; ++st) counts[st] = 0;
+    for (int i = 0; i < d->num_streams; ++i) {
+        Counters &c = d->streams[i].ctr;
+        counts[BENCH_CAMERA] += c.cam_out_frames.load();
+        counts[BENCH_INPUT] += c.appsink_in_frames.load();
+        counts[BENCH_OUTPUT] += c.processed_frames.load();
+        counts[BENCH_ENCODER] += c.encoder_in_frames.load();
+    }
+}
+
 /* ---------- bus watch (quit main loop) ---------- */
 
 static gboolean bus_cb(GstBus *bus, GstMessage *msg, gpointer user_data) {
@@ -529,127 +1921,379 @@ static gboolean bus_cb(GstBus *bus, GstMessage *msg, gpointer user_data) {
     return TRUE;
 }
 
-int main(int argc, char *argv[]) {
-    setvbuf(stdout, NULL, _IONBF, 0);
-    gst_init(&argc, &argv);
-
-    gboolean use_h265 = FALSE;
-    int bitrate_kbps = 20000; // Match original default (20 Mbps)
-    int num_workers = 2; // Default to 2 workers for better FPGA utilization
-
-    int v_width = 1920, v_height = 1080, fps = 60; // defaults
-
-    // --- extend argv parsing with width/height/fps ---
-    for (int i=1;i<argc;++i){
-        if (g_str_has_prefix(argv[i],"--codec=")) { const char* v=strchr(argv[i],'='); if(v&&g_ascii_strcasecmp(v+1,"h265")==0) use_h265=TRUE; }
-        else if (g_strcmp0(argv[i],"--codec")==0 && i+1<argc){ if (g_ascii_strcasecmp(argv[i+1],"h265")==0) use_h265=TRUE; }
-        else if (g_str_has_prefix(argv[i],"--bitrate=")) { const char* v=strchr(argv[i],'='); if(v){ int b=atoi(v+1); if(b>0) bitrate_kbps=b; } }
-        else if (g_strcmp0(argv[i],"--bitrate")==0 && i+1<argc){ int b=atoi(argv[i+1]); if(b>0) bitrate_kbps=b; }
-        else if (g_str_has_prefix(argv[i],"--workers=")) { const char* v=strchr(argv[i],'='); if(v){ int w=atoi(v+1); if(w>0 && w<=8) num_workers=w; } }
-        else if (g_strcmp0(argv[i],"--workers")==0 && i+1<argc){ int w=atoi(argv[i+1]); if(w>0 && w<=8) num_workers=w; }
-        else if (g_str_has_prefix(argv[i],"--width=")) { const char* v=strchr(argv[i],'='); if(v){ int w=atoi(v+1); if(w>0) v_width=w; } }
-        else if (g_strcmp0(argv[i],"--width")==0 && i+1<argc){ int w=atoi(argv[i+1]); if(w>0) v_width=w; }
-        else if (g_str_has_prefix(argv[i],"--height=")) { const char* v=strchr(argv[i],'='); if(v){ int h=atoi(v+1); if(h>0) v_height=h; } }
-        else if (g_strcmp0(argv[i],"--height")==0 && i+1<argc){ int h=atoi(argv[i+1]); if(h>0) v_height=h; }
-        else if (g_str_has_prefix(argv[i],"--fps=")) { const char* v=strchr(argv[i],'='); if(v){ int f=atoi(v+1); if(f>0) fps=f; } }
-        else if (g_strcmp0(argv[i],"--fps")==0 && i+1<argc){ int f=atoi(argv[i+1]); if(f>0) fps=f; }
+/* ---------- --input: one capture + streaming pipeline pair per camera ---------- */
+
+// DEVICE[:WxH[@FPS]][,port=N]; whatever is left out keeps the --width/--height/--fps defaults
+static bool parse_input_spec(const char *spec, Stream *s) {
+    gchar **parts = g_strsplit(spec, ",", -1);
+    bool ok = parts[0] && parts[0][0];
+    if (ok) {
+        const char *geom = strchr(parts[0], ':');
+        s->device = geom ? std::string(parts[0], geom - parts[0]) : std::string(parts[0]);
+        if (geom) {
+            int w = 0, h = 0, f = 0;
+            const int n = sscanf(geom + 1, "%dx%d@%d", &w, &h, &f);
+            if (n >= 2 && w > 0 && h > 0) { s->width = w; s->height = h; }
+            else ok = false;
+            if (n == 3 && f > 0) s->fps = f;
+        }
     }
-    g_print("Encoder: %s, target-bitrate: %d kbps, workers: %d, %dx%d@%dfps (OpenCL FPGA Acceleration)\n",
-            use_h265 ? "H.265" : "H.264", bitrate_kbps, num_workers, v_width, v_height, fps);
-
-    CustomData d{};
-    d.work_q = g_async_queue_new();
-    d.num_workers = num_workers;
-    
-    // Initialize shared OpenCL context first
-    if (!initialize_shared_opencl_context(&d.shared_opencl)) {
-        g_printerr("Failed to initialize shared OpenCL context\n");
-        return -1;
+    for (int p = 1; ok && parts[p]; ++p) {
+        if (g_str_has_prefix(parts[p], "port=")) {
+            int port = atoi(parts[p] + 5);
+            if (port > 0 && port <= 65535) s->port = port;
+            else ok = false;
+        } else {
+            ok = false;
+        }
     }
-    
-    // Allocate worker OpenCL contexts
-    d.worker_opencl_contexts = g_new0(WorkerOpenCLContext, num_workers);
+    g_strfreev(parts);
+    return ok && !s->device.empty();
+}
+
+static int gcd_int(int a, int b) {
+    while (b) { int t = a % b; a = b; b = t; }
+    return a;
+}
 
+// Capture pipeline ending in cv_sink and streaming pipeline starting at my_src for one camera.
+// On failure nothing of the stream is left behind.
+static bool create_stream_pipelines(Stream *s, BenchRun *bench, gboolean use_h265, int bitrate_kbps, bool roi) {
     // Capture pipeline (bump queue to 8 for smoothing; add videorate dropper)
     GError *err=NULL;
+    gchar *cam_str = bench->mode != BENCH_OFF ? bench_capture_desc(bench, s->width, s->height)
+        : g_strdup_printf(
+            "v4l2src device=%s io-mode=4 ! "
+            "video/x-raw,format=NV12,width=%d,height=%d,framerate=60/1 ! "
+            "videorate drop-only=true max-rate=%d ! ",
+            s->device.c_str(), s->width, s->height, s->fps);
     gchar *sink_str = g_strdup_printf(
-        "v4l2src device=/dev/video0 io-mode=4 ! "
-        "video/x-raw,format=NV12,width=%d,height=%d,framerate=60/1 ! "
-        "videorate drop-only=true max-rate=%d ! "
+        "%s"
         "queue name=q_cam leaky=downstream max-size-buffers=8 max-size-time=0 max-size-bytes=0 ! "
         "appsink name=cv_sink emit-signals=true max-buffers=1 drop=true sync=false",
-        v_width, v_height, fps
+        cam_str
     );
+    g_free(cam_str);
     GstElement *sink_pipe = gst_parse_launch(sink_str, &err);
     g_free(sink_str);
-    if (!sink_pipe) { g_printerr("Create sink pipeline failed: %s\n", err?err->message:"?"); g_clear_error(&err); return -1; }
-    d.appsink = gst_bin_get_by_name(GST_BIN(sink_pipe), "cv_sink");
-    if (!d.appsink) { g_printerr("Failed to find appsink 'cv_sink'\n"); gst_object_unref(sink_pipe); return -1; }
+    if (!sink_pipe) { g_printerr("Stream %d: create sink pipeline failed: %s\n", s->index, err?err->message:"?"); g_clear_error(&err); return false; }
+    GstElement *appsink = gst_bin_get_by_name(GST_BIN(sink_pipe), "cv_sink");
+    if (!appsink) { g_printerr("Failed to find appsink 'cv_sink'\n"); gst_object_unref(sink_pipe); return false; }
 
     // Streaming pipeline (dynamic caps derived from CLI)
     gchar *src_str=NULL;
-    if (use_h265) {
+    gchar *net_sink = bench->mode == BENCH_ENCODE ? g_strdup(BENCH_OUTPUT_SINK)
+        : g_strdup_printf("udpsink buffer-size=60000000 host=192.168.25.69 port=%d async=false max-lateness=-1 qos-dscp=60",
+                          s->port);
+    if (bench->mode == BENCH_PROCESS) {
+        src_str = g_strdup_printf(
+            "appsrc name=my_src is-live=true format=GST_FORMAT_TIME do-timestamp=false ! "
+            "video/x-raw,format=NV12,width=%d,height=%d,framerate=%d/1 ! "
+            "queue name=q_after_src leaky=downstream max-size-buffers=2 max-size-time=0 max-size-bytes=0 ! "
+            BENCH_PROCESS_TAIL,
+            s->width, s->height, s->fps
+        );
+    } else if (use_h265) {
         src_str = g_strdup_printf(
-            "appsrc name=my_src is-live=true format=GST_FORMAT_TIME do-timestamp=true ! "
+            "appsrc name=my_src is-live=true format=GST_FORMAT_TIME do-timestamp=false ! "
             "video/x-raw,format=NV12,width=%d,height=%d,framerate=%d/1 ! "
             "queue name=q_after_src leaky=downstream max-size-buffers=2 max-size-time=0 max-size-bytes=0 ! "
             "omxh265enc name=enc num-slices=8 periodicity-idr=240 cpb-size=500 gdr-mode=horizontal "
-            "initial-delay=250 control-rate=low-latency prefetch-buffer=true target-bitrate=%d "
+            "initial-delay=250 control-rate=low-latency prefetch-buffer=true target-bitrate=%d %s"
             "gop-mode=low-delay-p ! video/x-h265,alignment=au ! "
-            "rtph265pay ! "
-            "udpsink buffer-size=60000000 host=192.168.25.69 port=5004 async=false max-lateness=-1 qos-dscp=60",
-            v_width, v_height, fps, bitrate_kbps
+            "rtph265pay name=pay ! "
+            "%s",
+            s->width, s->height, s->fps, bitrate_kbps, roi ? "qp-mode=roi " : "", net_sink
         );
     } else {
         src_str = g_strdup_printf(
-            "appsrc name=my_src is-live=true format=GST_FORMAT_TIME do-timestamp=true ! "
+            "appsrc name=my_src is-live=true format=GST_FORMAT_TIME do-timestamp=false ! "
             "video/x-raw,format=NV12,width=%d,height=%d,framerate=%d/1 ! "
             "queue name=q_after_src leaky=downstream max-size-buffers=2 max-size-time=0 max-size-bytes=0 ! "
             "omxh264enc name=enc num-slices=8 periodicity-idr=240 cpb-size=500 gdr-mode=horizontal "
-            "initial-delay=250 control-rate=low-latency prefetch-buffer=true target-bitrate=%d "
+            "initial-delay=250 control-rate=low-latency prefetch-buffer=true target-bitrate=%d %s"
             "gop-mode=low-delay-p ! video/x-h264,alignment=nal ! "
-            "rtph264pay ! "
-            "udpsink buffer-size=60000000 host=192.168.25.69 port=5004 async=false max-lateness=-1 qos-dscp=60",
-            v_width, v_height, fps, bitrate_kbps
+            "rtph264pay name=pay ! "
+            "%s",
+            s->width, s->height, s->fps, bitrate_kbps, roi ? "qp-mode=roi " : "", net_sink
         );
     }
+    g_free(net_sink);
     GstElement *src_pipe = gst_parse_launch(src_str, &err);
     g_free(src_str);
     if (!src_pipe) {
-        g_printerr("Create src pipeline failed: %s\n", err?err->message:"?");
+        g_printerr("Stream %d: create src pipeline failed: %s\n", s->index, err?err->message:"?");
         g_clear_error(&err);
+        gst_object_unref(appsink);
         gst_object_unref(sink_pipe);
-        return -1;
+        return false;
     }
-    d.appsrc = gst_bin_get_by_name(GST_BIN(src_pipe), "my_src");
-    if (!d.appsrc) {
+    GstElement *appsrc = gst_bin_get_by_name(GST_BIN(src_pipe), "my_src");
+    if (!appsrc) {
         g_printerr("Failed to find appsrc 'my_src'\n");
         gst_object_unref(src_pipe);
+        gst_object_unref(appsink);
         gst_object_unref(sink_pipe);
-        return -1;
+        return false;
     }
+    s->sink_pipe = sink_pipe;
+    s->src_pipe = src_pipe;
+    s->appsink = appsink;
+    s->appsrc = appsrc;
+    return true;
+}
 
-    // Probes: q_cam.sink, q_cam.src, appsink.sink, q_after_src.src, enc.sink
+// Probes: q_cam.sink, q_cam.src, appsink.sink, q_after_src.src, enc.sink
+static void attach_stream_probes(Stream *s) {
     {
-        GstElement *q_cam = gst_bin_get_by_name(GST_BIN(sink_pipe), "q_cam");
+        GstElement *q_cam = gst_bin_get_by_name(GST_BIN(s->sink_pipe), "q_cam");
         if (q_cam) {
-            if (GstPad *p = gst_element_get_static_pad(q_cam, "sink")) { gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, probe_cam_out, &d, NULL); gst_object_unref(p); }
-            if (GstPad *p = gst_element_get_static_pad(q_cam, "src"))  { gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, probe_qcam_out, &d, NULL); gst_object_unref(p); }
+            if (GstPad *p = gst_element_get_static_pad(q_cam, "sink")) { gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, probe_cam_out, s, NULL); gst_object_unref(p); }
+            if (GstPad *p = gst_element_get_static_pad(q_cam, "src"))  { gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, probe_qcam_out, s, NULL); gst_object_unref(p); }
             gst_object_unref(q_cam);
         }
     }
-    { if (GstPad *p = gst_element_get_static_pad(d.appsink, "sink")) { gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, probe_apps_sink, &d, NULL); gst_object_unref(p); } }
+    { if (GstPad *p = gst_element_get_static_pad(s->appsink, "sink")) { gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, probe_apps_sink, s, NULL); gst_object_unref(p); } }
     {
-        GstElement *q = gst_bin_get_by_name(GST_BIN(src_pipe), "q_after_src");
-        if (q) { if (GstPad *p = gst_element_get_static_pad(q, "src")) { gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, probe_after_appsrc_queue, &d, NULL); gst_object_unref(p); } gst_object_unref(q); }
+        GstElement *q = gst_bin_get_by_name(GST_BIN(s->src_pipe), "q_after_src");
+        if (q) { if (GstPad *p = gst_element_get_static_pad(q, "src")) { gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, probe_after_appsrc_queue, s, NULL); gst_object_unref(p); } gst_object_unref(q); }
     }
     {
-        GstElement *enc = gst_bin_get_by_name(GST_BIN(src_pipe), "enc");
-        if (enc) { if (GstPad *p = gst_element_get_static_pad(enc, "sink")) { gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, probe_encoder_sink, &d, NULL); gst_object_unref(p); } gst_object_unref(enc); }
+        GstElement *enc = gst_bin_get_by_name(GST_BIN(s->src_pipe), "enc");
+        if (enc) { if (GstPad *p = gst_element_get_static_pad(enc, "sink")) { gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, probe_encoder_sink, s, NULL); gst_object_unref(p); } gst_object_unref(enc); }
+    }
+
+    // Per-frame latency: q_cam.sink -> enc.sink -> payloader
+    latency_trace_attach(&s->latency, s->sink_pipe, s->src_pipe);
+}
+
+int main(int argc, char *argv[]) {
+    setvbuf(stdout, NULL, _IONBF, 0);
+    gst_init(&argc, &argv);
+
+    gboolean use_h265 = FALSE;
+    int bitrate_kbps = 20000; // Match original default (20 Mbps)
+    int num_workers = 2; // Default to 2 workers for better FPGA utilization
+    int reorder_window = 0; // --reorder-window=N frames held waiting for a late one (0 = auto)
+    int ring_size = 0;      // --ring-size=N frames waiting for a worker (0 = auto)
+    FrameDropPolicy drop_policy = FRAME_DROP_OLDEST; // --drop-policy=oldest|newest|max-age
+    int max_age_ms = FRAME_RING_MAX_AGE_MS_DEFAULT;  // --max-age-ms=N for --drop-policy=max-age
+    int pool_min = OUTPUT_POOL_MIN_DEFAULT; // --pool-min=N output buffers preallocated
+    int pool_max = 0;       // --pool-max=N output buffers before falling back to allocation (0 = auto)
+    gboolean single_read = TRUE; // --kernel=single (temporal LUT, one DMA) | dual (exact, two DMAs) | nv12
+    gboolean nv12 = FALSE;       // --kernel=nv12: fused kernel, full frame in/out with chroma kept
+    int pipeline_depth = 1;      // --pipeline-depth=2..3 overlaps upload, kernel and readback
+    gboolean zero_copy = FALSE;  // --zero-copy: kernel reads camera buffers, writes pool buffers
+    int max_cus = MAX_COMPUTE_UNITS;   // --cus=N
+    gboolean cu_least_loaded = TRUE;   // --cu-policy=least-loaded | bound
+    gboolean temporal = FALSE;         // --lut-mode=exact|temporal
+    double lut_alpha = TEMPORAL_LUT_ALPHA_DEFAULT;     // --lut-alpha=F EMA weight of the newest histogram
+    double scene_cut = TEMPORAL_LUT_SCENE_CUT_DEFAULT; // --scene-cut=F histogram distance forcing a fresh LUT (0 = off)
+    int metrics_port = 0;              // --metrics-port=N serve Prometheus /metrics (0 = off)
+    BenchRun bench;                    // --bench[=process|encode]: synthetic source, no camera or network
+    const char *input_specs[MAX_STREAMS] = {nullptr}; // --input=DEVICE[:WxH[@FPS]][,port=N], repeatable
+    int num_inputs = 0;
+    StreamSchedPolicy sched_policy = STREAM_SCHED_FPS; // --schedule=rr|fps across the streams
+    gboolean fpga_background = TRUE;   // --fpga-init=background (stream on the CPU meanwhile) | blocking
+    int eq_stripes = NEON_EQ_STRIPES_DEFAULT;          // --eq-stripes=N row stripes of the CPU equalizer
+    int fpga_error_limit = FPGA_ERROR_LIMIT_DEFAULT;   // --fpga-error-limit=N OpenCL errors per 2 s before falling back
+    int fpga_retry_s = FPGA_RETRY_S_DEFAULT;           // --fpga-retry=S back to the FPGA after S s on the CPU (0 = never)
+    DeadlineGovernor governor_opts;    // --governor=auto|off|subsample|lut-reuse|skip-alternate (deepest level)
+    gboolean static_detect = FALSE;    // --static-detect: static frames reuse the LUT, no histogram or device
+    gboolean static_roi = FALSE;       // --static-roi: static blocks as low-quality encoder ROI (implies --static-detect)
+    double static_threshold = SCENE_CHANGE_THRESHOLD_DEFAULT; // --static-threshold=F grey levels a block may move
+    double static_pct = SCENE_CHANGE_STATIC_PCT_DEFAULT;      // --static-pct=F changed blocks a static frame may have
+    int static_refresh = SCENE_CHANGE_REFRESH_DEFAULT;        // --static-refresh=N static frames before a full one (0 = never)
+
+    int v_width = 1920, v_height = 1080, fps = 60; // defaults
+    int kernel_clock_mhz = KERNEL_CLOCK_MHZ;        // --kernel-clock=MHz, for xclbin selection
+
+    // --- extend argv parsing with width/height/fps ---
+    for (int i=1;i<argc;++i){
+        if (g_str_has_prefix(argv[i],"--codec=")) { const char* v=strchr(argv[i],'='); if(v&&g_ascii_strcasecmp(v+1,"h265")==0) use_h265=TRUE; }
+        else if (g_strcmp0(argv[i],"--codec")==0 && i+1<argc){ if (g_ascii_strcasecmp(argv[i+1],"h265")==0) use_h265=TRUE; }
+        else if (g_str_has_prefix(argv[i],"--bitrate=")) { const char* v=strchr(argv[i],'='); if(v){ int b=atoi(v+1); if(b>0) bitrate_kbps=b; } }
+        else if (g_strcmp0(argv[i],"--bitrate")==0 && i+1<argc){ int b=atoi(argv[i+1]); if(b>0) bitrate_kbps=b; }
+        else if (g_str_has_prefix(argv[i],"--workers=")) { const char* v=strchr(argv[i],'='); if(v){ int w=atoi(v+1); if(w>0 && w<=8) num_workers=w; } }
+        else if (g_strcmp0(argv[i],"--workers")==0 && i+1<argc){ int w=atoi(argv[i+1]); if(w>0 && w<=8) num_workers=w; }
+        else if (g_str_has_prefix(argv[i],"--reorder-window=")) { const char* v=strchr(argv[i],'='); if(v){ int r=atoi(v+1); if(r>0 && r<=REORDER_WINDOW_MAX) reorder_window=r; } }
+        else if (g_strcmp0(argv[i],"--reorder-window")==0 && i+1<argc){ int r=atoi(argv[i+1]); if(r>0 && r<=REORDER_WINDOW_MAX) reorder_window=r; }
+        else if (g_str_has_prefix(argv[i],"--ring-size=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0 && n<=FRAME_RING_CAPACITY_MAX) ring_size=n; } }
+        else if (g_str_has_prefix(argv[i],"--drop-policy=")) { const char* v=strchr(argv[i],'='); if(v && !frame_drop_policy_parse(v+1, &drop_policy)) g_printerr("Unknown --drop-policy %s, using oldest\n", v+1); }
+        else if (g_str_has_prefix(argv[i],"--max-age-ms=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0) max_age_ms=n; } }
+        else if (g_str_has_prefix(argv[i],"--pool-min=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0) pool_min=n; } }
+        else if (g_strcmp0(argv[i],"--pool-min")==0 && i+1<argc){ int n=atoi(argv[i+1]); if(n>0) pool_min=n; }
+        else if (g_str_has_prefix(argv[i],"--pool-max=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0) pool_max=n; } }
+        else if (g_strcmp0(argv[i],"--pool-max")==0 && i+1<argc){ int n=atoi(argv[i+1]); if(n>0) pool_max=n; }
+        else if (g_str_has_prefix(argv[i],"--width=")) { const char* v=strchr(argv[i],'='); if(v){ int w=atoi(v+1); if(w>0) v_width=w; } }
+        else if (g_strcmp0(argv[i],"--width")==0 && i+1<argc){ int w=atoi(argv[i+1]); if(w>0) v_width=w; }
+        else if (g_str_has_prefix(argv[i],"--height=")) { const char* v=strchr(argv[i],'='); if(v){ int h=atoi(v+1); if(h>0) v_height=h; } }
+        else if (g_strcmp0(argv[i],"--height")==0 && i+1<argc){ int h=atoi(argv[i+1]); if(h>0) v_height=h; }
+        else if (g_str_has_prefix(argv[i],"--fps=")) { const char* v=strchr(argv[i],'='); if(v){ int f=atoi(v+1); if(f>0) fps=f; } }
+        else if (g_strcmp0(argv[i],"--fps")==0 && i+1<argc){ int f=atoi(argv[i+1]); if(f>0) fps=f; }
+        else if (g_str_has_prefix(argv[i],"--kernel-clock=")) { const char* v=strchr(argv[i],'='); if(v){ int c=atoi(v+1); if(c>0) kernel_clock_mhz=c; } }
+        else if (g_strcmp0(argv[i],"--kernel-clock")==0 && i+1<argc){ int c=atoi(argv[i+1]); if(c>0) kernel_clock_mhz=c; }
+        else if (g_str_has_prefix(argv[i],"--kernel=")) { const char* v=strchr(argv[i],'='); if(v&&g_ascii_strcasecmp(v+1,"dual")==0) single_read=FALSE; if(v&&g_ascii_strcasecmp(v+1,"nv12")==0) nv12=TRUE; }
+        else if (g_strcmp0(argv[i],"--kernel")==0 && i+1<argc){ if (g_ascii_strcasecmp(argv[i+1],"dual")==0) single_read=FALSE; if (g_ascii_strcasecmp(argv[i+1],"nv12")==0) nv12=TRUE; }
+        else if (g_str_has_prefix(argv[i],"--pipeline-depth=")) { const char* v=strchr(argv[i],'='); if(v){ int p=atoi(v+1); if(p>0 && p<=MAX_PIPELINE_SLOTS) pipeline_depth=p; } }
+        else if (g_strcmp0(argv[i],"--pipeline-depth")==0 && i+1<argc){ int p=atoi(argv[i+1]); if(p>0 && p<=MAX_PIPELINE_SLOTS) pipeline_depth=p; }
+        else if (g_strcmp0(argv[i],"--zero-copy")==0) zero_copy=TRUE;
+        else if (g_str_has_prefix(argv[i],"--cus=")) { const char* v=strchr(argv[i],'='); if(v){ int c=atoi(v+1); if(c>0 && c<=MAX_COMPUTE_UNITS) max_cus=c; } }
+        else if (g_strcmp0(argv[i],"--cus")==0 && i+1<argc){ int c=atoi(argv[i+1]); if(c>0 && c<=MAX_COMPUTE_UNITS) max_cus=c; }
+        else if (g_str_has_prefix(argv[i],"--cu-policy=")) { const char* v=strchr(argv[i],'='); if(v&&g_ascii_strcasecmp(v+1,"bound")==0) cu_least_loaded=FALSE; }
+        else if (g_strcmp0(argv[i],"--cu-policy")==0 && i+1<argc){ if (g_ascii_strcasecmp(argv[i+1],"bound")==0) cu_least_loaded=FALSE; }
+        else if (g_str_has_prefix(argv[i],"--lut-mode=")) { const char* v=strchr(argv[i],'='); if(v) temporal = g_ascii_strcasecmp(v+1,"temporal")==0; }
+        else if (g_strcmp0(argv[i],"--lut-mode")==0 && i+1<argc){ temporal = g_ascii_strcasecmp(argv[i+1],"temporal")==0; }
+        else if (g_str_has_prefix(argv[i],"--lut-alpha=")) { const char* v=strchr(argv[i],'='); if(v){ double a=g_ascii_strtod(v+1,NULL); if(a>0.0 && a<=1.0) lut_alpha=a; } }
+        else if (g_str_has_prefix(argv[i],"--scene-cut=")) { const char* v=strchr(argv[i],'='); if(v){ double c=g_ascii_strtod(v+1,NULL); if(c>=0.0) scene_cut=c; } }
+        else if (g_str_has_prefix(argv[i],"--metrics-port=")) { const char* v=strchr(argv[i],'='); if(v){ int p=atoi(v+1); if(p>0 && p<=65535) metrics_port=p; } }
+        else if (g_strcmp0(argv[i],"--bench")==0) bench.mode=BENCH_PROCESS;
+        else if (g_str_has_prefix(argv[i],"--bench=")) { const char* v=strchr(argv[i],'='); if(v && !bench_mode_parse(v+1, &bench.mode)) { g_printerr("Unknown --bench mode %s, using process\n", v+1); bench.mode=BENCH_PROCESS; } }
+        else if (g_str_has_prefix(argv[i],"--bench-seconds=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0) bench.seconds=n; } }
+        else if (g_str_has_prefix(argv[i],"--bench-warmup=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>=0) bench.warmup=n; } }
+        else if (g_str_has_prefix(argv[i],"--bench-fps=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0) bench.fps=n; } }
+        else if (g_str_has_prefix(argv[i],"--bench-pattern=")) { const char* v=strchr(argv[i],'='); if(v && v[1]) bench.pattern=v+1; }
+        else if (g_str_has_prefix(argv[i],"--input=")) { const char* v=strchr(argv[i],'='); if(num_inputs<MAX_STREAMS) input_specs[num_inputs++]=v+1; else g_printerr("At most %d --input, ignoring %s\n", MAX_STREAMS, v+1); }
+        else if (g_strcmp0(argv[i],"--input")==0 && i+1<argc){ if(num_inputs<MAX_STREAMS) input_specs[num_inputs++]=argv[++i]; else g_printerr("At most %d --input, ignoring %s\n", MAX_STREAMS, argv[++i]); }
+        else if (g_str_has_prefix(argv[i],"--fpga-init=")) { const char* v=strchr(argv[i],'='); if(v) fpga_background = g_ascii_strcasecmp(v+1,"blocking")!=0; }
+        else if (g_str_has_prefix(argv[i],"--eq-stripes=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0 && n<=16) eq_stripes=n; } }
+        else if (g_str_has_prefix(argv[i],"--fpga-error-limit=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>=0) fpga_error_limit=n; } }
+        else if (g_str_has_prefix(argv[i],"--fpga-retry=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>=0) fpga_retry_s=n; } }
+        else if (g_strcmp0(argv[i],"--static-detect")==0) static_detect=TRUE;
+        else if (g_strcmp0(argv[i],"--static-roi")==0) { static_detect=TRUE; static_roi=TRUE; }
+        else if (g_str_has_prefix(argv[i],"--static-threshold=")) { const char* v=strchr(argv[i],'='); if(v){ double t=g_ascii_strtod(v+1,NULL); if(t>=0.0) static_threshold=t; } }
+        else if (g_str_has_prefix(argv[i],"--static-pct=")) { const char* v=strchr(argv[i],'='); if(v){ double p=g_ascii_strtod(v+1,NULL); if(p>=0.0 && p<=100.0) static_pct=p; } }
+        else if (g_str_has_prefix(argv[i],"--static-refresh=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>=0) static_refresh=n; } }
+        else if (g_str_has_prefix(argv[i],"--governor=")) { const char* v=strchr(argv[i],'='); if(v && !governor_parse(v+1, &governor_opts)) g_printerr("Unknown --governor %s, using auto\n", v+1); }
+        else if (g_str_has_prefix(argv[i],"--schedule=")) { const char* v=strchr(argv[i],'='); if(v && !stream_sched_policy_parse(v+1, &sched_policy)) g_printerr("Unknown --schedule %s, using fps\n", v+1); }
+    }
+    g_print("Encoder: %s, target-bitrate: %d kbps, workers: %d, %dx%d@%dfps (OpenCL FPGA Acceleration)\n",
+            use_h265 ? "H.265" : "H.264", bitrate_kbps, num_workers, v_width, v_height, fps);
+    if (nv12) single_read = TRUE; // same LUT-in / histogram-out protocol as the single-read kernel
+    if (temporal && !single_read) {
+        g_print("--lut-mode=temporal needs the LUT-in kernel, switching from --kernel=dual to single\n");
+        single_read = TRUE;
+    }
+    // The kernel histograms every pixel for free, so there is no subsampling on this path
+    if (temporal) g_print("LUT mode: temporal (alpha %.2f, scene cut %.2f)\n", lut_alpha, scene_cut);
+    g_print("FPGA kernel: %s\n", nv12 ? "equalizeHist_nv12_accel (fused NV12, chroma preserved)"
+                                 : single_read ? "equalizeHist_single_accel (single read, LUT from frame N-1)"
+                                               : "equalizeHist_accel (dual read)");
+    g_print("OpenCL submission: %s (pipeline depth %d)%s\n", pipeline_depth > 1 ? "async" : "blocking", pipeline_depth,
+            zero_copy ? ", zero-copy buffers" : "");
+
+    if (static_detect) {
+        g_print("Static-scene detection: %dpx blocks, threshold %.1f grey levels, static at <= %.1f%% changed, "
+                "refresh every %d static frames%s\n", SCENE_CHANGE_BLOCK, static_threshold, static_pct, static_refresh,
+                static_roi ? ", ROI hints to the encoder" : "");
+    }
+    if (governor_opts.enabled) {
+        g_print("Governor: sheds work down to %s when frames overrun their budget\n",
+                governor_level_name(governor_opts.max_level));
+    }
+
+    if (bench.mode != BENCH_OFF) {
+        g_print("Bench: %s mode, '%s' frame offered at %d fps, %u s measured after %u s warm-up\n",
+                bench_mode_name(bench.mode), bench.pattern, bench.fps, bench.seconds, bench.warmup);
+    }
+
+    CustomData d{};
+    d.num_workers = num_workers;
+    d.shared_opencl.single_read = single_read;
+    d.shared_opencl.nv12 = nv12;
+    d.shared_opencl.max_cus = max_cus;
+    d.shared_opencl.least_loaded = cu_least_loaded;
+    d.pipeline_depth = pipeline_depth;
+    d.temporal = temporal;
+    d.zero_copy = zero_copy;
+    d.eq_stripes = eq_stripes;
+    d.fpga_error_limit = fpga_error_limit;
+    d.fpga_retry_s = fpga_retry_s;
+    d.governor.enabled = governor_opts.enabled;
+    d.scene_detect = static_detect;
+    d.static_roi = static_roi;
+    d.governor.max_level = governor_opts.max_level;
+
+    // Cameras: one per --input, or /dev/video0 at --width/--height/--fps. All of them share
+    // the one FPGA context, so the xclbin is sized for their combined pixel rate.
+    d.num_streams = num_inputs > 0 ? num_inputs : 1;
+    stream_sched_init(&d.sched, sched_policy);
+    double pixel_rate = 0.0;
+    int width_align = 0;
+    for (int i = 0; i < d.num_streams; i++) {
+        Stream *s = &d.streams[i];
+        s->index = i;
+        s->app = &d;
+        s->width = v_width;
+        s->height = v_height;
+        s->fps = fps;
+        s->port = STREAM_PORT_BASE + 2 * i;
+        if (num_inputs > 0 && !parse_input_spec(input_specs[i], s)) {
+            g_printerr("Bad --input %s, expected DEVICE[:WxH[@FPS]][,port=N]\n", input_specs[i]);
+            return -1;
+        }
+        g_mutex_init(&s->lut_mutex);
+        temporal_lut_init(&s->tlut, lut_alpha, scene_cut, 1);
+        scene_change_init(&s->scene, static_threshold, static_pct, static_refresh);
+        stream_sched_add(&d.sched, &s->work_ring, s->fps);
+        pixel_rate += (double)s->width * (double)s->height * (double)s->fps;
+        width_align = gcd_int(width_align, s->width);
+        d.max_y_size = MAX(d.max_y_size, (size_t)s->width * (size_t)s->height);
+        if (num_inputs > 0) {
+            g_print("Stream %d: %s %dx%d@%dfps -> port %d\n", i, s->device.c_str(), s->width, s->height, s->fps, s->port);
+        }
+        if (!kernel_frame_aligned(&d.shared_opencl, (size_t)s->width * (size_t)s->height)) {
+            g_printerr("Stream %d: %dx%d frames are not a whole number of %d-byte kernel words, "
+                       "equalized on the CPU\n", i, s->width, s->height, KERNEL_WORD_BYTES);
+        }
+    }
+    if (d.num_streams > 1) {
+        g_print("Scheduling %d streams over %d workers: %s\n", d.num_streams, num_workers,
+                sched_policy == STREAM_SCHED_FPS ? "weighted by fps" : "round robin");
+    }
+    
+    d.pixel_rate = pixel_rate;
+    d.width_align = width_align;
+    d.kernel_clock_mhz = kernel_clock_mhz;
+    if (!fpga_background) {
+        // Old behaviour: no pipelines until the xclbin is loaded, and no FPGA means no relay
+        if (!bring_up_fpga(&d)) {
+            g_printerr("Failed to initialize shared OpenCL context\n");
+            return -1;
+        }
+        d.backend.store(RELAY_BACKEND_FPGA);
+    }
+    if (fpga_error_limit > 0) {
+        g_print("Backend: %s, CPU fallback after %d OpenCL errors per 2 s, FPGA retry %s\n",
+                fpga_background ? "CPU equalizer until the FPGA is ready" : "FPGA", fpga_error_limit,
+                fpga_retry_s > 0 ? "after a pause" : "off");
+    } else {
+        g_print("Backend: %s, no CPU fallback\n", fpga_background ? "CPU equalizer until the FPGA is ready" : "FPGA");
     }
 
-    // Callback + workers
-    g_signal_connect(d.appsink, "new-sample", G_CALLBACK(new_sample_cb), &d);
+    // Allocate worker OpenCL contexts
+    d.worker_opencl_contexts = new WorkerOpenCLContext[num_workers];
+    for (int i = 0; i < num_workers; i++) d.worker_opencl_contexts[i].num_slots = pipeline_depth;
+
+    // Every frame in flight on any worker may finish ahead of the oldest one
+    if (reorder_window <= 0) reorder_window = MAX(REORDER_WINDOW_DEFAULT, num_workers * pipeline_depth + 1);
+    // One frame waiting per worker slot keeps them busy without building up latency
+    if (ring_size <= 0) ring_size = MAX(2, num_workers * pipeline_depth);
+    // In-flight slots, frames held for reordering and the encoder queue all hold output buffers
+    if (pool_max <= 0) pool_max = MAX(OUTPUT_POOL_MAX_DEFAULT, num_workers * pipeline_depth + reorder_window + 4);
+
+    for (int i = 0; i < d.num_streams; i++) {
+        Stream *s = &d.streams[i];
+        if (!create_stream_pipelines(s, &bench, use_h265, bitrate_kbps, d.static_roi)) return -1;
+        frame_reorder_init(&s->reorder, s->appsrc, s->sink_pipe, s->src_pipe, (guint)reorder_window);
+        frame_ring_init(&s->work_ring, (guint)ring_size, drop_policy, (guint)max_age_ms, s->sink_pipe,
+                        drop_queued_frame, s);
+        output_pool_init(&s->host_pool, (guint)pool_min, (guint)pool_max);
+        attach_stream_probes(s);
+
+        // Callback
+        g_signal_connect(s->appsink, "new-sample", G_CALLBACK(new_sample_cb), s);
+    }
 
     // Start multiple worker threads with individual data structures
     d.workers = g_new(GThread*, d.num_workers);
@@ -670,22 +2314,37 @@ int main(int argc, char *argv[]) {
 
     // GLib loop + watches + status timer
     d.loop = g_main_loop_new(NULL, FALSE);
-    GstBus *bus_sink = gst_element_get_bus(sink_pipe);
-    GstBus *bus_src  = gst_element_get_bus(src_pipe);
-    gst_bus_add_watch(bus_sink, bus_cb, &d);
-    gst_bus_add_watch(bus_src,  bus_cb, &d);
+    for (int i = 0; i < d.num_streams; i++) {
+        GstBus *bus_sink = gst_element_get_bus(d.streams[i].sink_pipe);
+        GstBus *bus_src  = gst_element_get_bus(d.streams[i].src_pipe);
+        gst_bus_add_watch(bus_sink, bus_cb, &d);
+        gst_bus_add_watch(bus_src,  bus_cb, &d);
+        gst_object_unref(bus_sink);
+        gst_object_unref(bus_src);
+    }
     g_timeout_add_seconds(2, status_tick, &d);
+    if (metrics_port > 0) metrics_server_start(&d.metrics, (guint)metrics_port, render_metrics, &d);
+    if (bench.mode != BENCH_OFF) bench_start(&bench, num_workers, bench_read_counters, &d, d.loop);
 
     // Start & run
-    gst_element_set_state(src_pipe,  GST_STATE_PLAYING);
-    gst_element_set_state(sink_pipe, GST_STATE_PLAYING);
+    for (int i = 0; i < d.num_streams; i++) {
+        gst_element_set_state(d.streams[i].src_pipe,  GST_STATE_PLAYING);
+        gst_element_set_state(d.streams[i].sink_pipe, GST_STATE_PLAYING);
+    }
+    // The pipelines are already streaming on the CPU while this loads the xclbin
+    if (fpga_background) d.fpga_init_thread = g_thread_new("fpga-init", fpga_init_thread_fn, &d);
     g_print("Huiiiiiiiiiiiii (OpenCL FPGA histogram equalization, worker-decoupled). Press Ctrl+C to exit.\n");
     g_main_loop_run(d.loop);
 
     // Shutdown
+    metrics_server_stop(&d.metrics);
+    if (d.fpga_init_thread) {
+        g_thread_join(d.fpga_init_thread);
+        d.fpga_init_thread = nullptr;
+    }
     d.stop.store(true, std::memory_order_release);
-    // Drain worker queue
-    while (GstBuffer *b = (GstBuffer*)g_async_queue_try_pop(d.work_q)) gst_buffer_unref(b);
+    // Drain worker queues
+    for (int i = 0; i < d.num_streams; i++) frame_ring_drain(&d.streams[i].work_ring);
 
     // Join all worker threads
     if (d.workers) {
@@ -702,22 +2361,36 @@ int main(int argc, char *argv[]) {
     cleanup_shared_opencl_context(&d.shared_opencl);
     
     if (d.worker_opencl_contexts) {
-        g_free(d.worker_opencl_contexts);
+        delete[] d.worker_opencl_contexts;
         d.worker_opencl_contexts = nullptr;
     }
     
     g_free(worker_datas);
 
-    if (d.work_q) { g_async_queue_unref(d.work_q); d.work_q = nullptr; }
+    for (int i = 0; i < d.num_streams; i++) {
+        Stream *s = &d.streams[i];
+        frame_ring_clear(&s->work_ring);
+        frame_reorder_clear(&s->reorder);
+        output_pool_clear(&s->host_pool);
+        temporal_lut_clear(&s->tlut);
+        scene_change_clear(&s->scene);
+        g_mutex_clear(&s->lut_mutex);
+        gst_caps_replace(&s->caps, nullptr);
+
+        gst_element_set_state(s->sink_pipe, GST_STATE_NULL);
+        gst_element_set_state(s->src_pipe,  GST_STATE_NULL);
+        if (s->out_pool) {
+            gst_buffer_pool_set_active(s->out_pool, FALSE);
+            gst_object_unref(s->out_pool);
+            s->out_pool = nullptr;
+        }
 
-    gst_element_set_state(sink_pipe, GST_STATE_NULL);
-    gst_element_set_state(src_pipe,  GST_STATE_NULL);
-    gst_object_unref(bus_sink);
-    gst_object_unref(bus_src);
-    gst_object_unref(d.appsink);
-    gst_object_unref(d.appsrc);
-    gst_object_unref(sink_pipe);
-    gst_object_unref(src_pipe);
+        gst_object_unref(s->appsink);
+        gst_object_unref(s->appsrc);
+        gst_object_unref(s->sink_pipe);
+        gst_object_unref(s->src_pipe);
+    }
+    stream_sched_clear(&d.sched);
     g_main_loop_unref(d.loop);
     return 0;
 }
\ No newline at end of file
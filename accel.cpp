@@ -6,13 +6,18 @@
 #include "common/xf_common.hpp"
 #include "common/xf_utility.hpp"
 #include "imgproc/xf_hist_equalize.hpp"
+#include "imgproc/xf_clahe.hpp"
 
 #define WIDTH_4k 3840
 #define HEIGHT_4k 2160
 #define WIDTH_2k 1920
 #define HEIGHT_2k 1080
 
+// Pixels per clock of the xf::cv kernels. The default build is krnl_hist_equalize;
+// -DNPPCX=XF_NPPC4 / -DNPPCX=XF_NPPC8 build krnl_hist_equalize_nppc4 / _nppc8.
+#ifndef NPPCX
 #define NPPCX XF_NPPC1
+#endif
 
 #define IN_TYPE XF_8UC1
 #define OUT_TYPE XF_8UC1
@@ -29,9 +34,42 @@
 #define INPUT_PTR_WIDTH 256
 #define OUTPUT_PTR_WIDTH 256
 
+// Pixels carried by one AXI word in the single-read kernel
+#define PIXELS_PER_WORD (INPUT_PTR_WIDTH / 8)
+#define LUT_BINS 256
+
+// clahe_accel: tile grid is chosen at run time up to these limits
+#define CLAHE_TILES_Y_MAX 8
+#define CLAHE_TILES_X_MAX 8
+#define CLAHE_HIST_COUNTER_BITS 24
+#define CLAHE_CLIP_COUNTER_BITS 24
+#define CLAHE_NPPCX XF_NPPC1   // kept at one pixel per clock in every build variant
+
 #endif // _XF_HIST_EQUALIZE_NV12_CONFIG_H_
 
 
+// Dual-read equalizeHist for any pixels-per-clock. At NPC pixels per clock a
+// 256-bit AXI word feeds INPUT_PTR_WIDTH / (8 * NPC) clocks of the xf::cv stream.
+template <int NPC, int ROWS, int COLS>
+static void equalize_hist_dual(ap_uint<INPUT_PTR_WIDTH>* img_y_in,
+                               ap_uint<INPUT_PTR_WIDTH>* img_y_ref,
+                               ap_uint<OUTPUT_PTR_WIDTH>* img_y_out,
+                               int rows,
+                               int cols) {
+    xf::cv::Mat<IN_TYPE, ROWS, COLS, NPC, XF_CV_DEPTH_IN_1> in_mat(rows, cols);
+    xf::cv::Mat<IN_TYPE, ROWS, COLS, NPC, XF_CV_DEPTH_IN_2> in_mat_ref(rows, cols);
+    xf::cv::Mat<OUT_TYPE, ROWS, COLS, NPC, XF_CV_DEPTH_OUT> out_mat(rows, cols);
+
+#pragma HLS DATAFLOW
+
+    xf::cv::Array2xfMat<INPUT_PTR_WIDTH, IN_TYPE, ROWS, COLS, NPC, XF_CV_DEPTH_IN_1>(img_y_in, in_mat);
+    xf::cv::Array2xfMat<INPUT_PTR_WIDTH, IN_TYPE, ROWS, COLS, NPC, XF_CV_DEPTH_IN_2>(img_y_ref, in_mat_ref);
+
+    xf::cv::equalizeHist<IN_TYPE, ROWS, COLS, NPC, XF_USE_URAM, XF_CV_DEPTH_IN_1, XF_CV_DEPTH_IN_2, XF_CV_DEPTH_OUT>(in_mat, in_mat_ref, out_mat);
+
+    xf::cv::xfMat2Array<OUTPUT_PTR_WIDTH, OUT_TYPE, ROWS, COLS, NPC, XF_CV_DEPTH_OUT>(out_mat, img_y_out);
+}
+
 extern "C" {
 void equalizeHist_accel(ap_uint<INPUT_PTR_WIDTH>* img_y_in,
                         ap_uint<INPUT_PTR_WIDTH>* img_y_ref,
@@ -46,17 +84,194 @@ void equalizeHist_accel(ap_uint<INPUT_PTR_WIDTH>* img_y_in,
 #pragma HLS INTERFACE s_axilite port=cols       
 #pragma HLS INTERFACE s_axilite port=return
 
-    xf::cv::Mat<IN_TYPE, HEIGHT_4k, WIDTH_4k, NPPCX, XF_CV_DEPTH_IN_1> in_mat(rows, cols);
-    xf::cv::Mat<IN_TYPE, HEIGHT_4k, WIDTH_4k, NPPCX, XF_CV_DEPTH_IN_2> in_mat_ref(rows, cols);
-    xf::cv::Mat<OUT_TYPE, HEIGHT_4k, WIDTH_4k, NPPCX, XF_CV_DEPTH_OUT> out_mat(rows, cols);
+    equalize_hist_dual<NPPCX, HEIGHT_4k, WIDTH_4k>(img_y_in, img_y_ref, img_y_out, rows, cols);
+}
+
+// Single-read variant: the Y plane is fetched once over gmem1. Every pixel is
+// remapped through the LUT supplied by the host (built from frame N-1) while
+// the histogram of frame N is gathered in the same pass and written to
+// hist_out, so the host can build the LUT for frame N+1.
+void equalizeHist_single_accel(ap_uint<INPUT_PTR_WIDTH>* img_y_in,
+                               ap_uint<OUTPUT_PTR_WIDTH>* img_y_out,
+                               ap_uint<8>* lut_in,
+                               ap_uint<32>* hist_out,
+                               int rows,
+                               int cols) {
+#pragma HLS INTERFACE m_axi     port=img_y_in  offset=slave bundle=gmem1
+#pragma HLS INTERFACE m_axi     port=img_y_out offset=slave bundle=gmem3
+#pragma HLS INTERFACE m_axi     port=lut_in    offset=slave bundle=gmem2 depth=256
+#pragma HLS INTERFACE m_axi     port=hist_out  offset=slave bundle=gmem2 depth=256
+
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=cols
+#pragma HLS INTERFACE s_axilite port=return
+
+    // One LUT copy and one partial histogram per pixel lane
+    ap_uint<8>  lut[PIXELS_PER_WORD][LUT_BINS];
+    ap_uint<32> hist[PIXELS_PER_WORD][LUT_BINS];
+#pragma HLS ARRAY_PARTITION variable=lut  complete dim=1
+#pragma HLS ARRAY_PARTITION variable=hist complete dim=1
+
+load_lut:
+    for (int i = 0; i < LUT_BINS; i++) {
+#pragma HLS PIPELINE II=1
+        ap_uint<8> v = lut_in[i];
+        for (int p = 0; p < PIXELS_PER_WORD; p++) {
+#pragma HLS UNROLL
+            lut[p][i]  = v;
+            hist[p][i] = 0;
+        }
+    }
+
+    const int total = rows * cols;
+    const int words = (total + PIXELS_PER_WORD - 1) / PIXELS_PER_WORD;
+
+remap:
+    for (int w = 0; w < words; w++) {
+#pragma HLS PIPELINE
+#pragma HLS LOOP_TRIPCOUNT min=1 max=HEIGHT_4k*WIDTH_4k/PIXELS_PER_WORD
+        ap_uint<INPUT_PTR_WIDTH>  in  = img_y_in[w];
+        ap_uint<OUTPUT_PTR_WIDTH> out = 0;
+        for (int p = 0; p < PIXELS_PER_WORD; p++) {
+#pragma HLS UNROLL
+            ap_uint<8> px = in.range(p * 8 + 7, p * 8);
+            out.range(p * 8 + 7, p * 8) = lut[p][px];
+            if (w * PIXELS_PER_WORD + p < total) hist[p][px]++;
+        }
+        img_y_out[w] = out;
+    }
+
+merge_hist:
+    for (int i = 0; i < LUT_BINS; i++) {
+#pragma HLS PIPELINE II=1
+        ap_uint<32> sum = 0;
+        for (int p = 0; p < PIXELS_PER_WORD; p++) {
+#pragma HLS UNROLL
+            sum += hist[p][i];
+        }
+        hist_out[i] = sum;
+    }
+}
+
+// Fused NV12 variant: the whole NV12 frame is read once over gmem1 and the
+// whole output frame is written over gmem3. Bytes of the Y plane are remapped
+// through the host LUT while their histogram is gathered, exactly as in the
+// single-read kernel; the interleaved UV plane is passed through unchanged, so
+// the host does one DMA each way and never touches chroma.
+void equalizeHist_nv12_accel(ap_uint<INPUT_PTR_WIDTH>* img_nv12_in,
+                             ap_uint<OUTPUT_PTR_WIDTH>* img_nv12_out,
+                             ap_uint<8>* lut_in,
+                             ap_uint<32>* hist_out,
+                             int rows,
+                             int cols) {
+#pragma HLS INTERFACE m_axi     port=img_nv12_in  offset=slave bundle=gmem1
+#pragma HLS INTERFACE m_axi     port=img_nv12_out offset=slave bundle=gmem3
+#pragma HLS INTERFACE m_axi     port=lut_in       offset=slave bundle=gmem2 depth=256
+#pragma HLS INTERFACE m_axi     port=hist_out     offset=slave bundle=gmem2 depth=256
+
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=cols
+#pragma HLS INTERFACE s_axilite port=return
+
+    ap_uint<8>  lut[PIXELS_PER_WORD][LUT_BINS];
+    ap_uint<32> hist[PIXELS_PER_WORD][LUT_BINS];
+#pragma HLS ARRAY_PARTITION variable=lut  complete dim=1
+#pragma HLS ARRAY_PARTITION variable=hist complete dim=1
+
+load_lut:
+    for (int i = 0; i < LUT_BINS; i++) {
+#pragma HLS PIPELINE II=1
+        ap_uint<8> v = lut_in[i];
+        for (int p = 0; p < PIXELS_PER_WORD; p++) {
+#pragma HLS UNROLL
+            lut[p][i]  = v;
+            hist[p][i] = 0;
+        }
+    }
+
+    // Y plane is rows*cols bytes, the UV plane another half of that
+    const int y_total = rows * cols;
+    const int total = y_total + y_total / 2;
+    const int words = (total + PIXELS_PER_WORD - 1) / PIXELS_PER_WORD;
+
+remap_copy:
+    for (int w = 0; w < words; w++) {
+#pragma HLS PIPELINE
+#pragma HLS LOOP_TRIPCOUNT min=1 max=HEIGHT_4k*WIDTH_4k*3/2/PIXELS_PER_WORD
+        ap_uint<INPUT_PTR_WIDTH>  in  = img_nv12_in[w];
+        ap_uint<OUTPUT_PTR_WIDTH> out = 0;
+        for (int p = 0; p < PIXELS_PER_WORD; p++) {
+#pragma HLS UNROLL
+            // A word may straddle the Y/UV boundary when rows*cols is not word aligned
+            const bool is_y = w * PIXELS_PER_WORD + p < y_total;
+            ap_uint<8> px = in.range(p * 8 + 7, p * 8);
+            out.range(p * 8 + 7, p * 8) = is_y ? lut[p][px] : px;
+            if (is_y) hist[p][px]++;
+        }
+        img_nv12_out[w] = out;
+    }
+
+merge_hist:
+    for (int i = 0; i < LUT_BINS; i++) {
+#pragma HLS PIPELINE II=1
+        ap_uint<32> sum = 0;
+        for (int p = 0; p < PIXELS_PER_WORD; p++) {
+#pragma HLS UNROLL
+            sum += hist[p][i];
+        }
+        hist_out[i] = sum;
+    }
+}
+
+// CLAHE on the Y plane. The tile grid and the clip limit are run-time
+// arguments; clip is the absolute per-tile bin limit (clipLimit * tile pixels /
+// 256, as cv::CLAHE computes it). xf::cv builds the tile LUTs while the frame
+// streams through and applies the ones built from the previous frame, so the
+// two LUT sets are swapped on every call.
+void clahe_accel(ap_uint<INPUT_PTR_WIDTH>* img_y_in,
+                 ap_uint<OUTPUT_PTR_WIDTH>* img_y_out,
+                 int rows,
+                 int cols,
+                 int clip,
+                 int tiles_y,
+                 int tiles_x) {
+#pragma HLS INTERFACE m_axi     port=img_y_in  offset=slave bundle=gmem1
+#pragma HLS INTERFACE m_axi     port=img_y_out offset=slave bundle=gmem3
+
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=cols
+#pragma HLS INTERFACE s_axilite port=clip
+#pragma HLS INTERFACE s_axilite port=tiles_y
+#pragma HLS INTERFACE s_axilite port=tiles_x
+#pragma HLS INTERFACE s_axilite port=return
+
+    xf::cv::Mat<IN_TYPE, HEIGHT_4k, WIDTH_4k, CLAHE_NPPCX, XF_CV_DEPTH_IN_1> in_mat(rows, cols);
+    xf::cv::Mat<OUT_TYPE, HEIGHT_4k, WIDTH_4k, CLAHE_NPPCX, XF_CV_DEPTH_OUT> out_mat(rows, cols);
+
+    static ap_uint<CLAHE_HIST_COUNTER_BITS>
+        lut_a[CLAHE_TILES_Y_MAX][CLAHE_TILES_X_MAX][(XF_NPIXPERCYCLE(CLAHE_NPPCX) << 1)][1 << XF_DTPIXELDEPTH(IN_TYPE, CLAHE_NPPCX)];
+    static ap_uint<CLAHE_HIST_COUNTER_BITS>
+        lut_b[CLAHE_TILES_Y_MAX][CLAHE_TILES_X_MAX][(XF_NPIXPERCYCLE(CLAHE_NPPCX) << 1)][1 << XF_DTPIXELDEPTH(IN_TYPE, CLAHE_NPPCX)];
+#pragma HLS ARRAY_PARTITION variable=lut_a complete dim=3
+#pragma HLS ARRAY_PARTITION variable=lut_b complete dim=3
+    static ap_uint<CLAHE_CLIP_COUNTER_BITS> clip_counter[CLAHE_TILES_Y_MAX][CLAHE_TILES_X_MAX];
+    static bool swap = false;
+
+    xf::cv::clahe::CLAHEImpl<IN_TYPE, CLAHE_HIST_COUNTER_BITS, CLAHE_CLIP_COUNTER_BITS, HEIGHT_4k, WIDTH_4k, CLAHE_NPPCX,
+                             CLAHE_TILES_Y_MAX, CLAHE_TILES_X_MAX, XF_CV_DEPTH_IN_1, XF_CV_DEPTH_OUT> clahe;
 
 #pragma HLS DATAFLOW
 
-    xf::cv::Array2xfMat<INPUT_PTR_WIDTH, IN_TYPE, HEIGHT_4k, WIDTH_4k, NPPCX, XF_CV_DEPTH_IN_1>(img_y_in, in_mat);
-    xf::cv::Array2xfMat<INPUT_PTR_WIDTH, IN_TYPE, HEIGHT_4k, WIDTH_4k, NPPCX, XF_CV_DEPTH_IN_2>(img_y_ref, in_mat_ref);
+    xf::cv::Array2xfMat<INPUT_PTR_WIDTH, IN_TYPE, HEIGHT_4k, WIDTH_4k, CLAHE_NPPCX, XF_CV_DEPTH_IN_1>(img_y_in, in_mat);
 
-    xf::cv::equalizeHist<IN_TYPE, HEIGHT_4k, WIDTH_4k, NPPCX, XF_USE_URAM, XF_CV_DEPTH_IN_1, XF_CV_DEPTH_IN_2, XF_CV_DEPTH_OUT>(in_mat, in_mat_ref, out_mat);
+    if (!swap) {
+        clahe.process(in_mat, out_mat, lut_a, lut_b, clip_counter, rows, cols, clip, tiles_y, tiles_x);
+        swap = true;
+    } else {
+        clahe.process(in_mat, out_mat, lut_b, lut_a, clip_counter, rows, cols, clip, tiles_y, tiles_x);
+        swap = false;
+    }
 
-    xf::cv::xfMat2Array<OUTPUT_PTR_WIDTH, OUT_TYPE, HEIGHT_4k, WIDTH_4k, NPPCX, XF_CV_DEPTH_OUT>(out_mat, img_y_out);
+    xf::cv::xfMat2Array<OUTPUT_PTR_WIDTH, OUT_TYPE, HEIGHT_4k, WIDTH_4k, CLAHE_NPPCX, XF_CV_DEPTH_OUT>(out_mat, img_y_out);
 }
 }
@@ -0,0 +1,137 @@
+// bench_mode.hpp
+// --bench: run a relay without the camera or the network to find its throughput ceiling.
+//
+// The capture side becomes a single videotestsrc frame repeated by a live imagefreeze
+// (the same NV12 memory every time, so nothing is rendered per frame) at --bench-fps,
+// an offered load well above the camera's. Stages that can't keep up shed frames
+// through the usual leaky queues and ring policy, so each stage's rate is the most it
+// sustains. An unpaced source would instead spin a core or two on frames that are
+// dropped straight away, which skews exactly the worker scaling being measured.
+// The output side depends on the mode:
+//   process  appsrc -> identity (enc) -> identity (pay) -> fakesink: the processing ceiling
+//   encode   the real encoder and payloader into fakesink, no udpsink pacing
+// After --bench-warmup seconds the stage counters are sampled; --bench-seconds later
+// the sustained rate of each stage is printed as one "BENCH ..." line and the relay
+// quits. bench_sweep.sh runs a relay once per --workers count and collects the lines.
+
+#ifndef BENCH_MODE_HPP
+#define BENCH_MODE_HPP
+
+#include <gst/gst.h>
+#include <glib.h>
+#include <stdint.h>
+
+#define BENCH_SECONDS_DEFAULT 10
+#define BENCH_WARMUP_DEFAULT 3
+#define BENCH_FPS_DEFAULT 240
+#define BENCH_PATTERN_DEFAULT "smpte"
+#define BENCH_LIMIT_RATIO 0.95   // a stage below this share of the one before it is the bottleneck
+
+// Stands in for udpsink; the identities keep the enc/pay probe points in place
+#define BENCH_OUTPUT_SINK "fakesink sync=false async=false"
+#define BENCH_PROCESS_TAIL "identity name=enc silent=true ! identity name=pay silent=true ! " BENCH_OUTPUT_SINK
+
+enum BenchMode {
+    BENCH_OFF,
+    BENCH_PROCESS,
+    BENCH_ENCODE,
+};
+
+enum BenchStage {
+    BENCH_CAMERA,    // frames out of the source
+    BENCH_INPUT,     // frames reaching new_sample_cb
+    BENCH_OUTPUT,    // frames the workers processed
+    BENCH_ENCODER,   // frames reaching enc.sink
+    BENCH_STAGES
+};
+
+static const char *const bench_stage_names[BENCH_STAGES] = {"camera", "input", "output", "encoder"};
+
+typedef void (*BenchReadFn)(gpointer user_data, uint64_t counts[BENCH_STAGES]);
+
+struct BenchRun {
+    BenchMode   mode{BENCH_OFF};
+    guint       seconds{BENCH_SECONDS_DEFAULT};
+    guint       warmup{BENCH_WARMUP_DEFAULT};
+    int         fps{BENCH_FPS_DEFAULT};           // offered frame rate
+    const char *pattern{BENCH_PATTERN_DEFAULT};   // videotestsrc pattern
+    int         workers{0};                       // reported only
+    int         width{0}, height{0};
+
+    BenchReadFn read{nullptr};
+    gpointer    read_data{nullptr};
+    GMainLoop  *loop{nullptr};
+    uint64_t    base[BENCH_STAGES]{};
+    gint64      start_us{0};
+};
+
+static inline const char *bench_mode_name(BenchMode m) {
+    return m == BENCH_ENCODE ? "encode" : m == BENCH_PROCESS ? "process" : "off";
+}
+
+// "--bench" alone means process
+static inline bool bench_mode_parse(const char *s, BenchMode *m) {
+    if (!s || !*s || g_ascii_strcasecmp(s, "process") == 0) *m = BENCH_PROCESS;
+    else if (g_ascii_strcasecmp(s, "encode") == 0) *m = BENCH_ENCODE;
+    else return false;
+    return true;
+}
+
+// Capture pipeline up to (not including) q_cam, in place of v4l2src ! caps ! videorate.
+// The videorate stays for the camera-rate probe; it passes every frame.
+static inline gchar *bench_capture_desc(BenchRun *b, int width, int height) {
+    b->width = width;
+    b->height = height;
+    return g_strdup_printf(
+        "videotestsrc num-buffers=1 pattern=%s ! "
+        "video/x-raw,format=NV12,width=%d,height=%d,framerate=%d/1 ! "
+        "imagefreeze is-live=true ! videorate drop-only=true ! ",
+        b->pattern, width, height, b->fps);
+}
+
+static inline gboolean bench_finish_cb(gpointer user_data) {
+    auto *b = (BenchRun*)user_data;
+    uint64_t now[BENCH_STAGES];
+    b->read(b->read_data, now);
+    const double secs = (g_get_monotonic_time() - b->start_us) / 1e6;
+    double fps[BENCH_STAGES];
+    for (int s = 0; s < BENCH_STAGES; ++s) fps[s] = secs > 0.0 ? (now[s] - b->base[s]) / secs : 0.0;
+
+    // The first stage that falls behind the one feeding it; the source itself otherwise
+    const char *limit = bench_stage_names[BENCH_CAMERA];
+    for (int s = BENCH_INPUT; s < BENCH_STAGES; ++s) {
+        if (fps[s] < fps[s - 1] * BENCH_LIMIT_RATIO) {
+            limit = bench_stage_names[s];
+            break;
+        }
+    }
+    const char *name = g_get_prgname();
+    g_print("BENCH relay=%s mode=%s workers=%d size=%dx%d offered_fps=%d seconds=%.1f", name ? name : "relay",
+            bench_mode_name(b->mode), b->workers, b->width, b->height, b->fps, secs);
+    for (int s = 0; s < BENCH_STAGES; ++s) g_print(" %s_fps=%.1f", bench_stage_names[s], fps[s]);
+    g_print(" limit=%s\n", limit);
+
+    if (b->loop) g_main_loop_quit(b->loop);
+    return FALSE;
+}
+
+static inline gboolean bench_begin_cb(gpointer user_data) {
+    auto *b = (BenchRun*)user_data;
+    b->read(b->read_data, b->base);
+    b->start_us = g_get_monotonic_time();
+    g_print("Bench: warm-up done, measuring for %u s\n", b->seconds);
+    g_timeout_add_seconds(b->seconds, bench_finish_cb, b);
+    return FALSE;
+}
+
+// Call once the main loop exists; read() samples the relay's stage counters
+static inline void bench_start(BenchRun *b, int workers, BenchReadFn read, gpointer data, GMainLoop *loop) {
+    b->workers = workers;
+    b->read = read;
+    b->read_data = data;
+    b->loop = loop;
+    if (b->warmup > 0) g_timeout_add_seconds(b->warmup, bench_begin_cb, b);
+    else bench_begin_cb(b);
+}
+
+#endif // BENCH_MODE_HPP
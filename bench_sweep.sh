@@ -0,0 +1,33 @@
+#!/bin/sh
+# Sustained per-stage fps of a relay for each --workers count, without camera or network.
+#
+# Usage: ./bench_sweep.sh <relay binary> [workers ...] [-- relay options]
+#   ./bench_sweep.sh ./improvement 1 2 3 4 -- --bench=encode --eq-backend=neon
+#   ./bench_sweep.sh ./relay_debug_worker_opencl_fpga 1 2 4 -- --pipeline-depth=2 --width=3840 --height=2160
+#
+# Each count runs in a fresh process (--bench, default process mode, unless the options
+# pick one) and prints that run's BENCH line.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <relay binary> [workers ...] [-- relay options]" >&2
+    exit 1
+fi
+relay=$1
+shift
+
+counts=""
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+    counts="$counts $1"
+    shift
+done
+[ "$1" = "--" ] && shift
+[ -z "$counts" ] && counts="1 2 3 4"
+
+case " $* " in
+    *" --bench "*|*" --bench="*) ;;
+    *) set -- --bench "$@" ;;
+esac
+
+for n in $counts; do
+    "$relay" --workers="$n" "$@" 2>&1 | grep '^BENCH '
+done
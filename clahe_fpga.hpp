@@ -0,0 +1,176 @@
+// clahe_fpga.hpp
+// clahe_accel host side for the CLAHE tools (--backend=fpga), shared by clahevideo and
+// CLAHECompare; yenhance and 1frameMeasure, which keep their own OpenCL setup, use the
+// clip and run helpers. Include after the CL_HPP_* configuration macros, as the tools do.
+// Plain stdio, so the GStreamer-free benchmark can include it too.
+//
+// Same context split as OpenCLequalHist.cpp: one program load, one queue/kernel per
+// worker. The CLAHE tools run a single worker in the appsink callback.
+//
+// xf::cv CLAHE builds the tile LUTs while a frame streams through and remaps it with
+// the LUTs the previous call built; clahe_accel keeps both sets in static memory and
+// swaps them every call. The first call after start-up (or a size change) would apply
+// whatever the LUT memory holds, so it runs the kernel twice on that frame: once to
+// build its LUTs, once to apply them. Later frames are remapped with the LUTs of the
+// frame before them, which is the one-frame lag the kernel is designed around.
+
+#ifndef CLAHE_FPGA_HPP
+#define CLAHE_FPGA_HPP
+
+#include <opencv2/core.hpp>
+#include <CL/cl2.hpp>
+#include "xcl2.hpp"
+#include <algorithm>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// clahe_accel limits, must match accel.cpp
+#define CLAHE_TILES_MAX 8
+#define CLAHE_HIST_BINS 256
+#define CLAHE_FPGA_MAX_WIDTH 3840    // WIDTH_4k
+#define CLAHE_FPGA_MAX_HEIGHT 2160   // HEIGHT_4k
+
+struct SharedOpenCLContext {
+    cl::Context context;
+    cl::Device device;
+    cl::Program program;
+    bool initialized{false};
+};
+
+struct WorkerOpenCLContext {
+    cl::CommandQueue queue;
+    cl::Kernel kernel;
+    cl::Buffer img_y_in_buffer;
+    cl::Buffer img_y_out_buffer;
+    size_t buffer_size{0};
+    bool primed{false};          // the kernel's LUT memory holds LUTs of this frame size
+    bool initialized{false};
+};
+
+static inline bool initialize_shared_opencl_context(SharedOpenCLContext* shared_ctx) {
+    std::vector<cl::Device> devices = xcl::get_xil_devices();
+    if (devices.empty()) {
+        fprintf(stderr, "No Xilinx FPGA devices found\n");
+        return false;
+    }
+
+    shared_ctx->device = devices[0];
+    shared_ctx->context = cl::Context(shared_ctx->device);
+
+    // clahe_accel is linked into the same xclbin as equalizeHist_accel
+    std::string device_name = shared_ctx->device.getInfo<CL_DEVICE_NAME>();
+    std::string binaryFile = xcl::find_binary_file(device_name, "krnl_hist_equalize");
+    cl::Program::Binaries bins = xcl::import_binary_file(binaryFile);
+
+    std::vector<cl::Device> prog_devices = {shared_ctx->device};
+    cl_int err = CL_SUCCESS;
+    shared_ctx->program = cl::Program(shared_ctx->context, prog_devices, bins, nullptr, &err);
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "Failed to program FPGA: %d\n", err);
+        return false;
+    }
+
+    shared_ctx->initialized = true;
+    printf("Shared OpenCL FPGA context initialized successfully\n");
+    return true;
+}
+
+static inline bool initialize_worker_opencl_context(WorkerOpenCLContext* ctx, SharedOpenCLContext* shared_ctx) {
+    cl_int err = CL_SUCCESS;
+    ctx->queue = cl::CommandQueue(shared_ctx->context, shared_ctx->device, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (err == CL_SUCCESS) ctx->kernel = cl::Kernel(shared_ctx->program, "clahe_accel", &err);
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "Failed to create clahe_accel kernel: %d\n", err);
+        return false;
+    }
+    ctx->primed = false;
+    ctx->initialized = true;
+    return true;
+}
+
+static inline void cleanup_worker_opencl_context(WorkerOpenCLContext* ctx) {
+    // OpenCL objects are automatically cleaned up by destructors
+    ctx->primed = false;
+    ctx->initialized = false;
+}
+
+static inline void cleanup_shared_opencl_context(SharedOpenCLContext* ctx) {
+    ctx->initialized = false;
+}
+
+static inline bool allocate_worker_opencl_buffers(WorkerOpenCLContext* ctx, SharedOpenCLContext* shared_ctx, size_t y_size) {
+    if (ctx->buffer_size == y_size && ctx->img_y_in_buffer() != nullptr) {
+        return true; // Buffers already allocated for this size
+    }
+    cl_int err = CL_SUCCESS;
+    ctx->img_y_in_buffer = cl::Buffer(shared_ctx->context, CL_MEM_READ_ONLY, y_size, nullptr, &err);
+    if (err == CL_SUCCESS) ctx->img_y_out_buffer = cl::Buffer(shared_ctx->context, CL_MEM_WRITE_ONLY, y_size, nullptr, &err);
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "Failed to allocate OpenCL buffers: %d\n", err);
+        return false;
+    }
+    ctx->buffer_size = y_size;
+    ctx->primed = false;     // new size, the LUTs in the kernel are for another grid
+    return true;
+}
+
+// True when clahe_accel can take a width x height plane
+static inline bool clahe_fpga_fits(int width, int height) {
+    return width > 0 && height > 0 && width <= CLAHE_FPGA_MAX_WIDTH && height <= CLAHE_FPGA_MAX_HEIGHT;
+}
+
+// clahe_accel's clip argument: the absolute per-tile bin limit, scaled from clipLimit
+// the way cv::CLAHE does
+static inline int clahe_fpga_clip(double clip_limit, int width, int height, int tile_grid) {
+    const int tile_w = (width + tile_grid - 1) / tile_grid;
+    const int tile_h = (height + tile_grid - 1) / tile_grid;
+    return std::max((int)(clip_limit * tile_w * tile_h / CLAHE_HIST_BINS), 1);
+}
+
+static inline void clahe_fpga_set_args(cl::Kernel &kernel, const cl::Buffer &in, const cl::Buffer &out,
+                                       int width, int height, double clip_limit, int tile_grid) {
+    kernel.setArg(0, in);
+    kernel.setArg(1, out);
+    kernel.setArg(2, height);
+    kernel.setArg(3, width);
+    kernel.setArg(4, clahe_fpga_clip(clip_limit, width, height, tile_grid));
+    kernel.setArg(5, tile_grid);
+    kernel.setArg(6, tile_grid);
+}
+
+// One blocking write/run/read on an in-order queue, kernel arguments already set. Runs
+// the kernel a second time first unless *primed, then marks it primed on success.
+static inline cl_int clahe_fpga_run(cl::CommandQueue &queue, cl::Kernel &kernel, const cl::Buffer &in,
+                                    const cl::Buffer &out, const void *y_in, void *y_out, size_t y_size,
+                                    bool *primed) {
+    cl_int err = queue.enqueueWriteBuffer(in, CL_FALSE, 0, y_size, y_in);
+    if (err == CL_SUCCESS && !*primed) err = queue.enqueueTask(kernel);   // builds this frame's LUTs
+    if (err == CL_SUCCESS) err = queue.enqueueTask(kernel);
+    if (err == CL_SUCCESS) err = queue.enqueueReadBuffer(out, CL_TRUE, 0, y_size, y_out);
+    *primed = err == CL_SUCCESS;
+    return err;
+}
+
+// y_in must be contiguous (the full-width Y rows of an NV12 frame are). Returns false
+// when the frame can't go to the kernel or an OpenCL call failed; the caller falls back
+// to the CPU.
+static inline bool fpga_clahe_apply(SharedOpenCLContext* shared_ctx, WorkerOpenCLContext* ctx,
+                                    const cv::Mat &y_in, cv::Mat &y_out, double clip_limit, int tile_grid) {
+    const int width = y_in.cols;
+    const int height = y_in.rows;
+    if (!clahe_fpga_fits(width, height)) return false;
+    const size_t y_size = (size_t)width * (size_t)height;
+    if (!allocate_worker_opencl_buffers(ctx, shared_ctx, y_size)) return false;
+
+    clahe_fpga_set_args(ctx->kernel, ctx->img_y_in_buffer, ctx->img_y_out_buffer, width, height, clip_limit, tile_grid);
+    cl_int err = clahe_fpga_run(ctx->queue, ctx->kernel, ctx->img_y_in_buffer, ctx->img_y_out_buffer,
+                                y_in.data, y_out.data, y_size, &ctx->primed);
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "OpenCL CLAHE failed: %d\n", err);
+        return false;
+    }
+    return true;
+}
+
+#endif // CLAHE_FPGA_HPP
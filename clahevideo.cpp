@@ -10,7 +10,20 @@
 #include <stdio.h>
 #include <chrono>
 #include <vector>
-#include <numeric>
+
+// OpenCL includes (--backend=fpga)
+#define CL_HPP_CL_1_2_DEFAULT_BUILD
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#define CL_HPP_ENABLE_PROGRAM_CONSTRUCTION_FROM_ARRAY_COMPATIBILITY 1
+#include <CL/cl2.hpp>
+#include "xcl2.hpp"
+
+#include "output_pool.hpp"
+#include "video_clahe.hpp"
+#include "latency_hist.hpp"
+#include "deadline_governor.hpp"
+#include "clahe_fpga.hpp"
 
 typedef struct {
     GstElement *appsrc;
@@ -33,14 +46,28 @@ typedef struct {
     double clip_limit;           // e.g., 2.0
     int    tile_grid;            // e.g., 8 means (8x8)
     cv::Ptr<cv::CLAHE> clahe;    // created once and reused
+    gboolean video_clahe;        // --clahe-engine=video: per-tile LUT cache across frames
+    VideoClahe vclahe;
+
+    // === --backend=fpga ===
+    gboolean use_fpga;
+    SharedOpenCLContext fpga_shared;
+    WorkerOpenCLContext fpga_worker;
+
+    OutputPool out_pool;         // preallocated NV12 buffers handed to appsrc
+
+    // === --governor: shed CLAHE work when frames overrun 1/fps (CPU only) ===
+    DeadlineGovernor governor;
+    double gov_window_ms;        // frame time summed since the last governor update
+    int    gov_window_frames;
 
     // === Enhanced timing measurements ===
-    std::vector<double> clahe_times;      // Pure CLAHE processing times
-    std::vector<double> total_frame_times; // Total frame processing times
-    std::vector<double> memory_copy_times; // Memory operations timing
+    LatencyStats clahe_times;             // Pure CLAHE processing times
+    LatencyStats total_frame_times;       // Total frame processing times
+    LatencyStats memory_copy_times;       // Memory operations timing
     double total_clahe_time;
     double total_memory_time;
-    int timing_window_size;               // How many frames to average over
+    int timing_window_size;               // Frames per statistics window
     gboolean detailed_timing;             // Enable detailed per-frame output
 
     GstClockTime frame_duration;
@@ -51,35 +78,43 @@ typedef struct {
 
 } CustomData;
 
-static void print_timing_stats(CustomData *data) {
-    if (data->clahe_times.empty()) return;
-    
-    // Calculate statistics for CLAHE timing
-    double clahe_min = *std::min_element(data->clahe_times.begin(), data->clahe_times.end());
-    double clahe_max = *std::max_element(data->clahe_times.begin(), data->clahe_times.end());
-    double clahe_avg = std::accumulate(data->clahe_times.begin(), data->clahe_times.end(), 0.0) / data->clahe_times.size();
-    
-    // Calculate statistics for total frame timing
-    double frame_min = *std::min_element(data->total_frame_times.begin(), data->total_frame_times.end());
-    double frame_max = *std::max_element(data->total_frame_times.begin(), data->total_frame_times.end());
-    double frame_avg = std::accumulate(data->total_frame_times.begin(), data->total_frame_times.end(), 0.0) / data->total_frame_times.size();
-    
-    // Calculate statistics for memory operations
-    double mem_min = *std::min_element(data->memory_copy_times.begin(), data->memory_copy_times.end());
-    double mem_max = *std::max_element(data->memory_copy_times.begin(), data->memory_copy_times.end());
-    double mem_avg = std::accumulate(data->memory_copy_times.begin(), data->memory_copy_times.end(), 0.0) / data->memory_copy_times.size();
-    
-    g_print("\n=== TIMING ANALYSIS (clipLimit=%.1f, tileGrid=%dx%d) ===\n", 
-            data->clip_limit, data->tile_grid, data->tile_grid);
-    g_print("CLAHE Processing: avg=%.3fms, min=%.3fms, max=%.3fms (%.1f%% of total)\n", 
-            clahe_avg, clahe_min, clahe_max, (clahe_avg/frame_avg)*100.0);
-    g_print("Memory Operations: avg=%.3fms, min=%.3fms, max=%.3fms (%.1f%% of total)\n", 
-            mem_avg, mem_min, mem_max, (mem_avg/frame_avg)*100.0);
-    g_print("Total Frame Time: avg=%.3fms, min=%.3fms, max=%.3fms (%.1f FPS)\n", 
-            frame_avg, frame_min, frame_max, frame_avg > 0 ? 1000.0/frame_avg : 0.0);
+static void print_timing_line(const char *label, const LatencySummary &st) {
+    g_print("  %-18s avg=%.3fms, min=%.3fms, p50=%.3fms, p99=%.3fms, max=%.3fms\n",
+            label, st.avg_ms, st.min_ms, st.p50_ms, st.p99_ms, st.max_ms);
+}
+
+// whole_run: statistics since the start instead of the window since the last report
+static void print_timing_stats(CustomData *data, bool whole_run) {
+    LatencySummary clahe, mem, frame;
+    if (whole_run) {
+        if (!latency_hist_snapshot(&data->clahe_times.run, &clahe)) return;
+        latency_hist_snapshot(&data->memory_copy_times.run, &mem);
+        latency_hist_snapshot(&data->total_frame_times.run, &frame);
+    } else {
+        if (!latency_hist_drain(&data->clahe_times.window, &clahe)) return;
+        latency_hist_drain(&data->memory_copy_times.window, &mem);
+        latency_hist_drain(&data->total_frame_times.window, &frame);
+    }
+    const double clahe_avg = clahe.avg_ms, mem_avg = mem.avg_ms, frame_avg = frame.avg_ms;
+
+    g_print("\n=== TIMING ANALYSIS (clipLimit=%.1f, tileGrid=%dx%d, %s %" G_GUINT64_FORMAT " frames) ===\n",
+            data->clip_limit, data->tile_grid, data->tile_grid, whole_run ? "whole run," : "last", frame.count);
+    print_timing_line("CLAHE Processing:", clahe);
+    print_timing_line("Memory Operations:", mem);
+    print_timing_line("Total Frame Time:", frame);
+    g_print("Throughput: %.1f FPS\n", frame_avg > 0 ? 1000.0/frame_avg : 0.0);
     g_print("Processing Efficiency: CLAHE=%.1f%%, Memory=%.1f%%, Other=%.1f%%\n",
             (clahe_avg/frame_avg)*100.0, (mem_avg/frame_avg)*100.0, 
             ((frame_avg-clahe_avg-mem_avg)/frame_avg)*100.0);
+    g_print("Output pool (%u..%u): hits %" G_GUINT64_FORMAT " | misses %" G_GUINT64_FORMAT "\n",
+            data->out_pool.min_buffers, data->out_pool.max_buffers,
+            data->out_pool.hits.load(), data->out_pool.misses.load());
+    if (data->governor.enabled) governor_print(&data->governor);
+    if (data->video_clahe || data->governor.steps_up > 0) {
+        const uint64_t rebuilt = data->vclahe.tiles_rebuilt.load(), reused = data->vclahe.tiles_reused.load();
+        g_print("Tile LUTs: rebuilt %" G_GUINT64_FORMAT " | reused %" G_GUINT64_FORMAT " (%.1f%% reused)\n",
+                rebuilt, reused, rebuilt + reused ? 100.0 * reused / (rebuilt + reused) : 0.0);
+    }
     g_print("===============================================\n\n");
 }
 
@@ -190,9 +225,23 @@ static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
         
         auto mem_mid = std::chrono::high_resolution_clock::now();
         
+        // Below full the tile LUT cache takes over whatever the engine: subsampled tile
+        // histograms, then round-robin tile refresh, then odd frames interpolated only
+        const int level = governor_level(&data->governor);
+        const bool skip = governor_frame(&data->governor, (uint64_t)data->frame_count);
+        data->vclahe.hist_step = level >= GOVERNOR_SUBSAMPLE ? GOVERNOR_HIST_SUBSAMPLE : 1;
+        data->vclahe.refresh_stride = level >= GOVERNOR_LUT_REUSE ? VIDEO_CLAHE_REFRESH_STRIDE : 1;
+
         // === PURE CLAHE TIMING ===
         auto clahe_start = std::chrono::high_resolution_clock::now();
-        data->clahe->apply(y_in, y_out);
+        // FPGA errors fall back to the CPU for this frame
+        if (!data->use_fpga || !fpga_clahe_apply(&data->fpga_shared, &data->fpga_worker, y_in, y_out,
+                                                 data->clip_limit, data->tile_grid)) {
+            // Skipped frames are only counted when there were tile LUTs to interpolate with
+            if (skip && video_clahe_remap(&data->vclahe, y_in, y_out)) governor_skipped(&data->governor);
+            else if (data->video_clahe || level > GOVERNOR_FULL) video_clahe_apply(&data->vclahe, y_in, y_out);
+            else data->clahe->apply(y_in, y_out);
+        }
         auto clahe_end = std::chrono::high_resolution_clock::now();
         
         // Continue memory operations
@@ -207,13 +256,13 @@ static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
         double mem_ms = std::chrono::duration<double, std::milli>(mem_end - mem_start).count() - clahe_ms;
         
         // Store timing data
-        data->clahe_times.push_back(clahe_ms);
-        data->memory_copy_times.push_back(mem_ms);
+        latency_stats_record_ms(&data->clahe_times, clahe_ms);
+        latency_stats_record_ms(&data->memory_copy_times, mem_ms);
         data->total_clahe_time += clahe_ms;
         data->total_memory_time += mem_ms;
 
         // Create output buffer
-        GstBuffer *out = gst_buffer_new_allocate(NULL, y_size + uv_size, NULL);
+        GstBuffer *out = output_pool_acquire(&data->out_pool, &data->video_info, y_size + uv_size);
         if (!out) {
             g_printerr("Failed to allocate processed buffer\n");
             gst_buffer_unmap(buffer, &map_info);
@@ -233,8 +282,7 @@ static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
 
             GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(data->appsrc), out);
             if (ret != GST_FLOW_OK) {
-                g_printerr("Failed to push buffer to appsrc: %d\n", ret);
-                gst_buffer_unref(out);
+                g_printerr("Failed to push buffer to appsrc: %d\n", ret);  // appsrc owns the buffer either way
             }
         } else {
             g_printerr("Failed to map processed buffer\n");
@@ -245,10 +293,20 @@ static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
         auto frame_end = std::chrono::high_resolution_clock::now();
         double total_frame_ms = std::chrono::duration<double, std::milli>(frame_end - frame_start).count();
         
-        data->total_frame_times.push_back(total_frame_ms);
+        latency_stats_record_ms(&data->total_frame_times, total_frame_ms);
         data->total_processing_time += total_frame_ms;
         data->frame_count++;
 
+        // About a second of frames per governor window, against one frame interval
+        data->gov_window_ms += total_frame_ms;
+        const int fps = data->video_info.fps_d > 0 ? std::max(data->video_info.fps_n / data->video_info.fps_d, 1) : 30;
+        if (++data->gov_window_frames >= fps) {
+            governor_update(&data->governor, data->gov_window_ms / data->gov_window_frames,
+                            data->frame_duration / (double)GST_MSECOND);
+            data->gov_window_ms = 0.0;
+            data->gov_window_frames = 0;
+        }
+
         // Detailed per-frame output (if enabled)
         if (data->detailed_timing && (data->frame_count <= 10 || data->frame_count % 50 == 0)) {
             g_print("Frame %d: CLAHE=%.3fms, Memory=%.3fms, Total=%.3fms, Other=%.3fms\n",
@@ -256,18 +314,9 @@ static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
                     total_frame_ms - clahe_ms - mem_ms);
         }
 
-        // Periodic summary (every 100 frames)
-        if ((data->frame_count % 100) == 0) {
-            // Keep only recent data for rolling average
-            if (data->clahe_times.size() > data->timing_window_size) {
-                data->clahe_times.erase(data->clahe_times.begin(), 
-                    data->clahe_times.end() - data->timing_window_size);
-                data->total_frame_times.erase(data->total_frame_times.begin(), 
-                    data->total_frame_times.end() - data->timing_window_size);
-                data->memory_copy_times.erase(data->memory_copy_times.begin(), 
-                    data->memory_copy_times.end() - data->timing_window_size);
-            }
-            print_timing_stats(data);
+        // Periodic summary over the window since the last one
+        if ((data->frame_count % data->timing_window_size) == 0) {
+            print_timing_stats(data, false);
         }
 
     } catch (const std::exception &e) {
@@ -303,7 +352,7 @@ static gboolean bus_message_cb(GstBus *bus, GstMessage *message, gpointer user_d
                 } else {
                     // Print final timing summary before exit
                     g_print("\n=== FINAL TIMING SUMMARY ===\n");
-                    print_timing_stats(data);
+                    print_timing_stats(data, true);
                     g_print("Total frames processed: %d\n", data->frame_count);
                     g_print("Average CLAHE time per frame: %.3fms\n", 
                             data->frame_count > 0 ? data->total_clahe_time / data->frame_count : 0.0);
@@ -383,8 +432,14 @@ int main(int argc, char *argv[]) {
     gboolean udp_only = FALSE;
     double clip_limit = 2.0;  // default CLAHE clip limit
     int    tile_grid  = 8;    // default CLAHE tile grid size (tile x tile)
+    gboolean use_fpga = FALSE; // --backend=cpu|fpga
     gboolean detailed_timing = FALSE;
-    int timing_window = 200;  // rolling window size for statistics
+    int timing_window = 200;  // frames per rolling statistics window
+    gboolean video_clahe = FALSE;  // --clahe-engine=opencv|video
+    double tile_threshold = VIDEO_CLAHE_THRESHOLD_DEFAULT;  // --tile-threshold=F grey levels (0 = rebuild every tile)
+    int pool_min = OUTPUT_POOL_MIN_DEFAULT;  // --pool-min=N output buffers preallocated
+    int pool_max = OUTPUT_POOL_MAX_DEFAULT;  // --pool-max=N before falling back to allocation
+    const char *governor_mode = "off";       // --governor=off|auto|subsample|lut-reuse|skip-alternate
 
     for (int i = 1; i < argc; ++i) {
         if (g_str_has_prefix(argv[i], "--codec=")) {
@@ -448,6 +503,21 @@ int main(int argc, char *argv[]) {
         } else if (g_strcmp0(argv[i], "--tile") == 0 && i + 1 < argc) {
             int v = atoi(argv[i + 1]);
             if (v >= 1) tile_grid = v; i++;
+        } else if (g_str_has_prefix(argv[i], "--backend=")) {
+            const char *val = strchr(argv[i], '=');
+            if (val && g_ascii_strcasecmp(val + 1, "fpga") == 0) use_fpga = TRUE;
+        } else if (g_strcmp0(argv[i], "--backend") == 0 && i + 1 < argc) {
+            if (g_ascii_strcasecmp(argv[i + 1], "fpga") == 0) use_fpga = TRUE; i++;
+        } else if (g_str_has_prefix(argv[i], "--clahe-engine=")) {
+            const char *val = strchr(argv[i], '='); if (val) video_clahe = g_ascii_strcasecmp(val + 1, "video") == 0;
+        } else if (g_str_has_prefix(argv[i], "--tile-threshold=")) {
+            const char *val = strchr(argv[i], '='); if (val) { double v = g_ascii_strtod(val + 1, NULL); if (v >= 0.0) tile_threshold = v; }
+        } else if (g_str_has_prefix(argv[i], "--pool-min=")) {
+            const char *val = strchr(argv[i], '='); if (val) { int v = atoi(val + 1); if (v > 0) pool_min = v; }
+        } else if (g_str_has_prefix(argv[i], "--pool-max=")) {
+            const char *val = strchr(argv[i], '='); if (val) { int v = atoi(val + 1); if (v > 0) pool_max = v; }
+        } else if (g_str_has_prefix(argv[i], "--governor=")) {
+            const char *val = strchr(argv[i], '='); if (val) governor_mode = val + 1;
         }
     }
 
@@ -490,11 +560,47 @@ int main(int argc, char *argv[]) {
     data.src_pipeline = NULL;
     data.save_to_file = !udp_only;
     data.current_timestamp = 0;
+    output_pool_init(&data.out_pool, (guint)pool_min, (guint)pool_max);
 
     // Initialize CLAHE and timing
     data.clip_limit = clip_limit;
     data.tile_grid  = tile_grid < 1 ? 1 : tile_grid;
     data.clahe      = cv::createCLAHE(data.clip_limit, cv::Size(data.tile_grid, data.tile_grid));
+    data.video_clahe = video_clahe;
+    video_clahe_init(&data.vclahe, data.clip_limit, data.tile_grid, tile_threshold);
+
+    // FPGA backend: clahe_accel from the shared xclbin, CPU if it can't be used
+    data.use_fpga = use_fpga;
+    if (data.use_fpga && data.tile_grid > CLAHE_TILES_MAX) {
+        g_printerr("clahe_accel supports up to %dx%d tiles, using CPU CLAHE\n", CLAHE_TILES_MAX, CLAHE_TILES_MAX);
+        data.use_fpga = FALSE;
+    }
+    if (data.use_fpga && (!initialize_shared_opencl_context(&data.fpga_shared) ||
+                          !initialize_worker_opencl_context(&data.fpga_worker, &data.fpga_shared))) {
+        g_printerr("FPGA backend unavailable, using CPU CLAHE\n");
+        data.use_fpga = FALSE;
+    }
+    g_print("CLAHE backend: %s\n", data.use_fpga ? "FPGA (clahe_accel)"
+                                   : data.video_clahe ? "CPU (tile LUT cache)" : "CPU (cv::CLAHE)");
+    if (!data.use_fpga && data.video_clahe) g_print("Tile rebuild threshold: %.1f grey levels\n", tile_threshold);
+
+    // Off by default: a file transcode has no deadline, it just runs slower. clahe_accel
+    // has no cheaper mode, so the governor only drives the CPU engines.
+    data.governor.enabled = false;
+    if (!governor_parse(governor_mode, &data.governor)) {
+        g_printerr("Unknown --governor %s, leaving it off\n", governor_mode);
+        data.governor.enabled = false;
+    }
+    if (data.governor.enabled && data.use_fpga) {
+        g_print("--governor only sheds CPU CLAHE work, leaving it off for the FPGA backend\n");
+        data.governor.enabled = false;
+    }
+    if (data.governor.enabled) {
+        g_print("Governor: sheds work down to %s when frames overrun their interval\n",
+                governor_level_name(data.governor.max_level));
+    }
+    data.gov_window_ms = 0.0;
+    data.gov_window_frames = 0;
     data.total_clahe_time = 0.0;
     data.total_memory_time = 0.0;
     data.detailed_timing = detailed_timing;
@@ -615,6 +721,7 @@ int main(int argc, char *argv[]) {
 
     // Final timing summary
     g_print("\n=== FINAL PERFORMANCE ANALYSIS ===\n");
+    if (data.loop_playback) print_timing_stats(&data, true);  // otherwise already printed at input EOS
     if (data.frame_count > 0) {
         double avg_clahe = data.total_clahe_time / data.frame_count;
         double avg_memory = data.total_memory_time / data.frame_count;
@@ -643,6 +750,9 @@ int main(int argc, char *argv[]) {
     if (data.appsrc) gst_object_unref(data.appsrc);
     gst_object_unref(sink_pipeline);
     gst_object_unref(src_pipeline);
+    output_pool_clear(&data.out_pool);
+    cleanup_worker_opencl_context(&data.fpga_worker);
+    cleanup_shared_opencl_context(&data.fpga_shared);
     g_timer_destroy(data.processing_timer);
     g_free(input_file);
     if (output_file) g_free(output_file);
@@ -0,0 +1,145 @@
+// deadline_governor.hpp
+// Load shedding for the processing stage when frames take longer than the stream allows.
+//
+// Without it the only relief is the leaky q_cam and appsink drop=true, which throw whole
+// frames away wherever they happen to fall. The governor instead compares the average
+// processing time of the last window with the per-frame budget (1/fps, times however many
+// frames the workers overlap) and steps the work down one level at a time:
+//   full            - the normal path
+//   subsample       - histograms on every GOVERNOR_HIST_SUBSAMPLE-th pixel and row
+//   lut-reuse       - apply the previous frame's LUT, gather this frame's in the same pass
+//   skip-alternate  - odd frames skip the analysis (and the device) and are remapped with
+//                     the LUT the even frame before them left behind
+// Every frame is still pushed, so the encoder keeps the full frame rate. A level is left
+// again only after the load stays below `low` for `recover` windows; stepping back up
+// right after a recovery doubles that hold, so a load that sits on the edge doesn't make
+// the picture flip between levels.
+
+#ifndef DEADLINE_GOVERNOR_HPP
+#define DEADLINE_GOVERNOR_HPP
+
+#include <glib.h>
+#include <atomic>
+#include <stdint.h>
+
+#define GOVERNOR_HIGH_DEFAULT 0.95      // share of the budget that sheds one more level
+#define GOVERNOR_LOW_DEFAULT 0.6        // share of the budget that may give one back
+#define GOVERNOR_RECOVER_DEFAULT 3      // calm windows before a level is given back
+#define GOVERNOR_RECOVER_MAX 48
+#define GOVERNOR_HIST_SUBSAMPLE 4
+
+enum GovernorLevel {
+    GOVERNOR_FULL,
+    GOVERNOR_SUBSAMPLE,
+    GOVERNOR_LUT_REUSE,
+    GOVERNOR_SKIP_ALTERNATE,
+    GOVERNOR_LEVELS
+};
+
+struct DeadlineGovernor {
+    bool   enabled{true};
+    int    max_level{GOVERNOR_SKIP_ALTERNATE};
+    double high{GOVERNOR_HIGH_DEFAULT};
+    double low{GOVERNOR_LOW_DEFAULT};
+
+    std::atomic<int> level{GOVERNOR_FULL};      // read by the workers on every frame
+    double avg_ms{0.0}, budget_ms{0.0};          // last window, for the status output
+    int    calm{0};                              // windows below `low` in a row
+    int    recover{GOVERNOR_RECOVER_DEFAULT};
+    bool   just_recovered{false};
+
+    std::atomic<uint64_t> skipped{0};            // frames remapped without analysis
+    uint64_t steps_up{0}, steps_down{0};
+};
+
+static inline const char *governor_level_name(int level) {
+    switch (level) {
+    case GOVERNOR_SUBSAMPLE:      return "subsample";
+    case GOVERNOR_LUT_REUSE:      return "lut-reuse";
+    case GOVERNOR_SKIP_ALTERNATE: return "skip-alternate";
+    default:                      return "full";
+    }
+}
+
+// --governor=off|auto|<deepest level>
+static inline bool governor_parse(const char *s, DeadlineGovernor *g) {
+    if (g_ascii_strcasecmp(s, "off") == 0) {
+        g->enabled = false;
+        return true;
+    }
+    if (g_ascii_strcasecmp(s, "auto") == 0 || g_ascii_strcasecmp(s, "on") == 0) {
+        g->enabled = true;
+        g->max_level = GOVERNOR_SKIP_ALTERNATE;
+        return true;
+    }
+    for (int l = GOVERNOR_SUBSAMPLE; l < GOVERNOR_LEVELS; ++l) {
+        if (g_ascii_strcasecmp(s, governor_level_name(l)) == 0) {
+            g->enabled = true;
+            g->max_level = l;
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline int governor_level(DeadlineGovernor *g) {
+    return g->level.load(std::memory_order_relaxed);
+}
+
+// Per frame, by capture sequence: true for the frames that may skip their analysis. The
+// caller may still process the frame (no LUT to reuse yet), so it counts the frames it
+// actually remapped with governor_skipped().
+static inline bool governor_frame(DeadlineGovernor *g, uint64_t seq) {
+    return governor_level(g) >= GOVERNOR_SKIP_ALTERNATE && (seq & 1);
+}
+
+static inline void governor_skipped(DeadlineGovernor *g) {
+    g->skipped.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Once per window, from one thread: average processing time of the frames in it and the
+// time one frame may take. Returns true when the level changed.
+static inline bool governor_update(DeadlineGovernor *g, double avg_ms, double budget_ms) {
+    g->avg_ms = avg_ms;
+    g->budget_ms = budget_ms;
+    if (!g->enabled || budget_ms <= 0.0 || avg_ms <= 0.0) return false;
+
+    const int level = governor_level(g);
+    const double load = avg_ms / budget_ms;
+    int next = level;
+    if (load > g->high && level < g->max_level) {
+        next = level + 1;
+        if (g->just_recovered) g->recover = MIN(g->recover * 2, GOVERNOR_RECOVER_MAX);
+        g->calm = 0;
+        g->steps_up++;
+    } else if (load < g->low && level > GOVERNOR_FULL) {
+        if (++g->calm >= g->recover) {
+            next = level - 1;
+            g->calm = 0;
+            g->steps_down++;
+            if (next == GOVERNOR_FULL) g->recover = GOVERNOR_RECOVER_DEFAULT;
+        }
+    } else {
+        g->calm = 0;
+    }
+    g->just_recovered = next < level;
+    if (next == level) return false;
+
+    g->level.store(next, std::memory_order_relaxed);
+    g_print("Governor: %s -> %s (avg %.2f ms, budget %.2f ms)\n", governor_level_name(level),
+            governor_level_name(next), avg_ms, budget_ms);
+    return true;
+}
+
+static inline void governor_print(DeadlineGovernor *g) {
+    if (!g->enabled) {
+        g_print("Governor: off\n");
+        return;
+    }
+    g_print("Governor: level %d (%s) | avg %.2f ms / budget %.2f ms | skipped %" G_GUINT64_FORMAT
+            " | steps up %" G_GUINT64_FORMAT " down %" G_GUINT64_FORMAT "\n",
+            governor_level(g), governor_level_name(governor_level(g)), g->avg_ms, g->budget_ms,
+            g->skipped.load(), g->steps_up, g->steps_down);
+}
+
+#endif // DEADLINE_GOVERNOR_HPP
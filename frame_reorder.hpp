@@ -0,0 +1,159 @@
+// frame_reorder.hpp
+// Capture-order output stage shared by the multi-worker relays.
+//
+// new_sample_cb tags every camera buffer with a sequence number. Workers finish
+// frames in any order and hand the result (or a drop) back under that number;
+// frames leave for appsrc strictly in capture order. When `window` newer frames
+// are waiting on a missing one, the gap is given up and output moves on; if the
+// missing frame turns up afterwards it is dropped as late.
+//
+// The capture PTS and duration are carried over, rebased from the capture
+// pipeline's running time to the appsrc pipeline's (both run on the system clock),
+// so appsrc must be created with do-timestamp=false.
+
+#ifndef FRAME_REORDER_HPP
+#define FRAME_REORDER_HPP
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <glib.h>
+#include <atomic>
+#include <map>
+
+#define REORDER_WINDOW_DEFAULT 4
+#define REORDER_WINDOW_MAX 32
+
+struct FrameReorder {
+    GMutex      mutex;
+    GstElement *appsrc{nullptr};
+    GstElement *sink_pipeline{nullptr};      // capture side of the running-time rebase
+    GstElement *src_pipeline{nullptr};
+    guint       window{REORDER_WINDOW_DEFAULT};
+
+    std::atomic<uint64_t> next_tag{0};       // assigned in new_sample_cb
+    uint64_t    next_seq{0};                 // next sequence number allowed out
+    std::map<uint64_t, GstBuffer*> pending;  // finished out of order; nullptr = dropped by a worker
+    bool        have_offset{false};
+    GstClockTimeDiff pts_offset{0};
+
+    std::atomic<uint64_t> reordered{0};      // frames that had to wait for an earlier one
+    std::atomic<uint64_t> late_drops{0};     // arrived after their gap was skipped
+    std::atomic<uint64_t> gaps{0};           // sequence numbers given up on
+};
+
+static inline GQuark frame_seq_quark() {
+    static GQuark q = g_quark_from_static_string("frame-reorder-seq");
+    return q;
+}
+
+static inline void frame_reorder_init(FrameReorder *r, GstElement *appsrc, GstElement *sink_pipeline,
+                                      GstElement *src_pipeline, guint window) {
+    g_mutex_init(&r->mutex);
+    r->appsrc = appsrc;
+    r->sink_pipeline = sink_pipeline;
+    r->src_pipeline = src_pipeline;
+    r->window = window < 1 ? 1 : window;
+}
+
+static inline void frame_reorder_clear(FrameReorder *r) {
+    g_mutex_lock(&r->mutex);
+    for (auto &entry : r->pending) {
+        if (entry.second) gst_buffer_unref(entry.second);
+    }
+    r->pending.clear();
+    g_mutex_unlock(&r->mutex);
+    g_mutex_clear(&r->mutex);
+}
+
+// Called from new_sample_cb before the buffer is queued to a worker
+static inline void frame_reorder_tag(FrameReorder *r, GstBuffer *inbuf) {
+    const uint64_t seq = r->next_tag.fetch_add(1, std::memory_order_relaxed);
+    gst_mini_object_set_qdata(GST_MINI_OBJECT(inbuf), frame_seq_quark(), GSIZE_TO_POINTER(seq + 1), NULL);
+}
+
+static inline uint64_t frame_reorder_seq(GstBuffer *inbuf) {
+    gpointer v = gst_mini_object_get_qdata(GST_MINI_OBJECT(inbuf), frame_seq_quark());
+    return v ? (uint64_t)GPOINTER_TO_SIZE(v) - 1 : 0;
+}
+
+// Capture timing travels with the processed frame; DTS is left to the encoder
+static inline void frame_reorder_carry_timing(GstBuffer *outbuf, GstClockTime pts, GstClockTime duration) {
+    GST_BUFFER_PTS(outbuf)      = pts;
+    GST_BUFFER_DTS(outbuf)      = GST_CLOCK_TIME_NONE;
+    GST_BUFFER_DURATION(outbuf) = duration;
+}
+
+// Map a capture running time onto the appsrc pipeline; frames without a PTS get "now"
+static inline void frame_reorder_retime(FrameReorder *r, GstBuffer *outbuf) {
+    if (!r->have_offset && r->sink_pipeline && r->src_pipeline) {
+        r->pts_offset = GST_CLOCK_DIFF(gst_element_get_base_time(r->src_pipeline),
+                                       gst_element_get_base_time(r->sink_pipeline));
+        r->have_offset = true;
+    }
+    GstClockTime pts = GST_BUFFER_PTS(outbuf);
+    if (GST_CLOCK_TIME_IS_VALID(pts)) {
+        GstClockTimeDiff t = (GstClockTimeDiff)pts + r->pts_offset;
+        GST_BUFFER_PTS(outbuf) = t > 0 ? (GstClockTime)t : 0;
+    } else if (r->src_pipeline) {
+        GstClock *clock = gst_element_get_clock(r->src_pipeline);
+        if (clock) {
+            GST_BUFFER_PTS(outbuf) = gst_clock_get_time(clock) - gst_element_get_base_time(r->src_pipeline);
+            gst_object_unref(clock);
+        }
+    }
+}
+
+static inline guint frame_reorder_emit(FrameReorder *r, GstBuffer *outbuf) {
+    if (!outbuf) return 0;
+    frame_reorder_retime(r, outbuf);
+    GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(r->appsrc), outbuf);
+    return ret == GST_FLOW_OK ? 0 : 1;  // appsrc owns the buffer either way
+}
+
+// Hand a finished frame (or nullptr for a dropped one) to the output stage.
+// Returns the number of appsrc pushes that failed.
+static inline guint frame_reorder_push(FrameReorder *r, uint64_t seq, GstBuffer *outbuf) {
+    guint failures = 0;
+    g_mutex_lock(&r->mutex);
+    if (seq < r->next_seq) {
+        g_mutex_unlock(&r->mutex);
+        if (outbuf) {
+            gst_buffer_unref(outbuf);
+            r->late_drops.fetch_add(1, std::memory_order_relaxed);
+        }
+        return 0;
+    }
+
+    if (seq == r->next_seq) {
+        failures += frame_reorder_emit(r, outbuf);
+        r->next_seq++;
+    } else {
+        r->pending[seq] = outbuf;
+        if (outbuf) r->reordered.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    for (;;) {
+        // Release everything that is now contiguous
+        while (!r->pending.empty() && r->pending.begin()->first == r->next_seq) {
+            failures += frame_reorder_emit(r, r->pending.begin()->second);
+            r->pending.erase(r->pending.begin());
+            r->next_seq++;
+        }
+        if (r->pending.size() <= r->window) break;
+        // Too many frames waiting on a gap: give it up
+        const uint64_t first = r->pending.begin()->first;
+        r->gaps.fetch_add(first - r->next_seq, std::memory_order_relaxed);
+        r->next_seq = first;
+    }
+    g_mutex_unlock(&r->mutex);
+    return failures;
+}
+
+static inline guint frame_reorder_held(FrameReorder *r) {
+    g_mutex_lock(&r->mutex);
+    guint n = (guint)r->pending.size();
+    g_mutex_unlock(&r->mutex);
+    return n;
+}
+
+#endif // FRAME_REORDER_HPP
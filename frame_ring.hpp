@@ -0,0 +1,223 @@
+// frame_ring.hpp
+// Bounded hand-off of camera buffers from new_sample_cb to the workers.
+//
+// A fixed-capacity MPMC ring (sequence-numbered cells, no locks on push/pop) replaces
+// the unbounded GAsyncQueue, so a slow worker can no longer let latency pile up
+// behind it. When the ring is full the policy decides what goes:
+//   oldest   - the frame that has waited longest is dropped to make room (default)
+//   newest   - the incoming frame is dropped
+//   max-age  - like oldest, and a popped frame whose capture PTS is more than
+//              max_age behind the capture pipeline's running time is dropped too
+// Dropped buffers go to on_drop (the relays use it to tell the reorder stage) and
+// are counted. A mutex/cond pair is only used to park idle workers.
+
+#ifndef FRAME_RING_HPP
+#define FRAME_RING_HPP
+
+#include <gst/gst.h>
+#include <glib.h>
+#include <atomic>
+
+#define FRAME_RING_CAPACITY_MAX 64
+#define FRAME_RING_MAX_AGE_MS_DEFAULT 50
+
+enum FrameDropPolicy {
+    FRAME_DROP_OLDEST,
+    FRAME_DROP_NEWEST,
+    FRAME_DROP_MAX_AGE,
+};
+
+struct FrameRingCell {
+    std::atomic<size_t> seq{0};
+    GstBuffer *buf{nullptr};
+};
+
+struct FrameRing {
+    FrameRingCell cells[FRAME_RING_CAPACITY_MAX];
+    size_t capacity{4};
+    std::atomic<size_t> enqueue_pos{0};
+    std::atomic<size_t> dequeue_pos{0};
+
+    FrameDropPolicy policy{FRAME_DROP_OLDEST};
+    GstClockTime max_age{FRAME_RING_MAX_AGE_MS_DEFAULT * GST_MSECOND};
+    GstElement *pipeline{nullptr};                // capture pipeline, for the age of a PTS
+    void (*on_drop)(gpointer, GstBuffer*){nullptr};  // takes ownership of the buffer
+    gpointer drop_data{nullptr};
+
+    GMutex wait_mutex;
+    GCond  wait_cond;
+    std::atomic<int> waiters{0};
+
+    std::atomic<uint64_t> high_water{0};          // deepest the ring has been
+    std::atomic<uint64_t> dropped_oldest{0};
+    std::atomic<uint64_t> dropped_newest{0};
+    std::atomic<uint64_t> dropped_stale{0};
+};
+
+static inline const char *frame_drop_policy_name(FrameDropPolicy p) {
+    return p == FRAME_DROP_NEWEST ? "newest" : p == FRAME_DROP_MAX_AGE ? "max-age" : "oldest";
+}
+
+static inline bool frame_drop_policy_parse(const char *s, FrameDropPolicy *p) {
+    if (g_ascii_strcasecmp(s, "oldest") == 0) *p = FRAME_DROP_OLDEST;
+    else if (g_ascii_strcasecmp(s, "newest") == 0) *p = FRAME_DROP_NEWEST;
+    else if (g_ascii_strcasecmp(s, "max-age") == 0) *p = FRAME_DROP_MAX_AGE;
+    else return false;
+    return true;
+}
+
+static inline void frame_ring_init(FrameRing *r, guint capacity, FrameDropPolicy policy, guint max_age_ms,
+                                   GstElement *pipeline, void (*on_drop)(gpointer, GstBuffer*), gpointer drop_data) {
+    r->capacity = capacity < 1 ? 1 : capacity > FRAME_RING_CAPACITY_MAX ? FRAME_RING_CAPACITY_MAX : capacity;
+    for (size_t i = 0; i < r->capacity; ++i) {
+        r->cells[i].seq.store(i, std::memory_order_relaxed);
+        r->cells[i].buf = nullptr;
+    }
+    r->enqueue_pos.store(0, std::memory_order_relaxed);
+    r->dequeue_pos.store(0, std::memory_order_relaxed);
+    r->policy = policy;
+    r->max_age = (GstClockTime)max_age_ms * GST_MSECOND;
+    r->pipeline = pipeline;
+    r->on_drop = on_drop;
+    r->drop_data = drop_data;
+    g_mutex_init(&r->wait_mutex);
+    g_cond_init(&r->wait_cond);
+}
+
+static inline bool frame_ring_try_push(FrameRing *r, GstBuffer *buf) {
+    size_t pos = r->enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        FrameRingCell &cell = r->cells[pos % r->capacity];
+        const size_t seq = cell.seq.load(std::memory_order_acquire);
+        const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (r->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.buf = buf;
+                cell.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;   // full
+        } else {
+            pos = r->enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+static inline GstBuffer *frame_ring_try_pop(FrameRing *r) {
+    size_t pos = r->dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        FrameRingCell &cell = r->cells[pos % r->capacity];
+        const size_t seq = cell.seq.load(std::memory_order_acquire);
+        const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (r->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                GstBuffer *buf = cell.buf;
+                cell.seq.store(pos + r->capacity, std::memory_order_release);
+                return buf;
+            }
+        } else if (diff < 0) {
+            return nullptr;   // empty
+        } else {
+            pos = r->dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+static inline size_t frame_ring_depth(FrameRing *r) {
+    const size_t enq = r->enqueue_pos.load(std::memory_order_relaxed);
+    const size_t deq = r->dequeue_pos.load(std::memory_order_relaxed);
+    return enq > deq ? enq - deq : 0;
+}
+
+static inline void frame_ring_drop(FrameRing *r, GstBuffer *buf, std::atomic<uint64_t> *counter) {
+    counter->fetch_add(1, std::memory_order_relaxed);
+    if (r->on_drop) r->on_drop(r->drop_data, buf);
+    else gst_buffer_unref(buf);
+}
+
+// Capture-pipeline running time minus the buffer's PTS; 0 when either is unknown
+static inline GstClockTime frame_ring_age(FrameRing *r, GstBuffer *buf) {
+    const GstClockTime pts = GST_BUFFER_PTS(buf);
+    if (!GST_CLOCK_TIME_IS_VALID(pts) || !r->pipeline) return 0;
+    GstClock *clock = gst_element_get_clock(r->pipeline);
+    if (!clock) return 0;
+    const GstClockTime now = gst_clock_get_time(clock) - gst_element_get_base_time(r->pipeline);
+    gst_object_unref(clock);
+    return now > pts ? now - pts : 0;
+}
+
+// Takes ownership of buf
+static inline void frame_ring_push(FrameRing *r, GstBuffer *buf) {
+    while (!frame_ring_try_push(r, buf)) {
+        if (r->policy == FRAME_DROP_NEWEST) {
+            frame_ring_drop(r, buf, &r->dropped_newest);
+            return;
+        }
+        GstBuffer *old = frame_ring_try_pop(r);
+        if (old) frame_ring_drop(r, old, &r->dropped_oldest);
+    }
+
+    const uint64_t depth = frame_ring_depth(r);
+    uint64_t high = r->high_water.load(std::memory_order_relaxed);
+    while (depth > high && !r->high_water.compare_exchange_weak(high, depth, std::memory_order_relaxed)) {}
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (r->waiters.load(std::memory_order_relaxed) > 0) {
+        g_mutex_lock(&r->wait_mutex);
+        g_cond_signal(&r->wait_cond);
+        g_mutex_unlock(&r->wait_mutex);
+    }
+}
+
+// Next frame for a worker, or nullptr after timeout_us without one
+static inline GstBuffer *frame_ring_pop(FrameRing *r, gint64 timeout_us) {
+    const gint64 deadline = g_get_monotonic_time() + timeout_us;
+    for (;;) {
+        GstBuffer *buf = frame_ring_try_pop(r);
+        if (!buf) {
+            bool timed_out = false;
+            g_mutex_lock(&r->wait_mutex);
+            r->waiters.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            buf = frame_ring_try_pop(r);
+            if (!buf) timed_out = !g_cond_wait_until(&r->wait_cond, &r->wait_mutex, deadline);
+            r->waiters.fetch_sub(1, std::memory_order_relaxed);
+            g_mutex_unlock(&r->wait_mutex);
+            if (!buf) {
+                if (timed_out) return nullptr;
+                continue;
+            }
+        }
+        if (r->policy == FRAME_DROP_MAX_AGE && frame_ring_age(r, buf) > r->max_age) {
+            frame_ring_drop(r, buf, &r->dropped_stale);
+            continue;
+        }
+        return buf;
+    }
+}
+
+// Non-blocking pop with the max-age check, for callers that wait elsewhere (stream_sched.hpp)
+static inline GstBuffer *frame_ring_try_pop_fresh(FrameRing *r) {
+    while (GstBuffer *buf = frame_ring_try_pop(r)) {
+        if (r->policy == FRAME_DROP_MAX_AGE && frame_ring_age(r, buf) > r->max_age) {
+            frame_ring_drop(r, buf, &r->dropped_stale);
+            continue;
+        }
+        return buf;
+    }
+    return nullptr;
+}
+
+// Shutdown: release whatever is still queued
+static inline void frame_ring_drain(FrameRing *r) {
+    while (GstBuffer *buf = frame_ring_try_pop(r)) gst_buffer_unref(buf);
+}
+
+static inline void frame_ring_clear(FrameRing *r) {
+    frame_ring_drain(r);
+    g_cond_clear(&r->wait_cond);
+    g_mutex_clear(&r->wait_mutex);
+}
+
+#endif // FRAME_RING_HPP
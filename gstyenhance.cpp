@@ -0,0 +1,434 @@
+// gstyenhance.cpp
+// yenhance: the relays' luma enhancement as an in-place GStreamer filter.
+//
+// Build (plugin, found through GST_PLUGIN_PATH):
+// g++ -O3 -DNDEBUG -std=c++17 -shared -fPIC gstyenhance.cpp -o libgstyenhance.so \
+//   $(pkg-config --cflags --libs gstreamer-1.0 gstreamer-base-1.0 gstreamer-video-1.0 opencv4)
+// The FPGA backends need -DWITH_FPGA xcl2.cpp -lOpenCL -lxilinxopencl as well, and
+// krnl_hist_equalize.xclbin where xcl::find_binary_file looks for it.
+//
+// The relays move every frame out through an appsink and back in through an appsrc,
+// which is a copy and two scheduling hops in each direction. yenhance runs the same
+// backends on the streaming thread, on the buffer it was handed, so it can be dropped
+// into any pipeline string, the WebRTC senders' included:
+//   GST_PLUGIN_PATH=. gst-launch-1.0 v4l2src ! video/x-raw,format=NV12 ! \
+//     yenhance backend=neon ! omxh264enc ! ...
+// Only the Y plane is touched; chroma passes as it is. Backends:
+//   cpu          cv::equalizeHist
+//   neon         neon_equalize_hist, row stripes on OpenCV's thread pool (stripes)
+//   clahe        cv::CLAHE (clip-limit, tiles)
+//   clahe-video  VideoClahe: tiles whose content didn't move keep their LUT (threshold)
+//   fpga         equalizeHist_accel                         (WITH_FPGA)
+//   clahe-fpga   clahe_accel (clip-limit, tiles, at most 8)  (WITH_FPGA)
+// Equalization runs in place; the CLAHE backends write a scratch plane and copy it back.
+// The FPGA backends use one blocking write/run/read per frame, so they add the kernel's
+// round trip to the streaming thread; the relays stay the way to pipeline the FPGA. They
+// take at most 3840x2160: larger caps are refused while an FPGA backend is selected.
+
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideofilter.h>
+#include <opencv2/opencv.hpp>
+#include <string.h>
+
+#ifdef WITH_FPGA
+#define CL_HPP_CL_1_2_DEFAULT_BUILD
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#define CL_HPP_ENABLE_PROGRAM_CONSTRUCTION_FROM_ARRAY_COMPATIBILITY 1
+#include <CL/cl2.hpp>
+#include "xcl2.hpp"
+#include "clahe_fpga.hpp"
+#endif
+
+#include "neon_equalize.hpp"
+#include "video_clahe.hpp"
+
+#ifndef PACKAGE
+#define PACKAGE "yenhance"
+#endif
+#ifndef VERSION
+#define VERSION "1.0"
+#endif
+
+#define YENHANCE_CLIP_LIMIT_DEFAULT 2.0
+#define YENHANCE_TILES_DEFAULT 8
+#define YENHANCE_TILES_MAX_FPGA 8        // clahe_accel limit, must match accel.cpp
+#define YENHANCE_FPGA_MAX_WIDTH 3840     // WIDTH_4k/HEIGHT_4k of the kernels in accel.cpp
+#define YENHANCE_FPGA_MAX_HEIGHT 2160
+
+GST_DEBUG_CATEGORY_STATIC(yenhance_debug);
+#define GST_CAT_DEFAULT yenhance_debug
+
+enum YEnhanceBackend {
+    YENHANCE_CPU,
+    YENHANCE_NEON,
+    YENHANCE_CLAHE,
+    YENHANCE_CLAHE_VIDEO,
+    YENHANCE_FPGA,
+    YENHANCE_CLAHE_FPGA,
+};
+
+static GType yenhance_backend_get_type(void) {
+    static gsize type = 0;
+    static const GEnumValue values[] = {
+        {YENHANCE_CPU, "cv::equalizeHist", "cpu"},
+        {YENHANCE_NEON, "Striped NEON equalization", "neon"},
+        {YENHANCE_CLAHE, "cv::CLAHE", "clahe"},
+        {YENHANCE_CLAHE_VIDEO, "Frame-to-frame CLAHE", "clahe-video"},
+        {YENHANCE_FPGA, "equalizeHist_accel (FPGA)", "fpga"},
+        {YENHANCE_CLAHE_FPGA, "clahe_accel (FPGA)", "clahe-fpga"},
+        {0, NULL, NULL},
+    };
+    if (g_once_init_enter(&type)) {
+        g_once_init_leave(&type, g_enum_register_static("GstYEnhanceBackend", values));
+    }
+    return (GType)type;
+}
+
+#ifdef WITH_FPGA
+// One program load per element, one in-order queue; buffers follow the frame size
+struct YEnhanceFpga {
+    cl::Context context;
+    cl::Device device;
+    cl::Program program;
+    cl::CommandQueue queue;
+    cl::Kernel kernel;
+    cl::Buffer in, ref, out;
+    size_t size{0};
+    bool primed{false};     // clahe_accel holds LUTs built from a frame of this size
+};
+
+static bool yenhance_fpga_init(YEnhanceFpga *f, bool clahe) {
+    std::vector<cl::Device> devices = xcl::get_xil_devices();
+    if (devices.empty()) return false;
+    f->device = devices[0];
+    f->context = cl::Context(f->device);
+    std::string device_name = f->device.getInfo<CL_DEVICE_NAME>();
+    cl::Program::Binaries bins = xcl::import_binary_file(xcl::find_binary_file(device_name, "krnl_hist_equalize"));
+    std::vector<cl::Device> prog_devices = {f->device};
+    cl_int err = CL_SUCCESS;
+    f->program = cl::Program(f->context, prog_devices, bins, nullptr, &err);
+    if (err == CL_SUCCESS) f->queue = cl::CommandQueue(f->context, f->device, 0, &err);
+    if (err == CL_SUCCESS) f->kernel = cl::Kernel(f->program, clahe ? "clahe_accel" : "equalizeHist_accel", &err);
+    return err == CL_SUCCESS;
+}
+
+// y: continuous CV_8UC1, equalized in place. clahe_accel remaps with the tile LUTs its
+// previous call built, so the first frame of a size runs it twice to build its own.
+static bool yenhance_fpga_apply(YEnhanceFpga *f, bool clahe, cv::Mat &y, double clip_limit, int tiles) {
+    const size_t size = y.total();
+    cl_int err = CL_SUCCESS;
+    if (f->size != size) {
+        f->in = cl::Buffer(f->context, CL_MEM_READ_ONLY, size, nullptr, &err);
+        if (err == CL_SUCCESS && !clahe) f->ref = cl::Buffer(f->context, CL_MEM_READ_ONLY, size, nullptr, &err);
+        if (err == CL_SUCCESS) f->out = cl::Buffer(f->context, CL_MEM_WRITE_ONLY, size, nullptr, &err);
+        if (err != CL_SUCCESS) return false;
+        f->size = size;
+        f->primed = false;
+    }
+    if (clahe) {
+        clahe_fpga_set_args(f->kernel, f->in, f->out, y.cols, y.rows, clip_limit, tiles);
+        return clahe_fpga_run(f->queue, f->kernel, f->in, f->out, y.data, y.data, size, &f->primed) == CL_SUCCESS;
+    }
+    f->kernel.setArg(0, f->in);
+    f->kernel.setArg(1, f->ref);
+    f->kernel.setArg(2, f->out);
+    f->kernel.setArg(3, y.rows);
+    f->kernel.setArg(4, y.cols);
+    err = f->queue.enqueueWriteBuffer(f->in, CL_FALSE, 0, size, y.data);
+    if (err == CL_SUCCESS) err = f->queue.enqueueWriteBuffer(f->ref, CL_FALSE, 0, size, y.data);
+    if (err == CL_SUCCESS) err = f->queue.enqueueTask(f->kernel);
+    if (err == CL_SUCCESS) err = f->queue.enqueueReadBuffer(f->out, CL_TRUE, 0, size, y.data);
+    return err == CL_SUCCESS;
+}
+#endif
+
+// Everything with a C++ constructor lives here; the GObject instance only holds a pointer
+struct YEnhanceState {
+    cv::Ptr<cv::CLAHE> clahe;
+    VideoClahe video_clahe;
+    cv::Mat scratch;                 // CLAHE output, or a packed Y plane for the FPGA
+#ifdef WITH_FPGA
+    YEnhanceFpga fpga;
+#endif
+    bool ready{false};
+    YEnhanceBackend ready_backend{YENHANCE_CPU};
+    double ready_clip_limit{0.0};    // clahe-video: what video_clahe was set up with
+    int ready_tiles{0};
+
+    guint64 frames{0};
+    gint64 busy_us{0};
+};
+
+#define GST_TYPE_YENHANCE (gst_yenhance_get_type())
+G_DECLARE_FINAL_TYPE(GstYEnhance, gst_yenhance, GST, YENHANCE, GstVideoFilter)
+
+struct _GstYEnhance {
+    GstVideoFilter parent;
+
+    // Properties, under the object lock
+    YEnhanceBackend backend;
+    gdouble clip_limit;
+    gint tiles;
+    gint stripes;
+    gdouble threshold;
+
+    YEnhanceState *state;            // streaming thread only, between start and stop
+};
+
+G_DEFINE_TYPE(GstYEnhance, gst_yenhance, GST_TYPE_VIDEO_FILTER)
+
+enum {
+    PROP_0,
+    PROP_BACKEND,
+    PROP_CLIP_LIMIT,
+    PROP_TILES,
+    PROP_STRIPES,
+    PROP_THRESHOLD,
+};
+
+#define YENHANCE_CAPS GST_VIDEO_CAPS_MAKE("{ NV12, I420, GRAY8 }")
+
+static GstStaticPadTemplate yenhance_sink_template =
+    GST_STATIC_PAD_TEMPLATE("sink", GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS(YENHANCE_CAPS));
+static GstStaticPadTemplate yenhance_src_template =
+    GST_STATIC_PAD_TEMPLATE("src", GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS(YENHANCE_CAPS));
+
+static void gst_yenhance_set_property(GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec) {
+    GstYEnhance *self = GST_YENHANCE(object);
+    GST_OBJECT_LOCK(self);
+    switch (prop_id) {
+        case PROP_BACKEND: self->backend = (YEnhanceBackend)g_value_get_enum(value); break;
+        case PROP_CLIP_LIMIT: self->clip_limit = g_value_get_double(value); break;
+        case PROP_TILES: self->tiles = g_value_get_int(value); break;
+        case PROP_STRIPES: self->stripes = g_value_get_int(value); break;
+        case PROP_THRESHOLD: self->threshold = g_value_get_double(value); break;
+        default: G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec); break;
+    }
+    GST_OBJECT_UNLOCK(self);
+}
+
+static void gst_yenhance_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec) {
+    GstYEnhance *self = GST_YENHANCE(object);
+    GST_OBJECT_LOCK(self);
+    switch (prop_id) {
+        case PROP_BACKEND: g_value_set_enum(value, self->backend); break;
+        case PROP_CLIP_LIMIT: g_value_set_double(value, self->clip_limit); break;
+        case PROP_TILES: g_value_set_int(value, self->tiles); break;
+        case PROP_STRIPES: g_value_set_int(value, self->stripes); break;
+        case PROP_THRESHOLD: g_value_set_double(value, self->threshold); break;
+        default: G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec); break;
+    }
+    GST_OBJECT_UNLOCK(self);
+}
+
+static gboolean gst_yenhance_start(GstBaseTransform *trans) {
+    GstYEnhance *self = GST_YENHANCE(trans);
+    self->state = new YEnhanceState();
+    return TRUE;
+}
+
+static gboolean gst_yenhance_stop(GstBaseTransform *trans) {
+    GstYEnhance *self = GST_YENHANCE(trans);
+    YEnhanceState *s = self->state;
+    if (s && s->frames > 0) {
+        GST_INFO_OBJECT(self, "%" G_GUINT64_FORMAT " frames, %.3f ms per frame", s->frames,
+                        s->busy_us / 1000.0 / s->frames);
+    }
+    delete s;
+    self->state = NULL;
+    return TRUE;
+}
+
+static bool yenhance_is_fpga(YEnhanceBackend backend) {
+    return backend == YENHANCE_FPGA || backend == YENHANCE_CLAHE_FPGA;
+}
+
+static bool yenhance_fpga_fits(int width, int height) {
+    return width <= YENHANCE_FPGA_MAX_WIDTH && height <= YENHANCE_FPGA_MAX_HEIGHT;
+}
+
+// Per-backend setup, done on the first frame and again when the backend property changes.
+// clahe-video's tile grid is laid out by video_clahe_init, so a clip-limit or tiles change
+// sets it up again (dropping its cached LUTs).
+static bool gst_yenhance_prepare(GstYEnhance *self, YEnhanceState *s, YEnhanceBackend backend,
+                                 double clip_limit, int tiles, double threshold) {
+    const bool clahe_video_changed = backend == YENHANCE_CLAHE_VIDEO &&
+                                     (clip_limit != s->ready_clip_limit || tiles != s->ready_tiles);
+    if (s->ready && s->ready_backend == backend && !clahe_video_changed) return true;
+    switch (backend) {
+        case YENHANCE_CLAHE:
+            s->clahe = cv::createCLAHE(clip_limit, cv::Size(tiles, tiles));
+            break;
+        case YENHANCE_CLAHE_VIDEO:
+            video_clahe_init(&s->video_clahe, clip_limit, tiles, threshold);
+            s->ready_clip_limit = clip_limit;
+            s->ready_tiles = tiles;
+            break;
+        case YENHANCE_FPGA:
+        case YENHANCE_CLAHE_FPGA:
+#ifdef WITH_FPGA
+            if (!yenhance_fpga_init(&s->fpga, backend == YENHANCE_CLAHE_FPGA)) {
+                GST_ELEMENT_ERROR(self, RESOURCE, OPEN_READ_WRITE, ("FPGA setup failed"),
+                                  ("no Xilinx device, or no %s in krnl_hist_equalize.xclbin",
+                                   backend == YENHANCE_CLAHE_FPGA ? "clahe_accel" : "equalizeHist_accel"));
+                return false;
+            }
+            s->fpga.size = 0;
+            break;
+#else
+            GST_ELEMENT_ERROR(self, CORE, NOT_IMPLEMENTED, ("FPGA backends not built"),
+                              ("rebuild the plugin with -DWITH_FPGA"));
+            return false;
+#endif
+        default:
+            break;
+    }
+    s->ready = true;
+    s->ready_backend = backend;
+    return true;
+}
+
+// The FPGA kernels are synthesized for 4k at most; refuse bigger caps rather than overrun them
+static gboolean gst_yenhance_set_info(GstVideoFilter *filter, GstCaps *incaps, GstVideoInfo *in_info,
+                                      GstCaps *outcaps, GstVideoInfo *out_info) {
+    GstYEnhance *self = GST_YENHANCE(filter);
+    GST_OBJECT_LOCK(self);
+    const YEnhanceBackend backend = self->backend;
+    GST_OBJECT_UNLOCK(self);
+
+    const int width = GST_VIDEO_INFO_WIDTH(in_info);
+    const int height = GST_VIDEO_INFO_HEIGHT(in_info);
+    if (yenhance_is_fpga(backend) && !yenhance_fpga_fits(width, height)) {
+        GST_ERROR_OBJECT(self, "%dx%d exceeds the FPGA kernels' %dx%d", width, height,
+                         YENHANCE_FPGA_MAX_WIDTH, YENHANCE_FPGA_MAX_HEIGHT);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static GstFlowReturn gst_yenhance_transform_frame_ip(GstVideoFilter *filter, GstVideoFrame *frame) {
+    GstYEnhance *self = GST_YENHANCE(filter);
+    YEnhanceState *s = self->state;
+
+    GST_OBJECT_LOCK(self);
+    const YEnhanceBackend backend = self->backend;
+    const double clip_limit = self->clip_limit;
+    const int tiles = self->tiles;
+    const int stripes = self->stripes;
+    const double threshold = self->threshold;
+    GST_OBJECT_UNLOCK(self);
+
+    if (!gst_yenhance_prepare(self, s, backend, clip_limit, tiles, threshold)) return GST_FLOW_ERROR;
+
+    const gint64 t0 = g_get_monotonic_time();
+    cv::Mat y(GST_VIDEO_FRAME_COMP_HEIGHT(frame, 0), GST_VIDEO_FRAME_COMP_WIDTH(frame, 0), CV_8UC1,
+              GST_VIDEO_FRAME_PLANE_DATA(frame, 0), GST_VIDEO_FRAME_PLANE_STRIDE(frame, 0));
+
+    switch (backend) {
+        case YENHANCE_CPU:
+            cv::equalizeHist(y, y);
+            break;
+        case YENHANCE_NEON:
+            neon_equalize_hist(y, y, stripes);
+            break;
+        case YENHANCE_CLAHE:
+            s->clahe->setClipLimit(clip_limit);
+            s->clahe->setTilesGridSize(cv::Size(tiles, tiles));
+            s->clahe->apply(y, s->scratch);
+            s->scratch.copyTo(y);
+            break;
+        case YENHANCE_CLAHE_VIDEO:
+            s->video_clahe.threshold = threshold;
+            video_clahe_apply(&s->video_clahe, y, s->scratch);
+            s->scratch.copyTo(y);
+            break;
+        case YENHANCE_FPGA:
+        case YENHANCE_CLAHE_FPGA: {
+#ifdef WITH_FPGA
+            // set_info only saw the backend selected at negotiation time
+            if (!yenhance_fpga_fits(y.cols, y.rows)) {
+                GST_ELEMENT_ERROR(self, STREAM, FORMAT, ("Frame too large for the FPGA"),
+                                  ("%dx%d exceeds %dx%d", y.cols, y.rows, YENHANCE_FPGA_MAX_WIDTH,
+                                   YENHANCE_FPGA_MAX_HEIGHT));
+                return GST_FLOW_ERROR;
+            }
+            // The kernels read the plane as one block: pack padded rows first
+            const bool packed = y.isContinuous();
+            if (!packed) y.copyTo(s->scratch);
+            cv::Mat &plane = packed ? y : s->scratch;
+            if (!yenhance_fpga_apply(&s->fpga, backend == YENHANCE_CLAHE_FPGA, plane, clip_limit,
+                                     std::min(tiles, YENHANCE_TILES_MAX_FPGA))) {
+                GST_ELEMENT_ERROR(self, RESOURCE, FAILED, ("FPGA equalization failed"), (NULL));
+                return GST_FLOW_ERROR;
+            }
+            if (!packed) s->scratch.copyTo(y);
+#endif
+            break;
+        }
+    }
+
+    s->busy_us += g_get_monotonic_time() - t0;
+    s->frames++;
+    return GST_FLOW_OK;
+}
+
+static void gst_yenhance_class_init(GstYEnhanceClass *klass) {
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+    GstBaseTransformClass *trans_class = GST_BASE_TRANSFORM_CLASS(klass);
+    GstVideoFilterClass *filter_class = GST_VIDEO_FILTER_CLASS(klass);
+
+    gobject_class->set_property = gst_yenhance_set_property;
+    gobject_class->get_property = gst_yenhance_get_property;
+
+    const GParamFlags flags = (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING);
+    g_object_class_install_property(gobject_class, PROP_BACKEND,
+        g_param_spec_enum("backend", "Backend", "Where the Y plane is enhanced",
+                          yenhance_backend_get_type(), YENHANCE_NEON, flags));
+    g_object_class_install_property(gobject_class, PROP_CLIP_LIMIT,
+        g_param_spec_double("clip-limit", "Clip limit", "CLAHE contrast limit",
+                            0.1, 40.0, YENHANCE_CLIP_LIMIT_DEFAULT, flags));
+    g_object_class_install_property(gobject_class, PROP_TILES,
+        g_param_spec_int("tiles", "Tiles", "CLAHE tile grid (N x N); clahe-fpga caps it at 8",
+                         1, 64, YENHANCE_TILES_DEFAULT, flags));
+    g_object_class_install_property(gobject_class, PROP_STRIPES,
+        g_param_spec_int("stripes", "Stripes", "Row stripes for the neon backend",
+                         1, 64, NEON_EQ_STRIPES_DEFAULT, flags));
+    g_object_class_install_property(gobject_class, PROP_THRESHOLD,
+        g_param_spec_double("threshold", "Threshold",
+                            "clahe-video: mean grey-level change before a tile's LUT is rebuilt",
+                            0.0, 255.0, VIDEO_CLAHE_THRESHOLD_DEFAULT, flags));
+
+    gst_element_class_set_static_metadata(element_class, "Luma enhancement", "Filter/Effect/Video",
+                                          "Histogram equalization or CLAHE of the Y plane on the CPU or the FPGA",
+                                          "OpenCV-OpenCL");
+    gst_element_class_add_static_pad_template(element_class, &yenhance_sink_template);
+    gst_element_class_add_static_pad_template(element_class, &yenhance_src_template);
+
+    trans_class->start = GST_DEBUG_FUNCPTR(gst_yenhance_start);
+    trans_class->stop = GST_DEBUG_FUNCPTR(gst_yenhance_stop);
+    filter_class->set_info = GST_DEBUG_FUNCPTR(gst_yenhance_set_info);
+    filter_class->transform_frame_ip = GST_DEBUG_FUNCPTR(gst_yenhance_transform_frame_ip);
+}
+
+static void gst_yenhance_init(GstYEnhance *self) {
+    self->backend = YENHANCE_NEON;
+    self->clip_limit = YENHANCE_CLIP_LIMIT_DEFAULT;
+    self->tiles = YENHANCE_TILES_DEFAULT;
+    self->stripes = NEON_EQ_STRIPES_DEFAULT;
+    self->threshold = VIDEO_CLAHE_THRESHOLD_DEFAULT;
+    self->state = NULL;
+    gst_base_transform_set_in_place(GST_BASE_TRANSFORM(self), TRUE);
+}
+
+static gboolean plugin_init(GstPlugin *plugin) {
+    GST_DEBUG_CATEGORY_INIT(yenhance_debug, "yenhance", 0, "Luma enhancement");
+    return gst_element_register(plugin, "yenhance", GST_RANK_NONE, GST_TYPE_YENHANCE);
+}
+
+GST_PLUGIN_DEFINE(GST_VERSION_MAJOR, GST_VERSION_MINOR, yenhance,
+                  "Histogram equalization / CLAHE of the luma plane",
+                  plugin_init, VERSION, "Proprietary", PACKAGE, "OpenCV-OpenCL")
@@ -0,0 +1,313 @@
+// image_batch.hpp
+// Batch mode for the single-frame tools: one process for a whole set of stills.
+//
+// --batch=PATH takes a directory (every .jpg/.jpeg/.png/.bmp/.tif in it, sorted) or a
+// text file with one image path per line. --threads workers each take the next image
+// and run it through read -> decode -> process -> encode -> write, so with four workers
+// one image decodes while another is processed and a third is written. Each worker
+// keeps its file buffer, decoded image, planes and encode buffer between images;
+// cv::imdecode and Mat::create reuse them while the size stays the same, so a set of
+// same-size stills allocates once per worker.
+//
+// Only the Y plane is processed:
+//   colour  BGR -> YUV, Y extracted, processed and put back, YUV -> BGR
+//   --gray  decode straight to luma (libjpeg hands over the Y component without any
+//           colour conversion) and write the processed Y
+// --reduce=2|4|8 decodes through the JPEG DCT scaling (IMREAD_REDUCED_*).
+// A backend with a single device context (one FPGA queue) sets serial_process; the
+// workers then take turns in the process stage while the other stages stay parallel.
+// The run ends with images/s, Mpix/s and the mean time per image of each stage.
+
+#ifndef IMAGE_BATCH_HPP
+#define IMAGE_BATCH_HPP
+
+#include <opencv2/opencv.hpp>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum BatchStage {
+    BATCH_READ,
+    BATCH_DECODE,
+    BATCH_CONVERT,   // BGR <-> YUV and the Y plane copies, colour only
+    BATCH_PROCESS,
+    BATCH_ENCODE,
+    BATCH_WRITE,
+    BATCH_STAGES
+};
+
+static const char *const batch_stage_names[BATCH_STAGES] = {"read", "decode", "convert", "process", "encode", "write"};
+
+struct BatchOptions {
+    std::string input;            // --batch=DIR|LIST
+    std::string out_dir{"."};     // --out-dir=DIR
+    std::string suffix;           // appended to each input basename
+    int  threads{0};              // --threads=N, 0: one per core
+    int  reduce{1};               // --reduce=2|4|8
+    bool gray{false};             // --gray
+    bool serial_process{false};   // one device context shared by all workers
+};
+
+// y_out is a reused Mat; create() it (or let the OpenCV call do so) at y_in's size
+typedef std::function<bool(const cv::Mat &y_in, cv::Mat &y_out)> BatchProcessFn;
+
+struct BatchWorker {
+    std::vector<uchar> file, encoded;
+    cv::Mat decoded, yuv, y, y_out, bgr_out;
+};
+
+struct BatchStats {
+    std::atomic<uint64_t> done{0}, failed{0}, pixels{0};
+    std::atomic<uint64_t> stage_ns[BATCH_STAGES]{};
+};
+
+// Consumes the batch options; false for anything else
+static inline bool batch_parse_arg(const char *a, BatchOptions *o) {
+    if (strncmp(a, "--batch=", 8) == 0) o->input = a + 8;
+    else if (strncmp(a, "--out-dir=", 10) == 0) o->out_dir = a + 10;
+    else if (strncmp(a, "--threads=", 10) == 0) { int n = atoi(a + 10); if (n > 0) o->threads = n; }
+    else if (strncmp(a, "--reduce=", 9) == 0) {
+        int n = atoi(a + 9);
+        if (n == 1 || n == 2 || n == 4 || n == 8) o->reduce = n;
+        else std::cerr << "Warning: --reduce must be 1, 2, 4 or 8\n";
+    }
+    else if (strcmp(a, "--gray") == 0) o->gray = true;
+    else return false;
+    return true;
+}
+
+static inline void batch_usage(const char *argv0, const char *extra) {
+    std::cerr << "Batch: " << argv0 << " --batch=<dir|list.txt> [--out-dir=DIR] [--threads=N] [--gray]"
+              << " [--reduce=2|4|8]" << (extra ? extra : "") << "\n";
+}
+
+static inline int batch_read_flags(const BatchOptions &o) {
+    switch (o.reduce) {
+        case 2: return o.gray ? cv::IMREAD_REDUCED_GRAYSCALE_2 : cv::IMREAD_REDUCED_COLOR_2;
+        case 4: return o.gray ? cv::IMREAD_REDUCED_GRAYSCALE_4 : cv::IMREAD_REDUCED_COLOR_4;
+        case 8: return o.gray ? cv::IMREAD_REDUCED_GRAYSCALE_8 : cv::IMREAD_REDUCED_COLOR_8;
+        default: return o.gray ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR;
+    }
+}
+
+static inline std::string batch_extension(const std::string &path) {
+    const size_t slash = path.find_last_of("/\\");
+    const size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return ".jpg";
+    std::string ext = path.substr(dot);
+    for (auto &c : ext) c = (char)tolower((unsigned char)c);
+    return ext;
+}
+
+static inline bool batch_is_image(const std::string &path) {
+    static const char *const exts[] = {".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff"};
+    const std::string ext = batch_extension(path);
+    for (const char *e : exts) if (ext == e) return true;
+    return false;
+}
+
+static inline std::string batch_output_path(const BatchOptions &o, const std::string &input) {
+    const size_t slash = input.find_last_of("/\\");
+    std::string base = slash == std::string::npos ? input : input.substr(slash + 1);
+    const size_t dot = base.find_last_of('.');
+    if (dot != std::string::npos) base.resize(dot);
+    return o.out_dir + "/" + base + o.suffix + batch_extension(input);
+}
+
+// Directory: its images, sorted. Otherwise a list file: one path per line, '#' comments.
+static inline bool batch_collect(const std::string &input, std::vector<std::string> *files) {
+    struct stat st;
+    if (stat(input.c_str(), &st) != 0) {
+        std::cerr << "Error: cannot open " << input << "\n";
+        return false;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        std::vector<cv::String> all;
+        cv::glob(input + "/*", all, false);
+        for (const auto &f : all) if (batch_is_image(f)) files->push_back(f);
+        std::sort(files->begin(), files->end());
+        return true;
+    }
+    std::ifstream list(input);
+    std::string line;
+    while (std::getline(list, line)) {
+        while (!line.empty() && isspace((unsigned char)line.back())) line.pop_back();
+        if (!line.empty() && line[0] != '#') files->push_back(line);
+    }
+    return true;
+}
+
+static inline bool batch_read_file(const std::string &path, std::vector<uchar> *buf) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    const long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    bool ok = size > 0;
+    if (ok) {
+        buf->resize((size_t)size);
+        ok = fread(buf->data(), 1, (size_t)size, f) == (size_t)size;
+    }
+    fclose(f);
+    return ok;
+}
+
+static inline bool batch_write_file(const std::string &path, const std::vector<uchar> &buf) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    const bool ok = fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+    return fclose(f) == 0 && ok;
+}
+
+static inline uint64_t batch_ns_since(std::chrono::steady_clock::time_point *t) {
+    const auto now = std::chrono::steady_clock::now();
+    const uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - *t).count();
+    *t = now;
+    return ns;
+}
+
+static inline bool batch_one(const BatchOptions &o, const std::string &path, const BatchProcessFn &process,
+                             std::mutex *process_lock, BatchWorker *w, BatchStats *s) {
+    uint64_t ns[BATCH_STAGES] = {0};
+    auto t = std::chrono::steady_clock::now();
+
+    if (!batch_read_file(path, &w->file)) {
+        std::cerr << "Error: cannot read " << path << "\n";
+        return false;
+    }
+    ns[BATCH_READ] = batch_ns_since(&t);
+
+    cv::imdecode(w->file, batch_read_flags(o), &w->decoded);
+    if (w->decoded.empty()) {
+        std::cerr << "Error: cannot decode " << path << "\n";
+        return false;
+    }
+    ns[BATCH_DECODE] = batch_ns_since(&t);
+
+    const cv::Mat *y = &w->decoded;
+    if (!o.gray) {
+        cv::cvtColor(w->decoded, w->yuv, cv::COLOR_BGR2YUV);
+        cv::extractChannel(w->yuv, w->y, 0);
+        y = &w->y;
+        ns[BATCH_CONVERT] = batch_ns_since(&t);
+    }
+
+    bool ok;
+    {
+        std::unique_lock<std::mutex> lock;
+        if (process_lock) lock = std::unique_lock<std::mutex>(*process_lock);
+        ok = process(*y, w->y_out);
+    }
+    if (!ok || w->y_out.size() != y->size()) {
+        std::cerr << "Error: processing failed for " << path << "\n";
+        return false;
+    }
+    ns[BATCH_PROCESS] = batch_ns_since(&t);
+
+    const cv::Mat *out = &w->y_out;
+    if (!o.gray) {
+        cv::insertChannel(w->y_out, w->yuv, 0);
+        cv::cvtColor(w->yuv, w->bgr_out, cv::COLOR_YUV2BGR);
+        out = &w->bgr_out;
+        ns[BATCH_CONVERT] += batch_ns_since(&t);
+    }
+
+    const std::string out_path = batch_output_path(o, path);
+    if (!cv::imencode(batch_extension(path), *out, w->encoded)) {
+        std::cerr << "Error: cannot encode " << out_path << "\n";
+        return false;
+    }
+    ns[BATCH_ENCODE] = batch_ns_since(&t);
+
+    if (!batch_write_file(out_path, w->encoded)) {
+        std::cerr << "Error: cannot write " << out_path << "\n";
+        return false;
+    }
+    ns[BATCH_WRITE] = batch_ns_since(&t);
+
+    for (int i = 0; i < BATCH_STAGES; ++i) s->stage_ns[i].fetch_add(ns[i], std::memory_order_relaxed);
+    s->pixels.fetch_add((uint64_t)y->total(), std::memory_order_relaxed);
+    return true;
+}
+
+// Runs the whole batch and prints the summary; true when every image was written
+static inline bool batch_run(BatchOptions o, const BatchProcessFn &process) {
+    std::vector<std::string> files;
+    if (!batch_collect(o.input, &files)) return false;
+    if (files.empty()) {
+        std::cerr << "Error: no images in " << o.input << "\n";
+        return false;
+    }
+    if (o.threads <= 0) o.threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    o.threads = std::min<int>(o.threads, (int)files.size());
+    // The workers are the parallelism; OpenCV's own pool inside each call would oversubscribe the cores
+    if (o.threads > 1) cv::setNumThreads(1);
+
+    std::cout << "Batch: " << files.size() << " images, " << o.threads << " threads, "
+              << (o.gray ? "gray" : "colour") << (o.reduce > 1 ? ", reduced 1/" + std::to_string(o.reduce) : "")
+              << " -> " << o.out_dir << std::endl;
+
+    BatchStats stats;
+    std::mutex process_lock;
+    std::atomic<size_t> next{0};
+    const auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int i = 0; i < o.threads; ++i) {
+        pool.emplace_back([&] {
+            BatchWorker w;
+            for (size_t n; (n = next.fetch_add(1)) < files.size(); ) {
+                const bool ok = batch_one(o, files[n], process, o.serial_process ? &process_lock : nullptr, &w, &stats);
+                (ok ? stats.done : stats.failed).fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    for (auto &t : pool) t.join();
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    const uint64_t done = stats.done.load();
+    printf("Batch: %llu images (%llu failed) in %.2f s: %.1f images/s, %.1f Mpix/s\n",
+           (unsigned long long)done, (unsigned long long)stats.failed.load(), secs,
+           secs > 0.0 ? done / secs : 0.0, secs > 0.0 ? stats.pixels.load() / (secs * 1e6) : 0.0);
+    if (done > 0) {
+        printf("Batch stage time per image (ms):");
+        for (int i = 0; i < BATCH_STAGES; ++i) {
+            if (i == BATCH_CONVERT && o.gray) continue;
+            printf(" %s %.2f", batch_stage_names[i], stats.stage_ns[i].load() / 1e6 / done);
+        }
+        printf("\n");
+    }
+    return stats.failed.load() == 0;
+}
+
+// For tools with no options besides the batch ones. Runs the batch when argv starts with
+// an option; returns -1 without doing anything for the tool's positional form.
+static inline int batch_main(int argc, char **argv, const char *suffix, const BatchProcessFn &process) {
+    if (argc < 2 || argv[1][0] != '-') return -1;
+    BatchOptions o;
+    o.suffix = suffix;
+    for (int i = 1; i < argc; ++i) {
+        if (!batch_parse_arg(argv[i], &o)) {
+            std::cerr << "Unknown argument: " << argv[i] << "\n";
+            batch_usage(argv[0], nullptr);
+            return 1;
+        }
+    }
+    if (o.input.empty()) {
+        batch_usage(argv[0], nullptr);
+        return 1;
+    }
+    return batch_run(o, process) ? 0 : 1;
+}
+
+#endif // IMAGE_BATCH_HPP
@@ -0,0 +1,123 @@
+// latency_hist.hpp
+// Fixed-size latency histogram for the status ticks and timing reports.
+//
+// Log-bucketed: 4 sub-buckets per power of two of nanoseconds, so a percentile
+// is within ~25% of the true value, and LATENCY_HIST_BUCKETS reach ~1100 s.
+// Memory is constant however long the stream runs. Recording is a few relaxed
+// atomic ops from any thread (min/max exact, via CAS); readers either drain a
+// window or take a snapshot. LatencyStats pairs a drained window with a
+// whole-run histogram.
+
+#ifndef LATENCY_HIST_HPP
+#define LATENCY_HIST_HPP
+
+#include <atomic>
+#include <stdint.h>
+
+#define LATENCY_HIST_BUCKETS 160
+
+struct LatencyHist {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum_ns{0};
+    std::atomic<uint64_t> min_ns{UINT64_MAX};
+    std::atomic<uint64_t> max_ns{0};
+    std::atomic<uint64_t> buckets[LATENCY_HIST_BUCKETS]{};
+};
+
+struct LatencySummary {
+    uint64_t count{0};
+    double   avg_ms{0}, min_ms{0}, p50_ms{0}, p95_ms{0}, p99_ms{0}, max_ms{0};
+};
+
+// Rolling window (drained by each report) plus the whole run
+struct LatencyStats {
+    LatencyHist window;
+    LatencyHist run;
+};
+
+static inline int latency_hist_bucket(uint64_t ns) {
+    if (ns < 4) return (int)ns;
+    const int msb = 63 - __builtin_clzll(ns);
+    const int b = (msb - 1) * 4 + (int)((ns >> (msb - 2)) & 3);
+    return b < LATENCY_HIST_BUCKETS ? b : LATENCY_HIST_BUCKETS - 1;
+}
+
+// Upper edge of a bucket in ns
+static inline uint64_t latency_hist_bucket_limit(int b) {
+    if (b < 4) return (uint64_t)b + 1;
+    const int msb = b / 4 + 1;
+    return (uint64_t)(5 + b % 4) << (msb - 2);
+}
+
+static inline void latency_hist_record(LatencyHist *h, uint64_t ns) {
+    h->count.fetch_add(1, std::memory_order_relaxed);
+    h->sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    h->buckets[latency_hist_bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t lo = h->min_ns.load(std::memory_order_relaxed);
+    while (ns < lo && !h->min_ns.compare_exchange_weak(lo, ns, std::memory_order_relaxed)) {}
+    uint64_t hi = h->max_ns.load(std::memory_order_relaxed);
+    while (ns > hi && !h->max_ns.compare_exchange_weak(hi, ns, std::memory_order_relaxed)) {}
+}
+
+static inline void latency_hist_record_ms(LatencyHist *h, double ms) {
+    latency_hist_record(h, ms > 0.0 ? (uint64_t)(ms * 1e6) : 0);
+}
+
+static inline double latency_hist_percentile(const uint64_t counts[LATENCY_HIST_BUCKETS], uint64_t n, int pct) {
+    const uint64_t rank = (n * pct + 99) / 100;
+    uint64_t seen = 0;
+    int b = 0;
+    for (; b < LATENCY_HIST_BUCKETS - 1; ++b) {
+        seen += counts[b];
+        if (seen >= rank) break;
+    }
+    return (double)latency_hist_bucket_limit(b) / 1e6;
+}
+
+// Summarize into *s, emptying the histogram if `reset`; false if nothing was recorded
+static inline bool latency_hist_read(LatencyHist *h, LatencySummary *s, bool reset) {
+    uint64_t counts[LATENCY_HIST_BUCKETS];
+    uint64_t n = 0;
+    for (int b = 0; b < LATENCY_HIST_BUCKETS; ++b) {
+        counts[b] = reset ? h->buckets[b].exchange(0, std::memory_order_relaxed)
+                          : h->buckets[b].load(std::memory_order_relaxed);
+        n += counts[b];
+    }
+    const uint64_t sum = reset ? h->sum_ns.exchange(0, std::memory_order_relaxed) : h->sum_ns.load(std::memory_order_relaxed);
+    const uint64_t lo = reset ? h->min_ns.exchange(UINT64_MAX, std::memory_order_relaxed) : h->min_ns.load(std::memory_order_relaxed);
+    const uint64_t hi = reset ? h->max_ns.exchange(0, std::memory_order_relaxed) : h->max_ns.load(std::memory_order_relaxed);
+    if (reset) h->count.exchange(0, std::memory_order_relaxed);
+    if (n == 0) return false;
+    s->count  = n;
+    s->avg_ms = (double)sum / (double)n / 1e6;
+    s->min_ms = lo == UINT64_MAX ? 0.0 : (double)lo / 1e6;
+    s->max_ms = (double)hi / 1e6;
+    s->p50_ms = latency_hist_percentile(counts, n, 50);
+    s->p95_ms = latency_hist_percentile(counts, n, 95);
+    s->p99_ms = latency_hist_percentile(counts, n, 99);
+    // A bucket edge can overshoot the largest sample
+    if (s->p50_ms > s->max_ms) s->p50_ms = s->max_ms;
+    if (s->p95_ms > s->max_ms) s->p95_ms = s->max_ms;
+    if (s->p99_ms > s->max_ms) s->p99_ms = s->max_ms;
+    return true;
+}
+
+static inline bool latency_hist_drain(LatencyHist *h, LatencySummary *s) {
+    return latency_hist_read(h, s, true);
+}
+
+static inline bool latency_hist_snapshot(LatencyHist *h, LatencySummary *s) {
+    return latency_hist_read(h, s, false);
+}
+
+static inline void latency_stats_record(LatencyStats *st, uint64_t ns) {
+    latency_hist_record(&st->window, ns);
+    latency_hist_record(&st->run, ns);
+}
+
+static inline void latency_stats_record_ms(LatencyStats *st, double ms) {
+    latency_hist_record_ms(&st->window, ms);
+    latency_hist_record_ms(&st->run, ms);
+}
+
+#endif // LATENCY_HIST_HPP
@@ -0,0 +1,207 @@
+// latency_meta.hpp
+// Per-frame latency tracing from q_cam to the RTP payloader.
+//
+// A LatencyMeta is attached to every camera buffer at q_cam.sink and stamped (with
+// the monotonic gst_util_get_timestamp()) as the frame moves on: new_sample_cb,
+// worker pick-up, hand-off to the reorder stage, enc.sink and the payloader's src
+// pad. The relays copy the meta onto the output buffer they build, and since the
+// meta API carries no tags GstVideoEncoder and the RTP payloaders copy it onto
+// their output too. The relays hold the only references between appsink and
+// appsrc, so the stamps are written in place.
+//
+// enc.sink records the per-hop spans and glass-to-encoder; the payloader records
+// the encode hop and glass-to-payloader once per frame (a frame leaves as several
+// RTP packets that all carry the meta).
+
+#ifndef LATENCY_META_HPP
+#define LATENCY_META_HPP
+
+#include <gst/gst.h>
+#include <glib.h>
+#include <atomic>
+#include <string.h>
+
+#include "latency_hist.hpp"
+
+enum LatencyPoint {
+    LATENCY_CAPTURE,     // q_cam.sink
+    LATENCY_APPSINK,     // new_sample_cb
+    LATENCY_WORKER,      // popped by a worker
+    LATENCY_DONE,        // processed, handed to the reorder stage
+    LATENCY_ENCODER,     // enc.sink
+    LATENCY_PAYLOADER,   // payloader src
+    LATENCY_POINTS
+};
+
+// Name of the hop that ends at each point
+static const char *const latency_hop_names[LATENCY_POINTS] = {
+    "", "cam->appsink", "queued", "process", "output", "encode",
+};
+
+struct LatencyMeta {
+    GstMeta      meta;
+    GstClockTime stamp[LATENCY_POINTS];
+};
+
+struct LatencyTrace {
+    LatencyStats hop[LATENCY_POINTS];       // hop[p]: previous stamp -> stamp[p]
+    LatencyStats glass_to_encoder;
+    LatencyStats glass_to_payloader;
+    std::atomic<uint64_t> untraced{0};      // frames reaching enc.sink without a meta
+    GstClockTime last_payloaded{GST_CLOCK_TIME_NONE};  // payloader streaming thread only
+};
+
+static inline const GstMetaInfo *latency_meta_get_info();
+
+static inline GType latency_meta_api_get_type() {
+    static gsize type = 0;
+    static const gchar *tags[] = { NULL };
+    if (g_once_init_enter(&type)) {
+        GType t = gst_meta_api_type_register("RelayLatencyMetaAPI", tags);
+        g_once_init_leave(&type, (gsize)t);
+    }
+    return (GType)type;
+}
+
+static inline gboolean latency_meta_init(GstMeta *meta, gpointer, GstBuffer *) {
+    auto *m = (LatencyMeta*)meta;
+    for (int p = 0; p < LATENCY_POINTS; ++p) m->stamp[p] = GST_CLOCK_TIME_NONE;
+    return TRUE;
+}
+
+static inline LatencyMeta *latency_meta_get(GstBuffer *buf) {
+    return (LatencyMeta*)gst_buffer_get_meta(buf, latency_meta_api_get_type());
+}
+
+// buf must be writable
+static inline LatencyMeta *latency_meta_add(GstBuffer *buf) {
+    LatencyMeta *m = latency_meta_get(buf);
+    return m ? m : (LatencyMeta*)gst_buffer_add_meta(buf, latency_meta_get_info(), NULL);
+}
+
+// Copies, sub-buffers and encoder/payloader outputs keep the stamps of the frame they came from
+static inline gboolean latency_meta_transform(GstBuffer *dest, GstMeta *meta, GstBuffer *, GQuark, gpointer) {
+    LatencyMeta *m = latency_meta_add(dest);
+    if (!m) return FALSE;
+    memcpy(m->stamp, ((LatencyMeta*)meta)->stamp, sizeof(m->stamp));
+    return TRUE;
+}
+
+static inline const GstMetaInfo *latency_meta_get_info() {
+    static gsize info = 0;
+    if (g_once_init_enter(&info)) {
+        const GstMetaInfo *i = gst_meta_register(latency_meta_api_get_type(), "RelayLatencyMeta", sizeof(LatencyMeta),
+                                                 latency_meta_init, NULL, latency_meta_transform);
+        g_once_init_leave(&info, (gsize)i);
+    }
+    return (const GstMetaInfo*)info;
+}
+
+static inline void latency_meta_stamp(GstBuffer *buf, LatencyPoint point) {
+    if (LatencyMeta *m = latency_meta_get(buf)) m->stamp[point] = gst_util_get_timestamp();
+}
+
+// The worker's output buffer takes over the camera buffer's stamps; outbuf must be writable
+static inline void latency_meta_carry(GstBuffer *inbuf, GstBuffer *outbuf) {
+    LatencyMeta *src = latency_meta_get(inbuf);
+    if (!src) return;
+    if (LatencyMeta *dst = latency_meta_add(outbuf)) memcpy(dst->stamp, src->stamp, sizeof(dst->stamp));
+}
+
+static inline GstPadProbeReturn latency_probe_capture(GstPad *, GstPadProbeInfo *info, gpointer) {
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buf) return GST_PAD_PROBE_OK;
+    buf = gst_buffer_make_writable(buf);   // shares the memory, only the GstBuffer is copied if needed
+    GST_PAD_PROBE_INFO_DATA(info) = buf;
+    if (LatencyMeta *m = latency_meta_add(buf)) {
+        for (int p = 0; p < LATENCY_POINTS; ++p) m->stamp[p] = GST_CLOCK_TIME_NONE;
+        m->stamp[LATENCY_CAPTURE] = gst_util_get_timestamp();
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static inline GstPadProbeReturn latency_probe_encoder(GstPad *, GstPadProbeInfo *info, gpointer user_data) {
+    auto *t = (LatencyTrace*)user_data;
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    LatencyMeta *m = buf ? latency_meta_get(buf) : nullptr;
+    if (!m || !GST_CLOCK_TIME_IS_VALID(m->stamp[LATENCY_CAPTURE])) {
+        if (buf) t->untraced.fetch_add(1, std::memory_order_relaxed);
+        return GST_PAD_PROBE_OK;
+    }
+    const GstClockTime now = gst_util_get_timestamp();
+    m->stamp[LATENCY_ENCODER] = now;
+
+    // Points a frame skipped (e.g. no worker stage) fold into the next hop
+    GstClockTime prev = m->stamp[LATENCY_CAPTURE];
+    for (int p = LATENCY_APPSINK; p <= LATENCY_ENCODER; ++p) {
+        const GstClockTime s = m->stamp[p];
+        if (!GST_CLOCK_TIME_IS_VALID(s) || s < prev) continue;
+        latency_stats_record(&t->hop[p], s - prev);
+        prev = s;
+    }
+    if (now >= m->stamp[LATENCY_CAPTURE]) latency_stats_record(&t->glass_to_encoder, now - m->stamp[LATENCY_CAPTURE]);
+    return GST_PAD_PROBE_OK;
+}
+
+static inline GstPadProbeReturn latency_probe_payloader(GstPad *, GstPadProbeInfo *info, gpointer user_data) {
+    auto *t = (LatencyTrace*)user_data;
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    LatencyMeta *m = buf ? latency_meta_get(buf) : nullptr;
+    if (!m || !GST_CLOCK_TIME_IS_VALID(m->stamp[LATENCY_CAPTURE])) return GST_PAD_PROBE_OK;
+    if (m->stamp[LATENCY_CAPTURE] == t->last_payloaded) return GST_PAD_PROBE_OK;  // later packet of the same frame
+    t->last_payloaded = m->stamp[LATENCY_CAPTURE];
+
+    const GstClockTime now = gst_util_get_timestamp();
+    const GstClockTime enc = m->stamp[LATENCY_ENCODER];
+    if (GST_CLOCK_TIME_IS_VALID(enc) && now >= enc) latency_stats_record(&t->hop[LATENCY_PAYLOADER], now - enc);
+    if (now >= m->stamp[LATENCY_CAPTURE]) latency_stats_record(&t->glass_to_payloader, now - m->stamp[LATENCY_CAPTURE]);
+    return GST_PAD_PROBE_OK;
+}
+
+static inline void latency_trace_add_probe(GstElement *bin, const char *element, const char *pad,
+                                           GstPadProbeCallback cb, LatencyTrace *t) {
+    GstElement *e = gst_bin_get_by_name(GST_BIN(bin), element);
+    if (!e) {
+        g_printerr("Latency trace: no element '%s'\n", element);
+        return;
+    }
+    if (GstPad *p = gst_element_get_static_pad(e, pad)) {
+        gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, cb, t, NULL);
+        gst_object_unref(p);
+    }
+    gst_object_unref(e);
+}
+
+// Expects q_cam in the capture pipeline, enc and pay in the streaming pipeline
+static inline void latency_trace_attach(LatencyTrace *t, GstElement *sink_pipeline, GstElement *src_pipeline) {
+    latency_trace_add_probe(sink_pipeline, "q_cam", "sink", latency_probe_capture, t);
+    latency_trace_add_probe(src_pipeline, "enc", "sink", latency_probe_encoder, t);
+    latency_trace_add_probe(src_pipeline, "pay", "src", latency_probe_payloader, t);
+}
+
+// Status tick: drain the window and print glass-to-encoder/payloader and the hops
+static inline void latency_trace_print(LatencyTrace *t) {
+    LatencySummary enc, pay, hop[LATENCY_POINTS];
+    const bool have_enc = latency_hist_drain(&t->glass_to_encoder.window, &enc);
+    const bool have_pay = latency_hist_drain(&t->glass_to_payloader.window, &pay);
+    bool have_hop[LATENCY_POINTS] = {false};
+    for (int p = LATENCY_APPSINK; p < LATENCY_POINTS; ++p) have_hop[p] = latency_hist_drain(&t->hop[p].window, &hop[p]);
+
+    if (have_enc) {
+        g_print("Latency glass->encoder (ms): p50 %.2f | p95 %.2f | p99 %.2f | %" G_GUINT64_FORMAT " frames"
+                " | untraced %" G_GUINT64_FORMAT "\n",
+                enc.p50_ms, enc.p95_ms, enc.p99_ms, enc.count, t->untraced.load());
+    }
+    if (have_pay) {
+        g_print("Latency glass->payloader (ms): p50 %.2f | p95 %.2f | p99 %.2f\n", pay.p50_ms, pay.p95_ms, pay.p99_ms);
+    }
+    if (have_enc || have_pay) {
+        g_print("Latency hops p50/p99 (ms):");
+        for (int p = LATENCY_APPSINK; p < LATENCY_POINTS; ++p) {
+            if (have_hop[p]) g_print(" %s %.2f/%.2f", latency_hop_names[p], hop[p].p50_ms, hop[p].p99_ms);
+        }
+        g_print("\n");
+    }
+}
+
+#endif // LATENCY_META_HPP
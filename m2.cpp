@@ -4,7 +4,7 @@
 //
 // Build:
 // g++ -O3 -DNDEBUG -std=c++17 nv12_style_test.cpp -o nv12_style_test \
-//   $(pkg-config --cflags --libs opencv4)
+//   $(pkg-config --cflags --libs opencv4) -lpthread
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/imgproc.hpp>
@@ -12,9 +12,19 @@
 #include <string>
 #include <chrono>
 
+#include "image_batch.hpp"
+
 int main(int argc, char* argv[]) {
+    // --batch=DIR|LIST: the same Y equalization over every image, one process
+    const int batch_rc = batch_main(argc, argv, "_enhanced", [](const cv::Mat &y, cv::Mat &y_eq) {
+        cv::equalizeHist(y, y_eq);
+        return true;
+    });
+    if (batch_rc >= 0) return batch_rc;
+
     if (argc != 3) {
         std::cout << "Usage: " << argv[0] << " <input.jpg> <output.jpg>" << std::endl;
+        batch_usage(argv[0], nullptr);
         return -1;
     }
 
@@ -0,0 +1,202 @@
+// metrics_server.hpp
+// Prometheus text endpoint for the relay counters (--metrics-port=N).
+//
+// A SoupServer on the default GLib main context answers GET /metrics by calling
+// the relay's render function, which writes the Counters atomics, the rates the
+// status tick derived and the whole-run latency histograms with relaxed loads
+// only, so a scrape never takes a lock the workers or streaming threads use.
+//
+// The endpoint needs libsoup (2.4 or 3.x, as the WebRTC senders use); build with
+//   -DWITH_METRICS $(pkg-config --cflags --libs libsoup-2.4)
+// Without WITH_METRICS the formatting helpers still build and
+// metrics_server_start() just reports that the endpoint is unavailable.
+
+#ifndef METRICS_SERVER_HPP
+#define METRICS_SERVER_HPP
+
+#include <glib.h>
+#include <atomic>
+#include <stdint.h>
+
+#include "latency_hist.hpp"
+#include "latency_meta.hpp"
+#include "frame_reorder.hpp"
+#include "frame_ring.hpp"
+#include "output_pool.hpp"
+
+#ifdef WITH_METRICS
+#include <libsoup/soup.h>
+#endif
+
+typedef void (*MetricsRenderFn)(GString *out, gpointer user_data);
+
+struct MetricsServer {
+#ifdef WITH_METRICS
+    SoupServer *server{nullptr};
+#endif
+    MetricsRenderFn render{nullptr};
+    gpointer render_data{nullptr};
+    std::atomic<uint64_t> scrapes{0};
+};
+
+/* ---------- Prometheus text format ---------- */
+
+static inline void metrics_header(GString *out, const char *name, const char *type, const char *help) {
+    if (help) g_string_append_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static inline void metrics_counter(GString *out, const char *name, const char *help, uint64_t v) {
+    metrics_header(out, name, "counter", help);
+    g_string_append_printf(out, "%s %" G_GUINT64_FORMAT "\n", name, v);
+}
+
+static inline void metrics_gauge(GString *out, const char *name, const char *help, double v) {
+    metrics_header(out, name, "gauge", help);
+    g_string_append_printf(out, "%s %.6g\n", name, v);
+}
+
+// labels: e.g. "stage=\"camera\""; pass help only with the first series of a metric
+static inline void metrics_gauge_labeled(GString *out, const char *name, const char *help, const char *labels, double v) {
+    metrics_header(out, name, "gauge", help);
+    g_string_append_printf(out, "%s{%s} %.6g\n", name, labels, v);
+}
+
+static inline void metrics_counter_labeled(GString *out, const char *name, const char *help, const char *labels, uint64_t v) {
+    metrics_header(out, name, "counter", help);
+    g_string_append_printf(out, "%s{%s} %" G_GUINT64_FORMAT "\n", name, labels, v);
+}
+
+// Whole-run LatencyHist as a Prometheus histogram in seconds. Only every 4th bucket
+// edge (the powers of two) is exported, from ~1 us to ~2 s.
+static inline void metrics_histogram(GString *out, const char *name, const char *help, const char *labels,
+                                     LatencyHist *h) {
+    metrics_header(out, name, "histogram", help);
+    const char *sep = labels ? "," : "";
+    gchar *series = labels ? g_strdup_printf("{%s}", labels) : g_strdup("");
+    if (!labels) labels = "";
+    uint64_t cumulative = 0;
+    for (int b = 0; b < LATENCY_HIST_BUCKETS; ++b) {
+        cumulative += h->buckets[b].load(std::memory_order_relaxed);
+        const uint64_t edge = latency_hist_bucket_limit(b);
+        if (b % 4 != 3 || edge < 1000 || edge > 2200000000ull) continue;
+        g_string_append_printf(out, "%s_bucket{%s%sle=\"%.9g\"} %" G_GUINT64_FORMAT "\n",
+                               name, labels, sep, (double)edge / 1e9, cumulative);
+    }
+    g_string_append_printf(out, "%s_bucket{%s%sle=\"+Inf\"} %" G_GUINT64_FORMAT "\n", name, labels, sep, cumulative);
+    g_string_append_printf(out, "%s_sum%s %.9f\n", name, series, h->sum_ns.load(std::memory_order_relaxed) / 1e9);
+    g_string_append_printf(out, "%s_count%s %" G_GUINT64_FORMAT "\n", name, series, cumulative);
+    g_free(series);
+}
+
+/* ---------- Stages shared by the relays ---------- */
+
+static inline void metrics_frame_ring(GString *out, FrameRing *r) {
+    metrics_gauge(out, "relay_ring_depth", "Frames waiting for a worker", (double)frame_ring_depth(r));
+    metrics_gauge(out, "relay_ring_capacity", "Frame ring capacity", (double)r->capacity);
+    metrics_gauge(out, "relay_ring_high_water", "Deepest the frame ring has been", (double)r->high_water.load(std::memory_order_relaxed));
+    metrics_counter_labeled(out, "relay_ring_dropped_total", "Frames dropped by the frame ring policy", "reason=\"oldest\"",
+                            r->dropped_oldest.load(std::memory_order_relaxed));
+    metrics_counter_labeled(out, "relay_ring_dropped_total", NULL, "reason=\"newest\"", r->dropped_newest.load(std::memory_order_relaxed));
+    metrics_counter_labeled(out, "relay_ring_dropped_total", NULL, "reason=\"stale\"", r->dropped_stale.load(std::memory_order_relaxed));
+}
+
+// Counters only: the number of held frames needs the reorder mutex
+static inline void metrics_reorder(GString *out, FrameReorder *r) {
+    metrics_counter(out, "relay_reorder_reordered_total", "Frames that waited for an earlier one", r->reordered.load(std::memory_order_relaxed));
+    metrics_counter(out, "relay_reorder_late_drops_total", "Frames that arrived after their gap was skipped", r->late_drops.load(std::memory_order_relaxed));
+    metrics_counter(out, "relay_reorder_gaps_total", "Sequence numbers given up on", r->gaps.load(std::memory_order_relaxed));
+}
+
+static inline void metrics_output_pool(GString *out, OutputPool *p) {
+    metrics_counter_labeled(out, "relay_output_pool_acquires_total", "Output buffers served from the pool (hit) or allocated (miss)",
+                            "result=\"hit\"", p->hits.load(std::memory_order_relaxed));
+    metrics_counter_labeled(out, "relay_output_pool_acquires_total", NULL, "result=\"miss\"", p->misses.load(std::memory_order_relaxed));
+}
+
+static inline void metrics_latency_trace(GString *out, LatencyTrace *t) {
+    metrics_histogram(out, "relay_glass_to_encoder_seconds", "q_cam.sink to enc.sink per frame", NULL, &t->glass_to_encoder.run);
+    metrics_histogram(out, "relay_glass_to_payloader_seconds", "q_cam.sink to the payloader per frame", NULL, &t->glass_to_payloader.run);
+    for (int p = LATENCY_APPSINK; p < LATENCY_POINTS; ++p) {
+        gchar *labels = g_strdup_printf("hop=\"%s\"", latency_hop_names[p]);
+        metrics_histogram(out, "relay_hop_seconds", p == LATENCY_APPSINK ? "Per-hop latency between trace points" : NULL,
+                          labels, &t->hop[p].run);
+        g_free(labels);
+    }
+    metrics_counter(out, "relay_untraced_frames_total", "Frames reaching enc.sink without a latency meta", t->untraced.load(std::memory_order_relaxed));
+}
+
+/* ---------- HTTP endpoint ---------- */
+
+#ifdef WITH_METRICS
+static inline GString *metrics_server_render(MetricsServer *m) {
+    GString *out = g_string_sized_new(8192);
+    m->scrapes.fetch_add(1, std::memory_order_relaxed);
+    if (m->render) m->render(out, m->render_data);
+    metrics_counter(out, "relay_metrics_scrapes_total", "Scrapes of this endpoint", m->scrapes.load());
+    return out;
+}
+
+#if defined(SOUP_MAJOR_VERSION) && (SOUP_MAJOR_VERSION >= 3)
+static inline void metrics_server_handler(SoupServer *, SoupServerMessage *msg, const char *, GHashTable *,
+                                          gpointer user_data) {
+    if (g_strcmp0(soup_server_message_get_method(msg), "GET") != 0) {
+        soup_server_message_set_status(msg, SOUP_STATUS_METHOD_NOT_ALLOWED, NULL);
+        return;
+    }
+    GString *out = metrics_server_render((MetricsServer*)user_data);
+    const gsize len = out->len;
+    soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+    soup_server_message_set_response(msg, "text/plain; version=0.0.4", SOUP_MEMORY_TAKE,
+                                     g_string_free(out, FALSE), len);
+}
+#else
+static inline void metrics_server_handler(SoupServer *, SoupMessage *msg, const char *, GHashTable *,
+                                          SoupClientContext *, gpointer user_data) {
+    if (msg->method != SOUP_METHOD_GET) {
+        soup_message_set_status(msg, SOUP_STATUS_METHOD_NOT_ALLOWED);
+        return;
+    }
+    GString *out = metrics_server_render((MetricsServer*)user_data);
+    const gsize len = out->len;
+    soup_message_set_status(msg, SOUP_STATUS_OK);
+    soup_message_set_response(msg, "text/plain; version=0.0.4", SOUP_MEMORY_TAKE, g_string_free(out, FALSE), len);
+}
+#endif
+#endif // WITH_METRICS
+
+// Serve /metrics on all interfaces; the handler runs on the default main context
+static inline bool metrics_server_start(MetricsServer *m, guint port, MetricsRenderFn render, gpointer data) {
+    m->render = render;
+    m->render_data = data;
+#ifdef WITH_METRICS
+    GError *err = NULL;
+    m->server = soup_server_new(NULL, NULL);
+    soup_server_add_handler(m->server, "/metrics", metrics_server_handler, m, NULL);
+    if (!soup_server_listen_all(m->server, port, (SoupServerListenOptions)0, &err)) {
+        g_printerr("Metrics: cannot listen on port %u: %s\n", port, err ? err->message : "?");
+        g_clear_error(&err);
+        g_object_unref(m->server);
+        m->server = nullptr;
+        return false;
+    }
+    g_print("Metrics: http://0.0.0.0:%u/metrics\n", port);
+    return true;
+#else
+    g_printerr("Metrics: --metrics-port=%u ignored, built without -DWITH_METRICS\n", port);
+    return false;
+#endif
+}
+
+static inline void metrics_server_stop(MetricsServer *m) {
+#ifdef WITH_METRICS
+    if (m->server) {
+        soup_server_disconnect(m->server);
+        g_object_unref(m->server);
+        m->server = nullptr;
+    }
+#else
+    (void)m;
+#endif
+}
+
+#endif // METRICS_SERVER_HPP
@@ -0,0 +1,157 @@
+// neon_equalize.hpp
+// Y-plane histogram equalization for the CPU relays (--eq-backend=neon).
+//
+// The plane is split into row stripes that run on OpenCV's thread pool. Each stripe
+// builds a partial histogram; the partials are merged and turned into the CDF LUT
+// once, then the stripes apply the LUT again in parallel. On AArch64 the LUT is
+// applied 16 pixels at a time with four 64-entry TBL/TBX lookups. The LUT uses the
+// same formula as cv::equalizeHist, so the output is bit-identical.
+
+#ifndef NEON_EQUALIZE_HPP
+#define NEON_EQUALIZE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#define NEON_EQ_BINS 256
+#define NEON_EQ_STRIPES_DEFAULT 4     // one per Cortex-A53 core
+
+// Four interleaved sub-histograms so consecutive equal pixels don't serialize on one counter
+static inline void neon_eq_histogram_rows(const uint8_t *src, size_t stride, int width,
+                                          int row_begin, int row_end, uint32_t hist[NEON_EQ_BINS]) {
+    uint32_t sub[4][NEON_EQ_BINS];
+    memset(sub, 0, sizeof(sub));
+    for (int y = row_begin; y < row_end; ++y) {
+        const uint8_t *p = src + (size_t)y * stride;
+        int x = 0;
+        for (; x + 4 <= width; x += 4) {
+            sub[0][p[x]]++;
+            sub[1][p[x + 1]]++;
+            sub[2][p[x + 2]]++;
+            sub[3][p[x + 3]]++;
+        }
+        for (; x < width; ++x) sub[0][p[x]]++;
+    }
+    for (int i = 0; i < NEON_EQ_BINS; ++i) hist[i] = sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+}
+
+// Same LUT as cv::equalizeHist
+static inline void neon_eq_build_lut(const uint32_t hist[NEON_EQ_BINS], uint32_t total, uint8_t lut[NEON_EQ_BINS]) {
+    memset(lut, 0, NEON_EQ_BINS);
+    int i = 0;
+    while (i < NEON_EQ_BINS && !hist[i]) ++i;
+    if (i == NEON_EQ_BINS) return;
+    if (hist[i] == total) {
+        memset(lut, i, NEON_EQ_BINS);   // flat image: cv::equalizeHist fills with that value
+        return;
+    }
+    const float scale = (NEON_EQ_BINS - 1.f) / (float)(total - hist[i]);
+    uint32_t sum = 0;
+    for (lut[i++] = 0; i < NEON_EQ_BINS; ++i) {
+        sum += hist[i];
+        lut[i] = cv::saturate_cast<uint8_t>((float)sum * scale);
+    }
+}
+
+#if defined(__aarch64__)
+// vld1q_u8_x4 is missing from older GCC arm_neon.h
+static inline uint8x16x4_t neon_eq_load_table(const uint8_t *p) {
+    uint8x16x4_t t;
+    t.val[0] = vld1q_u8(p);
+    t.val[1] = vld1q_u8(p + 16);
+    t.val[2] = vld1q_u8(p + 32);
+    t.val[3] = vld1q_u8(p + 48);
+    return t;
+}
+#endif
+
+static inline void neon_eq_apply_rows(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride,
+                                      int width, int row_begin, int row_end, const uint8_t lut[NEON_EQ_BINS]) {
+#if defined(__aarch64__)
+    const uint8x16x4_t t0 = neon_eq_load_table(lut);
+    const uint8x16x4_t t1 = neon_eq_load_table(lut + 64);
+    const uint8x16x4_t t2 = neon_eq_load_table(lut + 128);
+    const uint8x16x4_t t3 = neon_eq_load_table(lut + 192);
+    const uint8x16_t k64 = vdupq_n_u8(64);
+#endif
+    for (int y = row_begin; y < row_end; ++y) {
+        const uint8_t *s = src + (size_t)y * src_stride;
+        uint8_t *o = dst + (size_t)y * dst_stride;
+        int x = 0;
+#if defined(__aarch64__)
+        for (; x + 16 <= width; x += 16) {
+            // TBL gives 0 for indices >= 64, TBX keeps the lane: each pass fills one quarter of the LUT
+            uint8x16_t idx = vld1q_u8(s + x);
+            uint8x16_t r = vqtbl4q_u8(t0, idx);
+            idx = vsubq_u8(idx, k64);
+            r = vqtbx4q_u8(r, t1, idx);
+            idx = vsubq_u8(idx, k64);
+            r = vqtbx4q_u8(r, t2, idx);
+            idx = vsubq_u8(idx, k64);
+            r = vqtbx4q_u8(r, t3, idx);
+            vst1q_u8(o + x, r);
+        }
+#endif
+        for (; x < width; ++x) o[x] = lut[s[x]];
+    }
+}
+
+// Remap a plane through a known LUT, in row stripes
+static inline void neon_eq_apply(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride,
+                                 int width, int height, const uint8_t lut[NEON_EQ_BINS],
+                                 int stripes = NEON_EQ_STRIPES_DEFAULT) {
+    if (width <= 0 || height <= 0) return;
+    if (stripes < 1) stripes = 1;
+    if (stripes > height) stripes = height;
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &r) {
+        for (int s = r.start; s < r.end; ++s) {
+            neon_eq_apply_rows(src, src_stride, dst, dst_stride, width,
+                               (int)((int64_t)height * s / stripes), (int)((int64_t)height * (s + 1) / stripes), lut);
+        }
+    }, stripes);
+}
+
+// Equalize a width x height 8-bit plane; src and dst may not overlap
+static inline void neon_equalize_hist(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride,
+                                      int width, int height, int stripes = NEON_EQ_STRIPES_DEFAULT) {
+    if (width <= 0 || height <= 0) return;
+    if (stripes < 1) stripes = 1;
+    if (stripes > height) stripes = height;
+
+    std::vector<uint32_t> partial((size_t)stripes * NEON_EQ_BINS);
+    auto stripe_rows = [height, stripes](int s, int *begin, int *end) {
+        *begin = (int)((int64_t)height * s / stripes);
+        *end   = (int)((int64_t)height * (s + 1) / stripes);
+    };
+
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &r) {
+        for (int s = r.start; s < r.end; ++s) {
+            int b, e;
+            stripe_rows(s, &b, &e);
+            neon_eq_histogram_rows(src, src_stride, width, b, e, &partial[(size_t)s * NEON_EQ_BINS]);
+        }
+    }, stripes);
+
+    uint32_t hist[NEON_EQ_BINS] = {0};
+    for (int s = 0; s < stripes; ++s) {
+        const uint32_t *h = &partial[(size_t)s * NEON_EQ_BINS];
+        for (int i = 0; i < NEON_EQ_BINS; ++i) hist[i] += h[i];
+    }
+    uint8_t lut[NEON_EQ_BINS];
+    neon_eq_build_lut(hist, (uint32_t)width * (uint32_t)height, lut);
+    neon_eq_apply(src, src_stride, dst, dst_stride, width, height, lut, stripes);
+}
+
+static inline void neon_equalize_hist(const cv::Mat &src, cv::Mat &dst, int stripes = NEON_EQ_STRIPES_DEFAULT) {
+    CV_Assert(src.type() == CV_8UC1);
+    dst.create(src.size(), CV_8UC1);
+    neon_equalize_hist(src.data, src.step, dst.data, dst.step, src.cols, src.rows, stripes);
+}
+
+#endif // NEON_EQUALIZE_HPP
@@ -4,6 +4,7 @@
 // Build:
 // g++ -O3 -DNDEBUG -std=c++17 relay_debug_nv12_worker_opencv.cpp -o relay_debug_worker_opencv \
 //   $(pkg-config --cflags --libs gstreamer-1.0 gstreamer-app-1.0 gstreamer-video-1.0 opencv4) -lpthread
+// --metrics-port needs -DWITH_METRICS $(pkg-config --cflags --libs libsoup-2.4) as well
 
 #include <gst/gst.h>
 #include <gst/app/gstappsink.h>
@@ -17,8 +18,17 @@
 #include <stdio.h>
 #include <chrono>
 
+#include "frame_reorder.hpp"
+#include "frame_ring.hpp"
+#include "output_pool.hpp"
+#include "neon_equalize.hpp"
+#include "temporal_lut.hpp"
+#include "latency_meta.hpp"
+#include "metrics_server.hpp"
+#include "bench_mode.hpp"
+
 struct FrameRateCounters {
-    // Frame counters for rate calculation (reset every 2 seconds)
+    // Frame counters since start; the status tick derives rates from the deltas
     std::atomic<uint64_t> camera_frames{0};          // Frames captured from camera
     std::atomic<uint64_t> opencv_input_frames{0};    // Frames sent to OpenCV processing  
     std::atomic<uint64_t> opencv_output_frames{0};   // Frames processed by OpenCV
@@ -27,6 +37,11 @@ struct FrameRateCounters {
     // For error tracking
     std::atomic<uint64_t> processing_errors{0};
     std::atomic<uint64_t> push_failures{0};
+    std::atomic<uint64_t> sliced_frames{0};          // --slices: frames remapped in slices
+
+    // Rates over the last status interval, set by the tick (main loop only writes them)
+    uint64_t prev_camera{0}, prev_input{0}, prev_output{0}, prev_encoder{0};
+    std::atomic<double> camera_fps{0}, input_fps{0}, output_fps{0}, encoder_fps{0};
 };
 
 struct CustomData {
@@ -36,7 +51,7 @@ struct CustomData {
     GstVideoInfo video_info{};
 
     // Worker decoupling
-    GAsyncQueue *work_q{nullptr};   // carries GstBuffer* from callback to worker
+    FrameRing    work_ring{};       // bounded hand-off of GstBuffer* from callback to workers
     GThread     *worker{nullptr};
     std::atomic<bool> stop{false};
 
@@ -44,7 +59,17 @@ struct CustomData {
     int num_workers{1};
     GThread     **workers{nullptr};
 
+    FrameReorder reorder{};   // capture-order output stage in front of appsrc
+    OutputPool   out_pool{};  // preallocated NV12 buffers handed to appsrc
+    bool         neon_eq{false};                  // --eq-backend=neon: striped NEON equalizer
+    int          eq_stripes{NEON_EQ_STRIPES_DEFAULT};
+    bool         temporal{false};                 // --lut-mode=temporal: LUT from earlier frames, one pass
+    TemporalLut  tlut{};
+    LatencyTrace latency{};   // per-frame q_cam -> payloader latency (latency_meta.hpp)
+    int          slices{0};                       // --slices=N: NV12 slices per frame (0 = whole frame)
+
     FrameRateCounters ctr{};
+    MetricsServer     metrics{};   // --metrics-port: Prometheus /metrics
     GMainLoop   *loop{nullptr};
 };
 
@@ -68,6 +93,13 @@ static GstPadProbeReturn probe_encoder_input(GstPad *pad, GstPadProbeInfo *info,
 
 /* ---------- appsink callback: O(1) enqueue ---------- */
 
+// Frames the ring drops still own a sequence number; release it so output doesn't stall
+static void drop_queued_frame(gpointer user_data, GstBuffer *buf) {
+    auto *d = (CustomData*)user_data;
+    frame_reorder_push(&d->reorder, frame_reorder_seq(buf), nullptr);
+    gst_buffer_unref(buf);
+}
+
 static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
     auto *d = (CustomData *)user_data;
 
@@ -91,7 +123,9 @@ static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer user_data) {
 
     // O(1): ref buffer, queue to worker, unref sample (returns one ref to pool)
     gst_buffer_ref(inbuf);
-    g_async_queue_push(d->work_q, inbuf);
+    frame_reorder_tag(&d->reorder, inbuf);
+    latency_meta_stamp(inbuf, LATENCY_APPSINK);
+    frame_ring_push(&d->work_ring, inbuf);
 
     gst_sample_unref(sample);
     return GST_FLOW_OK;
@@ -105,10 +139,14 @@ static gpointer worker_thread_fn(gpointer user_data) {
 
     while (!d->stop.load(std::memory_order_acquire)) {
         // Pop with timeout to allow graceful exit
-        gpointer item = g_async_queue_timeout_pop(d->work_q, 50 * G_TIME_SPAN_MILLISECOND);
+        gpointer item = frame_ring_pop(&d->work_ring, 50 * G_TIME_SPAN_MILLISECOND);
         if (!item) continue;
 
         GstBuffer *inbuf = (GstBuffer*)item;
+        latency_meta_stamp(inbuf, LATENCY_WORKER);
+        const uint64_t seq = frame_reorder_seq(inbuf);
+        const GstClockTime in_pts = GST_BUFFER_PTS(inbuf);
+        const GstClockTime in_duration = GST_BUFFER_DURATION(inbuf);
 
         try {
             // Map input buffer for reading
@@ -116,12 +154,14 @@ static gpointer worker_thread_fn(gpointer user_data) {
             if (!gst_buffer_map(inbuf, &map_info, GST_MAP_READ)) {
                 gst_buffer_unref(inbuf);
                 d->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+                frame_reorder_push(&d->reorder, seq, nullptr);
                 continue;
             }
 
             if (!d->video_info_valid) {
                 gst_buffer_unmap(inbuf, &map_info);
                 gst_buffer_unref(inbuf);
+                frame_reorder_push(&d->reorder, seq, nullptr);
                 continue;
             }
 
@@ -134,15 +174,17 @@ static gpointer worker_thread_fn(gpointer user_data) {
                 gst_buffer_unmap(inbuf, &map_info);
                 gst_buffer_unref(inbuf);
                 d->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+                frame_reorder_push(&d->reorder, seq, nullptr);
                 continue;
             }
 
             // Create output buffer
-            GstBuffer *outbuf = gst_buffer_new_allocate(NULL, y_size + uv_size, NULL);
+            GstBuffer *outbuf = output_pool_acquire(&d->out_pool, &d->video_info, y_size + uv_size);
             if (!outbuf) {
                 gst_buffer_unmap(inbuf, &map_info);
                 gst_buffer_unref(inbuf);
                 d->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+                frame_reorder_push(&d->reorder, seq, nullptr);
                 continue;
             }
 
@@ -153,40 +195,56 @@ static gpointer worker_thread_fn(gpointer user_data) {
                 gst_buffer_unmap(inbuf, &map_info);
                 gst_buffer_unref(inbuf);
                 d->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
+                frame_reorder_push(&d->reorder, seq, nullptr);
                 continue;
             }
 
-            // OPTIMIZATION 1: Copy UV data first (bulk memory operation)
-            memcpy(out_map_info.data + y_size, map_info.data + y_size, uv_size);
-
-            // OPTIMIZATION 2: Process Y plane directly without OpenCV Mat clone
-            // Create OpenCV Mat views directly on buffer memory (no copy)
-            cv::Mat y_plane_in(height, width, CV_8UC1, map_info.data);
-            cv::Mat y_plane_out(height, width, CV_8UC1, out_map_info.data);
-
-            // Apply histogram equalization directly to output buffer
-            cv::equalizeHist(y_plane_in, y_plane_out);
+            // Slice mode: Y bands and their chroma rows remapped in parallel with the LUT already known
+            uint32_t slice_hist[TEMPORAL_LUT_BINS];
+            const bool sliced = d->slices > 0 &&
+                temporal_lut_remap_slices(&d->tlut, map_info.data, out_map_info.data, width, height, true, d->slices, slice_hist);
+
+            if (!sliced) {
+                // OPTIMIZATION 1: Copy UV data first (bulk memory operation)
+                memcpy(out_map_info.data + y_size, map_info.data + y_size, uv_size);
+
+                // OPTIMIZATION 2: Process Y plane directly without OpenCV Mat clone
+                // Create OpenCV Mat views directly on buffer memory (no copy)
+                cv::Mat y_plane_in(height, width, CV_8UC1, map_info.data);
+                cv::Mat y_plane_out(height, width, CV_8UC1, out_map_info.data);
+
+                // Apply histogram equalization directly to output buffer
+                if (d->temporal) temporal_lut_equalize(&d->tlut, y_plane_in.data, y_plane_in.step, y_plane_out.data,
+                                                       y_plane_out.step, width, height, d->neon_eq ? d->eq_stripes : 1);
+                else if (d->neon_eq) neon_equalize_hist(y_plane_in, y_plane_out, d->eq_stripes);
+                else cv::equalizeHist(y_plane_in, y_plane_out);
+            }
 
+            latency_meta_carry(inbuf, outbuf);   // trace stamps go with the output frame
             gst_buffer_unmap(outbuf, &out_map_info);
             gst_buffer_unmap(inbuf, &map_info);
             gst_buffer_unref(inbuf); // release camera buffer
 
-            // Fresh timestamps in appsrc pipeline
-            GST_BUFFER_PTS(outbuf)      = GST_CLOCK_TIME_NONE;
-            GST_BUFFER_DTS(outbuf)      = GST_CLOCK_TIME_NONE;
-            GST_BUFFER_DURATION(outbuf) = GST_CLOCK_TIME_NONE;
+            // Capture timestamps travel with the frame (rebased by the reorder stage)
+            frame_reorder_carry_timing(outbuf, in_pts, in_duration);
 
             // Count frame processed by OpenCV
             d->ctr.opencv_output_frames.fetch_add(1, std::memory_order_relaxed);
 
-            GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(d->appsrc), outbuf);
-            if (ret != GST_FLOW_OK) {
-                d->ctr.push_failures.fetch_add(1, std::memory_order_relaxed);
-                gst_buffer_unref(outbuf);
+            // Leaves for appsrc in capture order, possibly together with frames waiting on this one
+            latency_meta_stamp(outbuf, LATENCY_DONE);
+            guint failures = frame_reorder_push(&d->reorder, seq, outbuf);
+            if (failures) d->ctr.push_failures.fetch_add(failures, std::memory_order_relaxed);
+
+            // Off the latency path: this frame's histogram only shapes the next LUT
+            if (sliced) {
+                temporal_lut_update(&d->tlut, slice_hist);
+                d->ctr.sliced_frames.fetch_add(1, std::memory_order_relaxed);
             }
 
         } catch (const std::exception& e) {
             gst_buffer_unref(inbuf);
+            frame_reorder_push(&d->reorder, seq, nullptr);
             d->ctr.processing_errors.fetch_add(1, std::memory_order_relaxed);
             g_printerr("OpenCV error: %s\n", e.what());
         }
@@ -199,21 +257,28 @@ static gpointer worker_thread_fn(gpointer user_data) {
 static gboolean framerate_status_tick(gpointer user_data) {
     auto *d = (CustomData*)user_data;
 
-    // Get current counts
-    uint64_t camera_fps = d->ctr.camera_frames.load();
-    uint64_t opencv_input_fps = d->ctr.opencv_input_frames.load();
-    uint64_t opencv_output_fps = d->ctr.opencv_output_frames.load();
-    uint64_t encoder_fps = d->ctr.encoder_frames.load();
-    
+    // Deltas since the last tick (divide by 2 since we're measuring over 2 seconds); the
+    // counters are never reset, so an increment racing the tick is not lost
+    const uint64_t camera = d->ctr.camera_frames.load();
+    const uint64_t opencv_input = d->ctr.opencv_input_frames.load();
+    const uint64_t opencv_output = d->ctr.opencv_output_frames.load();
+    const uint64_t encoder = d->ctr.encoder_frames.load();
+    const double camera_fps = (camera - d->ctr.prev_camera) / 2.0;
+    const double opencv_input_fps = (opencv_input - d->ctr.prev_input) / 2.0;
+    const double opencv_output_fps = (opencv_output - d->ctr.prev_output) / 2.0;
+    const double encoder_fps = (encoder - d->ctr.prev_encoder) / 2.0;
+    d->ctr.prev_camera = camera;
+    d->ctr.prev_input = opencv_input;
+    d->ctr.prev_output = opencv_output;
+    d->ctr.prev_encoder = encoder;
+    d->ctr.camera_fps.store(camera_fps, std::memory_order_relaxed);
+    d->ctr.input_fps.store(opencv_input_fps, std::memory_order_relaxed);
+    d->ctr.output_fps.store(opencv_output_fps, std::memory_order_relaxed);
+    d->ctr.encoder_fps.store(encoder_fps, std::memory_order_relaxed);
+
     uint64_t processing_errors = d->ctr.processing_errors.load();
     uint64_t push_failures = d->ctr.push_failures.load();
-    int queue_length = g_async_queue_length(d->work_q);
-
-    // Reset counters for next interval (divide by 2 since we're measuring over 2 seconds)
-    d->ctr.camera_frames.store(0);
-    d->ctr.opencv_input_frames.store(0);
-    d->ctr.opencv_output_frames.store(0);
-    d->ctr.encoder_frames.store(0);
+    int queue_length = (int)frame_ring_depth(&d->work_ring);
 
     g_print(
         "\n=== FRAME RATE STATUS (2s interval) ===\n"
@@ -222,16 +287,73 @@ static gboolean framerate_status_tick(gpointer user_data) {
         "OpenCV output rate:      %.1f fps\n"
         "Encoder input rate:      %.1f fps\n"
         "Queue length: %d | Processing errors: %" G_GUINT64_FORMAT " | Push failures: %" G_GUINT64_FORMAT "\n",
-        camera_fps / 2.0,
-        opencv_input_fps / 2.0,
-        opencv_output_fps / 2.0,
-        encoder_fps / 2.0,
+        camera_fps,
+        opencv_input_fps,
+        opencv_output_fps,
+        encoder_fps,
         queue_length, processing_errors, push_failures
     );
+    g_print("Reorder (window %u): held %u | reordered %" G_GUINT64_FORMAT " | late drops %" G_GUINT64_FORMAT
+            " | gaps %" G_GUINT64_FORMAT "\n",
+            d->reorder.window, frame_reorder_held(&d->reorder), d->reorder.reordered.load(),
+            d->reorder.late_drops.load(), d->reorder.gaps.load());
+    g_print("Frame ring (%u, drop %s): high water %" G_GUINT64_FORMAT " | dropped oldest %" G_GUINT64_FORMAT
+            " | newest %" G_GUINT64_FORMAT " | stale %" G_GUINT64_FORMAT "\n",
+            (guint)d->work_ring.capacity, frame_drop_policy_name(d->work_ring.policy), d->work_ring.high_water.load(),
+            d->work_ring.dropped_oldest.load(), d->work_ring.dropped_newest.load(), d->work_ring.dropped_stale.load());
+    g_print("Output pool (%u..%u): hits %" G_GUINT64_FORMAT " | misses %" G_GUINT64_FORMAT "\n",
+            d->out_pool.min_buffers, d->out_pool.max_buffers,
+            d->out_pool.hits.load(), d->out_pool.misses.load());
+    if (d->temporal) {
+        g_print("Temporal LUT: updates %" G_GUINT64_FORMAT " | scene cuts %" G_GUINT64_FORMAT "\n",
+                d->tlut.updates.load(), d->tlut.scene_cuts.load());
+    }
+    latency_trace_print(&d->latency);
+    if (d->slices > 0) {
+        g_print("Slices: %d per frame | sliced frames %" G_GUINT64_FORMAT "\n", d->slices, d->ctr.sliced_frames.load());
+    }
 
     return TRUE;
 }
 
+/* ---------- --metrics-port: Prometheus export ---------- */
+
+static void render_metrics(GString *out, gpointer user_data) {
+    auto *d = (CustomData*)user_data;
+    FrameRateCounters &c = d->ctr;
+    metrics_counter_labeled(out, "relay_frames_total", "Frames seen at each stage", "stage=\"camera\"",
+                            c.camera_frames.load(std::memory_order_relaxed));
+    metrics_counter_labeled(out, "relay_frames_total", NULL, "stage=\"input\"", c.opencv_input_frames.load(std::memory_order_relaxed));
+    metrics_counter_labeled(out, "relay_frames_total", NULL, "stage=\"output\"", c.opencv_output_frames.load(std::memory_order_relaxed));
+    metrics_counter_labeled(out, "relay_frames_total", NULL, "stage=\"encoder\"", c.encoder_frames.load(std::memory_order_relaxed));
+    metrics_gauge_labeled(out, "relay_fps", "Frame rate over the last status interval", "stage=\"camera\"",
+                          c.camera_fps.load(std::memory_order_relaxed));
+    metrics_gauge_labeled(out, "relay_fps", NULL, "stage=\"input\"", c.input_fps.load(std::memory_order_relaxed));
+    metrics_gauge_labeled(out, "relay_fps", NULL, "stage=\"output\"", c.output_fps.load(std::memory_order_relaxed));
+    metrics_gauge_labeled(out, "relay_fps", NULL, "stage=\"encoder\"", c.encoder_fps.load(std::memory_order_relaxed));
+    metrics_counter(out, "relay_processing_errors_total", "Frames the workers failed to process", c.processing_errors.load(std::memory_order_relaxed));
+    metrics_counter(out, "relay_push_failures_total", "appsrc pushes that failed", c.push_failures.load(std::memory_order_relaxed));
+    metrics_counter(out, "relay_sliced_frames_total", "Frames remapped in --slices slices", d->ctr.sliced_frames.load(std::memory_order_relaxed));
+    metrics_frame_ring(out, &d->work_ring);
+    metrics_reorder(out, &d->reorder);
+    metrics_output_pool(out, &d->out_pool);
+    if (d->temporal) {
+        metrics_counter(out, "relay_temporal_lut_updates_total", "Histograms folded into the temporal LUT", d->tlut.updates.load(std::memory_order_relaxed));
+        metrics_counter(out, "relay_temporal_lut_scene_cuts_total", "Temporal LUT resets on a scene cut", d->tlut.scene_cuts.load(std::memory_order_relaxed));
+    }
+    metrics_latency_trace(out, &d->latency);
+}
+
+/* ---------- --bench: stage counters ---------- */
+
+static void bench_read_counters(gpointer user_data, uint64_t counts[BENCH_STAGES]) {
+    auto *d = (CustomData*)user_data;
+    counts[BENCH_CAMERA] = d->ctr.camera_frames.load();
+    counts[BENCH_INPUT] = d->ctr.opencv_input_frames.load();
+    counts[BENCH_OUTPUT] = d->ctr.opencv_output_frames.load();
+    counts[BENCH_ENCODER] = d->ctr.encoder_frames.load();
+}
+
 /* ---------- bus watch (quit main loop) ---------- */
 
 static gboolean bus_cb(GstBus *bus, GstMessage *msg, gpointer user_data) {
@@ -261,6 +383,21 @@ int main(int argc, char *argv[]) {
     gboolean use_h265 = FALSE;
     int bitrate_kbps = 20000; // Match basic.cpp default (20 Mbps)
     int num_workers = 2; // Default to 2 workers for better performance
+    int reorder_window = 0; // --reorder-window=N frames held waiting for a late one (0 = auto)
+    int ring_size = 0;      // --ring-size=N frames waiting for a worker (0 = auto)
+    FrameDropPolicy drop_policy = FRAME_DROP_OLDEST; // --drop-policy=oldest|newest|max-age
+    int max_age_ms = FRAME_RING_MAX_AGE_MS_DEFAULT;  // --max-age-ms=N for --drop-policy=max-age
+    int pool_min = OUTPUT_POOL_MIN_DEFAULT; // --pool-min=N output buffers preallocated
+    int pool_max = 0;       // --pool-max=N output buffers before falling back to allocation (0 = auto)
+    gboolean neon_eq = FALSE; // --eq-backend=opencv|neon
+    int eq_stripes = NEON_EQ_STRIPES_DEFAULT; // --eq-stripes=N row stripes (threads) per frame
+    gboolean temporal = FALSE; // --lut-mode=exact|temporal
+    double lut_alpha = TEMPORAL_LUT_ALPHA_DEFAULT;     // --lut-alpha=F EMA weight of the newest histogram
+    double scene_cut = TEMPORAL_LUT_SCENE_CUT_DEFAULT; // --scene-cut=F histogram distance forcing a fresh LUT (0 = off)
+    int lut_subsample = TEMPORAL_LUT_SUBSAMPLE_DEFAULT; // --lut-subsample=N histogram grid step
+    int metrics_port = 0;   // --metrics-port=N serve Prometheus /metrics (0 = off)
+    BenchRun bench;         // --bench[=process|encode]: synthetic source, no camera or network
+    int slices = 0; // --slices=N remap in N NV12 slices with the temporal LUT (0 = off)
 
     int v_width = 1920, v_height = 1080, fps = 60; // defaults
 
@@ -272,6 +409,32 @@ int main(int argc, char *argv[]) {
         else if (g_strcmp0(argv[i],"--bitrate")==0 && i+1<argc){ int b=atoi(argv[i+1]); if(b>0) bitrate_kbps=b; }
         else if (g_str_has_prefix(argv[i],"--workers=")) { const char* v=strchr(argv[i],'='); if(v){ int w=atoi(v+1); if(w>0 && w<=8) num_workers=w; } }
         else if (g_strcmp0(argv[i],"--workers")==0 && i+1<argc){ int w=atoi(argv[i+1]); if(w>0 && w<=8) num_workers=w; }
+        else if (g_str_has_prefix(argv[i],"--reorder-window=")) { const char* v=strchr(argv[i],'='); if(v){ int r=atoi(v+1); if(r>0 && r<=REORDER_WINDOW_MAX) reorder_window=r; } }
+        else if (g_strcmp0(argv[i],"--reorder-window")==0 && i+1<argc){ int r=atoi(argv[i+1]); if(r>0 && r<=REORDER_WINDOW_MAX) reorder_window=r; }
+        else if (g_str_has_prefix(argv[i],"--ring-size=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0 && n<=FRAME_RING_CAPACITY_MAX) ring_size=n; } }
+        else if (g_str_has_prefix(argv[i],"--drop-policy=")) { const char* v=strchr(argv[i],'='); if(v && !frame_drop_policy_parse(v+1, &drop_policy)) g_printerr("Unknown --drop-policy %s, using oldest\n", v+1); }
+        else if (g_str_has_prefix(argv[i],"--max-age-ms=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0) max_age_ms=n; } }
+        else if (g_str_has_prefix(argv[i],"--pool-min=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0) pool_min=n; } }
+        else if (g_strcmp0(argv[i],"--pool-min")==0 && i+1<argc){ int n=atoi(argv[i+1]); if(n>0) pool_min=n; }
+        else if (g_str_has_prefix(argv[i],"--pool-max=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0) pool_max=n; } }
+        else if (g_strcmp0(argv[i],"--pool-max")==0 && i+1<argc){ int n=atoi(argv[i+1]); if(n>0) pool_max=n; }
+        else if (g_str_has_prefix(argv[i],"--eq-backend=")) { const char* v=strchr(argv[i],'='); if(v) neon_eq = g_ascii_strcasecmp(v+1,"neon")==0; }
+        else if (g_strcmp0(argv[i],"--eq-backend")==0 && i+1<argc){ neon_eq = g_ascii_strcasecmp(argv[i+1],"neon")==0; }
+        else if (g_str_has_prefix(argv[i],"--eq-stripes=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0 && n<=16) eq_stripes=n; } }
+        else if (g_strcmp0(argv[i],"--eq-stripes")==0 && i+1<argc){ int n=atoi(argv[i+1]); if(n>0 && n<=16) eq_stripes=n; }
+        else if (g_str_has_prefix(argv[i],"--lut-mode=")) { const char* v=strchr(argv[i],'='); if(v) temporal = g_ascii_strcasecmp(v+1,"temporal")==0; }
+        else if (g_strcmp0(argv[i],"--lut-mode")==0 && i+1<argc){ temporal = g_ascii_strcasecmp(argv[i+1],"temporal")==0; }
+        else if (g_str_has_prefix(argv[i],"--lut-alpha=")) { const char* v=strchr(argv[i],'='); if(v){ double a=g_ascii_strtod(v+1,NULL); if(a>0.0 && a<=1.0) lut_alpha=a; } }
+        else if (g_str_has_prefix(argv[i],"--scene-cut=")) { const char* v=strchr(argv[i],'='); if(v){ double c=g_ascii_strtod(v+1,NULL); if(c>=0.0) scene_cut=c; } }
+        else if (g_str_has_prefix(argv[i],"--slices=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>=0 && n<=16) slices=n; } }
+        else if (g_str_has_prefix(argv[i],"--lut-subsample=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0 && n<=TEMPORAL_LUT_SUBSAMPLE_MAX) lut_subsample=n; } }
+        else if (g_str_has_prefix(argv[i],"--metrics-port=")) { const char* v=strchr(argv[i],'='); if(v){ int p=atoi(v+1); if(p>0 && p<=65535) metrics_port=p; } }
+        else if (g_strcmp0(argv[i],"--bench")==0) bench.mode=BENCH_PROCESS;
+        else if (g_str_has_prefix(argv[i],"--bench=")) { const char* v=strchr(argv[i],'='); if(v && !bench_mode_parse(v+1, &bench.mode)) { g_printerr("Unknown --bench mode %s, using process\n", v+1); bench.mode=BENCH_PROCESS; } }
+        else if (g_str_has_prefix(argv[i],"--bench-seconds=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0) bench.seconds=n; } }
+        else if (g_str_has_prefix(argv[i],"--bench-warmup=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>=0) bench.warmup=n; } }
+        else if (g_str_has_prefix(argv[i],"--bench-fps=")) { const char* v=strchr(argv[i],'='); if(v){ int n=atoi(v+1); if(n>0) bench.fps=n; } }
+        else if (g_str_has_prefix(argv[i],"--bench-pattern=")) { const char* v=strchr(argv[i],'='); if(v && v[1]) bench.pattern=v+1; }
         else if (g_str_has_prefix(argv[i],"--width=")) { const char* v=strchr(argv[i],'='); if(v){ int w=atoi(v+1); if(w>0) v_width=w; } }
         else if (g_strcmp0(argv[i],"--width")==0 && i+1<argc){ int w=atoi(argv[i+1]); if(w>0) v_width=w; }
         else if (g_str_has_prefix(argv[i],"--height=")) { const char* v=strchr(argv[i],'='); if(v){ int h=atoi(v+1); if(h>0) v_height=h; } }
@@ -281,21 +444,42 @@ int main(int argc, char *argv[]) {
     }
     g_print("Encoder: %s, target-bitrate: %d kbps, workers: %d, %dx%d@%dfps\n",
             use_h265 ? "H.265" : "H.264", bitrate_kbps, num_workers, v_width, v_height, fps);
+    if (neon_eq) g_print("Equalizer: NEON, %d row stripes\n", eq_stripes);
+    else g_print("Equalizer: cv::equalizeHist\n");
+    if (slices > 0 && !temporal) {
+        g_print("--slices needs the LUT before the frame arrives, enabling --lut-mode=temporal\n");
+        temporal = TRUE;
+    }
+    if (temporal) g_print("LUT mode: temporal (alpha %.2f, scene cut %.2f, subsample %d)\n", lut_alpha, scene_cut, lut_subsample);
+
+    if (bench.mode != BENCH_OFF) {
+        g_print("Bench: %s mode, '%s' frame offered at %d fps, %u s measured after %u s warm-up\n",
+                bench_mode_name(bench.mode), bench.pattern, bench.fps, bench.seconds, bench.warmup);
+    }
 
     CustomData d{};
-    d.work_q = g_async_queue_new();
     d.num_workers = num_workers;
+    d.neon_eq = neon_eq;
+    d.eq_stripes = eq_stripes;
+    d.temporal = temporal;
+    d.slices = slices;
+    temporal_lut_init(&d.tlut, lut_alpha, scene_cut, lut_subsample);
 
     // Capture pipeline (bump queue to 8 for smoothing; add videorate dropper)
     GError *err=NULL;
+    gchar *cam_str = bench.mode != BENCH_OFF ? bench_capture_desc(&bench, v_width, v_height)
+        : g_strdup_printf(
+            "v4l2src device=/dev/video0 io-mode=4 ! "
+            "video/x-raw,format=NV12,width=%d,height=%d,framerate=60/1 ! "
+            "videorate drop-only=true max-rate=%d ! ",
+            v_width, v_height, fps);
     gchar *sink_str = g_strdup_printf(
-        "v4l2src device=/dev/video0 io-mode=4 ! "
-        "video/x-raw,format=NV12,width=%d,height=%d,framerate=60/1 ! "
-        "videorate drop-only=true max-rate=%d ! "
+        "%s"
         "queue name=q_cam leaky=downstream max-size-buffers=8 max-size-time=0 max-size-bytes=0 ! "
         "appsink name=cv_sink emit-signals=true max-buffers=1 drop=true sync=false",
-        v_width, v_height, fps
+        cam_str
     );
+    g_free(cam_str);
     GstElement *sink_pipe = gst_parse_launch(sink_str, &err);
     g_free(sink_str);
     if (!sink_pipe) { g_printerr("Create sink pipeline failed: %s\n", err?err->message:"?"); g_clear_error(&err); return -1; }
@@ -304,29 +488,39 @@ int main(int argc, char *argv[]) {
 
     // Streaming pipeline (dynamic caps derived from CLI)
     gchar *src_str=NULL;
-    if (use_h265) {
+    const char *net_sink = bench.mode == BENCH_ENCODE ? BENCH_OUTPUT_SINK
+        : "udpsink buffer-size=60000000 host=192.168.25.69 port=5004 async=false max-lateness=-1 qos-dscp=60";
+    if (bench.mode == BENCH_PROCESS) {
+        src_str = g_strdup_printf(
+            "appsrc name=my_src is-live=true format=GST_FORMAT_TIME do-timestamp=false ! "
+            "video/x-raw,format=NV12,width=%d,height=%d,framerate=%d/1 ! "
+            "queue name=q_after_src leaky=downstream max-size-buffers=2 max-size-time=0 max-size-bytes=0 ! "
+            BENCH_PROCESS_TAIL,
+            v_width, v_height, fps
+        );
+    } else if (use_h265) {
         src_str = g_strdup_printf(
-            "appsrc name=my_src is-live=true format=GST_FORMAT_TIME do-timestamp=true ! "
+            "appsrc name=my_src is-live=true format=GST_FORMAT_TIME do-timestamp=false ! "
             "video/x-raw,format=NV12,width=%d,height=%d,framerate=%d/1 ! "
             "queue name=q_after_src leaky=downstream max-size-buffers=2 max-size-time=0 max-size-bytes=0 ! "
             "omxh265enc name=enc num-slices=8 periodicity-idr=240 cpb-size=500 gdr-mode=horizontal "
             "initial-delay=250 control-rate=low-latency prefetch-buffer=true target-bitrate=%d "
             "gop-mode=low-delay-p ! video/x-h265,alignment=au ! "
-            "rtph265pay ! "
-            "udpsink buffer-size=60000000 host=192.168.25.69 port=5004 async=false max-lateness=-1 qos-dscp=60",
-            v_width, v_height, fps, bitrate_kbps
+            "rtph265pay name=pay ! "
+            "%s",
+            v_width, v_height, fps, bitrate_kbps, net_sink
         );
     } else {
         src_str = g_strdup_printf(
-            "appsrc name=my_src is-live=true format=GST_FORMAT_TIME do-timestamp=true ! "
+            "appsrc name=my_src is-live=true format=GST_FORMAT_TIME do-timestamp=false ! "
             "video/x-raw,format=NV12,width=%d,height=%d,framerate=%d/1 ! "
             "queue name=q_after_src leaky=downstream max-size-buffers=2 max-size-time=0 max-size-bytes=0 ! "
             "omxh264enc name=enc num-slices=8 periodicity-idr=240 cpb-size=500 gdr-mode=horizontal "
             "initial-delay=250 control-rate=low-latency prefetch-buffer=true target-bitrate=%d "
             "gop-mode=low-delay-p ! video/x-h264,alignment=nal ! "
-            "rtph264pay ! "
-            "udpsink buffer-size=60000000 host=192.168.25.69 port=5004 async=false max-lateness=-1 qos-dscp=60",
-            v_width, v_height, fps, bitrate_kbps
+            "rtph264pay name=pay ! "
+            "%s",
+            v_width, v_height, fps, bitrate_kbps, net_sink
         );
     }
     GstElement *src_pipe = gst_parse_launch(src_str, &err);
@@ -344,6 +538,14 @@ int main(int argc, char *argv[]) {
         gst_object_unref(sink_pipe);
         return -1;
     }
+    if (reorder_window <= 0) reorder_window = MAX(REORDER_WINDOW_DEFAULT, num_workers + 1);
+    frame_reorder_init(&d.reorder, d.appsrc, sink_pipe, src_pipe, (guint)reorder_window);
+    // One frame waiting per worker keeps them busy without building up latency
+    if (ring_size <= 0) ring_size = MAX(2, num_workers);
+    frame_ring_init(&d.work_ring, (guint)ring_size, drop_policy, (guint)max_age_ms, sink_pipe, drop_queued_frame, &d);
+    // Workers, frames held for reordering and the encoder queue all hold output buffers
+    if (pool_max <= 0) pool_max = MAX(OUTPUT_POOL_MAX_DEFAULT, num_workers + reorder_window + 4);
+    output_pool_init(&d.out_pool, (guint)pool_min, (guint)pool_max);
 
     // Add probes for frame rate monitoring
     {
@@ -389,6 +591,9 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // Per-frame latency: q_cam.sink -> enc.sink -> payloader
+    latency_trace_attach(&d.latency, sink_pipe, src_pipe);
+
     // Callback + workers
     g_signal_connect(d.appsink, "new-sample", G_CALLBACK(new_sample_cb), &d);
 
@@ -407,6 +612,8 @@ int main(int argc, char *argv[]) {
     gst_bus_add_watch(bus_sink, bus_cb, &d);
     gst_bus_add_watch(bus_src,  bus_cb, &d);
     g_timeout_add_seconds(2, framerate_status_tick, &d);
+    if (metrics_port > 0) metrics_server_start(&d.metrics, (guint)metrics_port, render_metrics, &d);
+    if (bench.mode != BENCH_OFF) bench_start(&bench, num_workers, bench_read_counters, &d, d.loop);
 
     // Start & run
     gst_element_set_state(src_pipe,  GST_STATE_PLAYING);
@@ -415,9 +622,10 @@ int main(int argc, char *argv[]) {
     g_main_loop_run(d.loop);
 
     // Shutdown
+    metrics_server_stop(&d.metrics);
     d.stop.store(true, std::memory_order_release);
     // Drain worker queue
-    while (GstBuffer *b = (GstBuffer*)g_async_queue_try_pop(d.work_q)) gst_buffer_unref(b);
+    frame_ring_drain(&d.work_ring);
 
     // Join all worker threads
     if (d.workers) {
@@ -430,7 +638,10 @@ int main(int argc, char *argv[]) {
         d.workers = nullptr;
     }
 
-    if (d.work_q) { g_async_queue_unref(d.work_q); d.work_q = nullptr; }
+    frame_ring_clear(&d.work_ring);
+    frame_reorder_clear(&d.reorder);
+    output_pool_clear(&d.out_pool);
+    temporal_lut_clear(&d.tlut);
 
     gst_element_set_state(sink_pipe, GST_STATE_NULL);
     gst_element_set_state(src_pipe,  GST_STATE_NULL);
@@ -0,0 +1,74 @@
+// offline_mode.hpp
+// --offline: transcode a recording to MP4 as fast as the slowest stage allows.
+//
+// Normally the file tools pace themselves to playback speed (sync=true sinks, a live
+// appsrc, videorate). For an archive run the two pipelines become a chain of bounded
+// queues instead, with each stage on its own streaming thread:
+//   decode   filesrc ! demux ! queue ! parse ! decoder ! q_decoded
+//   process  q_decoded ! convert/scale ! appsink, new_sample_cb on q_decoded's thread
+//   encode   appsrc (its own thread) ! encoder ! q_encoded
+//   mux      q_encoded ! parse ! mp4mux ! filesink
+// Nothing is dropped: appsink drop=false and appsrc block=true stall the stage feeding
+// a full queue, so the whole chain runs at the rate of its slowest stage. videorate is
+// left out and the output buffers keep the decoded PTS/DTS/duration, so the MP4 has the
+// source timeline. At output EOS the tool prints wall time against media duration.
+
+#ifndef OFFLINE_MODE_HPP
+#define OFFLINE_MODE_HPP
+
+#include <gst/gst.h>
+#include <glib.h>
+#include <stdint.h>
+
+#define OFFLINE_QUEUE_DEFAULT 4   // frames per queue between stages (--offline-queue=N)
+
+struct OfflineRun {
+    bool         enabled{false};
+    guint        queue{OFFLINE_QUEUE_DEFAULT};
+    gint64       start_us{0};
+    GstClockTime first_pts{GST_CLOCK_TIME_NONE};   // process thread only
+    GstClockTime end_pts{GST_CLOCK_TIME_NONE};     // last PTS + duration
+    uint64_t     frames{0};
+};
+
+// A frame-bounded queue element; the byte and time limits are off so only N counts
+static inline gchar *offline_queue_desc(const char *name, guint frames) {
+    return g_strdup_printf("queue name=%s max-size-buffers=%u max-size-bytes=0 max-size-time=0", name, frames);
+}
+
+// "<input basename without extension>_processed.mp4"
+static inline gchar *offline_default_output(const char *input_file) {
+    gchar *base = g_path_get_basename(input_file);
+    gchar *dot = g_strrstr(base, ".");
+    gchar *out = dot ? g_strdup_printf("%.*s_processed.mp4", (int)(dot - base), base)
+                     : g_strdup_printf("%s_processed.mp4", base);
+    g_free(base);
+    return out;
+}
+
+// Call right before the pipelines go to PLAYING
+static inline void offline_start(OfflineRun *o) {
+    o->start_us = g_get_monotonic_time();
+}
+
+// Every buffer handed to appsrc, after its timestamps were copied from the decoded frame
+static inline void offline_note_frame(OfflineRun *o, GstBuffer *buf) {
+    o->frames++;
+    const GstClockTime pts = GST_BUFFER_PTS(buf);
+    if (!GST_CLOCK_TIME_IS_VALID(pts)) return;
+    if (!GST_CLOCK_TIME_IS_VALID(o->first_pts) || pts < o->first_pts) o->first_pts = pts;
+    const GstClockTime dur = GST_BUFFER_DURATION(buf);
+    const GstClockTime end = pts + (GST_CLOCK_TIME_IS_VALID(dur) ? dur : 0);
+    if (!GST_CLOCK_TIME_IS_VALID(o->end_pts) || end > o->end_pts) o->end_pts = end;
+}
+
+// Once the output pipeline reached EOS (the MP4 is finalized)
+static inline void offline_print_summary(OfflineRun *o) {
+    const double wall = (g_get_monotonic_time() - o->start_us) / 1e6;
+    const double media = GST_CLOCK_TIME_IS_VALID(o->first_pts) && o->end_pts > o->first_pts
+                             ? (double)(o->end_pts - o->first_pts) / GST_SECOND : 0.0;
+    g_print("Offline: %" G_GUINT64_FORMAT " frames, media %.2f s in %.2f s wall, %.2fx realtime, %.1f fps\n",
+            o->frames, media, wall, wall > 0.0 ? media / wall : 0.0, wall > 0.0 ? o->frames / wall : 0.0);
+}
+
+#endif // OFFLINE_MODE_HPP
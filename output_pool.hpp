@@ -0,0 +1,111 @@
+// output_pool.hpp
+// Preallocated NV12 output buffers for appsrc, shared by the relay and file tools.
+//
+// The pool is created on the first acquire, sized from the negotiated caps, and is
+// recreated if the frame size changes. Buffers are page aligned so NEON code and
+// DMA engines can use them directly, and return to the pool when the encoder
+// releases them. When all max_buffers are downstream the frame falls back to a
+// one-off allocation; hits/misses count how often that happens.
+
+#ifndef OUTPUT_POOL_HPP
+#define OUTPUT_POOL_HPP
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <glib.h>
+#include <atomic>
+
+#define OUTPUT_POOL_MIN_DEFAULT 4
+#define OUTPUT_POOL_MAX_DEFAULT 12
+#define OUTPUT_POOL_ALIGN 4095        // alignment mask: 4 KiB pages
+
+struct OutputPool {
+    GMutex         mutex;
+    GstBufferPool *pool{nullptr};
+    gsize          frame_size{0};
+    guint          min_buffers{OUTPUT_POOL_MIN_DEFAULT};
+    guint          max_buffers{OUTPUT_POOL_MAX_DEFAULT};
+
+    std::atomic<uint64_t> hits{0};    // frames served from the pool
+    std::atomic<uint64_t> misses{0};  // pool exhausted (or unusable): one-off allocation
+};
+
+static inline void output_pool_init(OutputPool *p, guint min_buffers, guint max_buffers) {
+    g_mutex_init(&p->mutex);
+    p->min_buffers = min_buffers;
+    p->max_buffers = max_buffers < min_buffers ? min_buffers : max_buffers;
+}
+
+static inline void output_pool_release(OutputPool *p) {
+    if (!p->pool) return;
+    gst_buffer_pool_set_active(p->pool, FALSE);
+    gst_object_unref(p->pool);
+    p->pool = nullptr;
+    p->frame_size = 0;
+}
+
+static inline void output_pool_clear(OutputPool *p) {
+    g_mutex_lock(&p->mutex);
+    output_pool_release(p);
+    g_mutex_unlock(&p->mutex);
+    g_mutex_clear(&p->mutex);
+}
+
+static inline GstAllocationParams output_pool_params() {
+    GstAllocationParams params;
+    gst_allocation_params_init(&params);
+    params.align = OUTPUT_POOL_ALIGN;
+    return params;
+}
+
+// Called with p->mutex held
+static inline bool output_pool_configure(OutputPool *p, const GstVideoInfo *info, gsize size) {
+    output_pool_release(p);
+
+    GstBufferPool *pool = gst_buffer_pool_new();
+    GstStructure *config = gst_buffer_pool_get_config(pool);
+    GstCaps *caps = gst_video_info_to_caps(const_cast<GstVideoInfo*>(info));
+    GstAllocationParams params = output_pool_params();
+    gst_buffer_pool_config_set_params(config, caps, (guint)size, p->min_buffers, p->max_buffers);
+    gst_buffer_pool_config_set_allocator(config, NULL, &params);
+    if (caps) gst_caps_unref(caps);
+
+    if (!gst_buffer_pool_set_config(pool, config) || !gst_buffer_pool_set_active(pool, TRUE)) {
+        g_printerr("Output pool: failed to activate %u..%u x %" G_GSIZE_FORMAT " bytes\n",
+                   p->min_buffers, p->max_buffers, size);
+        gst_object_unref(pool);
+        return false;
+    }
+    p->pool = pool;
+    p->frame_size = size;
+    g_print("Output pool: %u..%u buffers x %" G_GSIZE_FORMAT " bytes (%dx%d)\n",
+            p->min_buffers, p->max_buffers, size, GST_VIDEO_INFO_WIDTH(info), GST_VIDEO_INFO_HEIGHT(info));
+    return true;
+}
+
+// One output frame of `size` bytes for the negotiated `info`; never blocks
+static inline GstBuffer *output_pool_acquire(OutputPool *p, const GstVideoInfo *info, gsize size) {
+    GstBuffer *buf = nullptr;
+
+    g_mutex_lock(&p->mutex);
+    if (p->frame_size != size) output_pool_configure(p, info, size);
+    GstBufferPool *pool = p->pool ? (GstBufferPool*)gst_object_ref(p->pool) : nullptr;
+    g_mutex_unlock(&p->mutex);
+
+    if (pool) {
+        GstBufferPoolAcquireParams acq = {};
+        acq.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+        if (gst_buffer_pool_acquire_buffer(pool, &buf, &acq) != GST_FLOW_OK) buf = nullptr;
+        gst_object_unref(pool);
+    }
+
+    if (buf) {
+        p->hits.fetch_add(1, std::memory_order_relaxed);
+        return buf;
+    }
+    p->misses.fetch_add(1, std::memory_order_relaxed);
+    GstAllocationParams params = output_pool_params();
+    return gst_buffer_new_allocate(NULL, size, &params);
+}
+
+#endif // OUTPUT_POOL_HPP
@@ -0,0 +1,227 @@
+// scene_change.hpp
+// Static-scene detection on the Y plane (--static-detect).
+//
+// The frame is cut into SCENE_CHANGE_BLOCK x SCENE_CHANGE_BLOCK blocks. One pass over a
+// downsampled grid (every SCENE_CHANGE_STEP-th pixel of every SCENE_CHANGE_STEP-th row)
+// measures each block's mean absolute difference against the samples it was last
+// declared changed with, and gathers the frame's histogram on the same grid, so a
+// relay that needs a subsampled histogram gets it for free. Blocks past `threshold`
+// grey levels count as changed and take the new samples; slow drift therefore adds up
+// until it crosses the threshold instead of hiding under it forever.
+//
+// A frame with at most `static_pct` percent of its blocks changed is static: the relay
+// can apply the LUT it already has and skip the histogram (and the device). After
+// `refresh` static frames in a row one is processed anyway, so the LUT follows slow
+// lighting changes. The block map can also go to the encoder as ROI metadata, so
+// static regions cost fewer bits (omxh26xenc qp-mode=roi).
+//
+// Workers may finish detection out of capture order; a frame older than the last one
+// seen is still measured, but leaves the samples alone and is never static.
+//
+// Several workers may measure frames of one camera at once. The stream lock is only
+// held to claim the frame's place in capture order and to record the verdict; each block
+// row is measured and, for an in-order frame, updated under that row's own lock, so the
+// workers only meet on the row they are both on. A row keeps the sequence of the frame
+// that last updated it, so a later frame's samples are never overwritten by an earlier
+// one. The samples are reallocated on a size change only when no worker is measuring.
+
+#ifndef SCENE_CHANGE_HPP
+#define SCENE_CHANGE_HPP
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <glib.h>
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#define SCENE_CHANGE_BINS 256
+#define SCENE_CHANGE_BLOCK 64               // block edge in pixels
+#define SCENE_CHANGE_STEP 4                 // sampling grid, also the histogram's
+#define SCENE_CHANGE_THRESHOLD_DEFAULT 4.0  // mean |diff| in grey levels that marks a block changed
+#define SCENE_CHANGE_STATIC_PCT_DEFAULT 1.0 // share of changed blocks a static frame may have
+#define SCENE_CHANGE_REFRESH_DEFAULT 30     // static frames in a row before one is processed anyway
+#define SCENE_CHANGE_ROI_QUALITY "low"      // roi/omx-alg quality for static regions
+
+struct SceneChange {
+    GMutex lock;
+    double threshold{SCENE_CHANGE_THRESHOLD_DEFAULT};
+    double static_pct{SCENE_CHANGE_STATIC_PCT_DEFAULT};
+    int    refresh{SCENE_CHANGE_REFRESH_DEFAULT};
+
+    int width{0}, height{0};
+    int blocks_x{0}, blocks_y{0};
+    int grid_w{0}, grid_h{0};              // downsampled plane
+    std::vector<uint8_t> ref;              // grid_w * grid_h samples
+    std::vector<GMutex>   row_locks;       // blocks_y: guard their rows of ref
+    std::vector<uint64_t> row_seq;         // blocks_y: frame the row's samples came from
+    int      measuring{0};                 // workers between claim and verdict
+    bool     have_ref{false};
+    uint64_t last_seq{0};
+    int      static_run{0};
+};
+
+// One frame's verdict; workers keep one as scratch
+struct SceneFrame {
+    int  blocks_x{0}, blocks_y{0};
+    int  width{0}, height{0};
+    int  changed{0}, total{0};
+    bool is_static{false};
+    std::vector<uint8_t> block_changed;    // blocks_y * blocks_x, row-major
+    uint32_t hist[SCENE_CHANGE_BINS]{};    // on the SCENE_CHANGE_STEP grid
+    std::vector<uint32_t> sad, count;      // blocks_x: scratch for the block row being measured
+};
+
+static inline void scene_change_init(SceneChange *sc, double threshold, double static_pct, int refresh) {
+    g_mutex_init(&sc->lock);
+    sc->threshold = threshold < 0.0 ? 0.0 : threshold;
+    sc->static_pct = static_pct < 0.0 ? 0.0 : static_pct;
+    sc->refresh = refresh < 0 ? 0 : refresh;
+}
+
+static inline void scene_change_clear(SceneChange *sc) {
+    for (GMutex &m : sc->row_locks) g_mutex_clear(&m);
+    sc->row_locks.clear();
+    g_mutex_clear(&sc->lock);
+}
+
+// Under lock, with no worker measuring
+static inline void scene_change_reset(SceneChange *sc, int width, int height) {
+    for (GMutex &m : sc->row_locks) g_mutex_clear(&m);
+    sc->width = width;
+    sc->height = height;
+    sc->blocks_x = (width + SCENE_CHANGE_BLOCK - 1) / SCENE_CHANGE_BLOCK;
+    sc->blocks_y = (height + SCENE_CHANGE_BLOCK - 1) / SCENE_CHANGE_BLOCK;
+    sc->grid_w = (width + SCENE_CHANGE_STEP - 1) / SCENE_CHANGE_STEP;
+    sc->grid_h = (height + SCENE_CHANGE_STEP - 1) / SCENE_CHANGE_STEP;
+    sc->ref.assign((size_t)sc->grid_w * sc->grid_h, 0);
+    sc->row_locks.resize((size_t)sc->blocks_y);
+    for (GMutex &m : sc->row_locks) g_mutex_init(&m);
+    sc->row_seq.assign((size_t)sc->blocks_y, 0);
+    sc->have_ref = false;
+    sc->static_run = 0;
+}
+
+// Measure frame `seq` (8-bit Y plane). Fills f and returns f->is_static.
+static inline bool scene_change_detect(SceneChange *sc, const uint8_t *y, size_t stride, int width, int height,
+                                       uint64_t seq, SceneFrame *f) {
+    const int per_block = SCENE_CHANGE_BLOCK / SCENE_CHANGE_STEP;   // samples along a block edge
+
+    // Claim the frame's place in capture order
+    g_mutex_lock(&sc->lock);
+    bool usable = true;
+    if (width != sc->width || height != sc->height) {
+        if (sc->measuring == 0) scene_change_reset(sc, width, height);
+        else usable = false;   // others still read the old samples: this frame counts as changed
+    }
+    const bool have_ref = usable && sc->have_ref;
+    const bool in_order = usable && (!sc->have_ref || seq > sc->last_seq);
+    if (in_order) sc->last_seq = seq;
+    if (usable) sc->measuring++;
+    g_mutex_unlock(&sc->lock);
+
+    const int grid_w = (width + SCENE_CHANGE_STEP - 1) / SCENE_CHANGE_STEP;
+    const int grid_h = (height + SCENE_CHANGE_STEP - 1) / SCENE_CHANGE_STEP;
+    f->blocks_x = (width + SCENE_CHANGE_BLOCK - 1) / SCENE_CHANGE_BLOCK;
+    f->blocks_y = (height + SCENE_CHANGE_BLOCK - 1) / SCENE_CHANGE_BLOCK;
+    f->width = width;
+    f->height = height;
+    f->total = f->blocks_x * f->blocks_y;
+    f->changed = 0;
+    f->block_changed.assign((size_t)f->total, 1);
+    f->sad.resize((size_t)f->blocks_x);
+    f->count.resize((size_t)f->blocks_x);
+    memset(f->hist, 0, sizeof(f->hist));
+
+    for (int by = 0; by < f->blocks_y; ++by) {
+        const int gy0 = by * per_block, gy1 = MIN(gy0 + per_block, grid_h);
+        uint8_t *bc = &f->block_changed[(size_t)by * f->blocks_x];
+        if (!usable) {
+            // Histogram only, every block changed
+            for (int gy = gy0; gy < gy1; ++gy) {
+                const uint8_t *p = y + (size_t)gy * SCENE_CHANGE_STEP * stride;
+                for (int gx = 0; gx < grid_w; ++gx) f->hist[p[gx * SCENE_CHANGE_STEP]]++;
+            }
+            f->changed += f->blocks_x;
+            continue;
+        }
+
+        // Per block of the row: SAD and sample count, one sampled row at a time
+        g_mutex_lock(&sc->row_locks[by]);
+        std::fill(f->sad.begin(), f->sad.end(), 0);
+        std::fill(f->count.begin(), f->count.end(), 0);
+        for (int gy = gy0; gy < gy1; ++gy) {
+            const uint8_t *p = y + (size_t)gy * SCENE_CHANGE_STEP * stride;
+            const uint8_t *r = &sc->ref[(size_t)gy * grid_w];
+            for (int gx = 0; gx < grid_w; ++gx) {
+                const int v = p[gx * SCENE_CHANGE_STEP];
+                f->hist[v]++;
+                f->sad[gx / per_block] += (uint32_t)abs(v - (int)r[gx]);
+                f->count[gx / per_block]++;
+            }
+        }
+        for (int bx = 0; bx < f->blocks_x; ++bx) {
+            const bool changed = !have_ref || f->sad[bx] > sc->threshold * f->count[bx];
+            bc[bx] = changed;
+            f->changed += changed;
+        }
+
+        // Changed blocks take this frame's samples, unless a later frame already updated the row
+        if (in_order && seq >= sc->row_seq[by]) {
+            for (int gy = gy0; gy < gy1; ++gy) {
+                const uint8_t *p = y + (size_t)gy * SCENE_CHANGE_STEP * stride;
+                uint8_t *r = &sc->ref[(size_t)gy * grid_w];
+                for (int gx = 0; gx < grid_w; ++gx) {
+                    if (bc[gx / per_block]) r[gx] = p[gx * SCENE_CHANGE_STEP];
+                }
+            }
+            sc->row_seq[by] = seq;
+        }
+        g_mutex_unlock(&sc->row_locks[by]);
+    }
+    if (!usable) {
+        f->is_static = false;
+        return false;
+    }
+
+    // Verdict
+    g_mutex_lock(&sc->lock);
+    f->is_static = in_order && have_ref && f->changed * 100.0 <= sc->static_pct * f->total &&
+                   (sc->refresh == 0 || sc->static_run < sc->refresh);
+    if (in_order) {
+        sc->static_run = f->is_static ? sc->static_run + 1 : 0;
+        sc->have_ref = true;
+    }
+    sc->measuring--;
+    g_mutex_unlock(&sc->lock);
+    return f->is_static;
+}
+
+// Static blocks go to the encoder as low-quality regions of interest, merged into runs
+// along each block row. The buffer must be writable.
+static inline guint scene_change_add_roi(GstBuffer *buf, const SceneFrame *f) {
+    guint regions = 0;
+    for (int by = 0; by < f->blocks_y; ++by) {
+        const uint8_t *bc = &f->block_changed[(size_t)by * f->blocks_x];
+        for (int bx = 0; bx < f->blocks_x;) {
+            if (bc[bx]) { ++bx; continue; }
+            const int run = bx;
+            while (bx < f->blocks_x && !bc[bx]) ++bx;
+
+            const guint x = (guint)run * SCENE_CHANGE_BLOCK, yy = (guint)by * SCENE_CHANGE_BLOCK;
+            const guint w = MIN((guint)bx * SCENE_CHANGE_BLOCK, (guint)f->width) - x;
+            const guint h = MIN(yy + SCENE_CHANGE_BLOCK, (guint)f->height) - yy;
+            GstVideoRegionOfInterestMeta *meta = gst_buffer_add_video_region_of_interest_meta(buf, "static", x, yy, w, h);
+            if (!meta) continue;
+            gst_video_region_of_interest_meta_add_param(meta, gst_structure_new("roi/omx-alg", "quality", G_TYPE_STRING,
+                                                                                SCENE_CHANGE_ROI_QUALITY, NULL));
+            regions++;
+        }
+    }
+    return regions;
+}
+
+#endif // SCENE_CHANGE_HPP
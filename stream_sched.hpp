@@ -0,0 +1,135 @@
+// stream_sched.hpp
+// Which camera a free worker serves next when several cameras share the workers and CUs.
+//
+// Every stream keeps its own FrameRing (drop policy, high water and drops stay per
+// camera); the scheduler only chooses among the rings that have a frame waiting.
+// Each stream runs a virtual clock that advances by 1/weight per frame served, and the
+// backlogged stream with the smallest clock goes next:
+//   rr   weight 1 everywhere: plain round robin over the streams with work
+//   fps  weight = the stream's frame rate: once the hardware saturates every camera
+//        loses the same share of its frames, instead of the fast one losing most
+// A stream that was idle rejoins at the current clock, so it can't spend credit saved
+// up while it had nothing queued in one burst. Idle workers park on one condition
+// that new_sample_cb signals after each push, whichever ring it went to.
+
+#ifndef STREAM_SCHED_HPP
+#define STREAM_SCHED_HPP
+
+#include <gst/gst.h>
+#include <glib.h>
+#include <atomic>
+
+#include "frame_ring.hpp"
+
+#define STREAM_SCHED_MAX 8
+
+enum StreamSchedPolicy {
+    STREAM_SCHED_RR,
+    STREAM_SCHED_FPS,
+};
+
+struct StreamSched {
+    FrameRing *rings[STREAM_SCHED_MAX]{};
+    double     weight[STREAM_SCHED_MAX]{};
+    double     vtime[STREAM_SCHED_MAX]{};
+    double     clock{0.0};              // virtual time of the last frame handed out
+    int        count{0};
+    int        next{0};                 // where ties start, so equal clocks rotate
+    StreamSchedPolicy policy{STREAM_SCHED_RR};
+
+    GMutex lock;                        // clocks, and parking idle workers
+    GCond  cond;
+    std::atomic<int> waiters{0};
+};
+
+static inline const char *stream_sched_policy_name(StreamSchedPolicy p) {
+    return p == STREAM_SCHED_FPS ? "fps" : "rr";
+}
+
+static inline bool stream_sched_policy_parse(const char *s, StreamSchedPolicy *p) {
+    if (g_ascii_strcasecmp(s, "rr") == 0 || g_ascii_strcasecmp(s, "round-robin") == 0) *p = STREAM_SCHED_RR;
+    else if (g_ascii_strcasecmp(s, "fps") == 0) *p = STREAM_SCHED_FPS;
+    else return false;
+    return true;
+}
+
+static inline void stream_sched_init(StreamSched *s, StreamSchedPolicy policy) {
+    s->policy = policy;
+    s->count = 0;
+    s->next = 0;
+    s->clock = 0.0;
+    g_mutex_init(&s->lock);
+    g_cond_init(&s->cond);
+}
+
+// Before the workers start; fps only matters for the fps policy
+static inline int stream_sched_add(StreamSched *s, FrameRing *ring, int fps) {
+    if (s->count >= STREAM_SCHED_MAX) return -1;
+    const int i = s->count++;
+    s->rings[i] = ring;
+    s->weight[i] = s->policy == STREAM_SCHED_FPS && fps > 0 ? (double)fps : 1.0;
+    s->vtime[i] = 0.0;
+    return i;
+}
+
+// After a frame_ring_push to any of the rings
+static inline void stream_sched_notify(StreamSched *s) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (s->waiters.load(std::memory_order_relaxed) > 0) {
+        g_mutex_lock(&s->lock);
+        g_cond_signal(&s->cond);
+        g_mutex_unlock(&s->lock);
+    }
+}
+
+// Under lock: the next frame by virtual clock, or nullptr when every ring is empty
+static inline GstBuffer *stream_sched_pick_locked(StreamSched *s, int *stream) {
+    bool tried[STREAM_SCHED_MAX] = {false};
+    for (int attempt = 0; attempt < s->count; ++attempt) {
+        int best = -1;
+        for (int k = 0; k < s->count; ++k) {
+            const int i = (s->next + k) % s->count;
+            if (tried[i] || frame_ring_depth(s->rings[i]) == 0) continue;
+            if (best < 0 || s->vtime[i] < s->vtime[best]) best = i;
+        }
+        if (best < 0) return nullptr;
+        tried[best] = true;
+
+        // Another worker may have taken it, or it was too old for max-age
+        GstBuffer *buf = frame_ring_try_pop_fresh(s->rings[best]);
+        if (!buf) continue;
+
+        if (s->vtime[best] < s->clock) s->vtime[best] = s->clock;
+        s->clock = s->vtime[best];
+        s->vtime[best] += 1.0 / s->weight[best];
+        s->next = (best + 1) % s->count;
+        *stream = best;
+        return buf;
+    }
+    return nullptr;
+}
+
+// Next frame for a worker and the stream it belongs to, or nullptr after timeout_us
+static inline GstBuffer *stream_sched_pop(StreamSched *s, gint64 timeout_us, int *stream) {
+    const gint64 deadline = g_get_monotonic_time() + timeout_us;
+    g_mutex_lock(&s->lock);
+    GstBuffer *buf = nullptr;
+    for (;;) {
+        // Registered before looking, so a push that lands in between still signals us
+        s->waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        buf = stream_sched_pick_locked(s, stream);
+        const bool timed_out = !buf && !g_cond_wait_until(&s->cond, &s->lock, deadline);
+        s->waiters.fetch_sub(1, std::memory_order_relaxed);
+        if (buf || timed_out) break;
+    }
+    g_mutex_unlock(&s->lock);
+    return buf;
+}
+
+static inline void stream_sched_clear(StreamSched *s) {
+    g_cond_clear(&s->cond);
+    g_mutex_clear(&s->lock);
+}
+
+#endif // STREAM_SCHED_HPP
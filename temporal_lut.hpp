@@ -0,0 +1,216 @@
+// temporal_lut.hpp
+// --lut-mode=temporal: equalize frame N with a LUT built from the frames before it.
+//
+// On the CPU the previous LUT is applied and the new histogram gathered in the same
+// pass over the Y plane, optionally on a subsampled grid (every `subsample`-th pixel
+// of every `subsample`-th row). Histograms are normalized and folded into an
+// exponential moving average, which also damps frame-to-frame flicker. When a new
+// histogram is too far from the average (L1 distance above `scene_cut`) the average
+// is reset to it, and the CPU path re-applies the fresh LUT to that frame.
+//
+// The FPGA single-read/NV12 kernels already return the histogram of the frame they
+// equalized, so they only use temporal_lut_update()/temporal_lut_get().
+
+#ifndef TEMPORAL_LUT_HPP
+#define TEMPORAL_LUT_HPP
+
+#include <glib.h>
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "neon_equalize.hpp"
+
+#define TEMPORAL_LUT_BINS 256
+#define TEMPORAL_LUT_ALPHA_DEFAULT 0.25      // weight of the newest histogram
+#define TEMPORAL_LUT_SCENE_CUT_DEFAULT 0.5   // L1 distance (0..2) that forces a fresh LUT
+#define TEMPORAL_LUT_SUBSAMPLE_DEFAULT 2
+#define TEMPORAL_LUT_SUBSAMPLE_MAX 16
+
+struct TemporalLut {
+    GMutex  mutex;
+    double  alpha{TEMPORAL_LUT_ALPHA_DEFAULT};
+    double  scene_cut{TEMPORAL_LUT_SCENE_CUT_DEFAULT};
+    int     subsample{TEMPORAL_LUT_SUBSAMPLE_DEFAULT};
+
+    double  pdf[TEMPORAL_LUT_BINS]{};   // smoothed, normalized histogram
+    uint8_t lut[TEMPORAL_LUT_BINS]{};
+    bool    valid{false};
+
+    std::atomic<uint64_t> updates{0};
+    std::atomic<uint64_t> scene_cuts{0};
+};
+
+static inline void temporal_lut_init(TemporalLut *t, double alpha, double scene_cut, int subsample) {
+    g_mutex_init(&t->mutex);
+    t->alpha = alpha <= 0.0 || alpha > 1.0 ? TEMPORAL_LUT_ALPHA_DEFAULT : alpha;
+    t->scene_cut = scene_cut;
+    t->subsample = subsample < 1 ? 1 : subsample > TEMPORAL_LUT_SUBSAMPLE_MAX ? TEMPORAL_LUT_SUBSAMPLE_MAX : subsample;
+}
+
+static inline void temporal_lut_clear(TemporalLut *t) {
+    g_mutex_clear(&t->mutex);
+}
+
+// cv::equalizeHist mapping on a normalized histogram; bins that have decayed to noise count as empty
+static inline void temporal_lut_build(const double pdf[TEMPORAL_LUT_BINS], uint8_t lut[TEMPORAL_LUT_BINS]) {
+    const double eps = 1e-7;
+    memset(lut, 0, TEMPORAL_LUT_BINS);
+    int i = 0;
+    while (i < TEMPORAL_LUT_BINS && pdf[i] < eps) ++i;
+    if (i == TEMPORAL_LUT_BINS) return;
+    if (pdf[i] >= 1.0 - eps) {
+        memset(lut, i, TEMPORAL_LUT_BINS);
+        return;
+    }
+    const double scale = (TEMPORAL_LUT_BINS - 1.0) / (1.0 - pdf[i]);
+    double sum = 0.0;
+    for (lut[i++] = 0; i < TEMPORAL_LUT_BINS; ++i) {
+        if (pdf[i] >= eps) sum += pdf[i];
+        lut[i] = cv::saturate_cast<uint8_t>(sum * scale);
+    }
+}
+
+// Fold one frame's histogram into the average and rebuild the LUT.
+// Returns true on the first histogram or a scene cut (the LUT reflects this histogram alone).
+static inline bool temporal_lut_update(TemporalLut *t, const uint32_t hist[TEMPORAL_LUT_BINS]) {
+    uint64_t total = 0;
+    for (int i = 0; i < TEMPORAL_LUT_BINS; ++i) total += hist[i];
+    if (total == 0) return false;
+
+    double pdf[TEMPORAL_LUT_BINS];
+    for (int i = 0; i < TEMPORAL_LUT_BINS; ++i) pdf[i] = (double)hist[i] / (double)total;
+
+    bool cut = false;
+    g_mutex_lock(&t->mutex);
+    if (t->valid) {
+        double dist = 0.0;
+        for (int i = 0; i < TEMPORAL_LUT_BINS; ++i) dist += fabs(pdf[i] - t->pdf[i]);
+        cut = t->scene_cut > 0.0 && dist > t->scene_cut;
+    }
+    if (!t->valid || cut) {
+        memcpy(t->pdf, pdf, sizeof(pdf));
+    } else {
+        for (int i = 0; i < TEMPORAL_LUT_BINS; ++i) t->pdf[i] += t->alpha * (pdf[i] - t->pdf[i]);
+    }
+    temporal_lut_build(t->pdf, t->lut);
+    const bool first = !t->valid;
+    t->valid = true;
+    g_mutex_unlock(&t->mutex);
+
+    t->updates.fetch_add(1, std::memory_order_relaxed);
+    if (cut) t->scene_cuts.fetch_add(1, std::memory_order_relaxed);
+    return cut || first;
+}
+
+// Copy the current LUT; false until the first histogram has been folded in
+static inline bool temporal_lut_get(TemporalLut *t, uint8_t lut[TEMPORAL_LUT_BINS]) {
+    g_mutex_lock(&t->mutex);
+    const bool valid = t->valid;
+    if (valid) memcpy(lut, t->lut, TEMPORAL_LUT_BINS);
+    g_mutex_unlock(&t->mutex);
+    return valid;
+}
+
+static inline void temporal_lut_gather_row(const uint8_t *s, int width, int subsample, uint32_t *hist) {
+    for (int x = 0; x < width; x += subsample) hist[s[x]]++;
+}
+
+// One pass per row: apply `lut` (dst may be null to only gather) and histogram the source
+// on the subsampled grid while the row is still in cache
+static inline void temporal_lut_apply_gather(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride,
+                                             int width, int height, const uint8_t lut[TEMPORAL_LUT_BINS],
+                                             int subsample, int stripes, uint32_t hist[TEMPORAL_LUT_BINS]) {
+    memset(hist, 0, TEMPORAL_LUT_BINS * sizeof(uint32_t));
+    if (width <= 0 || height <= 0) return;
+    if (stripes < 1) stripes = 1;
+    if (stripes > height) stripes = height;
+
+    std::vector<uint32_t> partial((size_t)stripes * TEMPORAL_LUT_BINS, 0);
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &r) {
+        for (int s = r.start; s < r.end; ++s) {
+            const int b = (int)((int64_t)height * s / stripes);
+            const int e = (int)((int64_t)height * (s + 1) / stripes);
+            uint32_t *h = &partial[(size_t)s * TEMPORAL_LUT_BINS];
+            for (int y = b; y < e; ++y) {
+                if (dst) neon_eq_apply_rows(src, src_stride, dst, dst_stride, width, y, y + 1, lut);
+                if (y % subsample == 0) temporal_lut_gather_row(src + (size_t)y * src_stride, width, subsample, h);
+            }
+        }
+    }, stripes);
+
+    for (int s = 0; s < stripes; ++s) {
+        const uint32_t *h = &partial[(size_t)s * TEMPORAL_LUT_BINS];
+        for (int i = 0; i < TEMPORAL_LUT_BINS; ++i) hist[i] += h[i];
+    }
+}
+
+// CPU relay entry point. Returns true when the frame paid for a second pass
+// (first frame or scene cut).
+static inline bool temporal_lut_equalize(TemporalLut *t, const uint8_t *src, size_t src_stride,
+                                         uint8_t *dst, size_t dst_stride, int width, int height, int stripes) {
+    if (width <= 0 || height <= 0) return false;
+    if (stripes < 1) stripes = 1;
+    if (stripes > height) stripes = height;
+
+    uint8_t lut[TEMPORAL_LUT_BINS];
+    uint32_t hist[TEMPORAL_LUT_BINS];
+    const bool have_lut = temporal_lut_get(t, lut);
+    temporal_lut_apply_gather(src, src_stride, have_lut ? dst : nullptr, dst_stride, width, height,
+                              lut, t->subsample, stripes, hist);
+    if (!temporal_lut_update(t, hist)) return false;
+
+    // The LUT this frame was given is stale (or missing): apply the one it just produced
+    temporal_lut_get(t, lut);
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &r) {
+        for (int s = r.start; s < r.end; ++s) {
+            neon_eq_apply_rows(src, src_stride, dst, dst_stride, width,
+                               (int)((int64_t)height * s / stripes), (int)((int64_t)height * (s + 1) / stripes), lut);
+        }
+    }, stripes);
+    return true;
+}
+
+// --slices: with the LUT known before the frame starts, remap a tightly packed NV12 frame
+// as `slices` horizontal slices (a Y band plus, if copy_uv, the chroma rows under it) in
+// parallel, gathering the histogram on the way. Nothing waits on the LUT update: the
+// caller pushes the frame first and then folds `hist` in with temporal_lut_update().
+// Returns false (nothing written) while there is no LUT yet.
+static inline bool temporal_lut_remap_slices(TemporalLut *t, const uint8_t *src, uint8_t *dst, int width, int height,
+                                             bool copy_uv, int slices, uint32_t hist[TEMPORAL_LUT_BINS]) {
+    uint8_t lut[TEMPORAL_LUT_BINS];
+    if (width <= 0 || height < 2 || !temporal_lut_get(t, lut)) return false;
+    if (slices < 1) slices = 1;
+    if (slices > height / 2) slices = height / 2;
+
+    const size_t y_size = (size_t)width * (size_t)height;
+    std::vector<uint32_t> partial((size_t)slices * TEMPORAL_LUT_BINS, 0);
+    cv::parallel_for_(cv::Range(0, slices), [&](const cv::Range &r) {
+        for (int s = r.start; s < r.end; ++s) {
+            // Even band edges so each slice owns whole chroma rows
+            const int b = (int)((int64_t)height * s / slices) & ~1;
+            const int e = s + 1 == slices ? height : (int)((int64_t)height * (s + 1) / slices) & ~1;
+            uint32_t *h = &partial[(size_t)s * TEMPORAL_LUT_BINS];
+            for (int y = b; y < e; ++y) {
+                neon_eq_apply_rows(src, width, dst, width, width, y, y + 1, lut);
+                if (y % t->subsample == 0) temporal_lut_gather_row(src + (size_t)y * width, width, t->subsample, h);
+            }
+            if (copy_uv) {
+                const size_t uv_begin = (size_t)(b / 2) * width, uv_end = (size_t)(e / 2) * width;
+                memcpy(dst + y_size + uv_begin, src + y_size + uv_begin, uv_end - uv_begin);
+            }
+        }
+    }, slices);
+
+    memset(hist, 0, TEMPORAL_LUT_BINS * sizeof(uint32_t));
+    for (int s = 0; s < slices; ++s) {
+        const uint32_t *h = &partial[(size_t)s * TEMPORAL_LUT_BINS];
+        for (int i = 0; i < TEMPORAL_LUT_BINS; ++i) hist[i] += h[i];
+    }
+    return true;
+}
+
+#endif // TEMPORAL_LUT_HPP
@@ -0,0 +1,239 @@
+// video_clahe.hpp
+// Frame-to-frame CLAHE for fixed cameras (--clahe-engine=video).
+//
+// Each tile keeps its clip/redistribute LUT and a sparse sample of the pixels it was
+// built from (every VIDEO_CLAHE_SAMPLE_STEP-th pixel of every VIDEO_CLAHE_SAMPLE_STEP-th
+// row). On a new frame the tile's mean absolute difference against that sample is
+// measured first; only tiles that moved past `threshold` grey levels rebuild their
+// histogram and LUT, the rest reuse the cached one. The bilinear interpolation
+// between tile LUTs then runs in parallel row bands.
+//
+// Under load (deadline_governor.hpp) two knobs trade accuracy for time: hist_step builds
+// tile histograms from every hist_step-th pixel of every hist_step-th row, and
+// refresh_stride > 1 lets only one tile in refresh_stride be rebuilt per frame, round
+// robin. video_clahe_remap() skips the tile stage altogether.
+//
+// Histogram clipping, redistribution and interpolation follow cv::CLAHE; with
+// threshold 0 and a frame size divisible by the grid the output matches
+// cv::CLAHE::apply. Other sizes use shorter edge tiles instead of cv::CLAHE's
+// reflected padding.
+
+#ifndef VIDEO_CLAHE_HPP
+#define VIDEO_CLAHE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#define VIDEO_CLAHE_BINS 256
+#define VIDEO_CLAHE_SAMPLE_STEP 4
+#define VIDEO_CLAHE_THRESHOLD_DEFAULT 3.0   // mean |diff| in grey levels before a tile is rebuilt
+#define VIDEO_CLAHE_REFRESH_STRIDE 4        // governor lut-reuse: tiles rebuilt per frame, 1 in N
+
+struct VideoClaheTile {
+    std::vector<uint8_t> ref;   // sampled pixels the LUT was built from
+    bool valid{false};
+};
+
+struct VideoClahe {
+    double clip_limit{2.0};
+    int    tiles_x{8}, tiles_y{8};
+    double threshold{VIDEO_CLAHE_THRESHOLD_DEFAULT};
+    int    hist_step{1};
+    int    refresh_stride{1};
+
+    int width{0}, height{0};
+    int tile_w{0}, tile_h{0};
+    std::vector<VideoClaheTile> tiles;   // tiles_y * tiles_x, row-major
+    std::vector<uint8_t> luts;           // VIDEO_CLAHE_BINS entries per tile
+
+    uint64_t frames{0};
+    std::atomic<uint64_t> tiles_rebuilt{0};
+    std::atomic<uint64_t> tiles_reused{0};
+};
+
+static inline void video_clahe_init(VideoClahe *v, double clip_limit, int tiles, double threshold) {
+    v->clip_limit = clip_limit;
+    v->tiles_x = v->tiles_y = tiles < 1 ? 1 : tiles;
+    v->threshold = threshold < 0.0 ? 0.0 : threshold;
+    v->width = v->height = 0;
+}
+
+// Geometry changes (first frame, new caps) drop every cached tile
+static inline void video_clahe_reset(VideoClahe *v, int width, int height) {
+    v->width = width;
+    v->height = height;
+    v->tile_w = (width + v->tiles_x - 1) / v->tiles_x;
+    v->tile_h = (height + v->tiles_y - 1) / v->tiles_y;
+    v->tiles.assign((size_t)v->tiles_x * v->tiles_y, VideoClaheTile());
+    v->luts.assign((size_t)v->tiles_x * v->tiles_y * VIDEO_CLAHE_BINS, 0);
+}
+
+static inline void video_clahe_tile_rect(const VideoClahe *v, int tx, int ty, int *x0, int *y0, int *x1, int *y1) {
+    // Tiny frames can leave trailing tiles empty; they borrow the last row/column
+    *x0 = std::min(tx * v->tile_w, v->width - 1);
+    *y0 = std::min(ty * v->tile_h, v->height - 1);
+    *x1 = std::min(*x0 + v->tile_w, v->width);
+    *y1 = std::min(*y0 + v->tile_h, v->height);
+}
+
+// Mean absolute difference between the tile and its stored sample; negative if there is none
+static inline double video_clahe_tile_delta(const VideoClaheTile &t, const uint8_t *src, size_t stride,
+                                            int x0, int y0, int x1, int y1) {
+    if (!t.valid) return -1.0;
+    const uint8_t *r = t.ref.data();
+    uint64_t sad = 0, n = 0;
+    for (int y = y0; y < y1; y += VIDEO_CLAHE_SAMPLE_STEP) {
+        const uint8_t *p = src + (size_t)y * stride;
+        for (int x = x0; x < x1; x += VIDEO_CLAHE_SAMPLE_STEP, ++n) sad += (uint64_t)std::abs((int)p[x] - (int)r[n]);
+    }
+    return n ? (double)sad / (double)n : 0.0;
+}
+
+static inline void video_clahe_tile_sample(VideoClaheTile &t, const uint8_t *src, size_t stride,
+                                           int x0, int y0, int x1, int y1) {
+    t.ref.clear();
+    for (int y = y0; y < y1; y += VIDEO_CLAHE_SAMPLE_STEP) {
+        const uint8_t *p = src + (size_t)y * stride;
+        for (int x = x0; x < x1; x += VIDEO_CLAHE_SAMPLE_STEP) t.ref.push_back(p[x]);
+    }
+    t.valid = true;
+}
+
+// cv::CLAHE's CLAHE_CalcLut_Body for one tile
+static inline void video_clahe_tile_lut(const VideoClahe *v, const uint8_t *src, size_t stride,
+                                        int x0, int y0, int x1, int y1, uint8_t *lut) {
+    int hist[VIDEO_CLAHE_BINS] = {0};
+    const int step = std::max(v->hist_step, 1);
+    int counted = 0;
+    for (int y = y0; y < y1; y += step) {
+        const uint8_t *p = src + (size_t)y * stride;
+        for (int x = x0; x < x1; x += step, ++counted) hist[p[x]]++;
+    }
+    const int area = std::max(counted, 1);
+
+    if (v->clip_limit > 0.0) {
+        const int clip = std::max((int)(v->clip_limit * area / VIDEO_CLAHE_BINS), 1);
+        int clipped = 0;
+        for (int i = 0; i < VIDEO_CLAHE_BINS; ++i) {
+            if (hist[i] > clip) {
+                clipped += hist[i] - clip;
+                hist[i] = clip;
+            }
+        }
+        const int batch = clipped / VIDEO_CLAHE_BINS;
+        int residual = clipped - batch * VIDEO_CLAHE_BINS;
+        for (int i = 0; i < VIDEO_CLAHE_BINS; ++i) hist[i] += batch;
+        if (residual != 0) {
+            const int rstep = std::max(VIDEO_CLAHE_BINS / residual, 1);
+            for (int i = 0; i < VIDEO_CLAHE_BINS && residual > 0; i += rstep, residual--) hist[i]++;
+        }
+    }
+
+    const float scale = (float)(VIDEO_CLAHE_BINS - 1) / (float)area;
+    int sum = 0;
+    for (int i = 0; i < VIDEO_CLAHE_BINS; ++i) {
+        sum += hist[i];
+        lut[i] = cv::saturate_cast<uint8_t>(sum * scale);
+    }
+}
+
+// cv::CLAHE's CLAHE_Interpolation_Body over rows [y_begin, y_end)
+static inline void video_clahe_interpolate(const VideoClahe *v, const uint8_t *src, size_t src_stride,
+                                           uint8_t *dst, size_t dst_stride, int y_begin, int y_end) {
+    const float inv_tw = 1.0f / v->tile_w;
+    const float inv_th = 1.0f / v->tile_h;
+    const uint8_t *luts = v->luts.data();
+
+    // Column weights are the same for every row
+    std::vector<int> ind1(v->width), ind2(v->width);
+    std::vector<float> xa(v->width);
+    for (int x = 0; x < v->width; ++x) {
+        const float txf = x * inv_tw - 0.5f;
+        int tx1 = cvFloor(txf);
+        int tx2 = tx1 + 1;
+        xa[x] = txf - tx1;
+        tx1 = std::max(tx1, 0);
+        tx2 = std::min(tx2, v->tiles_x - 1);
+        ind1[x] = tx1 * VIDEO_CLAHE_BINS;
+        ind2[x] = tx2 * VIDEO_CLAHE_BINS;
+    }
+
+    for (int y = y_begin; y < y_end; ++y) {
+        const float tyf = y * inv_th - 0.5f;
+        int ty1 = cvFloor(tyf);
+        int ty2 = ty1 + 1;
+        const float ya = tyf - ty1, ya1 = 1.0f - ya;
+        ty1 = std::max(ty1, 0);
+        ty2 = std::min(ty2, v->tiles_y - 1);
+
+        const uint8_t *lut1 = luts + (size_t)ty1 * v->tiles_x * VIDEO_CLAHE_BINS;
+        const uint8_t *lut2 = luts + (size_t)ty2 * v->tiles_x * VIDEO_CLAHE_BINS;
+        const uint8_t *s = src + (size_t)y * src_stride;
+        uint8_t *o = dst + (size_t)y * dst_stride;
+        for (int x = 0; x < v->width; ++x) {
+            const int p = s[x];
+            const float xa0 = xa[x], xa1 = 1.0f - xa0;
+            const float res = (lut1[ind1[x] + p] * xa1 + lut1[ind2[x] + p] * xa0) * ya1 +
+                              (lut2[ind1[x] + p] * xa1 + lut2[ind2[x] + p] * xa0) * ya;
+            o[x] = cv::saturate_cast<uint8_t>(res);
+        }
+    }
+}
+
+static inline void video_clahe_interpolate_all(const VideoClahe *v, const cv::Mat &src, cv::Mat &dst) {
+    const int bands = std::max(std::min(cv::getNumThreads(), v->height), 1);
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range &r) {
+        for (int b = r.start; b < r.end; ++b) {
+            video_clahe_interpolate(v, src.data, src.step, dst.data, dst.step,
+                                    (int)((int64_t)v->height * b / bands), (int)((int64_t)v->height * (b + 1) / bands));
+        }
+    }, bands);
+}
+
+// src/dst: CV_8UC1, same size, must not overlap
+static inline void video_clahe_apply(VideoClahe *v, const cv::Mat &src, cv::Mat &dst) {
+    CV_Assert(src.type() == CV_8UC1);
+    dst.create(src.size(), CV_8UC1);
+    if (src.cols != v->width || src.rows != v->height) video_clahe_reset(v, src.cols, src.rows);
+    const int stride = std::max(v->refresh_stride, 1);
+    const int turn = (int)(v->frames++ % (uint64_t)stride);
+
+    const int ntiles = v->tiles_x * v->tiles_y;
+    cv::parallel_for_(cv::Range(0, ntiles), [&](const cv::Range &r) {
+        for (int i = r.start; i < r.end; ++i) {
+            int x0, y0, x1, y1;
+            video_clahe_tile_rect(v, i % v->tiles_x, i / v->tiles_x, &x0, &y0, &x1, &y1);
+            VideoClaheTile &t = v->tiles[i];
+            if (t.valid && i % stride != turn) {
+                v->tiles_reused.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            const double delta = video_clahe_tile_delta(t, src.data, src.step, x0, y0, x1, y1);
+            if (delta >= 0.0 && delta <= v->threshold && v->threshold > 0.0) {
+                v->tiles_reused.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            video_clahe_tile_lut(v, src.data, src.step, x0, y0, x1, y1, &v->luts[(size_t)i * VIDEO_CLAHE_BINS]);
+            video_clahe_tile_sample(t, src.data, src.step, x0, y0, x1, y1);
+            v->tiles_rebuilt.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    video_clahe_interpolate_all(v, src, dst);
+}
+
+// Interpolate with the cached tile LUTs only; false (nothing written) until a frame of
+// this size has built them
+static inline bool video_clahe_remap(VideoClahe *v, const cv::Mat &src, cv::Mat &dst) {
+    CV_Assert(src.type() == CV_8UC1);
+    if (v->frames == 0 || src.cols != v->width || src.rows != v->height) return false;
+    dst.create(src.size(), CV_8UC1);
+    video_clahe_interpolate_all(v, src, dst);
+    return true;
+}
+
+#endif // VIDEO_CLAHE_HPP
@@ -18,6 +18,10 @@
 #include <sstream>
 #include <iostream>
 #include <cstring>
+#include <algorithm>
+
+#include "rate_control.hpp"
+#include "keyframe.hpp"
 
 struct App {
   // GStreamer
@@ -46,6 +50,11 @@ struct App {
   // State
   bool ws_ready = false;
   bool offer_sent = false;
+
+  // --rate-control; vp8enc's target-bitrate is in bits per second
+  RateControl rate;
+  // viewer PLI/FIR and connect-time keyframes, --keyframe-min-ms apart at most
+  KeyframeLimiter keyframes;
 };
 
 static void safe_ws_send(App* app, const char* json_str) {
@@ -239,10 +248,10 @@ static std::string build_pipeline_vp8_webrtc(const App* app) {
      << " ! queue"
      << " ! videoconvert"
      << " ! video/x-raw,format=I420"
-     << " ! vp8enc deadline=1 cpu-used=8 threads=4"
+     << " ! vp8enc name=enc deadline=1 cpu-used=8 threads=4"
      << " target-bitrate=" << app->target_bitrate
      << " error-resilient=1"
-     << " ! rtpvp8pay pt=96"
+     << " ! rtpvp8pay name=pay pt=96"
      << " ! application/x-rtp,media=video,encoding-name=VP8,payload=96"
      << " ! webrtcbin name=sendrecv bundle-policy=max-bundle";
   return ss.str();
@@ -271,6 +280,26 @@ static gboolean bus_cb(GstBus*, GstMessage* msg, gpointer user_data) {
   return TRUE;
 }
 
+static gboolean rate_control_tick(gpointer user_data) {
+  auto* app = static_cast<App*>(user_data);
+  if (!app->ws_ready || !app->offer_sent) return G_SOURCE_CONTINUE;
+  RateSample sample;
+  rate_sample_webrtc(app->webrtc, &sample);
+  if (GstElement* enc = gst_bin_get_by_name(GST_BIN(app->pipeline), "enc")) {
+    rate_control_update(&app->rate, &sample, enc);
+    gst_object_unref(enc);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+// Once media can reach the viewer, give it a keyframe instead of a wait for the next one
+static void on_ice_connection_state(GstElement* webrtc, GParamSpec*, gpointer user_data) {
+  auto* app = static_cast<App*>(user_data);
+  GstWebRTCICEConnectionState state;
+  g_object_get(webrtc, "ice-connection-state", &state, NULL);
+  if (state == GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED) keyframe_request(&app->keyframes, "viewer connected");
+}
+
 static gboolean on_sigint(gpointer user_data) {
   auto* app = static_cast<App*>(user_data);
   g_print("Caught SIGINT, shutting down...\n");
@@ -321,6 +350,12 @@ static void parse_args(App* app, int argc, char** argv) {
     else if (arg=="--fps")                  app->fps    = std::stoi(next(i));
     else if (arg.rfind("--bitrate=",0)==0)  app->target_bitrate = std::stoi(arg.substr(10));
     else if (arg=="--bitrate")              app->target_bitrate = std::stoi(next(i));
+    else if (arg=="--rate-control")         app->rate.enabled = true;
+    else if (arg.rfind("--min-bitrate=",0)==0)   app->rate.min_kbps = std::stoi(arg.substr(14)) / 1000;
+    else if (arg.rfind("--max-bitrate=",0)==0)   app->rate.max_kbps = std::stoi(arg.substr(14)) / 1000;
+    else if (arg.rfind("--keyframe-min-ms=",0)==0) app->keyframes.min_interval_ms = std::max(0, std::stoi(arg.substr(18)));
+    else if (arg.rfind("--rate-interval=",0)==0) app->rate.interval_ms = std::max(100, std::stoi(arg.substr(16)));
+    else if (arg.rfind("--rate-rtt-ms=",0)==0)  app->rate.rtt_high_ms = std::max(1, std::stoi(arg.substr(14)));
 
     else if (arg.rfind("--ws=",0)==0)       app->ws_url = arg.substr(5);
     else if (arg=="--ws")                   app->ws_url = next(i);
@@ -376,6 +411,8 @@ int main(int argc, char** argv) {
   // Hook WebRTC signals
   g_signal_connect(app.webrtc, "on-negotiation-needed", G_CALLBACK(on_negotiation_needed), &app);
   g_signal_connect(app.webrtc, "on-ice-candidate",      G_CALLBACK(on_ice_candidate),      &app);
+  g_signal_connect(app.webrtc, "notify::ice-connection-state", G_CALLBACK(on_ice_connection_state), &app);
+  keyframe_install(&app.keyframes, app.pipeline, "pay");
 
   // Bus logging
   GstBus* bus = gst_element_get_bus(app.pipeline);
@@ -388,6 +425,14 @@ int main(int argc, char** argv) {
   // Ctrl+C
   g_unix_signal_add(SIGINT, on_sigint, &app);
 
+  // Bitrate follows the viewer's receiver reports (--min/--max-bitrate in bps, like --bitrate)
+  if (app.rate.enabled) {
+    app.rate.unit = 1000;
+    rate_control_reset(&app.rate, app.target_bitrate / 1000);
+    g_print("Rate control: %d-%d kbps, every %d ms\n", app.rate.min_kbps, app.rate.max_kbps, app.rate.interval_ms);
+    g_timeout_add(app.rate.interval_ms, rate_control_tick, &app);
+  }
+
   // Connect WebSocket to signaling server
   app.soup = soup_session_new();
   app.ws_msg = soup_message_new(SOUP_METHOD_GET, app.ws_url.c_str());
@@ -403,6 +448,7 @@ int main(int argc, char** argv) {
   if (app.ws_conn) soup_websocket_connection_close(app.ws_conn, SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
   if (app.pipeline) { gst_element_set_state(app.pipeline, GST_STATE_NULL); gst_object_unref(app.pipeline); }
   if (app.webrtc) gst_object_unref(app.webrtc);
+  keyframe_uninstall(&app.keyframes);
   if (app.ws_msg) g_object_unref(app.ws_msg);
   if (app.soup) g_object_unref(app.soup);
   if (app.loop) g_main_loop_unref(app.loop);
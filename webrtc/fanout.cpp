@@ -0,0 +1,956 @@
+// fanout.cpp  (WebRTC sender, one encode shared by every viewer)
+// Build:
+// g++ -O2 -std=c++17 fanout.cpp -o fanout \
+//   $(pkg-config --cflags --libs gstreamer-1.0 gstreamer-webrtc-1.0 \
+//                gstreamer-sdp-1.0 gstreamer-video-1.0 glib-2.0 gio-2.0 json-glib-1.0 libsoup-2.4)
+//
+// vad2connection and friends give the single webrtcbin to whoever answered last. Here
+// the camera is encoded and payloaded once and split by a tee; every viewer gets its own
+// branch, added when it joins and torn down when it leaves:
+//   v4l2src ! ... ! enc ! parse ! pay ! vtee ─┬─ queue (leaky) ! webrtcbin (viewer A)
+//                                            └─ queue (leaky) ! webrtcbin (viewer B)
+//   audiotestsrc ! ... ! rtpopuspay ! atee ───── one leaky queue per viewer, likewise
+// A branch queue holds at most --peer-queue-ms of media and drops its oldest buffers
+// beyond that, so a viewer on a bad link loses frames without stalling the tee for the
+// others. The encoder runs at one bitrate for all viewers; with --rate-control that
+// bitrate follows the worst viewer's loss and RTT.
+//
+// Signaling is the vad2connection protocol plus join/leave notices. The server stamps
+// "from" on what it relays; a viewer announces itself with a broadcast
+//   {"type":"viewer-join"}                          (or the server sends {"type":"peer-joined","id":...})
+// and leaves with
+//   {"type":"viewer-leave"}                         (or {"type":"peer-left","id":...})
+// Offers and ICE candidates go "to" that viewer, its answer and candidates come back
+// "from" it. A viewer whose ICE connection fails or closes is dropped as well.
+
+#define GST_USE_UNSTABLE_API
+
+#include <gst/gst.h>
+#include <gst/webrtc/webrtc.h>
+#include <gst/sdp/sdp.h>
+#include <libsoup/soup.h>
+#include <json-glib/json-glib.h>
+#include <string.h>
+#include <iostream>
+#include <getopt.h>
+
+#include "rate_control.hpp"
+#include "keyframe.hpp"
+
+#define MAX_PEERS_DEFAULT 8
+#define PEER_QUEUE_MS_DEFAULT 200
+#define PEER_STATS_INTERVAL 5   // seconds between viewer/drop reports
+
+// Configuration structure
+struct Config {
+    gchar *codec;
+    gint bitrate;
+    gint fps;
+    gint width;
+    gint height;
+    gchar *device;
+    gint max_peers;
+    gint peer_queue_ms;
+    gint idr_period;
+    gchar *enhance;     // yenhance backend, NULL for none
+};
+
+// One viewer's branch. Created and destroyed on the main thread; the elements belong to
+// the pipeline bin from creation until finish_remove_peer.
+struct Peer {
+    gchar *id;
+    GstElement *webrtc;
+    GstElement *vqueue;
+    GstElement *aqueue;
+    GstPad *vtee_pad;          // request pads on vtee/atee
+    GstPad *atee_pad;
+    gint unlinks_pending;      // tee pads still to unlink during removal
+    gint dropped;              // video buffers the branch queue leaked (atomic)
+    gint dropped_reported;
+};
+
+// Global variables
+static GstElement *pipeline = NULL;
+static GstElement *vtee = NULL;
+static GstElement *atee = NULL;
+static GHashTable *peers = NULL;   // viewer id -> Peer*, main thread only
+static SoupWebsocketConnection *ws_conn = NULL;
+static GMainLoop *loop = NULL;
+static gchar *my_id = NULL;
+static struct Config config;
+static SoupSession *session = NULL;
+static gboolean is_reconnecting = FALSE;
+static RateControl rate;
+static KeyframeLimiter keyframes;
+
+// Signaling server details
+static const gchar *server_url = "ws://192.168.25.69:8080";
+
+// Function declarations
+static void on_offer_created(GstPromise *promise, gpointer user_data);
+static void on_negotiation_needed(GstElement *element, gpointer user_data);
+static void on_ice_candidate(GstElement *webrtc, guint mlineindex, gchar *candidate, gpointer user_data);
+static void remove_peer(Peer *p);
+static void connect_to_signaling_server();
+
+// " periodicity-idr=N" for the encoder, or nothing for its own default
+static std::string idr_option() {
+    return config.idr_period > 0 ? " periodicity-idr=" + std::to_string(config.idr_period) : std::string();
+}
+
+// "video/x-raw,format=NV12 ! yenhance backend=B ! " between videoconvert and the encoder
+static std::string enhance_option() {
+    if (!config.enhance) return std::string();
+    return std::string("video/x-raw,format=NV12 ! yenhance backend=") + config.enhance + " ! ";
+}
+
+static const gchar *peer_id_of(GstElement *webrtc) {
+    return (const gchar *)g_object_get_data(G_OBJECT(webrtc), "peer-id");
+}
+
+// Runs on the main thread; the socket is only touched there
+static gboolean send_text_cb(gpointer data) {
+    if (!ws_conn) {
+        g_printerr("WebSocket not connected\n");
+        return G_SOURCE_REMOVE;
+    }
+    g_print("Sending: %s\n", (const gchar *)data);
+    soup_websocket_connection_send_text(ws_conn, (const gchar *)data);
+    return G_SOURCE_REMOVE;
+}
+
+// Send JSON message via WebSocket. Safe from webrtcbin's threads: the text is handed
+// to the main loop (or sent right away when already on it).
+static void send_json_message(JsonObject *msg) {
+    JsonNode *root = json_node_new(JSON_NODE_OBJECT);
+    json_node_set_object(root, msg);
+    gchar *text = json_to_string(root, FALSE);
+    json_node_free(root);
+
+    g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, send_text_cb, text, g_free);
+}
+
+// queue "overrun": the branch is full and is about to leak a buffer
+static void on_branch_overrun(GstElement *queue, gpointer user_data) {
+    Peer *p = (Peer *)user_data;
+    g_atomic_int_inc(&p->dropped);
+}
+
+// data is a ref to the viewer's webrtcbin. A reloaded viewer gets a new branch under the
+// same id, so the old webrtcbin's late failed/closed must not remove it.
+static gboolean remove_peer_by_webrtc_cb(gpointer data) {
+    GstElement *webrtc = (GstElement *)data;
+    Peer *p = (Peer *)g_hash_table_lookup(peers, peer_id_of(webrtc));
+    if (p && p->webrtc == webrtc) remove_peer(p);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_ice_connection_state(GstElement *webrtc, GParamSpec *pspec, gpointer user_data) {
+    GstWebRTCICEConnectionState ice_conn_state;
+    g_object_get(webrtc, "ice-connection-state", &ice_conn_state, NULL);
+    const gchar *state_str = NULL;
+    switch (ice_conn_state) {
+        case GST_WEBRTC_ICE_CONNECTION_STATE_NEW: state_str = "new"; break;
+        case GST_WEBRTC_ICE_CONNECTION_STATE_CHECKING: state_str = "checking"; break;
+        case GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED: state_str = "connected"; break;
+        case GST_WEBRTC_ICE_CONNECTION_STATE_COMPLETED: state_str = "completed"; break;
+        case GST_WEBRTC_ICE_CONNECTION_STATE_FAILED: state_str = "failed"; break;
+        case GST_WEBRTC_ICE_CONNECTION_STATE_DISCONNECTED: state_str = "disconnected"; break;
+        case GST_WEBRTC_ICE_CONNECTION_STATE_CLOSED: state_str = "closed"; break;
+        default: state_str = "unknown";
+    }
+    g_print("[%s] ICE connection state changed to: %s\n", peer_id_of(webrtc), state_str);
+
+    // Media can reach this viewer now; one keyframe (shared by everyone) instead of a wait
+    // for the periodic IDR
+    if (ice_conn_state == GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED) {
+        keyframe_request(&keyframes, "viewer connected");
+    }
+
+    // "disconnected" may still recover; failed and closed do not
+    if (ice_conn_state == GST_WEBRTC_ICE_CONNECTION_STATE_FAILED ||
+        ice_conn_state == GST_WEBRTC_ICE_CONNECTION_STATE_CLOSED) {
+        g_idle_add_full(G_PRIORITY_DEFAULT, remove_peer_by_webrtc_cb, gst_object_ref(webrtc), gst_object_unref);
+    }
+}
+
+static GstElement *make_branch_queue() {
+    GstElement *q = gst_element_factory_make("queue", NULL);
+    // Bounded by time only; leaky=downstream (2) drops the oldest buffer when full
+    g_object_set(q,
+                 "max-size-buffers", 0,
+                 "max-size-bytes", 0,
+                 "max-size-time", (guint64)config.peer_queue_ms * GST_MSECOND,
+                 "leaky", 2,
+                 NULL);
+    return q;
+}
+
+// Link a new tee request pad to the branch queue; the branch is already PLAYING
+static GstPad *attach_to_tee(GstElement *tee, GstElement *queue) {
+    GstPad *tee_pad = gst_element_get_request_pad(tee, "src_%u");
+    GstPad *sink = gst_element_get_static_pad(queue, "sink");
+    if (gst_pad_link(tee_pad, sink) != GST_PAD_LINK_OK) {
+        g_printerr("Failed to link %s to a viewer branch\n", GST_ELEMENT_NAME(tee));
+    }
+    gst_object_unref(sink);
+    return tee_pad;
+}
+
+static void add_peer(const gchar *id) {
+    if (g_hash_table_size(peers) >= (guint)config.max_peers) {
+        g_printerr("Viewer limit (%d) reached, ignoring %s\n", config.max_peers, id);
+        return;
+    }
+
+    Peer *p = g_new0(Peer, 1);
+    p->id = g_strdup(id);
+
+    p->webrtc = gst_element_factory_make("webrtcbin", NULL);
+    if (!p->webrtc) {
+        g_printerr("Failed to create webrtcbin for %s\n", id);
+        g_free(p->id);
+        g_free(p);
+        return;
+    }
+    g_object_set(p->webrtc,
+                 "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE,
+                 "latency", 100,
+                 "stun-server", "stun://stun.l.google.com:19302",
+                 NULL);
+    g_object_set_data_full(G_OBJECT(p->webrtc), "peer-id", g_strdup(id), g_free);
+
+    p->vqueue = make_branch_queue();
+    p->aqueue = make_branch_queue();
+    g_signal_connect(p->vqueue, "overrun", G_CALLBACK(on_branch_overrun), p);
+
+    g_signal_connect(p->webrtc, "on-negotiation-needed", G_CALLBACK(on_negotiation_needed), NULL);
+    g_signal_connect(p->webrtc, "on-ice-candidate", G_CALLBACK(on_ice_candidate), NULL);
+    g_signal_connect(p->webrtc, "notify::ice-connection-state", G_CALLBACK(on_ice_connection_state), NULL);
+
+    gst_bin_add_many(GST_BIN(pipeline), p->vqueue, p->aqueue, p->webrtc, NULL);
+
+    // Video first so the m-lines stay video0/audio1 as in the other senders
+    if (!gst_element_link_pads(p->vqueue, "src", p->webrtc, "sink_%u") ||
+        !gst_element_link_pads(p->aqueue, "src", p->webrtc, "sink_%u")) {
+        g_printerr("Failed to link viewer branch for %s\n", id);
+    }
+
+    // Downstream first, and only then feed it, so the tee never pushes into a NULL element
+    gst_element_sync_state_with_parent(p->webrtc);
+    gst_element_sync_state_with_parent(p->vqueue);
+    gst_element_sync_state_with_parent(p->aqueue);
+
+    p->vtee_pad = attach_to_tee(vtee, p->vqueue);
+    p->atee_pad = attach_to_tee(atee, p->aqueue);
+
+    g_hash_table_insert(peers, p->id, p);
+    g_print("Viewer %s joined (%u connected)\n", id, g_hash_table_size(peers));
+}
+
+// Main thread, once both tee pads are released
+static gboolean finish_remove_peer(gpointer data) {
+    Peer *p = (Peer *)data;
+
+    gst_element_set_state(p->vqueue, GST_STATE_NULL);
+    gst_element_set_state(p->aqueue, GST_STATE_NULL);
+    gst_element_set_state(p->webrtc, GST_STATE_NULL);
+    gst_bin_remove_many(GST_BIN(pipeline), p->vqueue, p->aqueue, p->webrtc, NULL);
+
+    gst_object_unref(p->vtee_pad);
+    gst_object_unref(p->atee_pad);
+
+    g_print("Viewer %s removed (%u connected)\n", p->id, g_hash_table_size(peers));
+    g_free(p->id);
+    g_free(p);
+    return G_SOURCE_REMOVE;
+}
+
+// The tee is not pushing on this pad right now: cut the branch off and give the pad back
+static GstPadProbeReturn unlink_branch_cb(GstPad *tee_pad, GstPadProbeInfo *info, gpointer user_data) {
+    Peer *p = (Peer *)user_data;
+
+    GstElement *tee = gst_pad_get_parent_element(tee_pad);
+    GstPad *peer_pad = gst_pad_get_peer(tee_pad);
+    if (peer_pad) {
+        gst_pad_unlink(tee_pad, peer_pad);
+        gst_object_unref(peer_pad);
+    }
+    if (tee) {
+        gst_element_release_request_pad(tee, tee_pad);
+        gst_object_unref(tee);
+    }
+
+    if (g_atomic_int_dec_and_test(&p->unlinks_pending)) {
+        g_idle_add(finish_remove_peer, p);
+    }
+    return GST_PAD_PROBE_REMOVE;
+}
+
+// Detach a viewer without disturbing the others. The branch is unlinked from the tees
+// from an idle probe (between two buffers) and dismantled on the main thread afterwards.
+static void remove_peer(Peer *p) {
+    g_hash_table_steal(peers, p->id);
+    g_print("Removing viewer %s\n", p->id);
+    // No further state changes from this branch; ones already queued are ignored by
+    // remove_peer_by_webrtc_cb
+    g_signal_handlers_disconnect_by_func(p->webrtc, (gpointer)on_ice_connection_state, NULL);
+
+    p->unlinks_pending = 2;
+    gst_pad_add_probe(p->vtee_pad, GST_PAD_PROBE_TYPE_IDLE, unlink_branch_cb, p, NULL);
+    gst_pad_add_probe(p->atee_pad, GST_PAD_PROBE_TYPE_IDLE, unlink_branch_cb, p, NULL);
+}
+
+static void remove_all_peers() {
+    GList *list = g_hash_table_get_values(peers);
+    for (GList *l = list; l; l = l->next) {
+        remove_peer((Peer *)l->data);
+    }
+    g_list_free(list);
+}
+
+static gboolean print_peer_stats(gpointer user_data) {
+    if (g_hash_table_size(peers) == 0) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    g_print("Viewers: %u\n", g_hash_table_size(peers));
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, peers);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        Peer *p = (Peer *)value;
+        const gint dropped = g_atomic_int_get(&p->dropped);
+        g_print("  %s: %d video buffers dropped (+%d)\n", p->id, dropped, dropped - p->dropped_reported);
+        p->dropped_reported = dropped;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// "id" when the server announces the viewer, "from" when the viewer announced itself
+static const gchar *message_peer_id(JsonObject *object) {
+    if (json_object_has_member(object, "id")) {
+        return json_object_get_string_member(object, "id");
+    }
+    if (json_object_has_member(object, "from")) {
+        return json_object_get_string_member(object, "from");
+    }
+    return NULL;
+}
+
+// Handle incoming WebSocket messages
+static void on_message(SoupWebsocketConnection *conn, SoupWebsocketDataType type,
+                       GBytes *message, gpointer user_data) {
+    if (type != SOUP_WEBSOCKET_DATA_TEXT) {
+        return;
+    }
+
+    gsize size;
+    const gchar *data = (const gchar *)g_bytes_get_data(message, &size);
+    gchar *text = g_strndup(data, size);
+
+    g_print("Received: %s\n", text);
+
+    JsonParser *parser = json_parser_new();
+    if (!json_parser_load_from_data(parser, text, -1, NULL)) {
+        g_printerr("Failed to parse JSON\n");
+        g_free(text);
+        g_object_unref(parser);
+        return;
+    }
+
+    JsonNode *root = json_parser_get_root(parser);
+    JsonObject *object = json_node_get_object(root);
+    const gchar *msg_type = json_object_get_string_member(object, "type");
+
+    if (g_strcmp0(msg_type, "registered") == 0) {
+        g_free(my_id);
+        my_id = g_strdup(json_object_get_string_member(object, "id"));
+        g_print("Registered with ID: %s\n", my_id);
+        g_print("Waiting for viewers...\n");
+
+    } else if (g_strcmp0(msg_type, "viewer-join") == 0 || g_strcmp0(msg_type, "peer-joined") == 0) {
+        const gchar *id = message_peer_id(object);
+        if (id && g_strcmp0(id, my_id) != 0) {
+            // A repeated join is a viewer that reloaded: give it a fresh branch
+            Peer *old = (Peer *)g_hash_table_lookup(peers, id);
+            if (old) {
+                remove_peer(old);
+            }
+            add_peer(id);
+        }
+
+    } else if (g_strcmp0(msg_type, "viewer-leave") == 0 || g_strcmp0(msg_type, "peer-left") == 0) {
+        const gchar *id = message_peer_id(object);
+        Peer *p = id ? (Peer *)g_hash_table_lookup(peers, id) : NULL;
+        if (p) {
+            remove_peer(p);
+        }
+
+    } else if (g_strcmp0(msg_type, "answer") == 0) {
+        const gchar *sdp_text = json_object_get_string_member(object, "sdp");
+        const gchar *from_id = json_object_get_string_member(object, "from");
+        Peer *p = from_id ? (Peer *)g_hash_table_lookup(peers, from_id) : NULL;
+        if (!p) {
+            g_printerr("Answer from unknown viewer %s, ignoring\n", from_id ? from_id : "(none)");
+            g_free(text);
+            g_object_unref(parser);
+            return;
+        }
+
+        g_print("Received answer from: %s\n", from_id);
+
+        GstSDPMessage *sdp;
+        gst_sdp_message_new(&sdp);
+        gst_sdp_message_parse_buffer((guint8 *)sdp_text, strlen(sdp_text), sdp);
+
+        GstWebRTCSessionDescription *answer = gst_webrtc_session_description_new(
+            GST_WEBRTC_SDP_TYPE_ANSWER, sdp);
+
+        GstPromise *promise = gst_promise_new();
+        g_signal_emit_by_name(p->webrtc, "set-remote-description", answer, promise);
+        gst_promise_interrupt(promise);
+        gst_promise_unref(promise);
+
+        gst_webrtc_session_description_free(answer);
+
+    } else if (g_strcmp0(msg_type, "ice-candidate") == 0) {
+        const gchar *from_id = json_object_has_member(object, "from")
+                                   ? json_object_get_string_member(object, "from") : NULL;
+        Peer *p = from_id ? (Peer *)g_hash_table_lookup(peers, from_id) : NULL;
+        JsonObject *candidate_obj = json_object_get_object_member(object, "candidate");
+        const gchar *candidate_str = candidate_obj ? json_object_get_string_member(candidate_obj, "candidate") : NULL;
+
+        if (!p || !candidate_str || strlen(candidate_str) == 0) {
+            g_print("Ignoring ICE candidate (%s)\n", p ? "end-of-candidates" : "unknown viewer");
+            g_free(text);
+            g_object_unref(parser);
+            return;
+        }
+
+        guint sdp_mline_index = json_object_get_int_member(candidate_obj, "sdpMLineIndex");
+
+        g_print("Received ICE candidate from %s: %s\n", from_id, candidate_str);
+        g_signal_emit_by_name(p->webrtc, "add-ice-candidate", sdp_mline_index, candidate_str);
+    }
+
+    g_free(text);
+    g_object_unref(parser);
+}
+
+// Handle ICE candidate generation
+static void on_ice_candidate(GstElement *webrtc, guint mlineindex,
+                             gchar *candidate, gpointer user_data) {
+    const gchar *mid = (mlineindex == 1) ? "audio1" : "video0";
+
+    JsonObject *ice = json_object_new();
+    json_object_set_string_member(ice, "candidate", candidate);
+    json_object_set_int_member(ice, "sdpMLineIndex", mlineindex);
+    json_object_set_string_member(ice, "sdpMid", mid);
+
+    JsonObject *msg = json_object_new();
+    json_object_set_string_member(msg, "type", "ice-candidate");
+    json_object_set_object_member(msg, "candidate", ice);
+    json_object_set_string_member(msg, "to", peer_id_of(webrtc));
+
+    send_json_message(msg);
+    json_object_unref(msg);
+}
+
+// Handle offer creation; user_data is a ref on the viewer's webrtcbin
+static void on_offer_created(GstPromise *promise, gpointer user_data) {
+    GstElement *webrtc = GST_ELEMENT(user_data);
+    GstWebRTCSessionDescription *offer = NULL;
+    const GstStructure *reply = gst_promise_get_reply(promise);
+
+    gst_structure_get(reply, "offer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offer, NULL);
+    gst_promise_unref(promise);
+    if (!offer) {
+        g_printerr("[%s] Offer creation failed\n", peer_id_of(webrtc));
+        return;
+    }
+
+    g_print("[%s] Offer created, setting local description\n", peer_id_of(webrtc));
+
+    promise = gst_promise_new();
+    g_signal_emit_by_name(webrtc, "set-local-description", offer, promise);
+    gst_promise_interrupt(promise);
+    gst_promise_unref(promise);
+
+    gchar *sdp_text = gst_sdp_message_as_text(offer->sdp);
+
+    JsonObject *msg = json_object_new();
+    json_object_set_string_member(msg, "type", "offer");
+    json_object_set_string_member(msg, "sdp", sdp_text);
+    json_object_set_string_member(msg, "to", peer_id_of(webrtc));
+
+    send_json_message(msg);
+
+    g_free(sdp_text);
+    json_object_unref(msg);
+    gst_webrtc_session_description_free(offer);
+}
+
+// Handle negotiation needed
+static void on_negotiation_needed(GstElement *element, gpointer user_data) {
+    g_print("[%s] Negotiation needed, creating offer\n", peer_id_of(element));
+
+    GstPromise *promise = gst_promise_new_with_change_func(on_offer_created, gst_object_ref(element),
+                                                           (GDestroyNotify)gst_object_unref);
+    g_signal_emit_by_name(element, "create-offer", NULL, promise);
+}
+
+// WebSocket connection established
+static void on_websocket_connected(GObject *session_obj, GAsyncResult *res, gpointer user_data) {
+    GError *error = NULL;
+    ws_conn = soup_session_websocket_connect_finish(SOUP_SESSION(session_obj), res, &error);
+
+    if (error) {
+        g_printerr("WebSocket connection failed: %s\n", error->message);
+        g_error_free(error);
+
+        // Retry connection after 3 seconds
+        g_print("Retrying connection in 3 seconds...\n");
+        g_timeout_add_seconds(3, [](gpointer data) -> gboolean {
+            connect_to_signaling_server();
+            return G_SOURCE_REMOVE;
+        }, NULL);
+        return;
+    }
+
+    g_print("WebSocket connected to signaling server\n");
+    is_reconnecting = FALSE;
+
+    g_signal_connect(ws_conn, "message", G_CALLBACK(on_message), NULL);
+
+    g_signal_connect(ws_conn, "closed", G_CALLBACK(+[](SoupWebsocketConnection *conn, gpointer data) {
+        g_print("WebSocket closed\n");
+
+        if (ws_conn) {
+            g_object_unref(ws_conn);
+            ws_conn = NULL;
+        }
+
+        // Viewer ids belong to the old session; the encoder keeps running
+        remove_all_peers();
+
+        // Reconnect to signaling server after 2 seconds
+        if (!is_reconnecting) {
+            is_reconnecting = TRUE;
+            g_print("Reconnecting to signaling server in 2 seconds...\n");
+            g_timeout_add_seconds(2, [](gpointer data) -> gboolean {
+                connect_to_signaling_server();
+                return G_SOURCE_REMOVE;
+            }, NULL);
+        }
+    }), loop);
+}
+
+// Connect to signaling server
+static void connect_to_signaling_server() {
+    g_print("Connecting to signaling server: %s\n", server_url);
+
+    SoupMessage *msg = soup_message_new("GET", server_url);
+    soup_session_websocket_connect_async(session, msg, NULL, NULL, NULL,
+                                         on_websocket_connected, NULL);
+}
+
+// Bus message handler
+static gboolean on_bus_message(GstBus *bus, GstMessage *message, gpointer user_data) {
+    switch (GST_MESSAGE_TYPE(message)) {
+        case GST_MESSAGE_ERROR: {
+            GError *err;
+            gchar *debug;
+            gst_message_parse_error(message, &err, &debug);
+            g_printerr("Error from %s: %s\n", GST_OBJECT_NAME(message->src), err->message);
+            g_printerr("Debug: %s\n", debug);
+            g_error_free(err);
+            g_free(debug);
+            break;
+        }
+        case GST_MESSAGE_WARNING: {
+            GError *err;
+            gchar *debug;
+            gst_message_parse_warning(message, &err, &debug);
+            g_printerr("Warning: %s\n", err->message);
+            g_error_free(err);
+            g_free(debug);
+            break;
+        }
+        case GST_MESSAGE_EOS:
+            g_print("End of stream\n");
+            break;
+        default:
+            break;
+    }
+    return TRUE;
+}
+
+// Print usage information
+static void print_usage(const char *prog_name) {
+    g_print("Usage: %s [OPTIONS]\n", prog_name);
+    g_print("\nOptions:\n");
+    g_print("  --codec=CODEC       Video codec: h264 or h265 (default: h264)\n");
+    g_print("  --bitrate=KBPS      Video bitrate in kbps (default: 2000)\n");
+    g_print("  --fps=FPS           Framerate (default: 30)\n");
+    g_print("  --width=WIDTH       Video width (default: 1280)\n");
+    g_print("  --height=HEIGHT     Video height (default: 720)\n");
+    g_print("  --device=PATH       Camera device path (default: /dev/video0)\n");
+    g_print("  --max-peers=N       Viewers served at once (default: %d)\n", MAX_PEERS_DEFAULT);
+    g_print("  --peer-queue-ms=MS  Media buffered per viewer before its oldest buffers are dropped (default: %d)\n",
+            PEER_QUEUE_MS_DEFAULT);
+    g_print("  --rate-control      Adapt the bitrate to the worst viewer's loss and RTT\n");
+    g_print("  --min-bitrate=KBPS  Lowest adapted bitrate (default: bitrate/4)\n");
+    g_print("  --max-bitrate=KBPS  Highest adapted bitrate (default: bitrate)\n");
+    g_print("  --rate-interval=MS  Stats poll interval (default: %d)\n", RATE_INTERVAL_MS_DEFAULT);
+    g_print("  --rate-rtt-ms=MS    Round-trip time above which the bitrate is cut (default: %d)\n", RATE_RTT_MS_DEFAULT);
+    g_print("  --keyframe-min-ms=MS  Least time between forced keyframes (default: %d)\n", KEYFRAME_MIN_MS_DEFAULT);
+    g_print("  --idr-period=FRAMES   Periodic IDR interval, 0 for the encoder default (default: 0)\n");
+    g_print("  --enhance=BACKEND   Enhance luma before encoding with the yenhance element:\n");
+    g_print("                      cpu, neon, clahe, clahe-video, fpga, clahe-fpga (libgstyenhance.so on GST_PLUGIN_PATH)\n");
+    g_print("  --help              Show this help message\n");
+    g_print("\nExamples:\n");
+    g_print("  %s --codec=h264 --bitrate=5000 --fps=30 --max-peers=4\n", prog_name);
+    g_print("  %s --codec=h265 --bitrate=3000 --width=1920 --height=1080 --peer-queue-ms=500\n", prog_name);
+    g_print("\n");
+}
+
+// Parse command line arguments
+static gboolean parse_arguments(int argc, char *argv[]) {
+    config.codec = g_strdup("h264");
+    config.bitrate = 2000;
+    config.fps = 30;
+    config.width = 1280;
+    config.height = 720;
+    config.device = g_strdup("/dev/video0");
+    config.max_peers = MAX_PEERS_DEFAULT;
+    config.peer_queue_ms = PEER_QUEUE_MS_DEFAULT;
+    config.idr_period = 0;
+    config.enhance = NULL;
+
+    struct option long_options[] = {
+        {"codec",         required_argument, 0, 'c'},
+        {"bitrate",       required_argument, 0, 'b'},
+        {"fps",           required_argument, 0, 'f'},
+        {"width",         required_argument, 0, 'w'},
+        {"height",        required_argument, 0, 'H'},
+        {"device",        required_argument, 0, 'd'},
+        {"max-peers",     required_argument, 0, 'm'},
+        {"peer-queue-ms", required_argument, 0, 'q'},
+        {"rate-control",  no_argument,       0, 'r'},
+        {"min-bitrate",   required_argument, 0, 'n'},
+        {"max-bitrate",   required_argument, 0, 'x'},
+        {"rate-interval", required_argument, 0, 'i'},
+        {"rate-rtt-ms",   required_argument, 0, 't'},
+        {"keyframe-min-ms", required_argument, 0, 'k'},
+        {"idr-period",      required_argument, 0, 'p'},
+        {"enhance",         required_argument, 0, 'e'},
+        {"help",          no_argument,       0, '?'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "c:b:f:w:H:d:m:q:rn:x:i:t:k:p:e:?", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'c':
+                g_free(config.codec);
+                config.codec = g_strdup(optarg);
+                if (g_strcmp0(config.codec, "h264") != 0 && g_strcmp0(config.codec, "h265") != 0) {
+                    g_printerr("Error: codec must be 'h264' or 'h265'\n");
+                    return FALSE;
+                }
+                break;
+            case 'b':
+                config.bitrate = atoi(optarg);
+                if (config.bitrate <= 0) {
+                    g_printerr("Error: bitrate must be positive\n");
+                    return FALSE;
+                }
+                break;
+            case 'f':
+                config.fps = atoi(optarg);
+                if (config.fps <= 0 || config.fps > 120) {
+                    g_printerr("Error: fps must be between 1 and 120\n");
+                    return FALSE;
+                }
+                break;
+            case 'w':
+                config.width = atoi(optarg);
+                if (config.width <= 0) {
+                    g_printerr("Error: width must be positive\n");
+                    return FALSE;
+                }
+                break;
+            case 'H':
+                config.height = atoi(optarg);
+                if (config.height <= 0) {
+                    g_printerr("Error: height must be positive\n");
+                    return FALSE;
+                }
+                break;
+            case 'd':
+                g_free(config.device);
+                config.device = g_strdup(optarg);
+                break;
+            case 'm':
+                config.max_peers = atoi(optarg);
+                if (config.max_peers <= 0) {
+                    g_printerr("Error: max-peers must be positive\n");
+                    return FALSE;
+                }
+                break;
+            case 'q':
+                config.peer_queue_ms = atoi(optarg);
+                if (config.peer_queue_ms <= 0) {
+                    g_printerr("Error: peer-queue-ms must be positive\n");
+                    return FALSE;
+                }
+                break;
+            case 'r':
+                rate.enabled = true;
+                break;
+            case 'n':
+                rate.min_kbps = atoi(optarg);
+                break;
+            case 'x':
+                rate.max_kbps = atoi(optarg);
+                break;
+            case 'i':
+                rate.interval_ms = atoi(optarg);
+                if (rate.interval_ms < 100) {
+                    g_printerr("Error: rate-interval must be at least 100 ms\n");
+                    return FALSE;
+                }
+                break;
+            case 't':
+                rate.rtt_high_ms = atoi(optarg);
+                if (rate.rtt_high_ms <= 0) {
+                    g_printerr("Error: rate-rtt-ms must be positive\n");
+                    return FALSE;
+                }
+                break;
+            case 'k':
+                keyframes.min_interval_ms = atoi(optarg);
+                if (keyframes.min_interval_ms < 0) {
+                    g_printerr("Error: keyframe-min-ms must not be negative\n");
+                    return FALSE;
+                }
+                break;
+            case 'p':
+                config.idr_period = atoi(optarg);
+                if (config.idr_period < 0) {
+                    g_printerr("Error: idr-period must not be negative\n");
+                    return FALSE;
+                }
+                break;
+            case 'e':
+                g_free(config.enhance);
+                config.enhance = g_strdup(optarg);
+                break;
+            case '?':
+            default:
+                print_usage(argv[0]);
+                return FALSE;
+        }
+    }
+
+    if (config.enhance) {
+        GstElementFactory *factory = gst_element_factory_find("yenhance");
+        if (!factory) {
+            g_printerr("Error: --enhance needs the yenhance element; add libgstyenhance.so's directory to GST_PLUGIN_PATH\n");
+            return FALSE;
+        }
+        gst_object_unref(factory);
+    }
+
+    // target-bitrate is written the way the pipeline string does, kbps * 1000
+    rate.unit = 1000;
+    rate_control_reset(&rate, config.bitrate);
+
+    return TRUE;
+}
+
+// Poll every viewer's receiver reports; the worst one sets the shared encoder's rate
+static gboolean rate_control_tick(gpointer user_data) {
+    if (g_hash_table_size(peers) == 0) {
+        return G_SOURCE_CONTINUE;
+    }
+    RateSample sample;
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, peers);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        rate_sample_webrtc(((Peer *)value)->webrtc, &sample);
+    }
+    GstElement *enc = gst_bin_get_by_name(GST_BIN(pipeline), "enc");
+    if (enc) {
+        rate_control_update(&rate, &sample, enc);
+        gst_object_unref(enc);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// The shared part of the pipeline: capture, one encode, and the two tees. With no
+// viewer attached the tees discard everything (allow-not-linked).
+static std::string build_pipeline_string() {
+    const char *encoder;
+    const char *parser;
+    const char *payloader;
+    const char *encoding_name;
+
+    if (g_strcmp0(config.codec, "h265") == 0) {
+        encoder = "omxh265enc";
+        parser = "h265parse";
+        payloader = "rtph265pay";
+        encoding_name = "H265";
+    } else {
+        encoder = "omxh264enc";
+        parser = "h264parse";
+        payloader = "rtph264pay";
+        encoding_name = "H264";
+    }
+
+    char pipeline_buf[2048];
+    snprintf(pipeline_buf, sizeof(pipeline_buf),
+        "v4l2src device=%s ! "
+        "video/x-raw,width=%d,height=%d,framerate=%d/1 ! "
+        "videoconvert ! "
+        "%s"
+        "queue max-size-buffers=3 leaky=downstream ! "
+        "%s name=enc target-bitrate=%d control-rate=2%s ! "
+        "video/x-%s,profile=%s ! "
+        "%s config-interval=1 ! "
+        "%s name=pay config-interval=1 ! "
+        "application/x-rtp,media=video,encoding-name=%s,payload=96 ! "
+        "tee name=vtee allow-not-linked=true "
+        "audiotestsrc is-live=true wave=silence ! "
+        "audioconvert ! "
+        "audioresample ! "
+        "queue ! "
+        "opusenc ! "
+        "rtpopuspay ! "
+        "application/x-rtp,media=audio,encoding-name=OPUS,payload=97 ! "
+        "tee name=atee allow-not-linked=true",
+        config.device,
+        config.width,
+        config.height,
+        config.fps,
+        enhance_option().c_str(),
+        encoder,
+        config.bitrate * 1000,
+        idr_option().c_str(),
+        config.codec,
+        (g_strcmp0(config.codec, "h265") == 0) ? "main" : "baseline",
+        parser,
+        payloader,
+        encoding_name
+    );
+
+    g_print("\n=== Configuration ===\n");
+    g_print("Codec:      %s\n", config.codec);
+    g_print("Resolution: %dx%d\n", config.width, config.height);
+    g_print("Framerate:  %d fps\n", config.fps);
+    g_print("Bitrate:    %d kbps\n", config.bitrate);
+    g_print("Device:     %s\n", config.device);
+    g_print("Enhance:    %s\n", config.enhance ? config.enhance : "off");
+    g_print("Viewers:    up to %d, %d ms queue each\n", config.max_peers, config.peer_queue_ms);
+    if (rate.enabled) {
+        g_print("Rate ctl:   %d-%d kbps, every %d ms\n", rate.min_kbps, rate.max_kbps, rate.interval_ms);
+    }
+    g_print("====================\n\n");
+
+    return std::string(pipeline_buf);
+}
+
+int main(int argc, char *argv[]) {
+    gst_init(&argc, &argv);
+
+    if (!parse_arguments(argc, argv)) {
+        return -1;
+    }
+
+    loop = g_main_loop_new(NULL, FALSE);
+    peers = g_hash_table_new(g_str_hash, g_str_equal);
+
+    std::string pipeline_str = build_pipeline_string();
+
+    GError *error = NULL;
+    pipeline = gst_parse_launch(pipeline_str.c_str(), &error);
+
+    if (error) {
+        g_printerr("Failed to create pipeline: %s\n", error->message);
+        g_error_free(error);
+        g_free(config.codec);
+        g_free(config.device);
+        return -1;
+    }
+
+    vtee = gst_bin_get_by_name(GST_BIN(pipeline), "vtee");
+    atee = gst_bin_get_by_name(GST_BIN(pipeline), "atee");
+    g_assert(vtee != NULL && atee != NULL);
+    keyframe_install(&keyframes, pipeline, "pay");
+
+    // Set up bus watch
+    GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+    gst_bus_add_watch(bus, on_bus_message, NULL);
+    gst_object_unref(bus);
+
+    // Create soup session (reusable)
+    session = soup_session_new();
+
+    // Connect to signaling server
+    connect_to_signaling_server();
+
+    // The encoder runs from the start, so a viewer joins onto a warm pipeline
+    g_print("Starting pipeline...\n");
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    g_timeout_add_seconds(PEER_STATS_INTERVAL, print_peer_stats, NULL);
+    if (rate.enabled) {
+        g_timeout_add(rate.interval_ms, rate_control_tick, NULL);
+    }
+
+    // Run main loop
+    g_main_loop_run(loop);
+
+    // Cleanup; the branches go down with the pipeline
+    g_print("Cleaning up...\n");
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, peers);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        Peer *p = (Peer *)value;
+        gst_object_unref(p->vtee_pad);
+        gst_object_unref(p->atee_pad);
+        g_free(p->id);
+        g_free(p);
+    }
+    g_hash_table_destroy(peers);
+
+    keyframe_uninstall(&keyframes);
+    gst_object_unref(vtee);
+    gst_object_unref(atee);
+    gst_object_unref(pipeline);
+
+    if (ws_conn) {
+        soup_websocket_connection_close(ws_conn, SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
+        g_object_unref(ws_conn);
+    }
+
+    if (session) {
+        g_object_unref(session);
+    }
+
+    g_main_loop_unref(loop);
+
+    g_free(my_id);
+    g_free(config.codec);
+    g_free(config.device);
+    g_free(config.enhance);
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+// keyframe.hpp
+// Keyframes on demand, so a viewer doesn't wait for the next periodic IDR.
+//
+// Two things ask for one:
+//   - a viewer's PLI/FIR: webrtcbin's RTP session turns it into an upstream
+//     GstForceKeyUnit event, which travels back through the payloader to the parser and
+//     the encoder (in the fan-out sender every branch's requests meet at the tee);
+//   - the sender itself, once a viewer's ICE connection is up and media can reach it.
+// Both pass one limiter: within --keyframe-min-ms of the last forced keyframe further
+// requests are dropped at the payloader's sink pad, so a burst of PLIs from several
+// viewers, or a viewer on a lossy link, can't turn the stream into all-IDR. The parser
+// re-sends SPS/PPS with the forced frame (all-headers). With this in place the periodic
+// IDR (--idr-period) can be long without slowing the first picture down.
+
+#ifndef KEYFRAME_HPP
+#define KEYFRAME_HPP
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <glib.h>
+
+#define KEYFRAME_MIN_MS_DEFAULT 500
+
+struct KeyframeLimiter {
+    int     min_interval_ms{KEYFRAME_MIN_MS_DEFAULT};
+    GstPad *pay_sink{nullptr};        // where requests leave for the encoder
+    gint64  last_us{0};               // last request let through
+    guint32 own_seqnum{0};            // our own event, already counted
+    guint   forwarded{0}, dropped{0};
+    GMutex  lock;
+};
+
+// Under lock; true when a keyframe may be forced now
+static inline bool keyframe_allow(KeyframeLimiter *k, const char *reason) {
+    const gint64 now = g_get_monotonic_time();
+    if (k->last_us && now - k->last_us < (gint64)k->min_interval_ms * 1000) {
+        k->dropped++;
+        return false;
+    }
+    k->last_us = now;
+    k->forwarded++;
+    g_print("Keyframe: forced (%s), %u forced / %u suppressed so far\n", reason, k->forwarded, k->dropped);
+    return true;
+}
+
+static inline GstPadProbeReturn keyframe_upstream_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    auto *k = (KeyframeLimiter*)user_data;
+    GstEvent *ev = GST_PAD_PROBE_INFO_EVENT(info);
+    if (!gst_video_event_is_force_key_unit(ev)) return GST_PAD_PROBE_OK;
+
+    g_mutex_lock(&k->lock);
+    const bool pass = gst_event_get_seqnum(ev) == k->own_seqnum || keyframe_allow(k, "viewer PLI/FIR");
+    g_mutex_unlock(&k->lock);
+    return pass ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+// Watch the payloader named pay_name in bin; call once after the pipeline is built
+static inline bool keyframe_install(KeyframeLimiter *k, GstElement *bin, const char *pay_name) {
+    g_mutex_init(&k->lock);
+    GstElement *pay = gst_bin_get_by_name(GST_BIN(bin), pay_name);
+    if (!pay) return false;
+    k->pay_sink = gst_element_get_static_pad(pay, "sink");
+    gst_object_unref(pay);
+    if (!k->pay_sink) return false;
+    gst_pad_add_probe(k->pay_sink, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, keyframe_upstream_probe, k, NULL);
+    return true;
+}
+
+// The pipeline was rebuilt; the old pad goes away with it
+static inline void keyframe_uninstall(KeyframeLimiter *k) {
+    if (k->pay_sink) {
+        gst_object_unref(k->pay_sink);
+        k->pay_sink = nullptr;
+    }
+    g_mutex_clear(&k->lock);
+}
+
+// Ask the encoder for a keyframe from the sender's side, e.g. for a viewer that just connected
+static inline void keyframe_request(KeyframeLimiter *k, const char *reason) {
+    if (!k->pay_sink) return;
+    GstEvent *ev = gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0);
+    g_mutex_lock(&k->lock);
+    const bool pass = keyframe_allow(k, reason);
+    if (pass) k->own_seqnum = gst_event_get_seqnum(ev);
+    g_mutex_unlock(&k->lock);
+    if (pass) gst_pad_push_event(k->pay_sink, ev);
+    else gst_event_unref(ev);
+}
+
+#endif // KEYFRAME_HPP
@@ -0,0 +1,196 @@
+// rate_control.hpp
+// --rate-control: follow the viewers' link quality with the encoder's target bitrate.
+//
+// Every --rate-interval ms the sender asks each webrtcbin for "get-stats" and reads the
+// receiver reports it got back: packets lost against packets sent since the last poll,
+// and the round-trip time. The worst viewer drives a single decision:
+//   loss > RATE_LOSS_HIGH or rtt > --rate-rtt-ms   down, by loss/2 (at least 15 %, at most 50 %)
+//   loss < RATE_LOSS_LOW and rtt fine              up 8 %, after RATE_UP_AFTER clean polls
+//                                                  and not within RATE_HOLD_US of a cut
+//   in between                                     hold
+// The loss band, the clean-poll count and the hold after a cut keep the rate from
+// oscillating around a link's capacity. The result stays within --min/--max-bitrate and
+// is written to the encoder's bitrate property while PLAYING. Every decision other than
+// "steady at the maximum" is logged as one "Rate: ..." line.
+//
+// webrtcbin only reports RTCP receiver reports; REMB and transport-wide feedback don't
+// show up in get-stats, so loss and RTT are the congestion signals used here.
+
+#ifndef RATE_CONTROL_HPP
+#define RATE_CONTROL_HPP
+
+#define GST_USE_UNSTABLE_API
+
+#include <gst/gst.h>
+#include <gst/webrtc/webrtc.h>
+#include <glib.h>
+#include <string.h>
+
+#define RATE_INTERVAL_MS_DEFAULT 1000
+#define RATE_RTT_MS_DEFAULT 300
+#define RATE_LOSS_HIGH 0.10          // above this fraction the rate is cut
+#define RATE_LOSS_LOW 0.02           // below this it may grow
+#define RATE_UP_STEP 1.08
+#define RATE_DOWN_MIN 0.50           // never cut by more than half in one poll
+#define RATE_DOWN_MAX 0.85           // and always by at least 15 %
+#define RATE_UP_AFTER 3              // clean polls in a row before an increase
+#define RATE_HOLD_US (3 * G_USEC_PER_SEC)
+
+struct RateControl {
+    bool        enabled{false};
+    int         min_kbps{0};          // 0: a quarter of the start rate
+    int         max_kbps{0};          // 0: the start rate
+    int         start_kbps{0};
+    int         interval_ms{RATE_INTERVAL_MS_DEFAULT};
+    int         rtt_high_ms{RATE_RTT_MS_DEFAULT};
+    const char *property{"target-bitrate"};
+    int         unit{1};              // property units per kbps, as the sender writes it
+
+    int         kbps{0};              // what the encoder runs at now
+    guint       clean{0};
+    gint64      hold_until_us{0};
+};
+
+// One poll over all of a sender's webrtcbins
+struct RateSample {
+    guint  peers{0};                  // webrtcbins that had receiver reports this time
+    double loss{0.0};                 // worst viewer, fraction of packets
+    double rtt_ms{0.0};               // worst viewer
+};
+
+// Counters from the previous poll, kept on each webrtcbin
+struct RatePeerCounters {
+    gint64 lost;
+    gint64 sent;
+    gboolean valid;
+};
+
+struct RateStatsTotals {
+    gint64 lost, sent;
+    double rtt_s;
+    guint reports;
+};
+
+static inline bool rate_stats_int(const GstStructure *s, const char *field, gint64 *out) {
+    const GValue *v = gst_structure_get_value(s, field);
+    if (!v) return false;
+    GValue t = G_VALUE_INIT;
+    g_value_init(&t, G_TYPE_INT64);
+    const bool ok = g_value_transform(v, &t);
+    if (ok) *out = g_value_get_int64(&t);
+    g_value_unset(&t);
+    return ok;
+}
+
+// Audio is left out where the stats say which stream they are about
+static inline bool rate_stats_is_audio(const GstStructure *s) {
+    const gchar *kind = gst_structure_get_string(s, "kind");
+    return kind && strcmp(kind, "audio") == 0;
+}
+
+static inline gboolean rate_stats_field(GQuark field, const GValue *value, gpointer user_data) {
+    auto *t = (RateStatsTotals*)user_data;
+    if (!GST_VALUE_HOLDS_STRUCTURE(value)) return TRUE;
+    const GstStructure *s = gst_value_get_structure(value);
+    GstWebRTCStatsType type;
+    if (!gst_structure_get(s, "type", GST_TYPE_WEBRTC_STATS_TYPE, &type, NULL) || rate_stats_is_audio(s)) return TRUE;
+
+    gint64 n;
+    if (type == GST_WEBRTC_STATS_OUTBOUND_RTP) {
+        if (rate_stats_int(s, "packets-sent", &n)) t->sent += n;
+    } else if (type == GST_WEBRTC_STATS_REMOTE_INBOUND_RTP) {
+        t->reports++;
+        if (rate_stats_int(s, "packets-lost", &n) && n > 0) t->lost += n;
+        double rtt;
+        if (gst_structure_get_double(s, "round-trip-time", &rtt) && rtt > t->rtt_s) t->rtt_s = rtt;
+    }
+    return TRUE;
+}
+
+// Add one webrtcbin's view of its viewer to the sample. Runs on the caller's thread and
+// waits for webrtcbin to answer, which it does from its own thread.
+static inline void rate_sample_webrtc(GstElement *webrtc, RateSample *sample) {
+    GstPromise *promise = gst_promise_new();
+    g_signal_emit_by_name(webrtc, "get-stats", NULL, promise);
+    if (gst_promise_wait(promise) != GST_PROMISE_RESULT_REPLIED) {
+        gst_promise_unref(promise);
+        return;
+    }
+    RateStatsTotals t{};
+    if (const GstStructure *reply = gst_promise_get_reply(promise)) {
+        gst_structure_foreach(reply, rate_stats_field, &t);
+    }
+    gst_promise_unref(promise);
+    if (t.reports == 0) return;   // nothing back from this viewer yet
+
+    auto *prev = (RatePeerCounters*)g_object_get_data(G_OBJECT(webrtc), "rate-counters");
+    if (!prev) {
+        prev = g_new0(RatePeerCounters, 1);
+        g_object_set_data_full(G_OBJECT(webrtc), "rate-counters", prev, g_free);
+    }
+    const gint64 d_sent = t.sent - prev->sent;
+    const gint64 d_lost = t.lost - prev->lost;
+    const bool have_delta = prev->valid && d_sent > 0;
+    prev->sent = t.sent;
+    prev->lost = t.lost;
+    prev->valid = TRUE;
+
+    sample->peers++;
+    const double rtt_ms = t.rtt_s * 1000.0;
+    if (rtt_ms > sample->rtt_ms) sample->rtt_ms = rtt_ms;
+    if (have_delta) {
+        const double loss = d_lost > 0 ? (double)d_lost / d_sent : 0.0;
+        if (loss > sample->loss) sample->loss = loss > 1.0 ? 1.0 : loss;
+    }
+}
+
+// Once the start rate is known; also when the encoder is rebuilt at that rate
+static inline void rate_control_reset(RateControl *rc, int start_kbps) {
+    rc->start_kbps = start_kbps;
+    if (rc->max_kbps <= 0) rc->max_kbps = start_kbps;
+    if (rc->min_kbps <= 0) rc->min_kbps = MAX(1, start_kbps / 4);
+    if (rc->min_kbps > rc->max_kbps) rc->min_kbps = rc->max_kbps;
+    rc->kbps = CLAMP(start_kbps, rc->min_kbps, rc->max_kbps);
+    rc->clean = 0;
+    rc->hold_until_us = 0;
+}
+
+static inline void rate_control_update(RateControl *rc, const RateSample *s, GstElement *encoder) {
+    if (!rc->enabled || !encoder || s->peers == 0) return;
+
+    const gint64 now = g_get_monotonic_time();
+    const bool rtt_high = s->rtt_ms > rc->rtt_high_ms;
+    int target = rc->kbps;
+    const char *decision;
+
+    if (s->loss > RATE_LOSS_HIGH || rtt_high) {
+        const double factor = CLAMP(1.0 - 0.5 * s->loss, RATE_DOWN_MIN, RATE_DOWN_MAX);
+        target = (int)(rc->kbps * factor);
+        rc->clean = 0;
+        rc->hold_until_us = now + RATE_HOLD_US;
+        decision = s->loss > RATE_LOSS_HIGH ? "down (loss)" : "down (rtt)";
+    } else if (s->loss < RATE_LOSS_LOW) {
+        if (++rc->clean >= RATE_UP_AFTER && now >= rc->hold_until_us && rc->kbps < rc->max_kbps) {
+            target = (int)(rc->kbps * RATE_UP_STEP) + 1;
+            rc->clean = 0;
+            decision = "up";
+        } else {
+            decision = now < rc->hold_until_us ? "hold (after cut)" : "steady";
+        }
+    } else {
+        rc->clean = 0;
+        decision = "hold (loss)";
+    }
+
+    target = CLAMP(target, rc->min_kbps, rc->max_kbps);
+    if (target == rc->kbps && strcmp(decision, "steady") == 0 && rc->kbps == rc->max_kbps) return;
+
+    g_print("Rate: loss %.1f%% rtt %.0f ms over %u viewer(s) -> %s, %d -> %d kbps\n",
+            s->loss * 100.0, s->rtt_ms, s->peers, decision, rc->kbps, target);
+    if (target != rc->kbps) {
+        g_object_set(encoder, rc->property, (guint)target * (guint)rc->unit, NULL);
+        rc->kbps = target;
+    }
+}
+
+#endif // RATE_CONTROL_HPP
@@ -9,6 +9,9 @@
 #include <iostream>
 #include <getopt.h>
 
+#include "rate_control.hpp"
+#include "keyframe.hpp"
+
 // Configuration structure
 struct Config {
     gchar *codec;
@@ -17,6 +20,8 @@ struct Config {
     gint width;
     gint height;
     gchar *device;
+    gint idr_period;
+    gchar *enhance;     // yenhance backend, NULL for none
 };
 
 // Global variables
@@ -29,6 +34,8 @@ static gchar *my_id = NULL;
 static struct Config config;
 static SoupSession *session = NULL;
 static gboolean is_reconnecting = FALSE;
+static RateControl rate;
+static KeyframeLimiter keyframes;
 
 // Signaling server details
 static const gchar *server_url = "ws://192.168.25.69:8080";
@@ -42,6 +49,17 @@ static void on_incoming_stream(GstElement *webrtc, GstPad *pad, gpointer user_da
 static void reset_webrtc_connection();
 static void connect_to_signaling_server();
 
+// " periodicity-idr=N" for the encoder, or nothing for its own default
+static std::string idr_option() {
+    return config.idr_period > 0 ? " periodicity-idr=" + std::to_string(config.idr_period) : std::string();
+}
+
+// "video/x-raw,format=NV12 ! yenhance backend=B ! " between videoconvert and the encoder
+static std::string enhance_option() {
+    if (!config.enhance) return std::string();
+    return std::string("video/x-raw,format=NV12 ! yenhance backend=") + config.enhance + " ! ";
+}
+
 // Send JSON message via WebSocket
 static void send_json_message(JsonObject *msg) {
     if (!ws_conn) {
@@ -105,11 +123,12 @@ static void reset_webrtc_connection() {
         "v4l2src device=%s ! "
         "video/x-raw,width=%d,height=%d,framerate=%d/1 ! "
         "videoconvert ! "
+        "%s"
         "queue max-size-buffers=3 leaky=downstream ! "
-        "%s target-bitrate=%d control-rate=2 ! "
+        "%s name=enc target-bitrate=%d control-rate=2%s ! "
         "video/x-%s,profile=%s ! "
         "%s config-interval=1 ! "
-        "%s config-interval=1 ! "
+        "%s name=pay config-interval=1 ! "
         "application/x-rtp,media=video,encoding-name=%s,payload=%d ! "
         "webrtcbin. "
         "audiotestsrc is-live=true wave=silence ! "
@@ -124,8 +143,10 @@ static void reset_webrtc_connection() {
         config.width,
         config.height,
         config.fps,
+        enhance_option().c_str(),
         encoder,
         config.bitrate * 1000,
+        idr_option().c_str(),
         config.codec,
         (g_strcmp0(config.codec, "h265") == 0) ? "main" : "baseline",
         parser,
@@ -135,8 +156,12 @@ static void reset_webrtc_connection() {
     );
 
     pipeline_str = pipeline_buf;
+
+    // The new encoder starts at --bitrate again
+    rate_control_reset(&rate, config.bitrate);
     
     // Clean up old pipeline
+    keyframe_uninstall(&keyframes);
     if (pipeline) {
         gst_object_unref(pipeline);
     }
@@ -154,6 +179,7 @@ static void reset_webrtc_connection() {
     // Get new webrtcbin element
     webrtc = gst_bin_get_by_name(GST_BIN(pipeline), "webrtcbin");
     g_assert(webrtc != NULL);
+    keyframe_install(&keyframes, pipeline, "pay");
 
     // Reconnect signals
     g_signal_connect(webrtc, "on-negotiation-needed", 
@@ -191,6 +217,10 @@ static void reset_webrtc_connection() {
                              default: state_str = "unknown";
                          }
                          g_print("ICE connection state changed to: %s\n", state_str);
+                         // Media can reach the viewer now; don't make it wait for the periodic IDR
+                         if (ice_conn_state == GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED) {
+                             keyframe_request(&keyframes, "viewer connected");
+                         }
                      }), NULL);
 
     // Start pipeline
@@ -449,10 +479,20 @@ static void print_usage(const char *prog_name) {
     g_print("  --width=WIDTH       Video width (default: 1280)\n");
     g_print("  --height=HEIGHT     Video height (default: 720)\n");
     g_print("  --device=PATH       Camera device path (default: /dev/video0)\n");
+    g_print("  --rate-control      Adapt the bitrate to the viewer's loss and RTT\n");
+    g_print("  --min-bitrate=KBPS  Lowest adapted bitrate (default: bitrate/4)\n");
+    g_print("  --max-bitrate=KBPS  Highest adapted bitrate (default: bitrate)\n");
+    g_print("  --rate-interval=MS  Stats poll interval (default: %d)\n", RATE_INTERVAL_MS_DEFAULT);
+    g_print("  --rate-rtt-ms=MS    Round-trip time above which the bitrate is cut (default: %d)\n", RATE_RTT_MS_DEFAULT);
+    g_print("  --keyframe-min-ms=MS  Least time between forced keyframes (default: %d)\n", KEYFRAME_MIN_MS_DEFAULT);
+    g_print("  --idr-period=FRAMES   Periodic IDR interval, 0 for the encoder default (default: 0)\n");
+    g_print("  --enhance=BACKEND   Enhance luma before encoding with the yenhance element:\n");
+    g_print("                      cpu, neon, clahe, clahe-video, fpga, clahe-fpga (libgstyenhance.so on GST_PLUGIN_PATH)\n");
     g_print("  --help              Show this help message\n");
     g_print("\nExamples:\n");
     g_print("  %s --codec=h264 --bitrate=5000 --fps=30\n", prog_name);
     g_print("  %s --codec=h265 --bitrate=3000 --fps=25 --width=1920 --height=1080\n", prog_name);
+    g_print("  %s --bitrate=8000 --rate-control --min-bitrate=1000\n", prog_name);
     g_print("\n");
 }
 
@@ -464,6 +504,8 @@ static gboolean parse_arguments(int argc, char *argv[]) {
     config.width = 1280;
     config.height = 720;
     config.device = g_strdup("/dev/video0");
+    config.idr_period = 0;
+    config.enhance = NULL;
 
     struct option long_options[] = {
         {"codec",    required_argument, 0, 'c'},
@@ -472,6 +514,14 @@ static gboolean parse_arguments(int argc, char *argv[]) {
         {"width",    required_argument, 0, 'w'},
         {"height",   required_argument, 0, 'H'},
         {"device",   required_argument, 0, 'd'},
+        {"rate-control",  no_argument,       0, 'r'},
+        {"min-bitrate",   required_argument, 0, 'n'},
+        {"max-bitrate",   required_argument, 0, 'x'},
+        {"rate-interval", required_argument, 0, 'i'},
+        {"rate-rtt-ms",   required_argument, 0, 't'},
+        {"keyframe-min-ms", required_argument, 0, 'k'},
+        {"idr-period",      required_argument, 0, 'p'},
+        {"enhance",         required_argument, 0, 'e'},
         {"help",     no_argument,       0, '?'},
         {0, 0, 0, 0}
     };
@@ -479,7 +529,7 @@ static gboolean parse_arguments(int argc, char *argv[]) {
     int option_index = 0;
     int c;
 
-    while ((c = getopt_long(argc, argv, "c:b:f:w:H:d:?", long_options, &option_index)) != -1) {
+    while ((c = getopt_long(argc, argv, "c:b:f:w:H:d:rn:x:i:t:k:p:e:?", long_options, &option_index)) != -1) {
         switch (c) {
             case 'c':
                 g_free(config.codec);
@@ -521,6 +571,47 @@ static gboolean parse_arguments(int argc, char *argv[]) {
                 g_free(config.device);
                 config.device = g_strdup(optarg);
                 break;
+            case 'r':
+                rate.enabled = true;
+                break;
+            case 'n':
+                rate.min_kbps = atoi(optarg);
+                break;
+            case 'x':
+                rate.max_kbps = atoi(optarg);
+                break;
+            case 'i':
+                rate.interval_ms = atoi(optarg);
+                if (rate.interval_ms < 100) {
+                    g_printerr("Error: rate-interval must be at least 100 ms\n");
+                    return FALSE;
+                }
+                break;
+            case 't':
+                rate.rtt_high_ms = atoi(optarg);
+                if (rate.rtt_high_ms <= 0) {
+                    g_printerr("Error: rate-rtt-ms must be positive\n");
+                    return FALSE;
+                }
+                break;
+            case 'k':
+                keyframes.min_interval_ms = atoi(optarg);
+                if (keyframes.min_interval_ms < 0) {
+                    g_printerr("Error: keyframe-min-ms must not be negative\n");
+                    return FALSE;
+                }
+                break;
+            case 'p':
+                config.idr_period = atoi(optarg);
+                if (config.idr_period < 0) {
+                    g_printerr("Error: idr-period must not be negative\n");
+                    return FALSE;
+                }
+                break;
+            case 'e':
+                g_free(config.enhance);
+                config.enhance = g_strdup(optarg);
+                break;
             case '?':
             default:
                 print_usage(argv[0]);
@@ -528,9 +619,37 @@ static gboolean parse_arguments(int argc, char *argv[]) {
         }
     }
 
+    if (config.enhance) {
+        GstElementFactory *factory = gst_element_factory_find("yenhance");
+        if (!factory) {
+            g_printerr("Error: --enhance needs the yenhance element; add libgstyenhance.so's directory to GST_PLUGIN_PATH\n");
+            return FALSE;
+        }
+        gst_object_unref(factory);
+    }
+
+    // target-bitrate is written the way the pipeline string does, kbps * 1000
+    rate.unit = 1000;
+    rate_control_reset(&rate, config.bitrate);
+
     return TRUE;
 }
 
+// Poll the viewer's receiver reports and retune the encoder
+static gboolean rate_control_tick(gpointer user_data) {
+    if (!pipeline || !webrtc || !peer_id) {
+        return G_SOURCE_CONTINUE;
+    }
+    RateSample sample;
+    rate_sample_webrtc(webrtc, &sample);
+    GstElement *enc = gst_bin_get_by_name(GST_BIN(pipeline), "enc");
+    if (enc) {
+        rate_control_update(&rate, &sample, enc);
+        gst_object_unref(enc);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
 // Build GStreamer pipeline based on configuration
 static std::string build_pipeline_string() {
     std::string pipeline_str;
@@ -562,11 +681,12 @@ static std::string build_pipeline_string() {
         "v4l2src device=%s ! "
         "video/x-raw,width=%d,height=%d,framerate=%d/1 ! "
         "videoconvert ! "
+        "%s"
         "queue max-size-buffers=3 leaky=downstream ! "
-        "%s target-bitrate=%d control-rate=2 ! "
+        "%s name=enc target-bitrate=%d control-rate=2%s ! "
         "video/x-%s,profile=%s ! "
         "%s config-interval=1 ! "
-        "%s config-interval=1 ! "
+        "%s name=pay config-interval=1 ! "
         "application/x-rtp,media=video,encoding-name=%s,payload=%d ! "
         "webrtcbin. "
         "audiotestsrc is-live=true wave=silence ! "
@@ -581,8 +701,10 @@ static std::string build_pipeline_string() {
         config.width,
         config.height,
         config.fps,
+        enhance_option().c_str(),
         encoder,
         config.bitrate * 1000,
+        idr_option().c_str(),
         config.codec,
         (g_strcmp0(config.codec, "h265") == 0) ? "main" : "baseline",
         parser,
@@ -599,6 +721,10 @@ static std::string build_pipeline_string() {
     g_print("Framerate:  %d fps\n", config.fps);
     g_print("Bitrate:    %d kbps\n", config.bitrate);
     g_print("Device:     %s\n", config.device);
+    g_print("Enhance:    %s\n", config.enhance ? config.enhance : "off");
+    if (rate.enabled) {
+        g_print("Rate ctl:   %d-%d kbps, every %d ms\n", rate.min_kbps, rate.max_kbps, rate.interval_ms);
+    }
     g_print("====================\n\n");
 
     return pipeline_str;
@@ -630,6 +756,7 @@ int main(int argc, char *argv[]) {
     // Get webrtcbin element
     webrtc = gst_bin_get_by_name(GST_BIN(pipeline), "webrtcbin");
     g_assert(webrtc != NULL);
+    keyframe_install(&keyframes, pipeline, "pay");
 
     // Connect signals
     g_signal_connect(webrtc, "on-negotiation-needed", 
@@ -667,6 +794,10 @@ int main(int argc, char *argv[]) {
                              default: state_str = "unknown";
                          }
                          g_print("ICE connection state changed to: %s\n", state_str);
+                         // Media can reach the viewer now; don't make it wait for the periodic IDR
+                         if (ice_conn_state == GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED) {
+                             keyframe_request(&keyframes, "viewer connected");
+                         }
                      }), NULL);
 
     // Set up bus watch
@@ -684,12 +815,17 @@ int main(int argc, char *argv[]) {
     g_print("Starting pipeline...\n");
     gst_element_set_state(pipeline, GST_STATE_PLAYING);
 
+    if (rate.enabled) {
+        g_timeout_add(rate.interval_ms, rate_control_tick, NULL);
+    }
+
     // Run main loop
     g_main_loop_run(loop);
 
     // Cleanup
     g_print("Cleaning up...\n");
     gst_element_set_state(pipeline, GST_STATE_NULL);
+    keyframe_uninstall(&keyframes);
     gst_object_unref(pipeline);
     
     if (ws_conn) {
@@ -707,6 +843,7 @@ int main(int argc, char *argv[]) {
     g_free(peer_id);
     g_free(config.codec);
     g_free(config.device);
+    g_free(config.enhance);
 
     return 0;
 }
\ No newline at end of file